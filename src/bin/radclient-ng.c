@@ -33,6 +33,7 @@ RCSID("$Id$")
 #include <freeradius-devel/util/pair_legacy.h>
 #include <freeradius-devel/util/time.h>
 #include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/histogram.h>
 #include <freeradius-devel/server/packet.h>
 #include <freeradius-devel/radius/list.h>
 #include <freeradius-devel/radius/radius.h>
@@ -172,6 +173,12 @@ static NEVER_RETURNS void usage(void)
 	fprintf(stderr, "  -F                                Print the file name, packet number and reply code.\n");
 	fprintf(stderr, "  -h                                Print usage help information.\n");
 	fprintf(stderr, "  -i <id>                           Set request id to 'id'.  Values may be 0..255\n");
+	fprintf(stderr, "  -I <interval>                     In load mode, print statistics every 'interval' seconds (defaults to 1).\n");
+	fprintf(stderr, "  -L <pps>[:<step>:<max>]           Load mode.  Use the packets read as templates, and send 'pps' packets per second.\n");
+	fprintf(stderr, "                                    If 'step' and 'max' are given, the rate is increased by 'step' after each\n");
+	fprintf(stderr, "                                    period set by -T, until 'max' is reached.  In single quoted string values,\n");
+	fprintf(stderr, "                                    %%n is the packet number, %%m a random MAC, %%r a random hex number, and %%%% a '%%'.\n");
+	fprintf(stderr, "  -N <sockets>                      In load mode, send packets from 'sockets' source ports (defaults to 1).\n");
 	fprintf(stderr, "  -o <port>                         Set CoA listening port (defaults to 3799)\n");
 	fprintf(stderr, "  -p <num>                          Send 'num' packets from a file in parallel.\n");
 	fprintf(stderr, "  -P <proto>                        Use proto (tcp or udp) for transport.\n");
@@ -179,6 +186,7 @@ static NEVER_RETURNS void usage(void)
 	fprintf(stderr, "  -s                                Print out summary information of auth results.\n");
 	fprintf(stderr, "  -S <file>                         read secret from file, not command line.\n");
 	fprintf(stderr, "  -t <timeout>                      Wait 'timeout' seconds before retrying (may be a floating point number).\n");
+	fprintf(stderr, "  -T <duration>                     In load mode, send at each rate for 'duration' seconds (defaults to 10).\n");
 	fprintf(stderr, "  -v                                Show program version information.\n");
 	fprintf(stderr, "  -x                                Debugging mode.\n");
 
@@ -977,6 +985,47 @@ static void client_packet_release(fr_bio_packet_t *client, fr_packet_t *packet)
 }
 
 
+/*
+ *	Encode the cleartext password into whichever of
+ *	CHAP-Password or MS-CHAP-Password is in the request.
+ */
+static void password_encode(TALLOC_CTX *ctx, fr_packet_t *packet, fr_pair_list_t *list, fr_pair_t const *password)
+{
+	fr_pair_t *vp;
+
+	if ((vp = fr_pair_find_by_da(list, NULL, attr_chap_password)) != NULL) {
+		uint8_t		buffer[17];
+		fr_pair_t	*challenge;
+
+		/*
+		 *	Use CHAP-Challenge pair if present, otherwise create CHAP-Challenge and
+		 *	populate with current Request Authenticator.
+		 *
+		 *	Request Authenticator is re-calculated by fr_packet_sign
+		 */
+		challenge = fr_pair_find_by_da(list, NULL, attr_chap_challenge);
+		if (!challenge || (challenge->vp_length < 7)) {
+			if (!challenge) {
+				MEM(challenge = fr_pair_afrom_da(ctx, attr_chap_challenge));
+				fr_pair_append(list, challenge);
+			}
+			fr_pair_value_memdup(challenge, packet->vector, RADIUS_AUTH_VECTOR_LENGTH, false);
+		}
+
+		fr_chap_encode(buffer,
+			       fr_rand() & 0xff, challenge->vp_octets, challenge->vp_length,
+			       password->vp_strvalue,
+			       password->vp_length);
+		fr_pair_value_memdup(vp, buffer, sizeof(buffer), false);
+
+	} else if (fr_pair_find_by_da_nested(list, NULL, attr_ms_chap_password) != NULL) {
+		mschapv1_encode(packet, list, password->vp_strvalue);
+
+	} else {
+		DEBUG("WARNING: No password in the request");
+	}
+}
+
 /*
  *	Send one packet.
  */
@@ -998,38 +1047,7 @@ static int send_one_packet(fr_bio_packet_t *client, rc_request_t *request)
 	 *	Update the password, so it can be encrypted with the
 	 *	new authentication vector.
 	 */
-	if (request->password) {
-		fr_pair_t *vp;
-
-		if ((vp = fr_pair_find_by_da(&request->request_pairs, NULL, attr_chap_password)) != NULL) {
-			uint8_t		buffer[17];
-			fr_pair_t	*challenge;
-
-			/*
-			 *	Use CHAP-Challenge pair if present, otherwise create CHAP-Challenge and
-			 *	populate with current Request Authenticator.
-			 *
-			 *	Request Authenticator is re-calculated by fr_packet_sign
-			 */
-			challenge = fr_pair_find_by_da(&request->request_pairs, NULL, attr_chap_challenge);
-			if (!challenge || (challenge->vp_length < 7)) {
-				pair_update_request(challenge, attr_chap_challenge);
-				fr_pair_value_memdup(challenge, request->packet->vector, RADIUS_AUTH_VECTOR_LENGTH, false);
-			}
-
-			fr_chap_encode(buffer,
-				       fr_rand() & 0xff, challenge->vp_octets, challenge->vp_length,
-				       request->password->vp_strvalue,
-				       request->password->vp_length);
-			fr_pair_value_memdup(vp, buffer, sizeof(buffer), false);
-
-		} else if (fr_pair_find_by_da_nested(&request->request_pairs, NULL, attr_ms_chap_password) != NULL) {
-			mschapv1_encode(request->packet, &request->request_pairs, request->password->vp_strvalue);
-
-		} else {
-			DEBUG("WARNING: No password in the request");
-		}
-	}
+	if (request->password) password_encode(request, request->packet, &request->request_pairs, request->password);
 
 	request->timestamp = fr_time();
 	request->tries = 1;
@@ -1297,6 +1315,589 @@ static void  client_bio_connected(fr_bio_packet_t *client)
 }
 
 
+/*
+ *	Load generation.
+ *
+ *	The packets read from the input files are used as templates.
+ *	Packets are sent on a fixed schedule, no matter how quickly the
+ *	server replies, and latency is measured from when each packet
+ *	was due to be sent.  So if the server (or radclient) falls
+ *	behind, the queueing delay shows up in the latency, instead of
+ *	being hidden by a lower send rate.
+ */
+typedef struct {
+	uint64_t		sent;			//!< Packets written to the network.
+	uint64_t		received;		//!< Replies received.
+	uint64_t		timeouts;		//!< Packets which received no reply.
+	uint64_t		retransmits;		//!< Packets which were retransmitted.
+	uint64_t		unsent;			//!< Packets which were due, but couldn't be sent.
+	fr_histogram_t		latency;		//!< Time from when the packet was due, to the reply, in usec.
+} rc_load_stats_t;
+
+typedef struct {
+	fr_bio_packet_t		*bio;			//!< Client bio for this source port.
+	fr_radius_client_bio_info_t const *info;	//!< Information about the bio.
+	size_t			outstanding;		//!< Packets waiting for a reply or timeout.
+	bool			write_active;		//!< Whether we're waiting for the socket to become writable.
+} rc_load_socket_t;
+
+typedef struct {
+	uint64_t		num;			//!< Packet number, used for %n.
+	fr_time_t		scheduled;		//!< When the packet should have been sent.
+	rc_load_socket_t	*socket;		//!< The packet was sent on.
+	fr_packet_t		*packet;		//!< The outgoing request.
+	fr_pair_list_t		request_pairs;		//!< Copied from the template, and expanded.
+} rc_load_packet_t;
+
+typedef struct {
+	uint32_t		start_pps;		//!< Initial packets per second.
+	uint32_t		step;			//!< Increase in packets per second for each step.
+	uint32_t		max_pps;		//!< Final packets per second.
+	fr_time_delta_t		step_duration;		//!< How long to send at each rate.
+	fr_time_delta_t		interval;		//!< How often to print statistics.
+	size_t			num_sockets;		//!< Number of source ports to send from.
+
+	rc_load_socket_t	*sockets;		//!< Array of sockets.
+	size_t			connected;		//!< Number of sockets which are connected.
+	size_t			next_socket;		//!< Round-robin socket selection.
+	rc_request_t		*template;		//!< The last template used.
+
+	uint32_t		pps;			//!< Current packets per second.
+	fr_time_t		start;			//!< When we started sending packets.
+	fr_time_t		step_start;		//!< When the current step started.
+	uint64_t		step_sent;		//!< Packets scheduled in the current step.
+	uint64_t		num;			//!< Total packets scheduled.
+	bool			done;			//!< No more packets will be sent.
+
+	fr_timer_t		*ev;			//!< For sending packets.
+	fr_timer_t		*stats_ev;		//!< For printing statistics.
+	fr_time_t		interval_start;		//!< When the current interval started.
+	rc_load_stats_t		interval_stats;		//!< Statistics for the current interval.
+	rc_load_stats_t		total;			//!< Statistics for the whole run.
+} rc_load_t;
+
+static bool do_load = false;
+
+static rc_load_t rc_load = {
+	.num_sockets = 1,
+};
+
+#define LOAD_MAX_OUTSTANDING	(256)		//!< One RADIUS ID space per socket.
+
+#define USEC_TO_MSEC(_x)	((double) (_x) / 1000)
+
+static void load_packet_free(rc_load_packet_t *lp)
+{
+	fr_assert(lp->socket->outstanding > 0);
+	lp->socket->outstanding--;
+
+	talloc_free(lp);
+}
+
+/*
+ *	Stop once all packets have been sent, and all of them
+ *	have either received a reply, or timed out.
+ */
+static void load_check_done(void)
+{
+	size_t i;
+
+	if (!rc_load.done) return;
+
+	for (i = 0; i < rc_load.num_sockets; i++) {
+		if (rc_load.sockets[i].outstanding) return;
+	}
+
+	fr_event_loop_exit(client_config.el, 1);
+}
+
+/*
+ *	Expand %n, %m, %r and %% in string attributes.
+ */
+static int load_substitute(rc_load_packet_t *lp, fr_pair_list_t *list)
+{
+	fr_pair_list_foreach(list, vp) {
+		char		buffer[1024];
+		char		*out = buffer;
+		char const	*p, *end;
+
+		if (fr_type_is_structural(vp->vp_type)) {
+			if (load_substitute(lp, &vp->vp_group) < 0) return -1;
+			continue;
+		}
+
+		if (vp->vp_type != FR_TYPE_STRING) continue;
+
+		if (!memchr(vp->vp_strvalue, '%', vp->vp_length)) continue;
+
+		p = vp->vp_strvalue;
+		end = p + vp->vp_length;
+
+		while (p < end) {
+			size_t room = (buffer + sizeof(buffer)) - out;
+
+			/*
+			 *	Enough for the longest expansion.
+			 */
+			if (room < 32) {
+				fr_strerror_printf("Expansion of %s is too long", vp->da->name);
+				return -1;
+			}
+
+			if ((*p != '%') || ((p + 1) == end)) {
+				*out++ = *p++;
+				continue;
+			}
+
+			switch (p[1]) {
+			case 'n':
+				out += snprintf(out, room, "%" PRIu64, lp->num);
+				break;
+
+			case 'm':
+			{
+				uint8_t mac[6];
+
+				fr_rand_buffer(mac, sizeof(mac));
+				mac[0] = (mac[0] & 0xfc) | 0x02; /* unicast, locally administered */
+
+				out += snprintf(out, room, "%02x:%02x:%02x:%02x:%02x:%02x",
+						mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+			}
+				break;
+
+			case 'r':
+				out += snprintf(out, room, "%08x", fr_rand());
+				break;
+
+			case '%':
+				*out++ = '%';
+				break;
+
+			default:
+				*out++ = p[0];
+				*out++ = p[1];
+				break;
+			}
+			p += 2;
+		}
+
+		if (fr_pair_value_bstrndup(vp, buffer, out - buffer, true) < 0) return -1;
+	}
+
+	return 0;
+}
+
+/*
+ *	Create a packet from the next template, and send it.
+ */
+static int load_send_one(fr_time_t scheduled)
+{
+	rc_request_t		*template;
+	rc_load_socket_t	*s = NULL;
+	rc_load_packet_t	*lp;
+	size_t			i;
+	int			rcode;
+
+	/*
+	 *	Find a socket which can take another packet.
+	 */
+	for (i = 0; i < rc_load.num_sockets; i++) {
+		rc_load_socket_t *this = &rc_load.sockets[(rc_load.next_socket + i) % rc_load.num_sockets];
+
+		if (this->bio->write_blocked || (this->outstanding >= LOAD_MAX_OUTSTANDING)) continue;
+
+		s = this;
+		rc_load.next_socket = (rc_load.next_socket + i + 1) % rc_load.num_sockets;
+		break;
+	}
+
+	/*
+	 *	All of the IDs are in use, or the kernel can't take
+	 *	any more data.  The server isn't keeping up.
+	 */
+	if (!s) {
+	unsent:
+		rc_load.interval_stats.unsent++;
+		return 0;
+	}
+
+	template = fr_dlist_next(&rc_request_list, rc_load.template);
+	if (!template) template = fr_dlist_head(&rc_request_list);
+	rc_load.template = template;
+
+	MEM(lp = talloc_zero(s->bio, rc_load_packet_t));
+	lp->num = rc_load.num++;
+	lp->scheduled = scheduled;
+	lp->socket = s;
+
+	MEM(lp->packet = fr_packet_alloc(lp, false));
+	lp->packet->uctx = lp;
+	lp->packet->id = -1;
+	lp->packet->code = template->packet->code;
+	lp->packet->socket = template->packet->socket;
+	lp->packet->socket.inet.src_ipaddr = s->info->fd_info->socket.inet.src_ipaddr;
+	lp->packet->socket.inet.src_port = s->info->fd_info->socket.inet.src_port;
+	memcpy(lp->packet->vector, template->packet->vector, sizeof(lp->packet->vector));
+
+	fr_pair_list_init(&lp->request_pairs);
+	if (fr_pair_list_copy(lp, &lp->request_pairs, &template->request_pairs) < 0) {
+	error:
+		talloc_free(lp);
+		return -1;
+	}
+
+	if (load_substitute(lp, &lp->request_pairs) < 0) goto error;
+
+	if (template->password) password_encode(lp, lp->packet, &lp->request_pairs, template->password);
+
+	/*
+	 *	Ensure that each Access-Request is unique.
+	 */
+	if (lp->packet->code == FR_RADIUS_CODE_ACCESS_REQUEST) {
+		fr_rand_buffer(lp->packet->vector, sizeof(lp->packet->vector));
+	}
+
+	rcode = fr_bio_packet_write(s->bio, lp, lp->packet, &lp->request_pairs);
+	if (rcode < 0) {
+		talloc_free(lp);
+
+		if (rcode == fr_bio_error(IO_WOULD_BLOCK)) goto unsent;
+
+		return -1;
+	}
+
+	s->outstanding++;
+	rc_load.interval_stats.sent++;
+
+	if (fr_debug_lvl > 1) fr_radius_packet_log(&default_log, lp->packet, &lp->request_pairs, false);
+
+	return 0;
+}
+
+/*
+ *	Send all of the packets which are due, and figure out
+ *	when the next one is due.
+ */
+static void load_timer(fr_timer_list_t *tl, fr_time_t now, UNUSED void *uctx)
+{
+	fr_time_t when;
+
+	for (;;) {
+		fr_time_t step_end = fr_time_add(rc_load.step_start, rc_load.step_duration);
+
+		when = fr_time_add(rc_load.step_start, fr_time_delta_wrap((rc_load.step_sent * NSEC) / rc_load.pps));
+
+		/*
+		 *	Move to the next step, or stop.
+		 */
+		if (fr_time_gteq(when, step_end)) {
+			if (!rc_load.step || ((rc_load.pps + rc_load.step) > rc_load.max_pps)) {
+				rc_load.done = true;
+				load_check_done();
+				return;
+			}
+
+			rc_load.pps += rc_load.step;
+			rc_load.step_start = step_end;
+			rc_load.step_sent = 0;
+			continue;
+		}
+
+		if (fr_time_gt(when, now)) break;
+
+		if (load_send_one(when) < 0) {
+			fr_perror("radclient");
+			fr_exit_now(EXIT_FAILURE);
+		}
+		rc_load.step_sent++;
+	}
+
+	/*
+	 *	Don't wake up more than once a millisecond.  Packets
+	 *	which become due in the mean time are sent together,
+	 *	but their latency is still measured from when they
+	 *	were due.
+	 */
+	if (fr_time_lt(when, fr_time_add(now, fr_time_delta_from_msec(1)))) {
+		when = fr_time_add(now, fr_time_delta_from_msec(1));
+	}
+
+	if (fr_timer_at(autofree, tl, &rc_load.ev, when, false, load_timer, NULL) < 0) {
+		fr_perror("radclient");
+		fr_exit_now(EXIT_FAILURE);
+	}
+}
+
+static void load_stats_print(char const *label, uint32_t target, rc_load_stats_t const *s, fr_time_delta_t elapsed)
+{
+	double seconds = (double) fr_time_delta_unwrap(elapsed) / NSEC;
+
+	fprintf(fr_log_fp, "%8s %8u %8.0f %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64
+		" %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+		label, target, (seconds > 0) ? (double) s->sent / seconds : 0,
+		s->sent, s->received, s->timeouts, s->retransmits, s->unsent,
+		USEC_TO_MSEC(fr_histogram_percentile(&s->latency, 50)),
+		USEC_TO_MSEC(fr_histogram_percentile(&s->latency, 90)),
+		USEC_TO_MSEC(fr_histogram_percentile(&s->latency, 99)),
+		USEC_TO_MSEC(fr_histogram_percentile(&s->latency, 99.9)),
+		USEC_TO_MSEC(s->latency.max));
+}
+
+/*
+ *	Print the statistics for the current interval, and
+ *	add them to the totals.
+ */
+static void load_stats_interval(fr_time_t now)
+{
+	rc_load_stats_t	*s = &rc_load.interval_stats;
+	char		buffer[32];
+
+	snprintf(buffer, sizeof(buffer), "%.1f", (double) fr_time_delta_unwrap(fr_time_sub(now, rc_load.start)) / NSEC);
+	load_stats_print(buffer, rc_load.pps, s, fr_time_sub(now, rc_load.interval_start));
+
+	rc_load.total.sent += s->sent;
+	rc_load.total.received += s->received;
+	rc_load.total.timeouts += s->timeouts;
+	rc_load.total.retransmits += s->retransmits;
+	rc_load.total.unsent += s->unsent;
+	fr_histogram_merge(&rc_load.total.latency, &s->latency);
+
+	s->sent = s->received = s->timeouts = s->retransmits = s->unsent = 0;
+	fr_histogram_init(&s->latency);
+
+	rc_load.interval_start = now;
+}
+
+static void load_stats_timer(fr_timer_list_t *tl, fr_time_t now, UNUSED void *uctx)
+{
+	load_stats_interval(now);
+
+	if (fr_timer_at(autofree, tl, &rc_load.stats_ev, fr_time_add(now, rc_load.interval),
+			false, load_stats_timer, NULL) < 0) {
+		fr_perror("radclient");
+		fr_exit_now(EXIT_FAILURE);
+	}
+}
+
+/*
+ *	All of the sockets are connected, start sending packets.
+ */
+static void load_start(void)
+{
+	fr_time_t now = fr_time();
+
+	rc_load.start = rc_load.step_start = rc_load.interval_start = now;
+	rc_load.pps = rc_load.start_pps;
+
+	fprintf(fr_log_fp, "%8s %8s %8s %8s %8s %8s %8s %8s %9s %9s %9s %9s %9s\n",
+		"time", "target", "rate", "sent", "recv", "timeout", "retrans", "unsent",
+		"p50(ms)", "p90(ms)", "p99(ms)", "p99.9(ms)", "max(ms)");
+
+	if (fr_timer_in(autofree, client_config.el->tl, &rc_load.stats_ev, rc_load.interval,
+			false, load_stats_timer, NULL) < 0) {
+		fr_perror("radclient");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	load_timer(client_config.el->tl, now, NULL);
+}
+
+static void load_packet_retry(UNUSED fr_bio_packet_t *bio, UNUSED fr_packet_t *packet)
+{
+	rc_load.interval_stats.retransmits++;
+}
+
+static void load_packet_release(UNUSED fr_bio_packet_t *bio, fr_packet_t *packet)
+{
+	rc_load_packet_t *lp = packet->uctx;
+
+	rc_load.interval_stats.timeouts++;
+	stats.lost++;
+
+	load_packet_free(lp);
+	load_check_done();
+}
+
+static int load_write_pause(rc_load_socket_t *s)
+{
+	if (!s->write_active) return 0;
+
+	if (fr_event_filter_update(client_config.el, s->info->fd_info->socket.fd, FR_EVENT_FILTER_IO, pause_write) < 0) {
+		return fr_bio_error(GENERIC);
+	}
+	s->write_active = false;
+
+	return 0;
+}
+
+/*
+ *	The socket is blocked, wait for it to become writable so
+ *	that we can flush the pending data.
+ */
+static int load_bio_write_blocked(fr_bio_packet_t *bio)
+{
+	rc_load_socket_t *s = bio->uctx;
+
+	if (s->write_active) return 0;
+
+	if (fr_event_filter_update(client_config.el, s->info->fd_info->socket.fd, FR_EVENT_FILTER_IO, resume_write) < 0) {
+		return fr_bio_error(GENERIC);
+	}
+	s->write_active = true;
+
+	return 0;
+}
+
+static int load_bio_write_resume(fr_bio_packet_t *bio)
+{
+	rc_load_socket_t *s = bio->uctx;
+
+	if (load_write_pause(s) < 0) return fr_bio_error(GENERIC);
+
+	return 1;
+}
+
+static NEVER_RETURNS void load_bio_failed(UNUSED fr_bio_packet_t *bio)
+{
+	ERROR("Failed connecting to server");
+
+	fr_exit_now(EXIT_FAILURE);
+}
+
+static NEVER_RETURNS void load_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags,
+				     int fd_errno, UNUSED void *uctx)
+{
+	ERROR("Failed in connection - %s", fr_syserror(fd_errno));
+
+	fr_exit_now(EXIT_FAILURE);
+}
+
+static void load_read(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	rc_load_socket_t	*s = uctx;
+	rc_load_packet_t	*lp;
+	fr_pair_list_t		reply_pairs;
+	fr_packet_t		*reply;
+	int			rcode;
+
+	fr_pair_list_init(&reply_pairs);
+
+	rcode = fr_bio_packet_read(s->bio, (void **) &lp, &reply, s->bio, &reply_pairs);
+	if (rcode < 0) {
+		ERROR("Failed reading packet - %s", fr_bio_strerror(rcode));
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Not a RADIUS packet, or not a reply to a packet we sent.
+	 */
+	if (!rcode) return;
+
+	fr_histogram_add(&rc_load.interval_stats.latency,
+			 fr_time_delta_to_usec(fr_time_sub(reply->timestamp, lp->scheduled)));
+	rc_load.interval_stats.received++;
+
+	if (fr_debug_lvl > 1) fr_radius_packet_log(&default_log, reply, &reply_pairs, true);
+
+	switch (reply->code) {
+	case FR_RADIUS_CODE_ACCESS_ACCEPT:
+	case FR_RADIUS_CODE_ACCOUNTING_RESPONSE:
+	case FR_RADIUS_CODE_COA_ACK:
+	case FR_RADIUS_CODE_DISCONNECT_ACK:
+		stats.accepted++;
+		break;
+
+	case FR_RADIUS_CODE_ACCESS_CHALLENGE:
+		break;
+
+	default:
+		stats.rejected++;
+	}
+
+	/*
+	 *	The reply and its pairs are parented by the request.
+	 */
+	(void) fr_radius_client_fd_bio_cancel(s->bio, lp->packet);
+	load_packet_free(lp);
+	load_check_done();
+}
+
+static void load_write(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	rc_load_socket_t	*s = uctx;
+	int			rcode;
+
+	rcode = fr_bio_packet_write_flush(s->bio);
+	if (rcode < 0) {
+		if (rcode == fr_bio_error(IO_WOULD_BLOCK)) return;
+
+		ERROR("Failed writing packet - %s", fr_strerror());
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (s->bio->write_blocked) return;
+
+	if (load_write_pause(s) < 0) {
+		fr_perror("radclient");
+		fr_exit_now(EXIT_FAILURE);
+	}
+}
+
+static void load_bio_connected(fr_bio_packet_t *bio)
+{
+	rc_load_socket_t *s = bio->uctx;
+
+	if (fr_event_fd_insert(autofree, NULL, client_config.el, s->info->fd_info->socket.fd,
+			       load_read, load_write, load_error, s) < 0) {
+	error:
+		fr_perror("radclient");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	We only need to know about the socket being writable
+	 *	when the write is blocked.
+	 */
+	s->write_active = true;
+	if (load_write_pause(s) < 0) goto error;
+
+	if (++rc_load.connected == rc_load.num_sockets) load_start();
+}
+
+/*
+ *	Open all of the sockets, and start connecting them.
+ */
+static int load_init(void)
+{
+	size_t i;
+
+	fr_histogram_init(&rc_load.interval_stats.latency);
+	fr_histogram_init(&rc_load.total.latency);
+
+	MEM(rc_load.sockets = talloc_zero_array(autofree, rc_load_socket_t, rc_load.num_sockets));
+
+	for (i = 0; i < rc_load.num_sockets; i++) {
+		rc_load_socket_t *s = &rc_load.sockets[i];
+
+		s->bio = fr_radius_client_bio_alloc(autofree, &client_config, &fd_config);
+		if (!s->bio) {
+			ERROR("Failed opening socket: %s", fr_strerror());
+			return -1;
+		}
+		s->bio->uctx = s;
+		s->info = fr_radius_client_bio_info(s->bio);
+
+		if (fr_event_fd_insert(autofree, NULL, client_config.el, s->info->fd_info->socket.fd, NULL,
+				       fr_radius_client_bio_connect, load_error, s->bio) < 0) {
+			fr_perror("radclient");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
 /**
  *
  * @hidecallgraph
@@ -1402,7 +2003,7 @@ int main(int argc, char **argv)
 	 *
 	 ***********************************************************************/
 
-	while ((c = getopt(argc, argv, "46A:c:C:d:D:f:Fi:ho:p:P:r:sS:t:vx")) != -1) switch (c) {
+	while ((c = getopt(argc, argv, "46A:c:C:d:D:f:Fi:hI:L:N:o:p:P:r:sS:t:T:vx")) != -1) switch (c) {
 		case '4':
 			fd_config.dst_ipaddr.af = AF_INET;
 			break;
@@ -1495,6 +2096,38 @@ int main(int argc, char **argv)
 			}
 			break;
 
+		case 'I':
+			if (fr_time_delta_from_str(&rc_load.interval, optarg, strlen(optarg), FR_TIME_RES_SEC) < 0) {
+				fr_perror("Failed parsing interval value");
+				fr_exit_now(EXIT_FAILURE);
+			}
+			if (!fr_time_delta_ispos(rc_load.interval)) usage();
+			break;
+
+			/*
+			 *	pps[:step:max]
+			 */
+		case 'L':
+			rc_load.start_pps = strtoul(optarg, &end, 10);
+			if (!rc_load.start_pps) usage();
+			rc_load.max_pps = rc_load.start_pps;
+
+			if (*end == ':') {
+				rc_load.step = strtoul(end + 1, &end, 10);
+				if (*end != ':') usage();
+
+				rc_load.max_pps = strtoul(end + 1, &end, 10);
+				if (rc_load.max_pps < rc_load.start_pps) usage();
+			}
+			if (*end) usage();
+			do_load = true;
+			break;
+
+		case 'N':
+			rc_load.num_sockets = strtoul(optarg, &end, 10);
+			if (*end || !rc_load.num_sockets || (rc_load.num_sockets > 1024)) usage();
+			break;
+
 		case 'o':
 			coa_port = atoi(optarg);
 			if (!coa_port || (coa_port > 65535)) usage();
@@ -1574,6 +2207,14 @@ int main(int argc, char **argv)
 			}
 			break;
 
+		case 'T':
+			if (fr_time_delta_from_str(&rc_load.step_duration, optarg, strlen(optarg), FR_TIME_RES_SEC) < 0) {
+				fr_perror("Failed parsing duration value");
+				fr_exit_now(EXIT_FAILURE);
+			}
+			if (!fr_time_delta_ispos(rc_load.step_duration)) usage();
+			break;
+
 		case 'v':
 			fr_debug_lvl = 1;
 			DEBUG("%s", radclient_version);
@@ -1596,6 +2237,21 @@ int main(int argc, char **argv)
 		usage();
 	}
 
+	if (do_load) {
+		if (forced_id >= 0) {
+			ERROR("Cannot force the request id in load mode");
+			usage();
+		}
+
+		if ((rc_load.num_sockets > 1) && fd_config.src_port) {
+			ERROR("Cannot use multiple sockets with a fixed source port");
+			usage();
+		}
+
+		if (!fr_time_delta_ispos(rc_load.step_duration)) rc_load.step_duration = fr_time_delta_from_sec(10);
+		if (!fr_time_delta_ispos(rc_load.interval)) rc_load.interval = fr_time_delta_from_sec(1);
+	}
+
 	/*
 	 *	Get the request type
 	 */
@@ -1766,16 +2422,29 @@ int main(int argc, char **argv)
 	 *	Set callbacks so that the socket is automatically
 	 *	paused or resumed when the socket becomes writeable.
 	 */
-	client_config.packet_cb_cfg = (fr_bio_packet_cb_funcs_t) {
-		.connected	= client_bio_connected,
-		.failed		= client_bio_failed,
+	if (!do_load) {
+		client_config.packet_cb_cfg = (fr_bio_packet_cb_funcs_t) {
+			.connected	= client_bio_connected,
+			.failed		= client_bio_failed,
 
-		.write_blocked	= client_bio_write_pause,
-		.write_resume	= client_bio_write_resume,
+			.write_blocked	= client_bio_write_pause,
+			.write_resume	= client_bio_write_resume,
 
-		.retry		= (fr_debug_lvl > 0) ? client_packet_retry_log : NULL,
-		.release	= client_packet_release,
-	};
+			.retry		= (fr_debug_lvl > 0) ? client_packet_retry_log : NULL,
+			.release	= client_packet_release,
+		};
+	} else {
+		client_config.packet_cb_cfg = (fr_bio_packet_cb_funcs_t) {
+			.connected	= load_bio_connected,
+			.failed		= load_bio_failed,
+
+			.write_blocked	= load_bio_write_blocked,
+			.write_resume	= load_bio_write_resume,
+
+			.retry		= load_packet_retry,
+			.release	= load_packet_release,
+		};
+	}
 
 #ifdef STATIC_ANALYZER
 	if (!autofree) fr_exit_now(EXIT_FAILURE);
@@ -1783,11 +2452,21 @@ int main(int argc, char **argv)
 
 	/*
 	 *	Open the RADIUS client bio, and then get the information associated with it.
+	 *
+	 *	In load mode, the sockets are connected as soon as
+	 *	they're opened, and the first one is used to check the
+	 *	templates.
 	 */
-	client_bio = fr_radius_client_bio_alloc(autofree, &client_config, &fd_config);
-	if (!client_bio) {
-		ERROR("Failed opening socket: %s", fr_strerror());
-		fr_exit_now(EXIT_FAILURE);
+	if (do_load) {
+		if (load_init() < 0) fr_exit_now(EXIT_FAILURE);
+
+		client_bio = rc_load.sockets[0].bio;
+	} else {
+		client_bio = fr_radius_client_bio_alloc(autofree, &client_config, &fd_config);
+		if (!client_bio) {
+			ERROR("Failed opening socket: %s", fr_strerror());
+			fr_exit_now(EXIT_FAILURE);
+		}
 	}
 
 	client_info = fr_radius_client_bio_info(client_bio);
@@ -1818,8 +2497,9 @@ int main(int argc, char **argv)
 	 *
 	 *	Once the connect() passes, we start reading from the request list, and processing packets.
 	 */
-	if (fr_event_fd_insert(autofree, NULL, client_config.retry_cfg.el, client_info->fd_info->socket.fd, NULL,
-			       fr_radius_client_bio_connect, client_error, client_bio) < 0) {
+	if (!do_load &&
+	    (fr_event_fd_insert(autofree, NULL, client_config.retry_cfg.el, client_info->fd_info->socket.fd, NULL,
+				fr_radius_client_bio_connect, client_error, client_bio) < 0)) {
 		fr_perror("radclient");
 		fr_exit_now(EXIT_FAILURE);
 	}
@@ -1831,6 +2511,22 @@ int main(int argc, char **argv)
 	 ***********************************************************************/
 	(void) fr_event_loop(client_config.retry_cfg.el);
 
+	if (do_load) {
+		size_t i;
+
+		/*
+		 *	Print the final partial interval, and then the
+		 *	totals for the whole run.
+		 */
+		load_stats_interval(fr_time());
+		load_stats_print("total", rc_load.pps, &rc_load.total, fr_time_sub(rc_load.interval_start, rc_load.start));
+
+		for (i = 0; i < rc_load.num_sockets; i++) {
+			(void) fr_event_fd_delete(client_config.retry_cfg.el, rc_load.sockets[i].info->fd_info->socket.fd,
+						  FR_EVENT_FILTER_IO);
+		}
+	}
+
 	/***********************************************************************
 	 *
 	 *	We are done the event loop.  Start cleaning things up.
@@ -1838,7 +2534,7 @@ int main(int argc, char **argv)
 	 ***********************************************************************/
 	fr_dlist_talloc_free(&rc_request_list);
 
-	(void) fr_event_fd_delete(client_config.retry_cfg.el, client_info->fd_info->socket.fd, FR_EVENT_FILTER_IO);
+	if (!do_load) (void) fr_event_fd_delete(client_config.retry_cfg.el, client_info->fd_info->socket.fd, FR_EVENT_FILTER_IO);
 
 	fr_radius_global_free();
 
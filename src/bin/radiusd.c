@@ -846,6 +846,11 @@ int main(int argc, char *argv[])
 		schedule->max_networks = config->max_networks;
 		schedule->stats_interval = config->stats_interval;
 
+		schedule->network_cpus = config->network_cpus;
+		schedule->worker_cpus = config->worker_cpus;
+		schedule->numa_node = config->numa_node;
+		schedule->numa_node_is_set = config->numa_node_is_set;
+
 		schedule->network.max_outstanding = config->worker.max_requests;
 		schedule->worker = config->worker;
 
@@ -227,7 +227,7 @@ fr_trie_t *fr_bio_network_trie_alloc(TALLOC_CTX *ctx, int af, fr_ipaddr_t const
 	 *	And now check denied networks.
 	 */
 	num = talloc_array_length(deny);
-	if (!num) return trie;
+	if (!num) goto done;
 
 	/*
 	 *	Since the default is to deny, you can only add a "deny" inside of a previous "allow".
@@ -281,5 +281,11 @@ fr_trie_t *fr_bio_network_trie_alloc(TALLOC_CTX *ctx, int af, fr_ipaddr_t const
 		}
 	}
 
+done:
+	/*
+	 *	The rules don't change, and are checked for every new connection.
+	 */
+	if (fr_trie_freeze(trie) < 0) goto fail;
+
 	return trie;
 }
@@ -122,6 +122,16 @@ typedef struct {
 							///< with Wireshark.
 } fr_curl_tls_t;
 
+/** Which caches are shared between the curl handles of all threads
+ *
+ */
+typedef struct {
+	bool			dns;			//!< Share resolved hostnames.
+	bool			tls_session;		//!< Share TLS session IDs and tickets.
+} fr_curl_share_config_t;
+
+typedef struct fr_curl_share_s fr_curl_share_t;
+
 typedef struct {
 	fr_slab_config_t	reuse;
 	fr_time_delta_t		connect_timeout;
@@ -129,6 +139,7 @@ typedef struct {
 
 extern conf_parser_t	 	fr_curl_tls_config[];
 extern conf_parser_t		fr_curl_conn_config[];
+extern conf_parser_t		fr_curl_share_config[];
 extern global_lib_autoinst_t	fr_curl_autoinst;
 
 int			fr_curl_io_request_enqueue(fr_curl_handle_t *mhandle,
@@ -142,6 +153,10 @@ int			fr_curl_response_certinfo(request_t *request, fr_curl_io_request_t *randle
 
 int			fr_curl_easy_tls_init (fr_curl_io_request_t *randle, fr_curl_tls_t const *conf);
 
+fr_curl_share_t		*fr_curl_share_alloc(fr_curl_share_config_t const *conf);
+
+int			fr_curl_easy_share_init(fr_curl_io_request_t *randle, fr_curl_share_t const *share);
+
 CURL			*fr_curl_tmp_handle(void);
 #ifdef __cplusplus
 }
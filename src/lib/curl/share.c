@@ -0,0 +1,167 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file curl/share.c
+ * @brief Caches shared between the curl handles of all threads
+ *
+ * Each worker thread has its own multi-handle, so by default each thread
+ * resolves hostnames and negotiates TLS sessions independently.  A share
+ * handle lets the easy handles of every thread use a single DNS cache and
+ * a single TLS session cache, so after the first full handshake other
+ * threads can resume the session.
+ *
+ * libcurl does not support sharing the connection cache between threads
+ * that run transfers concurrently, so connections remain per-thread.
+ *
+ * @copyright 2026 The FreeRADIUS project
+ */
+#include <freeradius-devel/curl/base.h>
+
+#include <pthread.h>
+
+/*
+ *  CURL headers do:
+ *
+ *  #define curl_easy_setopt(handle,opt,param) curl_easy_setopt(handle,opt,param)
+ */
+DIAG_OFF(DIAG_UNKNOWN_PRAGMAS)
+DIAG_OFF(disabled-macro-expansion)
+DIAG_ON(DIAG_UNKNOWN_PRAGMAS)
+#define SET_SOPTION(_opt, _val)\
+do {\
+	if ((ret = curl_share_setopt(share->shandle, _opt, _val)) != CURLSHE_OK) {\
+		option = STRINGIFY(_opt);\
+		goto error;\
+	}\
+} while (0)
+
+/** Share handle and the locks protecting the data it holds
+ *
+ */
+struct fr_curl_share_s {
+	CURLSH			*shandle;			//!< The share handle.
+	pthread_mutex_t		mutex[CURL_LOCK_DATA_LAST];	//!< One lock for each type of shared data.
+};
+
+conf_parser_t fr_curl_share_config[] = {
+	{ FR_CONF_OFFSET("dns", fr_curl_share_config_t, dns), .dflt = "no" },
+	{ FR_CONF_OFFSET("tls_session", fr_curl_share_config_t, tls_session), .dflt = "no" },
+	CONF_PARSER_TERMINATOR
+};
+
+/** Called by libcurl before accessing shared data
+ *
+ */
+static void _fr_curl_share_lock(UNUSED CURL *candle, curl_lock_data data, UNUSED curl_lock_access access, void *uctx)
+{
+	fr_curl_share_t *share = uctx;
+
+	pthread_mutex_lock(&share->mutex[data]);
+}
+
+/** Called by libcurl after accessing shared data
+ *
+ */
+static void _fr_curl_share_unlock(UNUSED CURL *candle, curl_lock_data data, void *uctx)
+{
+	fr_curl_share_t *share = uctx;
+
+	pthread_mutex_unlock(&share->mutex[data]);
+}
+
+static int _fr_curl_share_free(fr_curl_share_t *share)
+{
+	size_t i;
+
+	/*
+	 *	Fails if any easy handles are still using the share
+	 */
+	if (curl_share_cleanup(share->shandle) != CURLSHE_OK) {
+		fr_assert_msg(0, "curl share handle still in use");
+		return -1;
+	}
+
+	for (i = 0; i < NUM_ELEMENTS(share->mutex); i++) pthread_mutex_destroy(&share->mutex[i]);
+
+	return 0;
+}
+
+/** Allocate a share handle to be used by the curl handles of all threads
+ *
+ * The share handle must outlive every easy handle using it, so should be
+ * freed after all thread instance data has been freed.  As module instance
+ * data is read-only after instantiation, the share is not parented by it.
+ *
+ * @param[in] conf	Which caches to share.
+ * @return
+ *	- A new share handle.
+ *	- NULL on error.
+ */
+fr_curl_share_t *fr_curl_share_alloc(fr_curl_share_config_t const *conf)
+{
+	fr_curl_share_t	*share;
+	CURLSHcode	ret;
+	char const	*option;
+	size_t		i;
+
+	MEM(share = talloc_zero(NULL, fr_curl_share_t));
+
+	share->shandle = curl_share_init();
+	if (!share->shandle) {
+		ERROR("Curl share-handle instantiation failed");
+		talloc_free(share);
+		return NULL;
+	}
+
+	for (i = 0; i < NUM_ELEMENTS(share->mutex); i++) pthread_mutex_init(&share->mutex[i], NULL);
+	talloc_set_destructor(share, _fr_curl_share_free);
+
+	SET_SOPTION(CURLSHOPT_LOCKFUNC, _fr_curl_share_lock);
+	SET_SOPTION(CURLSHOPT_UNLOCKFUNC, _fr_curl_share_unlock);
+	SET_SOPTION(CURLSHOPT_USERDATA, share);
+
+	if (conf->dns) SET_SOPTION(CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	if (conf->tls_session) SET_SOPTION(CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+	return share;
+
+error:
+	ERROR("Failed setting curl share option %s: %s (%i)", option, curl_share_strerror(ret), ret);
+	talloc_free(share);
+
+	return NULL;
+}
+
+/** Associate an easy handle with a share handle
+ *
+ * @param[in] randle	to associate with the share.
+ * @param[in] share	to use.  May be NULL, in which case this is a noop.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_curl_easy_share_init(fr_curl_io_request_t *randle, fr_curl_share_t const *share)
+{
+	if (!share) return 0;
+
+	FR_CURL_SET_OPTION(CURLOPT_SHARE, share->shandle);
+
+	return 0;
+error:
+	return -1;
+}
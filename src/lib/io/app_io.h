@@ -45,6 +45,8 @@ typedef struct {
 	fr_io_set_fd_t			fd_set;		//!< Set the file descriptor to the instance.
 
 	fr_io_data_read_t		read;		//!< Read from a socket to a data buffer
+	fr_io_data_pending_t		read_pending;	//!< Are there packets which have been read,
+							///< but not yet returned by read()?
 	fr_io_data_write_t		write;		//!< Write from a data buffer to a socket
 
 	fr_io_data_inject_t		inject;		//!< Inject a packet into a socket.
@@ -54,7 +56,8 @@ typedef struct {
 	fr_io_decode_t			decode;		//!< Translate raw bytes into fr_pair_ts and metadata.
 	fr_io_encode_t			encode;		//!< Pack fr_pair_ts back into a byte array.
 
-	fr_io_signal_t			flush;		//!< Flush the data when the socket is ready for writing.
+	fr_io_data_flush_t		flush;		//!< Flush queued data after a batch of writes, or
+							///< when the socket is ready for writing.
 
 	fr_io_signal_t			error;		//!< There was an error on the socket.
 	fr_io_close_t			close;		//!< Close the transport.
@@ -66,6 +69,7 @@ typedef struct {
 
 	fr_io_connection_set_t		connection_set;	//!< set src/dst IP/port of a connection
 	fr_io_network_get_t		network_get;	//!< get dynamic network information
+	fr_io_shards_get_t		shards_get;	//!< get the number of sockets to open
 	fr_io_client_find_t		client_find;	//!< find radclient
 	fr_io_name_t			get_name;	//!< get the socket name
 	fr_io_hexdump_set_t		hexdump_set;	//!< set the hexdump options
@@ -56,6 +56,18 @@ typedef int (*fr_app_open_t)(void *instance, fr_schedule_t *sc, CONF_SECTION *cs
  */
 typedef int (*fr_app_priority_get_t)(void const *instance, uint8_t const *buffer, size_t buflen);
 
+/** Return the packet type (code) of a packet
+ *
+ * The network thread predicts how long a packet will take to process,
+ * based on the processing time of previous packets of the same type.
+ *
+ * @param[in] instance	of the #fr_app_t.
+ * @param[in] buffer	raw packet
+ * @param[in] buflen	length of the packet
+ * @return the packet type
+ */
+typedef uint8_t (*fr_app_packet_type_get_t)(void const *instance, uint8_t const *buffer, size_t buflen);
+
 /** Called by the network thread to pass an event list for the module to use for timer events
  */
 typedef void (*fr_app_event_list_set_t)(fr_listen_t *li, fr_event_list_t *el, void *nr);
@@ -88,6 +100,8 @@ typedef struct {
 							///< to all #fr_app_io_t can be performed by the #fr_app_t.
 
 	fr_app_priority_get_t		priority;	//!< Assign a priority to the packet.
+
+	fr_app_packet_type_get_t	packet_type;	//!< Return the type of the packet.  May be NULL.
 } fr_app_t;
 
 /** Public structure describing an application (protocol) specialisation
@@ -175,6 +175,38 @@ typedef size_t (*fr_io_nak_t)(fr_listen_t *li, void *packet_ctx, uint8_t *const
  */
 typedef ssize_t (*fr_io_data_read_t)(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time, uint8_t *buffer, size_t buffer_len, size_t *leftover);
 
+/** Check if there is data which was read from a socket, but not yet returned to the caller
+ *
+ *  Datagram readers may read multiple packets from the kernel in one
+ *  system call, and then return them one at a time.  The socket is
+ *  not signalled as readable for packets which have already been
+ *  read, so the network side calls read() again until this function
+ *  returns false.
+ *
+ * @param[in] li		the listener for this socket
+ * @return
+ *	- true if there are packets which a subsequent read() will return.
+ *	- false if there are no pending packets.
+ */
+typedef bool (*fr_io_data_pending_t)(fr_listen_t *li);
+
+/** Write any data which the transport has queued
+ *
+ *  Datagram writers may queue packets in write(), so that many packets
+ *  can be written to the network in one system call.  The network side
+ *  calls this function once per event loop pass for each socket which
+ *  has been written to, and again when a blocked socket becomes
+ *  writable.
+ *
+ * @param[in] li		the listener for this socket
+ * @return
+ *	- <0 on error.  Some queued data was discarded.
+ *	- 0 if all queued data was written.
+ *	- 1 if the socket would block.  The network side will call this
+ *	  function again when the socket is writable.
+ */
+typedef int (*fr_io_data_flush_t)(fr_listen_t *li);
+
 /** Write a socket.
  *
  *  If the socket is a datagram socket, then the function can read or
@@ -355,6 +387,18 @@ typedef void (*fr_io_hexdump_set_t)(fr_listen_t *li, void *inst);
  */
 typedef void (*fr_io_network_get_t)(int *ipproto, bool *dynamic_clients, fr_trie_t const **trie, void *instance);
 
+/** Callback to return the number of sockets to open for a listener
+ *
+ *  Datagram transports can bind multiple sockets to the same address
+ *  with SO_REUSEPORT.  The kernel then spreads packets across the
+ *  sockets, and each socket can be serviced by a different network
+ *  thread.
+ *
+ * @param[in] instance		Instance data.
+ * @return the number of sockets to open.
+ */
+typedef uint32_t (*fr_io_shards_get_t)(void const *instance);
+
 typedef char const *(*fr_io_name_t)(fr_listen_t *li);
 
 
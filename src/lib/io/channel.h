@@ -138,6 +138,9 @@ typedef struct {
 	};
 
 	uint32_t	priority;				//!< Priority of this packet.
+	uint8_t		packet_type;				//!< Type of the request packet, returned with the reply.
+	fr_time_delta_t	predicted;				//!< Processing time the network thread predicted
+								///< for this request, returned with the reply.
 
 	void		*packet_ctx;				//!< Packet specific context for holding client
 								//!< information, and other proto_* specific information
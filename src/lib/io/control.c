@@ -91,23 +91,41 @@ struct fr_control_s {
 static void pipe_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
 {
 	fr_control_t *c = talloc_get_type_abort(uctx, fr_control_t);
-	fr_time_t now;
 	char read_buffer[256];
-	uint8_t	data[256];
-	size_t message_size;
-	uint32_t id = 0;
 
 	if (read(fd, read_buffer, sizeof(read_buffer)) <= 0) return;
 
-	now = fr_time();
+	(void) fr_control_service(c);
+}
+
+/** Run the callbacks for all pending control-plane messages
+ *
+ *  This is normally done when the event loop sees data on the pipe.
+ *  It should only be called directly when the event loop is no
+ *  longer being serviced.
+ *
+ * @param[in] c the control structure
+ * @return the number of messages which were processed.
+ */
+int fr_control_service(fr_control_t *c)
+{
+	fr_time_t now = fr_time();
+	uint8_t	data[256];
+	size_t message_size;
+	uint32_t id = 0;
+	int count = 0;
 
 	while((message_size = fr_control_message_pop(c->aq, &id, data, sizeof(data)))) {
+		count++;
+
 		if (id >= FR_CONTROL_MAX_TYPES) continue;
 
 		if (!c->type[id].callback) continue;
 
 		c->type[id].callback(c->type[id].ctx, data, message_size, now);
 	}
+
+	return count;
 }
 
 /** Free a control structure
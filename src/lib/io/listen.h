@@ -54,6 +54,9 @@ struct fr_listen {
 
 	size_t			default_message_size;	//!< copied from app_io, but may be changed
 	size_t			num_messages;		//!< for the message ring buffer
+
+	uint32_t		shard;			//!< which of the sockets bound to the same address this is.
+	uint32_t		num_shards;		//!< how many sockets are bound to the same address.
 };
 
 /**
@@ -71,6 +74,13 @@ struct fr_async_s {
 	void			*packet_ctx;
 	fr_listen_t		*listen;	//!< How we received this request,
 						//!< and how we'll send the reply.
+
+	uint8_t			packet_type;	//!< From the network thread, returned with the reply.
+	fr_time_delta_t		predicted;	//!< From the network thread, returned with the reply.
+
+	bool			stolen;		//!< Request is being run by a worker which
+						//!< doesn't own "channel".
+	uint32_t		owner;		//!< Which worker owns "channel", if the request was stolen.
 };
 
 int fr_io_listen_free(fr_listen_t *li);
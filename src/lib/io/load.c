@@ -59,6 +59,7 @@ typedef enum {
 	FR_LOAD_STATE_INIT = 0,
 	FR_LOAD_STATE_SENDING,
 	FR_LOAD_STATE_GATED,
+	FR_LOAD_STATE_STEP_DRAINING,		//!< waiting for the replies to the current step
 	FR_LOAD_STATE_DRAINING,
 } fr_load_state_t;
 
@@ -67,12 +68,20 @@ struct fr_load_s {
 	fr_event_list_t		*el;
 	fr_load_config_t const *config;
 	fr_load_callback_t	callback;
+	fr_load_done_t		done;			//!< called when the test ends without a reply
 	void			*uctx;
 
 	fr_load_stats_t		stats;			//!< sending statistics
 	fr_time_t		step_start;		//!< when the current step started
 	fr_time_t		step_end;		//!< when the current step will end
+	int			step_sent;
 	int			step_received;
+	int			step_lost;
+	bool			step_blocked;		//!< the backlog limit was reached during this step
+
+	fr_load_step_t		*steps;			//!< summaries of the completed steps
+	size_t			num_steps;
+	uint32_t		search_hi;		//!< lowest rate which failed the p99 limit
 
 	uint32_t		pps;
 	fr_time_delta_t		delta;			//!< between packets
@@ -84,8 +93,23 @@ struct fr_load_s {
 	fr_timer_t		*ev;
 };
 
+/** Allocate a new load generator
+ *
+ * @param[in] ctx	to allocate the generator in.
+ * @param[in] el	to run the timers in.
+ * @param[in] config	of the generator.  Unset values are given defaults.
+ * @param[in] callback	to send a packet.
+ * @param[in] done	called when the test ends from a timer, i.e. without
+ *			a final reply.  When a reply ends the test,
+ *			fr_load_generator_have_reply() returns #FR_LOAD_DONE
+ *			instead.  May be NULL.
+ * @param[in] uctx	passed to the callbacks.
+ * @return
+ *	- the new generator.
+ *	- NULL on error.
+ */
 fr_load_t *fr_load_generator_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_load_config_t *config,
-				    fr_load_callback_t callback, void *uctx)
+				    fr_load_callback_t callback, fr_load_done_t done, void *uctx)
 {
 	fr_load_t *l;
 
@@ -95,15 +119,25 @@ fr_load_t *fr_load_generator_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_loa
 	if (!config->start_pps) config->start_pps = 1;
 	if (!config->milliseconds) config->milliseconds = 1000;
 	if (!config->parallel) config->parallel = 1;
+	if (!fr_time_delta_ispos(config->drain_timeout)) config->drain_timeout = fr_time_delta_from_sec(30);
 
 	l->el = el;
 	l->config = config;
 	l->callback = callback;
+	l->done = done;
 	l->uctx = uctx;
 
 	return l;
 }
 
+/** The number of packets which are still waiting for a reply
+ *
+ */
+static inline int load_outstanding(fr_load_t const *l)
+{
+	return l->stats.sent - l->stats.received - l->stats.lost;
+}
+
 /** Send one or more packets.
  *
  */
@@ -126,6 +160,170 @@ static void fr_load_generator_send(fr_load_t *l, fr_time_t now, int count)
 	}
 }
 
+/** Record the statistics for the step which just finished, and start a new one
+ *
+ */
+static void load_step_record(fr_load_t *l, fr_time_t now)
+{
+	fr_load_step_t		*step;
+	fr_histogram_t const	*h = &l->stats.step_rtt;
+	fr_time_delta_t		elapsed = fr_time_sub(now, l->step_start);
+
+	if ((l->num_steps % 16) == 0) {
+		fr_load_step_t *steps;
+
+		steps = talloc_realloc(l, l->steps, fr_load_step_t, l->num_steps + 16);
+		if (!steps) goto reset;
+		l->steps = steps;
+	}
+
+	step = &l->steps[l->num_steps++];
+	*step = (fr_load_step_t) {
+		.pps = l->pps,
+		.sent = l->stats.sent - l->step_sent,
+		.received = l->stats.received - l->step_received,
+		.lost = l->stats.lost - l->step_lost,
+		.blocked = l->step_blocked,
+		.p50 = fr_time_delta_wrap(fr_histogram_percentile(h, 50)),
+		.p90 = fr_time_delta_wrap(fr_histogram_percentile(h, 90)),
+		.p99 = fr_time_delta_wrap(fr_histogram_percentile(h, 99)),
+		.p999 = fr_time_delta_wrap(fr_histogram_percentile(h, 99.9)),
+		.max = fr_time_delta_wrap(h->max),
+	};
+
+	if (fr_time_delta_ispos(elapsed)) {
+		step->pps_accepted = fr_time_delta_unwrap(fr_time_delta_div(fr_time_delta_from_sec(step->received),
+									    elapsed));
+	}
+
+	/*
+	 *	A step with no replies tells us nothing good about
+	 *	the rate.  Lost packets took longer than any limit.
+	 */
+	step->passed = !fr_time_delta_ispos(l->config->p99_limit) ||
+		       (!step->blocked && (step->received > 0) && !step->lost &&
+			fr_time_delta_lteq(step->p99, l->config->p99_limit));
+
+reset:
+	fr_histogram_init(&l->stats.step_rtt);
+	l->step_sent = l->stats.sent;
+	l->step_received = l->stats.received;
+	l->step_lost = l->stats.lost;
+	l->step_blocked = false;
+}
+
+/** Pick the rate for the next step
+ *
+ * @return
+ *	- true if there is another step to run.
+ *	- false if the test is done.
+ */
+static bool load_step_next(fr_load_t *l)
+{
+	fr_load_step_t const	*step;
+	uint32_t		lo, hi;
+
+	if (!fr_time_delta_ispos(l->config->p99_limit) || !l->num_steps) {
+	ramp:
+		l->pps += l->config->step;
+
+		/*
+		 *	Stop at max PPS, if it's set.  Otherwise
+		 *	continue without limit.
+		 */
+		return !(l->config->max_pps && (l->pps > l->config->max_pps));
+	}
+
+	step = &l->steps[l->num_steps - 1];
+	if (step->passed) {
+		if (step->pps > l->stats.sustained_pps) l->stats.sustained_pps = step->pps;
+
+	} else if (!l->search_hi || (step->pps < l->search_hi)) {
+		l->search_hi = step->pps;
+	}
+
+	/*
+	 *	Keep ramping up until a step fails.
+	 */
+	if (!l->search_hi) goto ramp;
+
+	/*
+	 *	Then bisect until we're within 1%.
+	 */
+	lo = l->stats.sustained_pps;
+	hi = l->search_hi;
+	if ((lo >= hi) || ((hi - lo) <= (hi / 100))) return false;
+
+	l->pps = lo + ((hi - lo) / 2);
+
+	return (l->pps > 0);
+}
+
+/** Close the current step, and start the next one
+ *
+ *  All of the replies to packets sent during the step must have been
+ *  received, so that they are charged to the step they were sent in.
+ *
+ * @return
+ *	- true if there is another step to run.
+ *	- false if the test is done.
+ */
+static bool load_step_close(fr_load_t *l, fr_time_t now)
+{
+	load_step_record(l, now);
+
+	/*
+	 *	Replies to packets sent before now are for a closed
+	 *	step, even if there is no next step.
+	 */
+	l->step_start = now;
+
+	if (!load_step_next(l)) {
+		l->state = FR_LOAD_STATE_DRAINING;
+		return false;
+	}
+
+	l->step_end = fr_time_add(now, l->config->duration);
+	l->stats.pps = l->pps;
+	l->stats.skipped = 0;
+	l->delta = fr_time_delta_div(fr_time_delta_from_sec(l->config->parallel), fr_time_delta_wrap(l->pps));
+
+	return true;
+}
+
+/** The test ended without a reply, tell the caller
+ *
+ */
+static void load_finish(fr_load_t *l, fr_time_t now)
+{
+	l->stats.end = now;
+
+	if (l->done) l->done(l->uctx);
+}
+
+static void load_timer(fr_timer_list_t *tl, fr_time_t now, void *uctx);
+
+/** We waited too long for the replies to a step
+ *
+ *  The server may never reply to some packets, e.g. if they time
+ *  out, or if it decides not to respond.  Count them as lost, and
+ *  go to the next step.
+ */
+static void load_drain_timeout(fr_timer_list_t *tl, fr_time_t now, void *uctx)
+{
+	fr_load_t *l = uctx;
+
+	l->stats.lost += load_outstanding(l);
+
+	if (!load_step_close(l, now)) {
+		load_finish(l, now);
+		return;
+	}
+
+	l->next = now;
+	load_timer(tl, now, l);
+}
+
 static void load_timer(fr_timer_list_t *tl, fr_time_t now, void *uctx)
 {
 	fr_load_t *l = uctx;
@@ -136,27 +334,32 @@ static void load_timer(fr_timer_list_t *tl, fr_time_t now, void *uctx)
 	 *	Keep track of the overall maximum backlog for the
 	 *	duration of the entire test run.
 	 */
-	l->stats.backlog = l->stats.sent - l->stats.received;
+	l->stats.backlog = load_outstanding(l);
 	if (l->stats.backlog > l->stats.max_backlog) l->stats.max_backlog = l->stats.backlog;
 
 	/*
 	 *	If we're done this step, go to the next one.
+	 *
+	 *	Replies which are still outstanding belong to this
+	 *	step.  If they were received during the next step,
+	 *	their round trip times would be charged to the wrong
+	 *	rate.  So we stop sending, and let the reply handler
+	 *	close the step once the last reply has come in.  If
+	 *	some replies never come in, the drain timer closes the
+	 *	step instead.
 	 */
 	if (fr_time_gteq(l->next, l->step_end)) {
-		l->step_start = l->next;
-		l->step_end = fr_time_add(l->next, l->config->duration);
-		l->step_received = l->stats.received;
-		l->pps += l->config->step;
-		l->stats.pps = l->pps;
-		l->stats.skipped = 0;
-		l->delta = fr_time_delta_div(fr_time_delta_from_sec(l->config->parallel), fr_time_delta_wrap(l->pps));
+		if (l->stats.backlog > 0) {
+			l->state = FR_LOAD_STATE_STEP_DRAINING;
 
-		/*
-		 *	Stop at max PPS, if it's set.  Otherwise
-		 *	continue without limit.
-		 */
-		if (l->config->max_pps && (l->pps > l->config->max_pps)) {
-			l->state = FR_LOAD_STATE_DRAINING;
+			if (fr_timer_in(l, tl, &l->ev, l->config->drain_timeout, false, load_drain_timeout, l) < 0) {
+				l->state = FR_LOAD_STATE_DRAINING;
+			}
+			return;
+		}
+
+		if (!load_step_close(l, l->next)) {
+			load_finish(l, l->next);
 			return;
 		}
 	}
@@ -196,6 +399,7 @@ static void load_timer(fr_timer_list_t *tl, fr_time_t now, void *uctx)
 		 */
 		l->state = FR_LOAD_STATE_GATED;
 		l->stats.blocked = true;
+		l->step_blocked = true;
 		count = 0;
 		l->stats.skipped += l->count;
 	}
@@ -237,6 +441,15 @@ int fr_load_generator_start(fr_load_t *l)
 	l->stats.pps = l->pps;
 	l->count = l->config->parallel;
 
+	l->step_sent = l->stats.sent;
+	l->step_received = l->stats.received;
+	l->step_lost = l->stats.lost;
+	l->step_blocked = false;
+	l->num_steps = 0;
+	l->search_hi = 0;
+	l->stats.sustained_pps = 0;
+	fr_histogram_init(&l->stats.step_rtt);
+
 	l->delta = fr_time_delta_div(fr_time_delta_from_sec(l->config->parallel), fr_time_delta_wrap(l->pps));
 	l->next = fr_time_add(l->step_start, l->delta);
 
@@ -274,11 +487,20 @@ fr_load_reply_t fr_load_generator_have_reply(fr_load_t *l, fr_time_t request_tim
 	now = fr_time();
 	t = fr_time_sub(now, request_time);
 
+	/*
+	 *	The packet was sent during a step which has already
+	 *	been closed, so it was counted as lost.  Don't charge
+	 *	it to the current step.
+	 */
+	if (fr_time_lt(request_time, l->step_start)) return FR_LOAD_CONTINUE;
+
 	l->stats.rttvar = RTTVAR(l->stats.rtt, l->stats.rttvar, t);
 	l->stats.rtt = RTT(l->stats.rtt, t);
 
 	l->stats.received++;
 
+	if (fr_time_delta_ispos(t)) fr_histogram_add(&l->stats.step_rtt, fr_time_delta_unwrap(t));
+
 	/*
 	 *	t is in nanoseconds.
 	 */
@@ -319,6 +541,23 @@ fr_load_reply_t fr_load_generator_have_reply(fr_load_t *l, fr_time_t request_tim
 		return FR_LOAD_CONTINUE;
 	}
 
+	/*
+	 *	The step is over, and we were waiting for the replies
+	 *	to the packets sent during it.  Once we have them all,
+	 *	start the next step.
+	 */
+	if (l->state == FR_LOAD_STATE_STEP_DRAINING) {
+		if (load_outstanding(l) > 0) return FR_LOAD_CONTINUE;
+
+		FR_TIMER_DISARM(l->ev);
+
+		if (load_step_close(l, now)) {
+			l->next = now;
+			load_timer(l->el->tl, now, l);
+			return FR_LOAD_CONTINUE;
+		}
+	}
+
 	/*
 	 *	We're still sending or gated, tell the caller to
 	 *	continue.
@@ -330,7 +569,7 @@ fr_load_reply_t fr_load_generator_have_reply(fr_load_t *l, fr_time_t request_tim
 	 *	Not yet received all replies.  Wait until we have all
 	 *	replies.
 	 */
-	if (l->stats.received < l->stats.sent) return FR_LOAD_CONTINUE;
+	if (load_outstanding(l) > 0) return FR_LOAD_CONTINUE;
 
 	l->stats.end = now;
 	return FR_LOAD_DONE;
@@ -345,7 +584,7 @@ size_t fr_load_generator_stats_sprint(fr_load_t *l, fr_time_t now, char *buffer,
 
 	if (!l->header) {
 		l->header = true;
-		return snprintf(buffer, buflen, "\"time\",\"last_packet\",\"rtt\",\"rttvar\",\"pps\",\"pps_accepted\",\"sent\",\"received\",\"backlog\",\"max_backlog\",\"<usec\",\"us\",\"10us\",\"100us\",\"ms\",\"10ms\",\"100ms\",\"s\",\"blocked\"\n");
+		return snprintf(buffer, buflen, "\"time\",\"last_packet\",\"rtt\",\"rttvar\",\"pps\",\"pps_accepted\",\"sent\",\"received\",\"backlog\",\"max_backlog\",\"<usec\",\"us\",\"10us\",\"100us\",\"ms\",\"10ms\",\"100ms\",\"s\",\"blocked\",\"p50\",\"p90\",\"p99\",\"p99.9\"\n");
 	}
 
 
@@ -374,7 +613,8 @@ size_t fr_load_generator_stats_sprint(fr_load_t *l, fr_time_t now, char *buffer,
 			"%d,%d,"
 			"%d,%d,"
 			"%d,%d,%d,%d,%d,%d,%d,%d,"
-			"%d\n",
+			"%d,"
+			"%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
 			now_f, last_send_f,
 			fr_time_delta_unwrap(l->stats.rtt), fr_time_delta_unwrap(l->stats.rttvar),
 			l->stats.pps, l->stats.pps_accepted,
@@ -382,10 +622,87 @@ size_t fr_load_generator_stats_sprint(fr_load_t *l, fr_time_t now, char *buffer,
 			l->stats.backlog, l->stats.max_backlog,
 			l->stats.times[0], l->stats.times[1], l->stats.times[2], l->stats.times[3],
 			l->stats.times[4], l->stats.times[5], l->stats.times[6], l->stats.times[7],
-			l->stats.blocked);
+			l->stats.blocked,
+			fr_histogram_percentile(&l->stats.step_rtt, 50), fr_histogram_percentile(&l->stats.step_rtt, 90),
+			fr_histogram_percentile(&l->stats.step_rtt, 99), fr_histogram_percentile(&l->stats.step_rtt, 99.9));
 }
 
 fr_load_stats_t const * fr_load_generator_stats(fr_load_t const *l)
 {
 	return &l->stats;
 }
+
+/** Return the summaries of all of the completed steps
+ *
+ * @param[in] l		the load generator.
+ * @param[out] num	the number of steps.
+ * @return the array of steps, which may be NULL if num is zero.
+ */
+fr_load_step_t const *fr_load_generator_steps(fr_load_t const *l, size_t *num)
+{
+	*num = l->num_steps;
+
+	return l->steps;
+}
+
+/** Write the summaries of all of the completed steps
+ *
+ *  Round trip times are written in microseconds.
+ *
+ * @param[in] l		the load generator.
+ * @param[in] fp	to write the report to.
+ * @param[in] format	of the report.
+ * @return
+ *	- 0 on success.
+ *	- -1 on write error.
+ */
+int fr_load_generator_report(fr_load_t const *l, FILE *fp, fr_load_report_format_t format)
+{
+	size_t i;
+
+	switch (format) {
+	case FR_LOAD_REPORT_CSV:
+		fprintf(fp, "\"step\",\"pps\",\"pps_accepted\",\"sent\",\"received\",\"lost\",\"blocked\",\"passed\","
+			"\"p50\",\"p90\",\"p99\",\"p99.9\",\"max\"\n");
+
+		for (i = 0; i < l->num_steps; i++) {
+			fr_load_step_t const *step = &l->steps[i];
+
+			fprintf(fp, "%zu,%u,%u,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%d,%d,"
+				"%" PRId64 ",%" PRId64 ",%" PRId64 ",%" PRId64 ",%" PRId64 "\n",
+				i + 1, step->pps, step->pps_accepted, step->sent, step->received, step->lost,
+				step->blocked, step->passed,
+				fr_time_delta_to_usec(step->p50), fr_time_delta_to_usec(step->p90),
+				fr_time_delta_to_usec(step->p99), fr_time_delta_to_usec(step->p999),
+				fr_time_delta_to_usec(step->max));
+		}
+		break;
+
+	case FR_LOAD_REPORT_JSON:
+		fprintf(fp, "{\n\t\"p99_limit_us\": %" PRId64 ",\n", fr_time_delta_to_usec(l->config->p99_limit));
+		if (fr_time_delta_ispos(l->config->p99_limit)) {
+			fprintf(fp, "\t\"sustained_pps\": %u,\n", l->stats.sustained_pps);
+		}
+		fprintf(fp, "\t\"steps\": [");
+
+		for (i = 0; i < l->num_steps; i++) {
+			fr_load_step_t const *step = &l->steps[i];
+
+			fprintf(fp, "%s\n\t\t{ \"pps\": %u, \"pps_accepted\": %u, \"sent\": %" PRIu64 ", \"received\": %" PRIu64 ", "
+				"\"lost\": %" PRIu64 ", \"blocked\": %s, \"passed\": %s, "
+				"\"p50_us\": %" PRId64 ", \"p90_us\": %" PRId64 ", \"p99_us\": %" PRId64 ", "
+				"\"p99.9_us\": %" PRId64 ", \"max_us\": %" PRId64 " }",
+				(i > 0) ? "," : "",
+				step->pps, step->pps_accepted, step->sent, step->received, step->lost,
+				step->blocked ? "true" : "false", step->passed ? "true" : "false",
+				fr_time_delta_to_usec(step->p50), fr_time_delta_to_usec(step->p90),
+				fr_time_delta_to_usec(step->p99), fr_time_delta_to_usec(step->p999),
+				fr_time_delta_to_usec(step->max));
+		}
+
+		fprintf(fp, "\n\t]\n}\n");
+		break;
+	}
+
+	return ferror(fp) ? -1 : 0;
+}
@@ -26,8 +26,11 @@
 RCSIDH(load_h, "$Id$")
 
 #include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/histogram.h>
 #include <freeradius-devel/util/talloc.h>
 
+#include <stdio.h>
+
 /** Load generation configuration.
  *
  *  The load generator runs a callback periodically in order to
@@ -68,6 +71,21 @@ RCSIDH(load_h, "$Id$")
  *  "duration" seconds, even if the maximum backlog is currently
  *  reached.  This increase has the effect of also increasing the
  *  maximum backlog.
+ *
+ *  At the end of each step, the generator stops sending until it has
+ *  received the replies to all of the packets sent during the step.
+ *  The round trip times are then charged to the rate which caused
+ *  them, and not to the next step.  Packets which have not had a
+ *  reply after "drain_timeout" are counted as lost, and the next step
+ *  starts anyway.  Replies to lost packets are ignored.
+ *
+ *  If "p99_limit" is set, the generator instead searches for the
+ *  highest rate at which the 99th percentile of the round trip time
+ *  stays below the limit.  It increases the rate by "step" until a
+ *  step fails, and then bisects between the highest passing rate and
+ *  the lowest failing rate, until the rate is known to within 1%.  A
+ *  step fails if its p99 is over the limit, if the backlog limit was
+ *  reached during the step, or if any packets were lost.
  */
 typedef struct {
 	uint32_t       	start_pps;	//!< start PPS
@@ -76,6 +94,8 @@ typedef struct {
 	uint32_t	step;		//!< how much to increase each load test by
 	uint32_t	parallel;	//!< how many packets in parallel to send
 	uint32_t	milliseconds;	//!< how many milliseconds of backlog to top out at
+	fr_time_delta_t	p99_limit;	//!< search for the max rate with p99 below this, 0 for "don't search".
+	fr_time_delta_t	drain_timeout;	//!< how long to wait for the replies to a step
 } fr_load_config_t;
 
 typedef struct {
@@ -88,13 +108,42 @@ typedef struct {
 	int       	pps_accepted;	//!< Accepted PPS for the last second
 	int		sent;		//!< total packets sent
 	int		received;      	//!< total packets received (should be == sent)
+	int		lost;		//!< total packets which never had a reply
 	int		skipped;	//!< we skipped sending this number of packets
 	int		backlog;	//!< current backlog
 	int		max_backlog;	//!< maximum backlog we saw during the test
 	bool		blocked;	//!< whether or not we're blocked
 	int		times[8];	//!< response time in microseconds to tens of seconds
+	fr_histogram_t	step_rtt;	//!< round trip times for the current step, in nanoseconds
+	uint32_t	sustained_pps;	//!< highest rate which met the p99 limit, when searching
 } fr_load_stats_t;
 
+/** Summary of one completed step
+ *
+ */
+typedef struct {
+	uint32_t	pps;		//!< offered packets/s
+	uint32_t	pps_accepted;	//!< replies/s during the step
+	uint64_t	sent;		//!< packets sent during the step
+	uint64_t	received;	//!< replies received during the step
+	uint64_t	lost;		//!< packets sent during the step which never had a reply
+	bool		blocked;	//!< whether the backlog limit was reached during the step
+	bool		passed;		//!< whether the step met the p99 limit
+	fr_time_delta_t	p50;		//!< round trip time percentiles
+	fr_time_delta_t	p90;
+	fr_time_delta_t	p99;
+	fr_time_delta_t	p999;
+	fr_time_delta_t	max;
+} fr_load_step_t;
+
+/** Formats for the final report
+ *
+ */
+typedef enum {
+	FR_LOAD_REPORT_CSV = 0,		//!< one line per step
+	FR_LOAD_REPORT_JSON		//!< object with an array of steps
+} fr_load_report_format_t;
+
 typedef struct fr_load_s fr_load_t;
 
 /** Whether or not the application should continue.
@@ -108,8 +157,10 @@ typedef enum {
 
 typedef int (*fr_load_callback_t)(fr_time_t now, void *uctx);
 
+typedef void (*fr_load_done_t)(void *uctx);
+
 fr_load_t *fr_load_generator_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_load_config_t *config,
-				    fr_load_callback_t callback, void *uctx) CC_HINT(nonnull(2,3,4));
+				    fr_load_callback_t callback, fr_load_done_t done, void *uctx) CC_HINT(nonnull(2,3,4));
 
 int fr_load_generator_start(fr_load_t *l) CC_HINT(nonnull);
 
@@ -120,3 +171,7 @@ fr_load_reply_t fr_load_generator_have_reply(fr_load_t *l, fr_time_t request_tim
 size_t fr_load_generator_stats_sprint(fr_load_t *l, fr_time_t now, char *buffer, size_t buflen);
 
 fr_load_stats_t const * fr_load_generator_stats(fr_load_t const *l) CC_HINT(nonnull);
+
+fr_load_step_t const *fr_load_generator_steps(fr_load_t const *l, size_t *num) CC_HINT(nonnull);
+
+int fr_load_generator_report(fr_load_t const *l, FILE *fp, fr_load_report_format_t format) CC_HINT(nonnull);
@@ -0,0 +1,493 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the load generator steps, rate search and report
+ *
+ * @file src/lib/io/load_tests.c
+ * @copyright 2026 The FreeRADIUS server project
+ */
+
+static void test_init(void);
+#  define TEST_INIT  test_init()
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/version.h>
+
+#include "load.c"
+
+/*
+ *	Replies per simulated step.
+ */
+#define TEST_STEP_PACKETS	(100)
+
+static TALLOC_CTX	*autofree;
+
+/*
+ *	The times of the packets the generator asked us to send.
+ */
+static fr_time_t	test_sent[1024];
+static size_t		test_num_sent;
+static bool		test_done_called;
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("load_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) goto error;
+}
+
+static int test_send(fr_time_t now, UNUSED void *uctx)
+{
+	if (test_num_sent < NUM_ELEMENTS(test_sent)) test_sent[test_num_sent++] = now;
+
+	return 0;
+}
+
+static void test_done(UNUSED void *uctx)
+{
+	test_done_called = true;
+}
+
+static fr_load_t *test_load_alloc(fr_load_config_t *config)
+{
+	fr_event_list_t	*el;
+	fr_load_t	*l;
+
+	MEM(el = fr_event_list_alloc(autofree, NULL, NULL));
+	MEM(l = fr_load_generator_create(el, el, config, test_send, test_done, NULL));
+
+	l->pps = config->start_pps;
+	test_num_sent = 0;
+	test_done_called = false;
+
+	return l;
+}
+
+/** Run one step without any I/O, and record it
+ *
+ * Rates up to "capacity" get replies well under the p99 limit, higher
+ * rates get replies over it.  Rates above "block_above" also hit the
+ * backlog limit.
+ */
+static void test_step_run(fr_load_t *l, uint32_t capacity, uint32_t block_above)
+{
+	fr_time_delta_t	rtt = fr_time_delta_from_msec((l->pps <= capacity) ? 1 : 20);
+	int		i;
+
+	for (i = 0; i < TEST_STEP_PACKETS; i++) fr_histogram_add(&l->stats.step_rtt, fr_time_delta_unwrap(rtt));
+
+	l->stats.sent += TEST_STEP_PACKETS;
+	l->stats.received += TEST_STEP_PACKETS;
+	l->step_blocked = (l->pps > block_above);
+
+	load_step_record(l, fr_time_add(l->step_start, fr_time_delta_from_sec(1)));
+	l->step_start = fr_time_add(l->step_start, fr_time_delta_from_sec(1));
+}
+
+/** Run steps until the generator says the test is done
+ *
+ * @return the number of steps run.
+ */
+static size_t test_steps_run(fr_load_t *l, uint32_t capacity, uint32_t block_above)
+{
+	do {
+		test_step_run(l, capacity, block_above);
+	} while (load_step_next(l) && (l->num_steps < 100));
+
+	return l->num_steps;
+}
+
+static void test_load_ramp(void)
+{
+	fr_load_config_t	config = {
+					.start_pps = 100,
+					.max_pps = 500,
+					.step = 100,
+				};
+	fr_load_t		*l = test_load_alloc(&config);
+	size_t			i;
+
+	TEST_CASE("Without a p99 limit, the rate ramps up to max_pps");
+	TEST_CHECK(test_steps_run(l, 200, UINT32_MAX) == 5);
+
+	for (i = 0; i < l->num_steps; i++) {
+		TEST_CHECK(l->steps[i].pps == (i + 1) * 100);
+		TEST_CHECK(l->steps[i].sent == TEST_STEP_PACKETS);
+		TEST_CHECK(l->steps[i].received == TEST_STEP_PACKETS);
+		TEST_CHECK(l->steps[i].pps_accepted == TEST_STEP_PACKETS);
+		TEST_CHECK(l->steps[i].passed);
+	}
+
+	TEST_CASE("Steps record their round trip times");
+	TEST_CHECK(fr_time_delta_to_msec(l->steps[0].p99) == 1);
+	TEST_CHECK(fr_time_delta_to_msec(l->steps[4].p99) == 20);
+	TEST_CHECK(fr_time_delta_to_msec(l->steps[4].max) == 20);
+
+	TEST_CASE("No sustained rate is reported");
+	TEST_CHECK(l->stats.sustained_pps == 0);
+}
+
+static void test_load_search(void)
+{
+	fr_load_config_t	config = {
+					.start_pps = 100,
+					.step = 100,
+					.p99_limit = fr_time_delta_from_msec(5),
+				};
+	fr_load_t		*l = test_load_alloc(&config);
+	size_t			i;
+
+	TEST_CASE("Ramp up until a step fails, then bisect");
+	TEST_CHECK(test_steps_run(l, 1234, UINT32_MAX) == 16);
+
+	for (i = 0; i < 12; i++) {
+		TEST_CHECK(l->steps[i].pps == (i + 1) * 100);
+		TEST_CHECK(l->steps[i].passed);
+	}
+	TEST_CHECK((l->steps[12].pps == 1300) && !l->steps[12].passed);
+	TEST_CHECK((l->steps[13].pps == 1250) && !l->steps[13].passed);
+	TEST_CHECK((l->steps[14].pps == 1225) && l->steps[14].passed);
+	TEST_CHECK((l->steps[15].pps == 1237) && !l->steps[15].passed);
+
+	TEST_CASE("The sustained rate is the highest passing rate, within 1% of the capacity");
+	TEST_CHECK(l->stats.sustained_pps == 1225);
+	TEST_MSG("sustained_pps = %u", l->stats.sustained_pps);
+	TEST_CHECK((1234 - l->stats.sustained_pps) <= (1234 / 100));
+}
+
+static void test_load_search_blocked(void)
+{
+	fr_load_config_t	config = {
+					.start_pps = 100,
+					.step = 100,
+					.p99_limit = fr_time_delta_from_msec(5),
+				};
+	fr_load_t		*l = test_load_alloc(&config);
+	size_t			i, num;
+
+	TEST_CASE("Steps which reach the backlog limit fail, even with a good p99");
+	num = test_steps_run(l, UINT32_MAX, 250);
+
+	for (i = 0; i < num; i++) {
+		TEST_CHECK(l->steps[i].blocked == (l->steps[i].pps > 250));
+		TEST_CHECK(l->steps[i].passed == !l->steps[i].blocked);
+	}
+	TEST_CHECK(l->stats.sustained_pps == 250);
+	TEST_MSG("sustained_pps = %u", l->stats.sustained_pps);
+
+	TEST_CASE("Steps without replies fail");
+	l->pps = 100;
+	l->stats.sent += TEST_STEP_PACKETS;
+	load_step_record(l, fr_time_add(l->step_start, fr_time_delta_from_sec(1)));
+	TEST_CHECK(l->steps[l->num_steps - 1].received == 0);
+	TEST_CHECK(!l->steps[l->num_steps - 1].passed);
+}
+
+/** Run the send timer until the current step is over
+ *
+ */
+static void test_step_send(fr_load_t *l)
+{
+	int i;
+
+	for (i = 0; (i < 100) && (l->state != FR_LOAD_STATE_STEP_DRAINING); i++) load_timer(l->el->tl, l->next, l);
+
+	TEST_CHECK(l->state == FR_LOAD_STATE_STEP_DRAINING);
+}
+
+static void test_load_drain(void)
+{
+	fr_load_config_t	config = {
+					.start_pps = 1000,
+					.max_pps = 2000,
+					.step = 1000,
+					.duration = fr_time_delta_from_msec(10),
+				};
+	fr_load_t		*l;
+	size_t			i, sent;
+
+	l = test_load_alloc(&config);
+
+	TEST_CASE("Sending stops at the end of a step, while replies are outstanding");
+	TEST_CHECK_RET(fr_load_generator_start(l), 0);
+	test_step_send(l);
+
+	sent = test_num_sent;
+	TEST_CHECK(sent > 1);
+	TEST_CHECK((size_t) l->stats.sent == sent);
+
+	load_timer(l->el->tl, l->next, l);
+	TEST_CHECK(test_num_sent == sent);
+	TEST_CHECK(l->num_steps == 0);
+
+	TEST_CASE("The step stays open until the last reply arrives");
+	for (i = 0; i < (sent - 1); i++) {
+		TEST_CHECK(fr_load_generator_have_reply(l, test_sent[i]) == FR_LOAD_CONTINUE);
+	}
+	TEST_CHECK(l->num_steps == 0);
+	TEST_CHECK(test_num_sent == sent);
+
+	TEST_CASE("The last reply closes the step, and starts the next one");
+	TEST_CHECK(fr_load_generator_have_reply(l, test_sent[sent - 1]) == FR_LOAD_CONTINUE);
+	TEST_CHECK(l->num_steps == 1);
+	TEST_CHECK(l->steps[0].pps == 1000);
+	TEST_CHECK(l->steps[0].sent == sent);
+	TEST_CHECK(l->steps[0].received == sent);
+
+	TEST_CHECK(l->state == FR_LOAD_STATE_SENDING);
+	TEST_CHECK(l->pps == 2000);
+	TEST_CHECK(test_num_sent == (sent + 1));
+	TEST_CHECK(l->stats.step_rtt.count == 0);
+
+	TEST_CASE("Replies to the last step end the test");
+	test_step_send(l);
+	for (i = sent; i < (test_num_sent - 1); i++) {
+		TEST_CHECK(fr_load_generator_have_reply(l, test_sent[i]) == FR_LOAD_CONTINUE);
+	}
+	TEST_CHECK(fr_load_generator_have_reply(l, test_sent[test_num_sent - 1]) == FR_LOAD_DONE);
+	TEST_CHECK(l->num_steps == 2);
+	TEST_CHECK(l->steps[1].pps == 2000);
+	TEST_CHECK(l->steps[1].sent == (test_num_sent - sent));
+	TEST_CHECK(l->steps[1].received == (test_num_sent - sent));
+	TEST_CHECK(l->steps[1].lost == 0);
+	TEST_CHECK(!test_done_called);
+}
+
+/** Fire the drain timer, as if none of the outstanding replies arrived in time
+ *
+ */
+static fr_time_t test_drain_timeout(fr_load_t *l)
+{
+	fr_time_t now = fr_time_add(l->step_end, l->config->drain_timeout);
+
+	TEST_CHECK(fr_timer_armed(l->ev));
+	load_drain_timeout(l->el->tl, now, l);
+
+	return now;
+}
+
+static void test_load_lost(void)
+{
+	fr_load_config_t	config = {
+					.start_pps = 1000,
+					.step = 1000,
+					.duration = fr_time_delta_from_msec(10),
+					.drain_timeout = fr_time_delta_from_msec(5),
+					.p99_limit = fr_time_delta_from_sec(1),
+				};
+	fr_load_t		*l;
+	size_t			i, sent;
+	int			received;
+
+	l = test_load_alloc(&config);
+
+	TEST_CASE("Some packets get no reply");
+	TEST_CHECK_RET(fr_load_generator_start(l), 0);
+	test_step_send(l);
+
+	sent = test_num_sent;
+	for (i = 0; i < (sent / 2); i++) {
+		TEST_CHECK(fr_load_generator_have_reply(l, test_sent[i]) == FR_LOAD_CONTINUE);
+	}
+	TEST_CHECK(l->num_steps == 0);
+
+	TEST_CASE("The drain timer counts them as lost, and starts the next step");
+	test_drain_timeout(l);
+	TEST_CHECK(l->num_steps == 1);
+	TEST_CHECK(l->steps[0].sent == sent);
+	TEST_CHECK(l->steps[0].received == (sent / 2));
+	TEST_CHECK(l->steps[0].lost == (sent - (sent / 2)));
+	TEST_CHECK(l->stats.lost == (int) (sent - (sent / 2)));
+	TEST_CHECK(l->stats.backlog == 0);
+
+	TEST_CASE("A step with lost packets fails, even with a good p99");
+	TEST_CHECK(!l->steps[0].passed);
+	TEST_CHECK(l->pps == 500);
+	TEST_CHECK(l->state == FR_LOAD_STATE_SENDING);
+	TEST_CHECK(test_num_sent == (sent + 1));
+	TEST_CHECK(!test_done_called);
+
+	TEST_CASE("Late replies to lost packets are ignored");
+	received = l->stats.received;
+	TEST_CHECK(fr_load_generator_have_reply(l, test_sent[sent - 1]) == FR_LOAD_CONTINUE);
+	TEST_CHECK(l->stats.received == received);
+	TEST_CHECK(l->stats.step_rtt.count == 0);
+}
+
+static void test_load_lost_last(void)
+{
+	fr_load_config_t	config = {
+					.start_pps = 1000,
+					.max_pps = 1000,
+					.step = 1000,
+					.duration = fr_time_delta_from_msec(10),
+					.drain_timeout = fr_time_delta_from_msec(5),
+				};
+	fr_load_t		*l;
+	fr_time_t		now;
+	size_t			sent;
+
+	l = test_load_alloc(&config);
+
+	TEST_CASE("No replies at all to the last step");
+	TEST_CHECK_RET(fr_load_generator_start(l), 0);
+	test_step_send(l);
+	sent = test_num_sent;
+
+	TEST_CASE("The drain timer ends the test, and tells the caller");
+	now = test_drain_timeout(l);
+	TEST_CHECK(test_done_called);
+	TEST_CHECK(fr_time_eq(l->stats.end, now));
+	TEST_CHECK(l->num_steps == 1);
+	TEST_CHECK(l->steps[0].received == 0);
+	TEST_CHECK(l->steps[0].lost == sent);
+	TEST_CHECK(test_num_sent == sent);
+
+	TEST_CASE("Late replies don't end the test a second time");
+	TEST_CHECK(fr_load_generator_have_reply(l, test_sent[0]) == FR_LOAD_CONTINUE);
+	TEST_CHECK(l->stats.received == 0);
+}
+
+static void test_load_done_timer(void)
+{
+	fr_load_config_t	config = {
+					.start_pps = 1000,
+					.max_pps = 1000,
+					.step = 1000,
+					.duration = fr_time_delta_from_msec(10),
+				};
+	fr_load_t		*l;
+	size_t			i;
+
+	l = test_load_alloc(&config);
+
+	TEST_CASE("Replies which all arrive before the step ends");
+	TEST_CHECK_RET(fr_load_generator_start(l), 0);
+	for (i = 0; (i < 100) && !test_done_called; i++) {
+		while (l->stats.received < l->stats.sent) {
+			TEST_CHECK(fr_load_generator_have_reply(l, test_sent[l->stats.received]) == FR_LOAD_CONTINUE);
+		}
+		load_timer(l->el->tl, l->next, l);
+	}
+
+	TEST_CASE("The send timer ends the test, and tells the caller");
+	TEST_CHECK(test_done_called);
+	TEST_CHECK(l->num_steps == 1);
+	TEST_CHECK(l->steps[0].received == l->steps[0].sent);
+	TEST_CHECK(l->steps[0].lost == 0);
+}
+
+/** Write a report, and return it as a string
+ *
+ */
+static char *test_report_print(fr_load_t const *l, fr_load_report_format_t format)
+{
+	char	buff[4096];
+	size_t	len;
+	FILE	*fp;
+
+	fp = tmpfile();
+	if (!TEST_CHECK(fp != NULL)) return NULL;
+
+	TEST_CHECK_RET(fr_load_generator_report(l, fp, format), 0);
+
+	rewind(fp);
+	len = fread(buff, 1, sizeof(buff) - 1, fp);
+	buff[len] = '\0';
+	fclose(fp);
+
+	return talloc_strdup(autofree, buff);
+}
+
+static void test_load_report(void)
+{
+	fr_load_config_t	config = {
+					.p99_limit = fr_time_delta_from_msec(10),
+				};
+	fr_load_t		*l = test_load_alloc(&config);
+
+	MEM(l->steps = talloc_array(l, fr_load_step_t, 2));
+	l->steps[0] = (fr_load_step_t) {
+		.pps = 100, .pps_accepted = 100, .sent = 1000, .received = 1000, .passed = true,
+		.p50 = fr_time_delta_from_usec(500), .p90 = fr_time_delta_from_usec(900),
+		.p99 = fr_time_delta_from_usec(990), .p999 = fr_time_delta_from_usec(999),
+		.max = fr_time_delta_from_usec(1200),
+	};
+	l->steps[1] = (fr_load_step_t) {
+		.pps = 200, .pps_accepted = 150, .sent = 2000, .received = 1500, .lost = 500, .blocked = true,
+		.p50 = fr_time_delta_from_usec(5000), .p90 = fr_time_delta_from_usec(9000),
+		.p99 = fr_time_delta_from_usec(20000), .p999 = fr_time_delta_from_usec(30000),
+		.max = fr_time_delta_from_usec(40000),
+	};
+	l->num_steps = 2;
+	l->stats.sustained_pps = 100;
+
+	TEST_CASE("CSV report");
+	TEST_CHECK_STRCMP(test_report_print(l, FR_LOAD_REPORT_CSV),
+			  "\"step\",\"pps\",\"pps_accepted\",\"sent\",\"received\",\"lost\",\"blocked\",\"passed\","
+			  "\"p50\",\"p90\",\"p99\",\"p99.9\",\"max\"\n"
+			  "1,100,100,1000,1000,0,0,1,500,900,990,999,1200\n"
+			  "2,200,150,2000,1500,500,1,0,5000,9000,20000,30000,40000\n");
+
+	TEST_CASE("JSON report");
+	TEST_CHECK_STRCMP(test_report_print(l, FR_LOAD_REPORT_JSON),
+			  "{\n"
+			  "\t\"p99_limit_us\": 10000,\n"
+			  "\t\"sustained_pps\": 100,\n"
+			  "\t\"steps\": [\n"
+			  "\t\t{ \"pps\": 100, \"pps_accepted\": 100, \"sent\": 1000, \"received\": 1000, "
+			  "\"lost\": 0, \"blocked\": false, \"passed\": true, \"p50_us\": 500, \"p90_us\": 900, \"p99_us\": 990, "
+			  "\"p99.9_us\": 999, \"max_us\": 1200 },\n"
+			  "\t\t{ \"pps\": 200, \"pps_accepted\": 150, \"sent\": 2000, \"received\": 1500, "
+			  "\"lost\": 500, \"blocked\": true, \"passed\": false, \"p50_us\": 5000, \"p90_us\": 9000, \"p99_us\": 20000, "
+			  "\"p99.9_us\": 30000, \"max_us\": 40000 }\n"
+			  "\t]\n"
+			  "}\n");
+
+	TEST_CASE("Without a p99 limit, there is no sustained rate");
+	config.p99_limit = fr_time_delta_wrap(0);
+	l->num_steps = 0;
+	TEST_CHECK_STRCMP(test_report_print(l, FR_LOAD_REPORT_JSON),
+			  "{\n"
+			  "\t\"p99_limit_us\": 0,\n"
+			  "\t\"steps\": [\n"
+			  "\t]\n"
+			  "}\n");
+}
+
+TEST_LIST = {
+	{ "load_ramp",			test_load_ramp },
+	{ "load_search",		test_load_search },
+	{ "load_search_blocked",	test_load_search_blocked },
+	{ "load_drain",			test_load_drain },
+	{ "load_lost",			test_load_lost },
+	{ "load_lost_last",		test_load_lost_last },
+	{ "load_done_timer",		test_load_done_timer },
+	{ "load_report",		test_load_report },
+
+	TEST_TERMINATOR
+};
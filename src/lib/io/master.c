@@ -1923,6 +1923,38 @@ have_client:
 	return 0;
 }
 
+/** Check if the child socket has packets which were read, but not yet returned
+ *
+ */
+static bool mod_read_pending(fr_listen_t *li)
+{
+	fr_io_instance_t const	*inst;
+	fr_io_connection_t	*connection;
+	fr_listen_t		*child;
+
+	get_inst(li, &inst, NULL, &connection, &child);
+
+	if (!inst->app_io->read_pending) return false;
+
+	return inst->app_io->read_pending(child);
+}
+
+/** Flush any packets which the child socket has queued
+ *
+ */
+static int mod_flush(fr_listen_t *li)
+{
+	fr_io_instance_t const	*inst;
+	fr_io_connection_t	*connection;
+	fr_listen_t		*child;
+
+	get_inst(li, &inst, NULL, &connection, &child);
+
+	if (!inst->app_io->flush) return 0;
+
+	return inst->app_io->flush(child);
+}
+
 /** Inject a packet to a connection.
  *
  *  Always called in the context of the network.
@@ -2982,7 +3014,7 @@ fr_trie_t *fr_master_io_network(TALLOC_CTX *ctx, int af, fr_ipaddr_t *allow, fr_
 	 *	And now check denied networks.
 	 */
 	num = talloc_array_length(deny);
-	if (!num) return trie;
+	if (!num) goto done;
 
 	/*
 	 *	Since the default is to deny, you can only add
@@ -3055,6 +3087,16 @@ fr_trie_t *fr_master_io_network(TALLOC_CTX *ctx, int af, fr_ipaddr_t *allow, fr_
 		deny[i].af = AF_UNSPEC;
 	}
 
+done:
+	/*
+	 *	The networks don't change, and are checked for every
+	 *	packet from an unknown client.
+	 */
+	if (fr_trie_freeze(trie) < 0) {
+		talloc_free(trie);
+		return NULL;
+	}
+
 	return trie;
 }
 
@@ -3067,25 +3109,25 @@ int fr_io_listen_free(fr_listen_t *li)
 	return 0;
 }
 
-int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
-			size_t default_message_size, size_t num_messages)
+/** Create one listener for the master IO handler, and add it to the scheduler
+ *
+ * @param[in] inst			the master IO instance.
+ * @param[in] sc			the scheduler to add the listener to.
+ * @param[in] default_message_size	for the message ring buffer.
+ * @param[in] num_messages		for the message ring buffer.
+ * @param[in] shard			which of the sockets bound to the same address this is.
+ * @param[in] num_shards		how many sockets are bound to the same address.
+ * @return
+ *	- <0 on error.
+ *	- 0 on success.
+ */
+static int master_io_listen_shard(fr_io_instance_t *inst, fr_schedule_t *sc,
+				  size_t default_message_size, size_t num_messages,
+				  uint32_t shard, uint32_t num_shards)
 {
 	fr_listen_t	*li, *child;
 	fr_io_thread_t	*thread;
 
-	/*
-	 *	No IO paths, so we don't initialize them.
-	 */
-	if (!inst->app_io) {
-		fr_assert(!inst->dynamic_clients);
-		return 0;
-	}
-
-	if (!inst->app_io->common.thread_inst_size) {
-		fr_strerror_const("IO modules MUST set 'thread_inst_size' when using the master IO handler.");
-		return -1;
-	}
-
 	/*
 	 *	Build the #fr_listen_t.  This describes the complete
 	 *	path data takes from the socket to the decoder and
@@ -3109,6 +3151,8 @@ int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
 	li->app = inst->app;
 	li->app_instance = inst->app_instance;
 	li->server_cs = inst->server_cs;
+	li->shard = shard;
+	li->num_shards = num_shards;
 
 	/*
 	 *	Set configurable parameters for message ring buffer.
@@ -3202,9 +3246,11 @@ int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
 	li->name = child->name;
 
 	/*
-	 *	Record which socket we opened.
+	 *	Record which socket we opened.  The other shards are
+	 *	bound to the same address as the first one, so we only
+	 *	check for conflicts with other listeners once.
 	 */
-	if (child->app_io_addr) {
+	if (child->app_io_addr && (shard == 0)) {
 		fr_listen_t *other;
 
 		other = listen_find_any(thread->child);
@@ -3233,6 +3279,43 @@ int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
 	return 0;
 }
 
+int fr_master_io_listen(fr_io_instance_t *inst, fr_schedule_t *sc,
+			size_t default_message_size, size_t num_messages)
+{
+	uint32_t	i, num_shards = 1;
+
+	/*
+	 *	No IO paths, so we don't initialize them.
+	 */
+	if (!inst->app_io) {
+		fr_assert(!inst->dynamic_clients);
+		return 0;
+	}
+
+	if (!inst->app_io->common.thread_inst_size) {
+		fr_strerror_const("IO modules MUST set 'thread_inst_size' when using the master IO handler.");
+		return -1;
+	}
+
+	/*
+	 *	The IO module may want to open multiple sockets bound
+	 *	to the same address.  Each socket gets its own
+	 *	listener, with its own client and duplicate detection
+	 *	tables, so that the listeners can be serviced by
+	 *	different network threads without any locking.
+	 */
+	if (inst->app_io->shards_get) {
+		num_shards = inst->app_io->shards_get(inst->app_io_instance);
+		if (!num_shards) num_shards = 1;
+	}
+
+	for (i = 0; i < num_shards; i++) {
+		if (master_io_listen_shard(inst, sc, default_message_size, num_messages, i, num_shards) < 0) return -1;
+	}
+
+	return 0;
+}
+
 /*
  *	Used to create a tracking structure for fr_network_sendto_worker()
  */
@@ -3288,7 +3371,9 @@ fr_app_io_t fr_master_app_io = {
 	.track_duplicates	= true,
 
 	.read			= mod_read,
+	.read_pending		= mod_read_pending,
 	.write			= mod_write,
+	.flush			= mod_flush,
 	.inject			= mod_inject,
 
 	.open			= mod_open,
@@ -55,6 +55,14 @@ typedef struct {
 	fr_time_t		recv_time;
 } fr_network_inject_t;
 
+/** Message sent to a network, to add a worker
+ *
+ */
+typedef struct {
+	fr_worker_t		*worker;		//!< the worker to add
+	bool			preferred;		//!< whether we prefer this worker
+} fr_network_worker_add_t;
+
 /** Associate a worker thread with a network thread
  *
  */
@@ -62,8 +70,11 @@ typedef struct {
 	fr_heap_index_t		heap_id;		//!< workers are in a heap
 	fr_time_delta_t		cpu_time;		//!< how much CPU time this worker has spent
 	fr_time_delta_t		predicted;		//!< predicted processing time for one packet
+	fr_time_delta_t		backlog;		//!< predicted processing time for the packets
+							///< we've sent, and not yet received replies for.
 
 	bool			blocked;		//!< is this worker blocked?
+	bool			preferred;		//!< do we prefer this worker, e.g. it's on the same NUMA node.
 
 	fr_channel_t		*channel;		//!< channel to the worker
 	fr_worker_t		*worker;		//!< worker pointer
@@ -93,6 +104,8 @@ typedef struct {
 
 	fr_channel_data_t	*pending;		//!< the currently pending partial packet
 	fr_heap_t		*waiting;		//!< packets waiting to be written
+	fr_dlist_t		flush_entry;		//!< in the list of sockets with queued writes
+	fr_time_delta_t		*predicted;		//!< predicted processing time for each packet type
 	fr_io_stats_t		stats;
 } fr_network_socket_t;
 
@@ -104,7 +117,10 @@ typedef struct {
  *	just update the predicted CPU time in place.
  *
  *	when we need to choose a worker, pick 2 at random, and then
- *	choose the one with the lowe cpu time.  For background, see
+ *	choose the one which we predict will finish its outstanding
+ *	requests first.  The prediction is based on the processing
+ *	time of each packet type received on each socket, so that
+ *	expensive packets are not piled onto one worker.  For background, see
  *	"Power of Two-Choices" and
  *	https://www.eecs.harvard.edu/~michaelm/postscripts/mythesis.pdf
  *	https://www.eecs.harvard.edu/~michaelm/postscripts/tpds2001.pdf
@@ -128,6 +144,7 @@ struct fr_network_s {
 	fr_event_list_t		*el;			//!< our event list
 
 	fr_heap_t		*replies;		//!< replies from the worker, ordered by priority / origin time
+	fr_dlist_head_t		flush;			//!< sockets which have queued writes
 
 	fr_io_stats_t		stats;
 
@@ -135,6 +152,8 @@ struct fr_network_s {
 	fr_rb_tree_t		*sockets_by_num;       	//!< ordered by number;
 
 	int			num_workers;		//!< number of active workers
+	int			num_preferred;		//!< number of preferred workers, which are
+							///< at the start of the workers array.
 	int			num_blocked;		//!< number of blocked workers
 	int			num_pending_workers;	//!< number of workers we're waiting to start.
 	int			max_workers;		//!< maximum number of allowed workers
@@ -301,10 +320,13 @@ int fr_network_directory_add(fr_network_t *nr, fr_listen_t *li)
  *
  * @param nr the network
  * @param worker the worker
+ * @param preferred whether the network should send packets to this
+ *	worker in preference to other workers.
  */
-int fr_network_worker_add(fr_network_t *nr, fr_worker_t *worker)
+int fr_network_worker_add(fr_network_t *nr, fr_worker_t *worker, bool preferred)
 {
 	fr_ring_buffer_t *rb;
+	fr_network_worker_add_t add = { .worker = worker, .preferred = preferred };
 
 	rb = fr_network_rb_init();
 	if (!rb) return -1;
@@ -312,7 +334,7 @@ int fr_network_worker_add(fr_network_t *nr, fr_worker_t *worker)
 	(void) talloc_get_type_abort(nr, fr_network_t);
 	(void) talloc_get_type_abort(worker, fr_worker_t);
 
-	return fr_control_message_send(nr->control, rb, FR_CONTROL_ID_WORKER, &worker, sizeof(worker));
+	return fr_control_message_send(nr->control, rb, FR_CONTROL_ID_WORKER, &add, sizeof(add));
 }
 
 static void fr_network_worker_started_callback(void *ctx, void const *data, size_t data_size, fr_time_t now);
@@ -324,7 +346,9 @@ static void fr_network_worker_started_callback(void *ctx, void const *data, size
  */
 void fr_network_worker_add_self(fr_network_t *nr, fr_worker_t *worker)
 {
-	fr_network_worker_started_callback(nr, &worker, sizeof(worker), fr_time_wrap(0));
+	fr_network_worker_add_t add = { .worker = worker };
+
+	fr_network_worker_started_callback(nr, &add, sizeof(add), fr_time_wrap(0));
 }
 
 
@@ -598,13 +622,17 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 				if (i == (nr->num_workers - 1)) break;
 
 				/*
-				 *	Close the hole...
+				 *	Close the hole, keeping the
+				 *	preferred workers at the start.
 				 */
-				memcpy(&nr->workers[i], &nr->workers[i + 1], ((nr->num_workers - i) - 1));
+				memmove(&nr->workers[i], &nr->workers[i + 1],
+					sizeof(nr->workers[0]) * ((nr->num_workers - i) - 1));
+				nr->workers[nr->num_workers - 1] = NULL;
 				break;
 			}
 		}
 		nr->num_workers--;
+		if (w->preferred) nr->num_preferred--;
 	}
 		break;
 	}
@@ -612,14 +640,89 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 
 #define OUTSTANDING(_x) ((_x)->stats.in - (_x)->stats.out)
 
+/** Predict how long a packet will take to process
+ *
+ * @param[in] s			the socket the packet was received on.
+ * @param[in] packet_type	of the packet.
+ * @return
+ *	- the predicted processing time.
+ *	- 0 if we haven't seen any replies for this packet type.
+ */
+static inline CC_HINT(always_inline) fr_time_delta_t fr_network_predicted(fr_network_socket_t const *s, uint8_t packet_type)
+{
+	if (!s->predicted) return fr_time_delta_wrap(0);
+
+	return s->predicted[packet_type];
+}
+
+/** Predict how long a worker will take to finish its outstanding requests
+ *
+ *  The requests we've sent to the worker are predicted by packet type.
+ *  The worker may also be running requests from other network threads.
+ *  Those are predicted from the worker's average processing time.
+ *
+ * @param[in] worker	to check.
+ * @return the predicted time.
+ */
+static fr_time_delta_t fr_network_worker_load(fr_network_worker_t const *worker)
+{
+	uint64_t	outstanding = OUTSTANDING(worker);
+	uint64_t	total = fr_worker_num_outstanding(worker->worker);
+
+	if (total <= outstanding) return worker->backlog;
+
+	return fr_time_delta_add(worker->backlog,
+				 fr_time_delta_wrap(fr_time_delta_unwrap(worker->predicted) * (total - outstanding)));
+}
+
+/** Update the predicted processing time when we get a reply from a worker
+ *
+ * @param[in] s	the socket the request was received on.
+ * @param[in] cd	the reply.
+ */
+static void fr_network_predicted_update(fr_network_socket_t *s, fr_channel_data_t *cd)
+{
+	fr_network_worker_t	*worker;
+	fr_time_delta_t		predicted;
+
+	if (!s->predicted) {
+		s->predicted = talloc_zero_array(s, fr_time_delta_t, UINT8_MAX + 1);
+		if (!s->predicted) return;
+	}
+
+	predicted = s->predicted[cd->packet_type];
+	if (!fr_time_delta_ispos(predicted)) {
+		predicted = cd->reply.processing_time;
+	} else {
+		predicted = RTT(predicted, cd->reply.processing_time);
+	}
+	s->predicted[cd->packet_type] = predicted;
+
+	/*
+	 *	The request is no longer in the worker's backlog.
+	 *	Remove the prediction we added when we sent it, not
+	 *	the updated one.
+	 */
+	worker = fr_channel_requestor_uctx_get(cd->channel.ch);
+	if (!worker) return;
+
+	if (!OUTSTANDING(worker) || fr_time_delta_lteq(worker->backlog, cd->predicted)) {
+		worker->backlog = fr_time_delta_wrap(0);
+	} else {
+		worker->backlog = fr_time_delta_sub(worker->backlog, cd->predicted);
+	}
+}
+
 /** Send a message on the "best" channel.
  *
  * @param nr the network
+ * @param s the socket the message was received on
  * @param cd the message we've received
  */
-static int fr_network_send_request(fr_network_t *nr, fr_channel_data_t *cd)
+static int fr_network_send_request(fr_network_t *nr, fr_network_socket_t *s, fr_channel_data_t *cd)
 {
 	fr_network_worker_t *worker;
+	fr_time_delta_t predicted;
 
 	(void) talloc_get_type_abort(nr, fr_network_t);
 
@@ -635,27 +738,36 @@ retry:
 		}
 
 	} else if (nr->num_blocked == 0) {
-		int64_t cmp;
-		uint32_t one, two;
+		fr_time_delta_t load_one, load_two;
+		uint32_t one, two, num;
 
-		one = fr_rand() % nr->num_workers;
+		/*
+		 *	If we have enough preferred workers, then only
+		 *	choose between them.  They're at the start of
+		 *	the array.
+		 */
+		num = (nr->num_preferred > 1) ? nr->num_preferred : nr->num_workers;
+
+	choose:
+		one = fr_rand() % num;
 		do {
-			two = fr_rand() % nr->num_workers;
+			two = fr_rand() % num;
 		} while (two == one);
 
 		/*
 		 *	Choose a worker based on minimizing the amount
 		 *	of future work it's being asked to do.
 		 *
-		 *	If both workers have the same number of
-		 *	outstanding requests, then choose the worker
-		 *	which has used the least total CPU time.
+		 *	If both workers are predicted to finish at the
+		 *	same time, then choose the worker which has
+		 *	used the least total CPU time.
 		 */
-		cmp = (OUTSTANDING(nr->workers[one]) - OUTSTANDING(nr->workers[two]));
-		if (cmp < 0) {
+		load_one = fr_network_worker_load(nr->workers[one]);
+		load_two = fr_network_worker_load(nr->workers[two]);
+		if (fr_time_delta_lt(load_one, load_two)) {
 			worker = nr->workers[one];
 
-		} else if (cmp > 0) {
+		} else if (fr_time_delta_gt(load_one, load_two)) {
 			worker = nr->workers[two];
 
 		} else if (fr_time_delta_lt(nr->workers[one]->cpu_time, nr->workers[two]->cpu_time)) {
@@ -664,9 +776,19 @@ retry:
 		} else {
 			worker = nr->workers[two];
 		}
+
+		/*
+		 *	The preferred workers are too busy, so we
+		 *	choose from all of the workers.
+		 */
+		if ((num < (uint32_t) nr->num_workers) && nr->config.max_outstanding &&
+		    (OUTSTANDING(worker) >= nr->config.max_outstanding)) {
+			num = nr->num_workers;
+			goto choose;
+		}
 	} else {
 		int i;
-		uint64_t min_outstanding = UINT64_MAX;
+		fr_time_delta_t min_load = fr_time_delta_max();
 		fr_network_worker_t *found = NULL;
 
 		/*
@@ -674,19 +796,19 @@ retry:
 		 *	with the least amount of future work to do.
 		 */
 		for (i = 0; i < nr->num_workers; i++) {
-			uint64_t outstanding;
+			fr_time_delta_t load;
 
 			worker = nr->workers[i];
 			if (worker->blocked) continue;
 
-			outstanding = OUTSTANDING(worker);
-			if ((outstanding < min_outstanding) || !found) {
+			load = fr_network_worker_load(worker);
+			if (fr_time_delta_lt(load, min_load) || !found) {
 				found = worker;
-				min_outstanding = outstanding;
+				min_load = load;
 
-			} else if (outstanding == min_outstanding) {
+			} else if (fr_time_delta_eq(load, min_load)) {
 				/*
-				 *	Queue lengths are the same.
+				 *	Predicted loads are the same.
 				 *	Choose this worker if it's
 				 *	less busy than the previous one we found.
 				 */
@@ -727,6 +849,16 @@ retry:
 		goto drop;
 	}
 
+	/*
+	 *	If we haven't seen this type of packet before, guess
+	 *	that it takes as long as an average packet.  The
+	 *	prediction is returned with the reply, so that we
+	 *	remove exactly what we add to the backlog.
+	 */
+	predicted = fr_network_predicted(s, cd->packet_type);
+	if (!fr_time_delta_ispos(predicted)) predicted = worker->predicted;
+	cd->predicted = predicted;
+
 	/*
 	 *	Send the message to the channel.  If we fail, drop the
 	 *	packet.  The only reason for failure is that the
@@ -759,6 +891,8 @@ retry:
 	 */
 	worker->cpu_time = fr_time_delta_add(worker->cpu_time, worker->predicted);
 
+	worker->backlog = fr_time_delta_add(worker->backlog, predicted);
+
 	return 0;
 }
 
@@ -795,12 +929,13 @@ int fr_network_listen_send_packet(fr_network_t *nr, fr_listen_t *parent, fr_list
 
 	cd->listen = parent;
 	cd->priority = PRIORITY_NORMAL;
+	cd->packet_type = 0;
 	cd->packet_ctx = packet_ctx;
 	cd->request.recv_time = recv_time;
 	memcpy(cd->m.data, buffer, buflen);
 	cd->m.when = fr_time();
 
-	if (fr_network_send_request(nr, cd) < 0) {
+	if (fr_network_send_request(nr, s, cd) < 0) {
 		talloc_free(cd->packet_ctx);
 		fr_message_done(&cd->m);
 		nr->stats.dropped++;
@@ -915,6 +1050,7 @@ next_message:
 	}
 
 	cd->priority = PRIORITY_NORMAL;
+	cd->packet_type = 0;
 
 	/*
 	 *	Read data from the network.
@@ -929,6 +1065,13 @@ next_message:
 	data_size = s->listen->app_io->read(s->listen, &cd->packet_ctx, &cd->request.recv_time,
 					    cd->m.data, cd->m.rb_size, &s->leftover);
 	if (data_size == 0) {
+		/*
+		 *	The app_io discarded a packet which it had
+		 *	read as part of a batch.  There may be more
+		 *	packets in the batch, so go get them.
+		 */
+		if (s->listen->app_io->read_pending && s->listen->app_io->read_pending(s->listen)) goto next_message;
+
 		/*
 		 *	Cache the message for later.  This is
 		 *	important for stream sockets, which can do
@@ -1017,7 +1160,11 @@ next_message:
 		cd->priority = priority;
 	}
 
-	if (fr_network_send_request(nr, cd) < 0) {
+	if (s->listen->app->packet_type) {
+		cd->packet_type = s->listen->app->packet_type(s->listen->app_instance, cd->m.data, data_size);
+	}
+
+	if (fr_network_send_request(nr, s, cd) < 0) {
 	discard:
 		talloc_free(cd->packet_ctx); /* not sure what else to do here */
 		fr_message_done(&cd->m);
@@ -1044,6 +1191,27 @@ next_message:
 		num_messages++;
 		goto next_message;
 	}
+
+	/*
+	 *	Datagram app_ios may read many packets from the kernel
+	 *	in one system call.  The socket won't be signalled as
+	 *	readable for the packets which have already been read,
+	 *	so we have to drain them now.
+	 *
+	 *	This loop is bounded by the size of the app_io's
+	 *	batch, as it only reads from the kernel again once
+	 *	the batch is empty.
+	 */
+	if (s->listen->app_io->read_pending && s->listen->app_io->read_pending(s->listen)) {
+		cd = (fr_channel_data_t *) fr_message_reserve(s->ms, s->listen->default_message_size);
+		if (!cd) {
+			ERROR("Failed allocating message size %zd! - Closing socket",
+			      s->listen->default_message_size);
+			fr_network_socket_dead(nr, s);
+			return;
+		}
+		goto next_message;
+	}
 }
 
 int fr_network_sendto_worker(fr_network_t *nr, fr_listen_t *li, void *packet_ctx, uint8_t const *data, size_t data_len, fr_time_t recv_time)
@@ -1060,6 +1228,7 @@ int fr_network_sendto_worker(fr_network_t *nr, fr_listen_t *li, void *packet_ctx
 	s->stats.in++;
 
 	cd->priority = PRIORITY_NORMAL;
+	cd->packet_type = 0;
 
 	cd->m.when = recv_time;
 	cd->listen = li;
@@ -1067,7 +1236,7 @@ int fr_network_sendto_worker(fr_network_t *nr, fr_listen_t *li, void *packet_ctx
 
 	memcpy(cd->m.data, data, data_len);
 
-	if (fr_network_send_request(nr, cd) < 0) {
+	if (fr_network_send_request(nr, s, cd) < 0) {
 		talloc_free(packet_ctx);
 		fr_message_done(&cd->m);
 		nr->stats.dropped++;
@@ -1257,6 +1426,15 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 			goto save_pending;
 		}
 
+		/*
+		 *	The transport may have queued the packet.
+		 *	Remember to flush it at the end of this event
+		 *	loop pass.
+		 */
+		if (li->app_io->flush && !fr_dlist_entry_in_list(&s->flush_entry)) {
+			fr_dlist_insert_tail(&nr->flush, s);
+		}
+
 	discard:
 		s->written = 0;
 
@@ -1273,6 +1451,24 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 		cd = fr_heap_pop(&s->waiting);
 	}
 
+	/*
+	 *	The socket isn't blocked, so there's no write callback
+	 *	to remove.  Any queued packets will be flushed at the
+	 *	end of this event loop pass.
+	 */
+	if (!s->blocked) return;
+
+	/*
+	 *	We were called because the socket is writable again.
+	 *	Write out anything the transport queued before it
+	 *	blocked.
+	 */
+	if (li->app_io->flush) {
+		if (fr_dlist_entry_in_list(&s->flush_entry)) fr_dlist_remove(&nr->flush, s);
+
+		if (li->app_io->flush(li) > 0) return;
+	}
+
 	/*
 	 *	We've successfully written all of the packets.  Remove
 	 *	the write callback.
@@ -1285,6 +1481,38 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 	s->blocked = false;
 }
 
+/** Write any packets the transport has queued, and wait for the socket to become writable if necessary
+ *
+ * @param nr the network
+ * @param s the network socket context.
+ */
+static void fr_network_flush(fr_network_t *nr, fr_network_socket_t *s)
+{
+	int rcode;
+
+	rcode = s->listen->app_io->flush(s->listen);
+	if (rcode == 0) return;
+
+	/*
+	 *	Errors are for individual packets, e.g. "no route to
+	 *	host".  They don't mean that the socket is dead.
+	 */
+	if (rcode < 0) {
+		RATE_LIMIT_GLOBAL(PERROR, "Failed writing to socket %s", s->listen->name);
+		return;
+	}
+
+	if (s->blocked) return;
+
+	if (fr_event_filter_update(nr->el, s->listen->fd, FR_EVENT_FILTER_IO, resume_write) < 0) {
+		PERROR("Failed adding write callback to event loop");
+		fr_network_socket_dead(nr, s);
+		return;
+	}
+
+	s->blocked = true;
+}
+
 static int _network_socket_free(fr_network_socket_t *s)
 {
 	fr_network_t *nr = s->nr;
@@ -1295,6 +1523,8 @@ static int _network_socket_free(fr_network_socket_t *s)
 	fr_rb_delete(nr->sockets, s);
 	fr_rb_delete(nr->sockets_by_num, s);
 
+	if (fr_dlist_entry_in_list(&s->flush_entry)) fr_dlist_remove(&nr->flush, s);
+
 	fr_event_fd_delete(nr->el, s->listen->fd, s->filter);
 
 	if (s->listen->app_io->close) {
@@ -1528,18 +1758,19 @@ static void fr_network_worker_started_callback(void *ctx, void const *data, size
 {
 	int i;
 	fr_network_t *nr = ctx;
-	fr_worker_t *worker;
+	fr_network_worker_add_t add;
 	fr_network_worker_t *w;
 
-	fr_assert(data_size == sizeof(worker));
+	fr_assert(data_size == sizeof(add));
 
-	memcpy(&worker, data, data_size);
-	(void) talloc_get_type_abort(worker, fr_worker_t);
+	memcpy(&add, data, data_size);
+	(void) talloc_get_type_abort(add.worker, fr_worker_t);
 
 	MEM(w = talloc_zero(nr, fr_network_worker_t));
 
-	w->worker = worker;
-	w->channel = fr_worker_channel_create(worker, w, nr->control);
+	w->worker = add.worker;
+	w->preferred = add.preferred;
+	w->channel = fr_worker_channel_create(w->worker, w, nr->control);
 	w->predicted = fr_time_delta_from_msec(10);
 	fr_fatal_assert_msg(w->channel, "Failed creating new channel");
 
@@ -1555,12 +1786,18 @@ static void fr_network_worker_started_callback(void *ctx, void const *data, size
 	nr->num_workers++;
 
 	/*
-	 *	Insert the worker into the array of workers.
+	 *	Insert the worker into the array of workers.  The
+	 *	preferred workers are kept at the start of the array.
 	 */
 	for (i = 0; i < nr->max_workers; i++) {
 		if (nr->workers[i]) continue;
 
-		nr->workers[i] = w;
+		if (w->preferred) {
+			nr->workers[i] = nr->workers[nr->num_preferred];
+			nr->workers[nr->num_preferred++] = w;
+		} else {
+			nr->workers[i] = w;
+		}
 		return;
 	}
 
@@ -1631,6 +1868,7 @@ static int fr_network_pre_event(UNUSED fr_time_t now, UNUSED fr_time_delta_t wak
 static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
 {
 	fr_channel_data_t *cd;
+	fr_network_socket_t *s;
 	fr_network_t *nr = talloc_get_type_abort(uctx, fr_network_t);
 
 	/*
@@ -1639,7 +1877,6 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t n
 	 */
 	while ((cd = fr_heap_pop(&nr->replies)) != NULL) {
 		fr_listen_t *li;
-		fr_network_socket_t *s;
 
 		li = cd->listen;
 
@@ -1660,6 +1897,8 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t n
 		if (cd->m.status != FR_MESSAGE_LOCALIZED) {
 			fr_assert(s->outstanding > 0);
 			s->outstanding--;
+
+			fr_network_predicted_update(s, cd);
 		}
 
 		/*
@@ -1692,11 +1931,18 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t n
 		 *	waiting for IO write to become ready.
 		 */
 		if (!s->pending) {
-			fr_assert(!s->blocked);
 			(void) fr_heap_insert(&s->waiting, cd);
 			fr_network_write(nr->el, s->listen->fd, 0, s);
 		}
 	}
+
+	/*
+	 *	Write out the packets which the transports queued
+	 *	during this pass.
+	 */
+	while ((s = fr_dlist_pop_head(&nr->flush)) != NULL) {
+		fr_network_flush(nr, s);
+	}
 }
 
 /** Stop a network thread in an orderly way
@@ -2007,6 +2253,8 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const
 		goto fail2;
 	}
 
+	fr_dlist_init(&nr->flush, fr_network_socket_t, flush_entry);
+
 	if (fr_event_pre_insert(nr->el, fr_network_pre_event, nr) < 0) {
 		fr_strerror_const("Failed adding pre-check to event list");
 		goto fail2;
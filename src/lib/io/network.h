@@ -52,7 +52,7 @@ int		fr_network_listen_delete(fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull
 
 int		fr_network_directory_add(fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull) CC_HINT(warn_unused_result);
 
-int		fr_network_worker_add(fr_network_t *nr, fr_worker_t *worker) CC_HINT(nonnull) CC_HINT(warn_unused_result);
+int		fr_network_worker_add(fr_network_t *nr, fr_worker_t *worker, bool preferred) CC_HINT(nonnull) CC_HINT(warn_unused_result);
 
 void		fr_network_worker_add_self(fr_network_t *nr, fr_worker_t *worker) CC_HINT(nonnull);
 
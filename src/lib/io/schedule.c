@@ -28,8 +28,10 @@ RCSID("$Id$")
 
 #include <freeradius-devel/autoconf.h>
 
+#include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/io/schedule.h>
 #include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hw.h>
 #include <freeradius-devel/util/rb.h>
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/server/trigger.h>
@@ -93,6 +95,8 @@ typedef struct {
 
 	fr_schedule_t	*sc;			//!< the scheduler we are running under
 
+	int		numa_node;		//!< NUMA node this worker runs on, or -1 if unknown.
+
 	fr_schedule_child_status_t status;	//!< status of the worker
 	fr_worker_t	*worker;		//!< the worker data structure
 } fr_schedule_worker_t;
@@ -112,6 +116,8 @@ typedef struct {
 
 	fr_schedule_t	*sc;			//!< the scheduler we are running under
 
+	int		numa_node;		//!< NUMA node this network runs on, or -1 if unknown.
+
 	fr_schedule_child_status_t status;	//!< status of the worker
 	fr_network_t	*nr;			//!< the receive data structure
 
@@ -146,6 +152,15 @@ struct fr_schedule_s {
 
 	fr_network_t	*single_network;	//!< for single-threaded mode
 	fr_worker_t	*single_worker;		//!< for single-threaded mode
+
+	uint32_t	*network_cpus;		//!< CPUs to pin network threads to.
+	int		num_network_cpus;	//!< number of entries in network_cpus.
+	uint32_t	*worker_cpus;		//!< CPUs to pin worker threads to.
+	int		num_worker_cpus;	//!< number of entries in worker_cpus.
+	uint32_t	*numa_cpus;		//!< CPUs on the configured NUMA node.
+	int		num_numa_cpus;		//!< number of entries in numa_cpus.
+
+	fr_worker_steal_t *steal;		//!< lets idle workers take requests from busy ones.
 };
 
 static _Thread_local int worker_id;		//!< Internal ID of the current worker thread.
@@ -159,6 +174,77 @@ int fr_schedule_worker_id(void)
 	return worker_id;
 }
 
+/** Set the CPU affinity of the current thread
+ *
+ *  Threads with a list of CPUs are pinned to one CPU from the list.
+ *  Otherwise, if a NUMA node was configured, threads are allowed to
+ *  run on any CPU on that node.
+ *
+ *  This function should be called before the thread allocates any
+ *  memory.  The OS then allocates that memory on the NUMA node which
+ *  is local to the thread.
+ *
+ * @param[in] sc	the scheduler.
+ * @param[in] name	of the thread, for logging.
+ * @param[in] cpus	to pin the thread to.  Thread "id" runs on cpus[id % num_cpus].
+ * @param[in] num_cpus	the number of CPUs in the list.
+ * @param[in] id	of the thread.
+ * @return
+ *	- The NUMA node the thread runs on.
+ *	- -1 if the NUMA node is unknown.
+ */
+static int fr_schedule_thread_affinity_set(fr_schedule_t *sc, char const *name,
+					   uint32_t const *cpus, int num_cpus, unsigned int id)
+{
+#ifdef __linux__
+	cpu_set_t	set;
+	int		ret, node;
+
+	CPU_ZERO(&set);
+
+	if (num_cpus > 0) {
+		uint32_t cpu = cpus[id % num_cpus];
+
+		if (cpu >= CPU_SETSIZE) {
+			WARN("%s - Cannot run on CPU %u, the maximum is %u", name, cpu, CPU_SETSIZE - 1);
+			return -1;
+		}
+
+		CPU_SET(cpu, &set);
+		node = fr_hw_cpu_numa_node(cpu);
+
+		DEBUG("%s - Running on CPU %u", name, cpu);
+
+	} else if (sc->num_numa_cpus > 0) {
+		int i;
+
+		for (i = 0; i < sc->num_numa_cpus; i++) {
+			if (sc->numa_cpus[i] < CPU_SETSIZE) CPU_SET(sc->numa_cpus[i], &set);
+		}
+		node = sc->config->numa_node;
+
+		DEBUG("%s - Running on NUMA node %u", name, sc->config->numa_node);
+
+	} else {
+		return -1;
+	}
+
+	ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (ret != 0) {
+		WARN("%s - Failed setting CPU affinity: %s", name, fr_syserror(ret));
+		return -1;
+	}
+
+	return node;
+#else
+	if ((num_cpus > 0) || (sc->num_numa_cpus > 0)) {
+		WARN("%s - Setting CPU affinity is not supported on this system", name);
+	}
+
+	return -1;
+#endif
+}
+
 /** Entry point for worker threads
  *
  * @param[in] arg	the fr_schedule_worker_t
@@ -204,6 +290,8 @@ static void *fr_schedule_worker_thread(void *arg)
 
 	snprintf(worker_name, sizeof(worker_name), "Worker %d", sw->id);
 
+	sw->numa_node = fr_schedule_thread_affinity_set(sc, worker_name, sc->worker_cpus, sc->num_worker_cpus, sw->id);
+
 	sw->ctx = ctx = talloc_init("%s", worker_name);
 	if (!ctx) {
 		ERROR("%s - Failed allocating memory", worker_name);
@@ -225,6 +313,11 @@ static void *fr_schedule_worker_thread(void *arg)
 		goto fail;
 	}
 
+	if (sc->steal && (fr_worker_steal_add(sw->worker, sc->steal, sw->id) < 0)) {
+		PERROR("%s - Failed enabling work stealing", worker_name);
+		goto fail;
+	}
+
 	/*
 	 *	@todo make this a registry
 	 */
@@ -246,12 +339,17 @@ static void *fr_schedule_worker_thread(void *arg)
 	sw->status = FR_CHILD_RUNNING;
 
 	/*
-	 *	Add this worker to all network threads.
+	 *	Add this worker to all network threads.  Network
+	 *	threads prefer workers which are on the same NUMA
+	 *	node, so that the channels between them don't cross
+	 *	NUMA nodes.
 	 */
 	for (sn = fr_dlist_head(&sc->networks);
 	     sn != NULL;
 	     sn = fr_dlist_next(&sc->networks, sn)) {
-		if (unlikely(fr_network_worker_add(sn->nr, sw->worker) < 0)) {
+		bool preferred = (sw->numa_node >= 0) && (sw->numa_node == sn->numa_node);
+
+		if (unlikely(fr_network_worker_add(sn->nr, sw->worker, preferred) < 0)) {
 			PERROR("%s - Failed adding worker to network %u", worker_name, sn->id);
 			goto fail;	/* FIXME - Should maybe try to undo partial adds? */
 		}
@@ -355,6 +453,8 @@ static void *fr_schedule_network_thread(void *arg)
 
 	INFO("%s - Starting", network_name);
 
+	sn->numa_node = fr_schedule_thread_affinity_set(sc, network_name, sc->network_cpus, sc->num_network_cpus, sn->id);
+
 	sn->ctx = ctx = talloc_init("%s", network_name);
 	if (!ctx) {
 		ERROR("%s - Failed allocating memory", network_name);
@@ -581,6 +681,36 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		if (sc->config->max_workers > 64) sc->config->max_workers = 64;
 	}
 
+	/*
+	 *	Parse the CPU affinity configuration.
+	 */
+	if (sc->config->network_cpus) {
+		sc->num_network_cpus = fr_hw_cpu_list_parse(sc, &sc->network_cpus, sc->config->network_cpus);
+		if (sc->num_network_cpus < 0) {
+			PERROR("Failed parsing 'network_cpus'");
+			talloc_free(sc);
+			return NULL;
+		}
+	}
+
+	if (sc->config->worker_cpus) {
+		sc->num_worker_cpus = fr_hw_cpu_list_parse(sc, &sc->worker_cpus, sc->config->worker_cpus);
+		if (sc->num_worker_cpus < 0) {
+			PERROR("Failed parsing 'worker_cpus'");
+			talloc_free(sc);
+			return NULL;
+		}
+	}
+
+	if (sc->config->numa_node_is_set) {
+		sc->num_numa_cpus = fr_hw_numa_node_cpus(sc, &sc->numa_cpus, sc->config->numa_node);
+		if (sc->num_numa_cpus < 0) {
+			PERROR("Failed getting CPUs for 'numa_node'");
+			talloc_free(sc);
+			return NULL;
+		}
+	}
+
 	/*
 	 *	Create the lists which hold the workers and networks.
 	 */
@@ -660,6 +790,19 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		return NULL;
 	}
 
+	/*
+	 *	Idle workers can take new requests from busy ones.
+	 *	This has to be set up before any worker starts.
+	 */
+	if (sc->config->worker.steal_threshold && (sc->config->max_workers > 1)) {
+		sc->steal = fr_worker_steal_alloc(sc, sc->config->max_workers);
+		if (!sc->steal) {
+			PERROR("Failed setting up work stealing");
+			fr_schedule_destroy(&sc);
+			return NULL;
+		}
+	}
+
 	/*
 	 *	Create all of the workers.
 	 */
@@ -882,6 +1025,10 @@ done:
 }
 
 /** Add a fr_listen_t to a scheduler.
+ *
+ *  Listeners which share an address (see fr_listen_t.shard) are
+ *  spread across the network threads.  All other listeners are added
+ *  to the first network thread.
  *
  * @param[in] sc the scheduler
  * @param[in] li the ctx and callbacks for the transport.
@@ -899,12 +1046,16 @@ fr_network_t *fr_schedule_listen_add(fr_schedule_t *sc, fr_listen_t *li)
 		nr = sc->single_network;
 	} else {
 		fr_schedule_network_t *sn;
+		unsigned int i;
 
 		/*
 		 *	@todo - round robin it among the listeners?
 		 *	or maybe add it to the same parent thread?
 		 */
 		sn = fr_dlist_head(&sc->networks);
+		for (i = li->shard % fr_dlist_num_elements(&sc->networks); i > 0; i--) {
+			sn = fr_dlist_next(&sc->networks, sn);
+		}
 		nr = sn->nr;
 	}
 
@@ -64,6 +64,11 @@ typedef struct {
 	uint32_t	max_networks;		//!< number of network threads
 	uint32_t	max_workers;		//!< number of network threads
 
+	char const	*network_cpus;		//!< CPUs to pin network threads to.
+	char const	*worker_cpus;		//!< CPUs to pin worker threads to.
+	uint32_t	numa_node;		//!< NUMA node to run threads on, if they're not pinned to a CPU.
+	bool		numa_node_is_set;	//!< Whether we were provided with a NUMA node.
+
 	fr_worker_config_t worker;		//!< configuration for each worker
 	fr_network_config_t network;		//!< configuration for each network;
 
@@ -61,12 +61,15 @@ RCSID("$Id$")
 #include <freeradius-devel/server/request.h>
 #include <freeradius-devel/server/time_tracking.h>
 #include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/math.h>
 #include <freeradius-devel/util/minmax_heap.h>
 #include <freeradius-devel/util/slab.h>
 #include <freeradius-devel/util/time.h>
 #include <freeradius-devel/util/timer.h>
 
+#include <sched.h>
 #include <stdalign.h>
+#include <unistd.h>
 
 #ifdef WITH_VERIFY_PTR
 static void worker_verify(fr_worker_t *worker);
@@ -93,6 +96,46 @@ typedef struct {
 	fr_dlist_head_t		dlist;
 } fr_worker_channel_t;
 
+#define WORKER_STEAL_QUEUE_SIZE	(1024)
+
+/** Requests which one worker has made available to the other workers
+ *
+ */
+typedef struct {
+	atomic_bool		active;		//!< the worker is running, and other workers may take requests.
+	fr_atomic_queue_t	*queue;		//!< of fr_channel_data_t which haven't been decoded.
+	fr_control_t		*control;	//!< control plane of the worker.
+
+	_Atomic(uint32_t)	refs;		//!< other workers which are looking at this slot.
+	_Atomic(uint32_t)	num_stolen;	//!< requests taken by other workers, and not yet replied to.
+} fr_worker_steal_slot_t;
+
+struct fr_worker_steal_s {
+	uint32_t		num_workers;	//!< number of slots.
+	_Atomic(uint64_t)	idle;		//!< bitmap of workers which are waiting for events.
+	fr_worker_steal_slot_t	slot[];		//!< one for each worker.
+};
+
+/** The reply to a stolen request
+ *
+ *  The worker which ran the request encodes the reply.  The worker
+ *  which owns the channel then sends it to the network thread.
+ */
+typedef struct {
+	fr_channel_t		*ch;		//!< the request was received on.
+	fr_listen_t		*listen;	//!< the request was received on.
+	void			*packet_ctx;	//!< from the original request.
+	uint8_t			packet_type;	//!< from the original request.
+	fr_time_delta_t		predicted;	//!< from the original request.
+
+	fr_time_t		request_time;	//!< when the network thread received the request.
+	fr_time_delta_t		processing_time; //!< time spent running the request.
+	fr_time_delta_t		cpu_time;	//!< total CPU time of the worker which ran the request.
+
+	size_t			data_size;	//!< of the encoded reply.  0 if there is no reply.
+	uint8_t			data[];		//!< the encoded reply.
+} fr_worker_steal_reply_t;
+
 /**
  *  A worker which takes packets from a master, and processes them.
  */
@@ -132,6 +175,7 @@ struct fr_worker_s {
 
 	uint64_t    		num_naks;	//!< number of messages which were nak'd
 	uint64_t    		num_active;	//!< number of active requests
+	_Atomic(uint32_t)	num_outstanding; //!< copy of num_active, which other threads can read.
 
 	fr_time_delta_t		predicted;	//!< How long we predict a request will take to execute.
 	fr_time_tracking_t	tracking;	//!< how much time the worker has spent doing things.
@@ -142,6 +186,10 @@ struct fr_worker_s {
 	fr_worker_channel_t	*channel;	//!< list of channels
 
 	request_slab_list_t	*slab;		//!< slab allocator for request_t
+
+	fr_worker_steal_t	*steal;		//!< requests shared with other workers
+	uint32_t		steal_id;	//!< our slot in the steal structure
+	uint64_t		num_stolen;	//!< number of requests we took from other workers
 };
 
 typedef struct {
@@ -201,8 +249,11 @@ static inline bool is_worker_thread(fr_worker_t const *worker)
 	return (pthread_equal(pthread_self(), worker->thread_id) != 0);
 }
 
-static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now);
+static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, int owner, fr_time_t now);
 static void worker_send_reply(fr_worker_t *worker, request_t *request, bool do_not_respond, fr_time_t now);
+static bool worker_steal_push(fr_worker_t *worker, fr_channel_data_t *cd);
+static void worker_steal_drain(fr_worker_t *worker, fr_time_t now);
+static void worker_steal_nak(fr_worker_t *worker, fr_channel_data_t *cd, uint32_t owner);
 
 /** Callback which handles a message being received on the worker side.
  *
@@ -217,7 +268,13 @@ static void worker_recv_request(void *ctx, fr_channel_t *ch, fr_channel_data_t *
 	worker->stats.in++;
 	DEBUG3("Received request %" PRIu64 "", worker->stats.in);
 	cd->channel.ch = ch;
-	worker_request_bootstrap(worker, cd, fr_time());
+
+	/*
+	 *	We're busy, let an idle worker have it.
+	 */
+	if (worker->steal && worker_steal_push(worker, cd)) return;
+
+	worker_request_bootstrap(worker, cd, -1, fr_time());
 }
 
 static void worker_requests_cancel(fr_worker_channel_t *ch)
@@ -326,6 +383,12 @@ static void worker_channel_callback(void *ctx, void const *data, size_t data_siz
 
 		ok = false;
 
+		/*
+		 *	Take back any requests which we had queued
+		 *	for other workers.
+		 */
+		if (worker->steal) worker_steal_drain(worker, now);
+
 		/*
 		 *	Locate the signalling channel in the list
 		 *	of channels.
@@ -415,9 +478,10 @@ static void worker_listen_cancel_callback(void *ctx, void const *data, NDEBUG_UN
  *
  * @param[in] worker	the worker
  * @param[in] cd	the message to NAK
+ * @param[in] owner	the worker which received the message, or -1 for this worker.
  * @param[in] now	when the message is NAKd
  */
-static void worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now)
+static void worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, int owner, fr_time_t now)
 {
 	size_t			size;
 	fr_channel_data_t	*reply;
@@ -427,6 +491,11 @@ static void worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now
 
 	worker->num_naks++;
 
+	if (owner >= 0) {
+		worker_steal_nak(worker, cd, owner);
+		return;
+	}
+
 	/*
 	 *	Cache the outbound channel.  We'll need it later.
 	 */
@@ -479,6 +548,8 @@ static void worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now
 
 	reply->listen = cd->listen;
 	reply->packet_ctx = cd->packet_ctx;
+	reply->packet_type = cd->packet_type;
+	reply->predicted = cd->predicted;
 
 	/*
 	 *	Mark the original message as done.
@@ -597,6 +668,7 @@ static int worker_request_time_tracking_start(fr_worker_t *worker, request_t *re
 	fr_time_tracking_start(&worker->tracking, &request->async->tracking, now);
 	fr_time_tracking_yield(&request->async->tracking, now);
 	worker->num_active++;
+	atomic_store_explicit(&worker->num_outstanding, worker->num_active, memory_order_relaxed);
 
 	fr_assert(!fr_heap_entry_inserted(request->runnable));
 	(void) fr_heap_insert(&worker->runnable, request);
@@ -610,10 +682,38 @@ static void worker_request_time_tracking_end(fr_worker_t *worker, request_t *req
 	fr_time_tracking_end(&worker->predicted, &request->async->tracking, now);
 	fr_assert(worker->num_active > 0);
 	worker->num_active--;
+	atomic_store_explicit(&worker->num_outstanding, worker->num_active, memory_order_relaxed);
 
 	TALLOC_FREE(request->timeout);	/* Disarm the reques timer */
 }
 
+/** Encode a reply packet
+ *
+ * @param[in] request	to encode the reply for.
+ * @param[out] buffer	to write the packet to.
+ * @param[in] buffer_len	length of the buffer.
+ * @return the length of the packet.  Encoding errors produce a one byte packet.
+ */
+static size_t worker_reply_encode(request_t *request, uint8_t *buffer, size_t buffer_len)
+{
+	ssize_t			slen = 0;
+	fr_listen_t const	*listen = request->async->listen;
+
+	if (listen->app_io->encode) {
+		slen = listen->app_io->encode(listen->app_io_instance, request, buffer, buffer_len);
+	} else if (listen->app->encode) {
+		slen = listen->app->encode(listen->app_instance, request, buffer, buffer_len);
+	}
+	if (slen < 0) {
+		RPERROR("Failed encoding request");
+		*buffer = 0;
+		slen = 1;
+	}
+
+	fr_assert((size_t) slen <= buffer_len);
+	return slen;
+}
+
 /** Send a response packet to the network side
  *
  * @param[in] worker		This worker.
@@ -667,29 +767,12 @@ static void worker_send_reply(fr_worker_t *worker, request_t *request, bool send
 	 *	Encode it, if required.
 	 */
 	if (send_reply) {
-		ssize_t slen = 0;
-		fr_listen_t const *listen = request->async->listen;
-
-		if (listen->app_io->encode) {
-			slen = listen->app_io->encode(listen->app_io_instance, request,
-						      reply->m.data, reply->m.rb_size);
-		} else if (listen->app->encode) {
-			slen = listen->app->encode(listen->app_instance, request,
-						   reply->m.data, reply->m.rb_size);
-		}
-		if (slen < 0) {
-			RPERROR("Failed encoding request");
-			*reply->m.data = 0;
-			slen = 1;
-		}
-
 		/*
 		 *	Shrink the buffer to the actual packet size.
 		 *
 		 *	This will ALWAYS return the same message as we put in.
 		 */
-		fr_assert((size_t) slen <= reply->m.rb_size);
-		(void) fr_message_alloc(ms, &reply->m, slen);
+		(void) fr_message_alloc(ms, &reply->m, worker_reply_encode(request, reply->m.data, reply->m.rb_size));
 	}
 
 	/*
@@ -704,6 +787,8 @@ static void worker_send_reply(fr_worker_t *worker, request_t *request, bool send
 
 	reply->listen = request->async->listen;
 	reply->packet_ctx = request->async->packet_ctx;
+	reply->packet_type = request->async->packet_type;
+	reply->predicted = request->async->predicted;
 
 	/*
 	 *	Update the various timers.
@@ -742,6 +827,426 @@ static void worker_send_reply(fr_worker_t *worker, request_t *request, bool send
 #endif
 }
 
+/** Take a reference to a slot in the steal structure
+ *
+ *  The worker which owns the slot does not exit while other
+ *  workers hold references to it.
+ *
+ * @param[in] slot	to reference.
+ * @return
+ *	- true if the owner is running.  The slot must be released with worker_steal_slot_release().
+ *	- false if the owner is exiting.
+ */
+static bool worker_steal_slot_get(fr_worker_steal_slot_t *slot)
+{
+	atomic_fetch_add(&slot->refs, 1);
+	if (atomic_load(&slot->active)) return true;
+
+	atomic_fetch_sub(&slot->refs, 1);
+	return false;
+}
+
+static inline CC_HINT(always_inline) void worker_steal_slot_release(fr_worker_steal_slot_t *slot)
+{
+	atomic_fetch_sub(&slot->refs, 1);
+}
+
+/** Wake up one idle worker, so that it takes requests from our queue
+ *
+ * @param[in] worker	the busy worker.
+ */
+static void worker_steal_wake(fr_worker_t *worker)
+{
+	fr_worker_steal_t	*steal = worker->steal;
+	uint64_t		idle;
+
+	idle = atomic_load(&steal->idle) & ~((uint64_t) 1 << worker->steal_id);
+	while (idle) {
+		uint32_t		id = fr_low_bit_pos(idle) - 1;
+		uint64_t		bit = (uint64_t) 1 << id;
+		fr_worker_steal_slot_t	*slot = &steal->slot[id];
+		fr_ring_buffer_t	*rb;
+
+		idle &= ~bit;
+
+		/*
+		 *	Another worker woke it up first.
+		 */
+		if (!(atomic_fetch_and(&steal->idle, ~bit) & bit)) continue;
+
+		if (!worker_steal_slot_get(slot)) continue;
+
+		rb = fr_worker_rb_init();
+		if (rb) (void) fr_control_message_send(slot->control, rb, FR_CONTROL_ID_STEAL_WAKE,
+						     &worker->steal_id, sizeof(worker->steal_id));
+		worker_steal_slot_release(slot);
+		return;
+	}
+}
+
+/** Make a new request available to other workers
+ *
+ *  Only requests which haven't been decoded can move between workers.
+ *  Once decoded, a request is tied to the interpreter, timers and
+ *  memory of the worker which decoded it.
+ *
+ * @param[in] worker	the worker which received the request.
+ * @param[in] cd	the request.
+ * @return
+ *	- true if the request was queued for other workers.
+ *	- false if the caller should run the request.
+ */
+static bool worker_steal_push(fr_worker_t *worker, fr_channel_data_t *cd)
+{
+	if (fr_heap_num_elements(worker->runnable) < worker->config.steal_threshold) return false;
+
+	if (!fr_atomic_queue_push(worker->steal->slot[worker->steal_id].queue, cd)) return false;
+
+	worker_steal_wake(worker);
+	return true;
+}
+
+/** Run all of the requests we queued for other workers
+ *
+ * @param[in] worker	the worker.
+ * @param[in] now	the current time.
+ */
+static void worker_steal_drain(fr_worker_t *worker, fr_time_t now)
+{
+	void	*cd;
+
+	while (fr_atomic_queue_pop(worker->steal->slot[worker->steal_id].queue, &cd)) {
+		worker_request_bootstrap(worker, cd, -1, now);
+	}
+}
+
+/** Take one request from another worker
+ *
+ * @param[in] worker	the idle worker.
+ * @param[in] id	of the worker to take the request from.
+ * @return
+ *	- true if we took a request.
+ *	- false if there were no requests to take.
+ */
+static bool worker_steal_one(fr_worker_t *worker, uint32_t id)
+{
+	fr_worker_steal_slot_t	*slot = &worker->steal->slot[id];
+	void			*cd;
+	bool			found;
+
+	if (!worker_steal_slot_get(slot)) return false;
+
+	/*
+	 *	The owner can't exit until we've replied.
+	 */
+	found = fr_atomic_queue_pop(slot->queue, &cd);
+	if (found) atomic_fetch_add(&slot->num_stolen, 1);
+
+	worker_steal_slot_release(slot);
+
+	if (!found) return false;
+
+	DEBUG3("Took request from worker %u", id);
+	worker->num_stolen++;
+	worker_request_bootstrap(worker, cd, id, fr_time());
+
+	return true;
+}
+
+/** Take back our own requests, or take requests from busy workers
+ *
+ *  We first take back requests from our own queue, if we have
+ *  capacity to run them.  If we're idle, we then look for requests
+ *  in the other workers' queues.
+ *
+ * @param[in] worker	the worker.
+ * @return
+ *	- true if we took a request from another worker.
+ *	- false otherwise.
+ */
+static bool worker_steal_run(fr_worker_t *worker)
+{
+	fr_worker_steal_t	*steal = worker->steal;
+	uint64_t		bit = (uint64_t) 1 << worker->steal_id;
+	void			*cd;
+	uint32_t		i;
+
+	atomic_fetch_and(&steal->idle, ~bit);
+
+	while ((fr_heap_num_elements(worker->runnable) < worker->config.steal_threshold) &&
+	       fr_atomic_queue_pop(steal->slot[worker->steal_id].queue, &cd)) {
+		worker_request_bootstrap(worker, cd, -1, fr_time());
+	}
+
+	if (worker->exiting || (fr_heap_num_elements(worker->runnable) > 0)) return false;
+
+	for (i = 1; i < steal->num_workers; i++) {
+		if (worker_steal_one(worker, (worker->steal_id + i) % steal->num_workers)) return true;
+	}
+
+	/*
+	 *	Tell the other workers that we're idle, and then look
+	 *	again.  A worker which queued a request after we
+	 *	looked will see our bit, and wake us up.
+	 */
+	atomic_fetch_or(&steal->idle, bit);
+
+	for (i = 1; i < steal->num_workers; i++) {
+		if (worker_steal_one(worker, (worker->steal_id + i) % steal->num_workers)) {
+			atomic_fetch_and(&steal->idle, ~bit);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/** Stop other workers from taking requests from us
+ *
+ * @param[in] worker	the worker.
+ * @return
+ *	- true if the worker can exit.
+ *	- false if other workers are still running requests which they took from us.
+ */
+static bool worker_steal_done(fr_worker_t *worker)
+{
+	fr_worker_steal_slot_t	*slot = &worker->steal->slot[worker->steal_id];
+
+	atomic_fetch_and(&worker->steal->idle, ~((uint64_t) 1 << worker->steal_id));
+	atomic_store(&slot->active, false);
+
+	/*
+	 *	Other workers only hold references for a few
+	 *	instructions.
+	 */
+	while (atomic_load(&slot->refs) > 0) sched_yield();
+
+	return (atomic_load(&slot->num_stolen) == 0);
+}
+
+/** Wait for other workers to reply to the requests which they took from us
+ *
+ *  The replies refer to our channels, and are sent via our control
+ *  plane.  So we can't be freed until all of them have arrived.
+ *  The event loop is no longer being serviced, so we run the
+ *  control plane callbacks ourselves.
+ *
+ * @param[in] worker	the worker.
+ */
+static void worker_steal_wait(fr_worker_t *worker)
+{
+	void	*cd;
+
+	if (!worker_steal_done(worker)) DEBUG("Waiting for other workers to finish requests taken from us");
+
+	/*
+	 *	No one can take these now, and we're not running them.
+	 */
+	while (fr_atomic_queue_pop(worker->steal->slot[worker->steal_id].queue, &cd)) {
+		if (fr_channel_active(((fr_channel_data_t *) cd)->channel.ch)) {
+			worker_nak(worker, cd, -1, fr_time());
+		} else {
+			fr_message_done(&((fr_channel_data_t *) cd)->m);
+		}
+	}
+
+	while (!worker_steal_done(worker)) {
+		if (fr_control_service(worker->control) == 0) usleep(1000);
+	}
+}
+
+/** Send the reply for a stolen request to the worker which owns the channel
+ *
+ * @param[in] worker	the worker which ran the request.
+ * @param[in] owner	the worker which owns the channel.
+ * @param[in] reply	to send.  NULL if we failed allocating the reply.
+ */
+static void worker_steal_reply_send(fr_worker_t *worker, uint32_t owner, fr_worker_steal_reply_t *reply)
+{
+	fr_worker_steal_slot_t	*slot = &worker->steal->slot[owner];
+	fr_ring_buffer_t	*rb;
+
+	/*
+	 *	The owner is still running, as it waits for
+	 *	num_stolen to reach zero before exiting.
+	 */
+	if (reply && ((rb = fr_worker_rb_init()) != NULL) &&
+	    (fr_control_message_send(slot->control, rb, FR_CONTROL_ID_STEAL_REPLY, &reply, sizeof(reply)) == 0)) {
+		return;
+	}
+
+	ERROR("Failed sending reply to worker %u", owner);
+	free(reply);
+	atomic_fetch_sub(&slot->num_stolen, 1);
+}
+
+/** Encode the reply for a stolen request
+ *
+ * @param[in] worker		This worker.
+ * @param[in] request		we're sending a reply for.
+ * @param[in] send_reply	whether the network side sends a reply
+ * @param[in] now		The current time
+ */
+static void worker_steal_send_reply(fr_worker_t *worker, request_t *request, bool send_reply, fr_time_t now)
+{
+	fr_worker_steal_reply_t	*reply;
+	size_t			size = 0;
+
+	REQUEST_VERIFY(request);
+	fr_assert(!fr_heap_entry_inserted(request->runnable));
+
+	if (send_reply) {
+		size = request->async->listen->app_io->default_reply_size;
+		if (!size) size = request->async->listen->app_io->default_message_size;
+	}
+
+	reply = malloc(sizeof(*reply) + size);
+	if (reply) {
+		if (send_reply) size = worker_reply_encode(request, reply->data, size);
+
+		reply->ch = request->async->channel;
+		reply->listen = request->async->listen;
+		reply->packet_ctx = request->async->packet_ctx;
+		reply->packet_type = request->async->packet_type;
+		reply->predicted = request->async->predicted;
+		reply->request_time = request->async->recv_time;
+		reply->processing_time = request->async->tracking.running_total;
+		reply->cpu_time = worker->tracking.running_total;
+		reply->data_size = size;
+
+		fr_time_elapsed_update(&worker->cpu_time, now, fr_time_add(now, reply->processing_time));
+		fr_time_elapsed_update(&worker->wall_clock, reply->request_time, now);
+	}
+
+	RDEBUG("Finished request");
+
+	fr_dlist_entry_unlink(&request->listen_entry);
+
+	worker_steal_reply_send(worker, request->async->owner, reply);
+}
+
+/** NAK a stolen request
+ *
+ * @param[in] worker	the worker which took the request.
+ * @param[in] cd	the message to NAK.
+ * @param[in] owner	the worker which owns the channel.
+ */
+static void worker_steal_nak(fr_worker_t *worker, fr_channel_data_t *cd, uint32_t owner)
+{
+	fr_worker_steal_reply_t	*reply;
+	fr_listen_t		*listen = cd->listen;
+	size_t			size;
+
+	size = listen->app_io->default_reply_size;
+	if (!size) size = listen->app_io->default_message_size;
+
+	reply = malloc(sizeof(*reply) + size);
+	if (reply) {
+		if (listen->app_io->nak) {
+			size = listen->app_io->nak(listen, cd->packet_ctx, cd->m.data,
+						   cd->m.data_size, reply->data, size);
+		} else {
+			reply->data[0] = 0;
+			size = 1;	/* rely on them to figure it the heck out */
+		}
+
+		reply->ch = cd->channel.ch;
+		reply->listen = listen;
+		reply->packet_ctx = cd->packet_ctx;
+		reply->packet_type = cd->packet_type;
+		reply->predicted = cd->predicted;
+		reply->request_time = cd->request.recv_time;
+		reply->processing_time = fr_time_delta_from_sec(10); /* @todo - set to something better? */
+		reply->cpu_time = worker->tracking.running_total;
+		reply->data_size = size;
+	}
+
+	fr_message_done(&cd->m);
+
+	worker_steal_reply_send(worker, owner, reply);
+}
+
+/** Send the reply for a request which another worker took from us
+ *
+ * @param[in] ctx	the worker
+ * @param[in] data	the message
+ * @param[in] data_size	size of the data
+ * @param[in] now	the current time
+ */
+static void worker_steal_reply_callback(void *ctx, void const *data, NDEBUG_UNUSED size_t data_size, fr_time_t now)
+{
+	fr_worker_t		*worker = ctx;
+	fr_worker_steal_reply_t	*reply;
+	fr_channel_data_t	*cd;
+	fr_message_set_t	*ms;
+	int			i;
+
+	fr_assert(data_size == sizeof(reply));
+
+	memcpy(&reply, data, sizeof(reply));
+
+	/*
+	 *	The channel was closed while the other worker was
+	 *	running the request.
+	 */
+	for (i = 0; i < worker->config.max_channels; i++) {
+		if (worker->channel[i].ch == reply->ch) break;
+	}
+	if ((i == worker->config.max_channels) || !fr_channel_active(reply->ch)) {
+		DEBUG2("Discarding reply for stolen request, the channel has been closed");
+		goto done;
+	}
+
+	ms = fr_channel_responder_uctx_get(reply->ch);
+	fr_assert(ms != NULL);
+
+	cd = (fr_channel_data_t *) fr_message_reserve(ms, reply->data_size ? reply->data_size : 1);
+	if (!cd) {
+		ERROR("Failed allocating reply for stolen request");
+		goto done;
+	}
+
+	if (reply->data_size) {
+		memcpy(cd->m.data, reply->data, reply->data_size);
+		(void) fr_message_alloc(ms, &cd->m, reply->data_size);
+	}
+
+	cd->m.when = now;
+	cd->reply.cpu_time = reply->cpu_time;
+	cd->reply.processing_time = reply->processing_time;
+	cd->reply.request_time = reply->request_time;
+
+	cd->listen = reply->listen;
+	cd->packet_ctx = reply->packet_ctx;
+	cd->packet_type = reply->packet_type;
+	cd->predicted = reply->predicted;
+
+	if (fr_channel_send_reply(reply->ch, cd) < 0) {
+		PERROR("Failed sending reply to network thread");
+	}
+
+	worker->stats.out++;
+
+done:
+	free(reply);
+	atomic_fetch_sub(&worker->steal->slot[worker->steal_id].num_stolen, 1);
+}
+
+/** Another worker queued requests, and woke us up to take them
+ *
+ *  We take a request now, so that it starts running in this pass
+ *  of the event loop.
+ */
+static void worker_steal_wake_callback(void *ctx, UNUSED void const *data, UNUSED size_t data_size,
+				       UNUSED fr_time_t now)
+{
+	fr_worker_t		*worker = talloc_get_type_abort(ctx, fr_worker_t);
+
+	if (!worker->steal || worker->exiting) return;
+
+	(void) worker_steal_run(worker);
+}
+
 /*
  *	talloc_typed_asprintf() is horrifically slow for printing
  *	simple numbers.
@@ -804,7 +1309,14 @@ static int _worker_request_deinit(request_t *request, UNUSED void *uctx)
 	return request_slab_deinit(request);
 }
 
-static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now)
+/** Decode a request, and mark it as runnable
+ *
+ * @param[in] worker	the worker.
+ * @param[in] cd	the message containing the request.
+ * @param[in] owner	the worker which received the message, or -1 for this worker.
+ * @param[in] now	the current time.
+ */
+static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd, int owner, fr_time_t now)
 {
 	int			ret = -1;
 	request_t		*request;
@@ -866,8 +1378,15 @@ static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd,
 
 	request->async->listen = listen;
 	request->async->packet_ctx = cd->packet_ctx;
+	request->async->packet_type = cd->packet_type;
+	request->async->predicted = cd->predicted;
 	request->priority = cd->priority;
 
+	if (owner >= 0) {
+		request->async->stolen = true;
+		request->async->owner = owner;
+	}
+
 	/*
 	 *	Now that the "request" structure has been initialized, go decode the packet.
 	 *
@@ -882,7 +1401,7 @@ static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd,
 	if (ret < 0) {
 		talloc_free(ctx);
 nak:
-		worker_nak(worker, cd, now);
+		worker_nak(worker, cd, owner, now);
 		return;
 	}
 
@@ -891,7 +1410,7 @@ nak:
 	 */
 	if (unlang_call_push(NULL, request, cd->listen->server_cs, UNLANG_TOP_FRAME) < 0) {
 		RERROR("Protocol failed to set 'process' function");
-		worker_nak(worker, cd, now);
+		worker_nak(worker, cd, owner, now);
 		return;
 	}
 
@@ -903,8 +1422,12 @@ nak:
 	/*
 	 *	Look for conflicting / duplicate packets, but only if
 	 *	requested to do so.
+	 *
+	 *	Stolen requests aren't tracked.  Our tree only has
+	 *	requests for our own channels, and the network thread
+	 *	already suppresses duplicates.
 	 */
-	if (request->async->listen->track_duplicates) {
+	if (request->async->listen->track_duplicates && !request->async->stolen) {
 		request_t *old;
 
 		old = fr_rb_find(worker->dedup, request);
@@ -1035,6 +1558,11 @@ void fr_worker_destroy(fr_worker_t *worker)
 
 //	WORKER_VERIFY;
 
+	/*
+	 *	Stop other workers from taking our requests.
+	 */
+	if (worker->steal) (void) worker_steal_done(worker);
+
 	/*
 	 *	Stop any new requests running with this interpreter
 	 */
@@ -1068,6 +1596,13 @@ void fr_worker_destroy(fr_worker_t *worker)
 
 	DEBUG("Worker is exiting - stopped %u requests", count);
 
+	/*
+	 *	The replies for requests we took from other workers
+	 *	have been sent.  Now get the replies for requests
+	 *	which they took from us.
+	 */
+	if (worker->steal) worker_steal_wait(worker);
+
 	/*
 	 *	Signal the channels that we're closing.
 	 *
@@ -1128,7 +1663,7 @@ static void _worker_request_done_external(request_t *request, UNUSED rlm_rcode_t
 	 *	Only real packets are in the dedup tree.  And even
 	 *	then, only some of the time.
 	 */
-	if (request->async->listen->track_duplicates) {
+	if (request->async->listen->track_duplicates && !request->async->stolen) {
 		(void) fr_rb_delete(worker->dedup, request);
 	}
 
@@ -1163,6 +1698,15 @@ static void _worker_request_done_external(request_t *request, UNUSED rlm_rcode_t
 		fr_dlist_entry_unlink(&request->async->entry);
 	}
 
+	/*
+	 *	The worker which owns the channel sends the reply.
+	 */
+	if (request->async->stolen) {
+		worker_steal_send_reply(worker, request, !unlang_request_is_cancelled(request), now);
+		request_slab_release(request);
+		return;
+	}
+
 	/*
 	 *	These conditions are true when the server is
 	 *	exiting and we're stopping all the requests.
@@ -1346,9 +1890,12 @@ static inline CC_HINT(always_inline) void worker_run_request(fr_worker_t *worker
 
 		/*
 		 *	For real requests, if the channel is gone,
-		 *	just stop the request and free it.
+		 *	just stop the request and free it.  Stolen
+		 *	requests are checked by the worker which owns
+		 *	the channel, when it sends the reply.
 		 */
-		if (request->async->channel && !fr_channel_active(request->async->channel)) {
+		if (request->async->channel && !request->async->stolen &&
+		    !fr_channel_active(request->async->channel)) {
 			worker_stop_request(request);
 			return;
 		}
@@ -1517,6 +2064,108 @@ nomem:
 	return worker;
 }
 
+/** Return the number of requests which the worker is running
+ *
+ *  This function may be called from any thread.
+ *
+ * @param[in] worker	the worker.
+ * @return the number of requests.
+ */
+uint32_t fr_worker_num_outstanding(fr_worker_t const *worker)
+{
+	return atomic_load_explicit(&worker->num_outstanding, memory_order_relaxed);
+}
+
+/** Allocate the structure which lets workers take requests from each other
+ *
+ *  This must be called before any of the workers start.  Each worker
+ *  then adds itself with fr_worker_steal_add().
+ *
+ * @param[in] ctx		to allocate the structure in.  It must outlive all of the workers.
+ * @param[in] num_workers	the number of workers.
+ * @return
+ *	- NULL on error
+ *	- fr_worker_steal_t on success
+ */
+fr_worker_steal_t *fr_worker_steal_alloc(TALLOC_CTX *ctx, uint32_t num_workers)
+{
+	fr_worker_steal_t	*steal;
+	uint32_t		i;
+
+	if ((num_workers < 2) || (num_workers > 64)) {
+		fr_strerror_printf("Work stealing needs between 2 and 64 workers, not %u", num_workers);
+		return NULL;
+	}
+
+	steal = (fr_worker_steal_t *) talloc_zero_size(ctx, sizeof(*steal) + (num_workers * sizeof(steal->slot[0])));
+	if (!steal) {
+		fr_strerror_const("Failed allocating memory");
+		return NULL;
+	}
+	talloc_set_name_const(steal, "fr_worker_steal_t");
+	steal->num_workers = num_workers;
+
+	for (i = 0; i < num_workers; i++) {
+		steal->slot[i].queue = fr_atomic_queue_alloc(steal, WORKER_STEAL_QUEUE_SIZE);
+		if (!steal->slot[i].queue) {
+			fr_strerror_const("Failed creating atomic queue");
+			talloc_free(steal);
+			return NULL;
+		}
+	}
+
+	return steal;
+}
+
+/** Let a worker share requests with the other workers
+ *
+ *  This must be called from the worker thread, before the worker
+ *  receives any channels.
+ *
+ * @param[in] worker	to add.
+ * @param[in] steal	from fr_worker_steal_alloc().
+ * @param[in] id	of the worker.  Each worker must use a different ID.
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+int fr_worker_steal_add(fr_worker_t *worker, fr_worker_steal_t *steal, uint32_t id)
+{
+	fr_worker_steal_slot_t	*slot;
+
+	fr_assert(is_worker_thread(worker));
+	fr_assert(worker->num_channels == 0);
+
+	if (id >= steal->num_workers) {
+		fr_strerror_printf("Invalid worker ID %u", id);
+		return -1;
+	}
+
+	if (!worker->config.steal_threshold) return 0;
+
+	if (fr_control_callback_add(worker->control, FR_CONTROL_ID_STEAL_WAKE, worker, worker_steal_wake_callback) < 0) {
+		fr_strerror_const_push("Failed adding callback for waking up");
+		return -1;
+	}
+
+	if (fr_control_callback_add(worker->control, FR_CONTROL_ID_STEAL_REPLY, worker, worker_steal_reply_callback) < 0) {
+		fr_strerror_const_push("Failed adding callback for replies");
+		return -1;
+	}
+
+	slot = &steal->slot[id];
+	slot->control = worker->control;
+
+	worker->steal = steal;
+	worker->steal_id = id;
+
+	/*
+	 *	Other workers can now see us.
+	 */
+	atomic_store(&slot->active, true);
+
+	return 0;
+}
 
 /** The main loop and entry point of the stand-alone worker thread.
  *
@@ -1531,18 +2180,26 @@ void fr_worker(fr_worker_t *worker)
 	WORKER_VERIFY;
 
 	while (true) {
-		bool wait_for_event;
+		bool wait_for_event, stole;
 		int num_events;
 
 		WORKER_VERIFY;
 
+		/*
+		 *	Take back requests which we queued for other
+		 *	workers, or take requests from busy workers.
+		 */
+		stole = worker->steal && worker_steal_run(worker);
+
 		/*
 		 *	There are runnable requests.  We still service
 		 *	the event loop, but we don't wait for events.
 		 */
-		wait_for_event = (fr_heap_num_elements(worker->runnable) == 0);
+		wait_for_event = !stole && (fr_heap_num_elements(worker->runnable) == 0);
+
 		if (wait_for_event) {
-			if (worker->exiting && (worker_num_requests(worker) == 0)) break;
+			if (worker->exiting && (worker_num_requests(worker) == 0) &&
+			    (!worker->steal || worker_steal_done(worker))) break;
 
 			DEBUG4("Ready to process requests");
 		}
@@ -1623,6 +2280,7 @@ void fr_worker_debug(fr_worker_t *worker, FILE *fp)
 
 	fprintf(fp, "\tnum_channels = %d\n", worker->num_channels);
 	fprintf(fp, "\tstats.in = %" PRIu64 "\n", worker->stats.in);
+	if (worker->steal) fprintf(fp, "\tnum_stolen = %" PRIu64 "\n", worker->num_stolen);
 
 	fprintf(fp, "\tcalculated (predicted) total CPU time = %" PRIu64 "\n",
 		fr_time_delta_unwrap(worker->predicted) * worker->stats.in);
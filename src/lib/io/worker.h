@@ -37,6 +37,13 @@ extern "C" {
  */
 typedef struct fr_worker_s fr_worker_t;
 
+/**
+ *  Requests which busy workers make available to idle workers.
+ *
+ *  Shared by all of the workers in a scheduler.
+ */
+typedef struct fr_worker_steal_s fr_worker_steal_t;
+
 #ifdef __cplusplus
 }
 #endif
@@ -66,6 +73,9 @@ typedef struct {
 
 	fr_time_delta_t		max_request_time;	//!< maximum time a request can be processed
 
+	uint32_t		steal_threshold;	//!< let other workers take new requests when we have
+							///< this many runnable requests.  0 disables stealing.
+
 	fr_slab_config_t	reuse;			//!< slab allocator configuration
 } fr_worker_config_t;
 
@@ -76,6 +86,10 @@ fr_worker_t	*fr_worker_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, char const *n
 
 void		fr_worker_destroy(fr_worker_t *worker) CC_HINT(nonnull);
 
+fr_worker_steal_t *fr_worker_steal_alloc(TALLOC_CTX *ctx, uint32_t num_workers);
+
+int		fr_worker_steal_add(fr_worker_t *worker, fr_worker_steal_t *steal, uint32_t id) CC_HINT(nonnull);
+
 void		fr_worker(fr_worker_t *worker) CC_HINT(nonnull);
 
 void		fr_worker_debug(fr_worker_t *worker, FILE *fp) CC_HINT(nonnull);
@@ -88,6 +102,8 @@ fr_channel_t	*fr_worker_channel_create(fr_worker_t *worker, TALLOC_CTX *ctx, fr_
 
 int		fr_worker_stats(fr_worker_t const *worker, int num, uint64_t *stats) CC_HINT(nonnull);
 
+uint32_t	fr_worker_num_outstanding(fr_worker_t const *worker) CC_HINT(nonnull);
+
 int		fr_worker_listen_cancel(fr_worker_t *worker, fr_listen_t const *li);
 
 #include <freeradius-devel/server/module.h>
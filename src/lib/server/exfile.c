@@ -29,6 +29,7 @@
 
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/file.h>
+#include <freeradius-devel/util/iovec.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/perm.h>
 #include <freeradius-devel/util/syserror.h>
@@ -590,3 +591,344 @@ int exfile_close(exfile_t *ef, int fd)
 	}
 	return exfile_close_lock(ef, fd);
 }
+
+/** Data buffered for a single file
+ *
+ */
+typedef struct {
+	fr_rb_node_t		node;			//!< Entry in the tree of files with buffered data.
+	char			*filename;		//!< File the data will be written to.
+	uint8_t			*data;			//!< Buffered data.
+	size_t			used;			//!< How much of the buffer contains data.
+	uint8_t			*header;		//!< Written before the data if the file is empty.
+	fr_dlist_head_t		waiting;		//!< Requests waiting for the data to be written.
+} exfile_buffer_file_t;
+
+/** Buffer for writes made by a single thread
+ *
+ */
+struct exfile_buffer_s {
+	exfile_t		*ef;			//!< Used to open, and lock, files.
+	fr_event_list_t		*el;			//!< Event list for the flush timer.
+	exfile_buffer_conf_t	conf;			//!< How much to buffer, and for how long.
+	mode_t			permissions;		//!< Permissions to use for new files.
+	gid_t			group;			//!< Group to set on files, or -1.
+	bool			fsync;			//!< fsync files after writing data.
+
+	fr_rb_tree_t		*files;			//!< Files with buffered data.
+	size_t			used;			//!< Total amount of data buffered.
+	fr_timer_t		*ev;			//!< When to write the buffered data.
+};
+
+/** A request waiting on buffered data to be written
+ *
+ */
+struct exfile_buffer_wait_s {
+	fr_dlist_t		entry;			//!< Entry in the file's list of waiting requests.
+	request_t		*request;		//!< To resume once the data has been written.
+	int			ret;			//!< 0 if the data was written, -1 on failure.
+};
+
+conf_parser_t const exfile_buffer_config[] = {
+	{ FR_CONF_OFFSET("size", exfile_buffer_conf_t, size), .dflt = "0" },
+	{ FR_CONF_OFFSET("interval", exfile_buffer_conf_t, interval), .dflt = "0.01" },
+	CONF_PARSER_TERMINATOR
+};
+
+static int8_t exfile_buffer_file_cmp(void const *one, void const *two)
+{
+	exfile_buffer_file_t const	*a = one, *b = two;
+	int				ret;
+
+	ret = strcmp(a->filename, b->filename);
+	return CMP(ret, 0);
+}
+
+/** Write the data buffered for a single file, and resume the requests waiting on it
+ *
+ * The file is only locked whilst the data is written.  The fsync is done
+ * on a duplicate of the file descriptor after the lock is released, so
+ * threads writing to the same file don't have to wait on each other's
+ * fsyncs.
+ *
+ * @param[in] eb	the file belongs to.
+ * @param[in] file	to write.  Is freed.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int exfile_buffer_file_flush(exfile_buffer_t *eb, exfile_buffer_file_t *file)
+{
+	struct iovec		vector[2];
+	int			fd, dupfd = -1, num = 0, ret = -1;
+	off_t			offset;
+	exfile_buffer_wait_t	*wait;
+
+	fd = exfile_open(eb->ef, file->filename, eb->permissions, &offset);
+	if (fd < 0) goto done;
+
+	if ((eb->group != (gid_t) -1) && (fchown(fd, -1, eb->group) < 0)) {
+		WARN("Unable to change system group of \"%s\": %s", file->filename, fr_syserror(errno));
+	}
+
+	if (file->header && (offset == 0)) {
+		vector[num].iov_base = file->header;
+		vector[num].iov_len = talloc_array_length(file->header);
+		num++;
+	}
+	vector[num].iov_base = file->data;
+	vector[num].iov_len = file->used;
+	num++;
+
+	if (fr_writev(fd, vector, num, fr_time_delta_wrap(0)) < 0) {
+		fr_strerror_printf("Failed writing to \"%s\": %s", file->filename, fr_syserror(errno));
+		exfile_close(eb->ef, fd);
+		goto done;
+	}
+
+	if (eb->fsync) {
+		dupfd = dup(fd);
+		if (dupfd < 0) {
+			fr_strerror_printf("Failed duplicating file descriptor for \"%s\": %s",
+					   file->filename, fr_syserror(errno));
+			exfile_close(eb->ef, fd);
+			goto done;
+		}
+	}
+	exfile_close(eb->ef, fd);
+
+	if (dupfd >= 0) {
+		if (fsync(dupfd) < 0) {
+			fr_strerror_printf("Failed syncing \"%s\" to persistent storage: %s",
+					   file->filename, fr_syserror(errno));
+			close(dupfd);
+			goto done;
+		}
+		close(dupfd);
+	}
+	ret = 0;
+
+done:
+	if (ret < 0) PERROR("Failed writing %zu bytes of buffered data", file->used);
+
+	eb->used -= file->used;
+	fr_rb_remove_by_inline_node(eb->files, &file->node);
+
+	while ((wait = fr_dlist_pop_head(&file->waiting))) {
+		wait->ret = ret;
+		unlang_interpret_mark_runnable(wait->request);
+	}
+	talloc_free(file);
+
+	return ret;
+}
+
+/** Write all buffered data
+ *
+ * @param[in] eb	to write data for.
+ * @return
+ *	- 0 on success.
+ *	- -1 if writing to any of the files failed.
+ */
+int exfile_buffer_flush(exfile_buffer_t *eb)
+{
+	exfile_buffer_file_t	*file;
+	int			ret = 0;
+
+	FR_TIMER_DISARM(eb->ev);
+
+	while ((file = fr_rb_first(eb->files))) {
+		if (exfile_buffer_file_flush(eb, file) < 0) ret = -1;
+	}
+
+	return ret;
+}
+
+static void _exfile_buffer_flush_timer(UNUSED fr_timer_list_t *tl, UNUSED fr_time_t now, void *uctx)
+{
+	exfile_buffer_t	*eb = talloc_get_type_abort(uctx, exfile_buffer_t);
+
+	(void) exfile_buffer_flush(eb);
+}
+
+static int _exfile_buffer_free(exfile_buffer_t *eb)
+{
+	(void) exfile_buffer_flush(eb);
+
+	return 0;
+}
+
+/** Allocate a buffer for writes from a single thread
+ *
+ * Data written via the buffer is collected per file, and written out
+ * with a single write (and optionally fsync) per file, either when
+ * the interval expires, or when the amount of buffered data reaches
+ * the configured size.
+ *
+ * @param[in] ctx		to allocate the buffer in.  Usually module thread instance data.
+ * @param[in] ef		used to open, and lock, files.  May be shared between threads.
+ * @param[in] el		the thread's event list.
+ * @param[in] conf		how much data to buffer, and for how long.
+ * @param[in] permissions	to use when creating new files.
+ * @param[in] group		to set on files, or -1 to leave the group unchanged.
+ * @param[in] fsync		whether to fsync files after writing buffered data.
+ * @return
+ *	- A new buffer.
+ *	- NULL on error.
+ */
+exfile_buffer_t *exfile_buffer_alloc(TALLOC_CTX *ctx, exfile_t *ef, fr_event_list_t *el,
+				     exfile_buffer_conf_t const *conf, mode_t permissions, gid_t group, bool fsync)
+{
+	exfile_buffer_t	*eb;
+
+	fr_assert(conf->size > 0);
+
+	MEM(eb = talloc_zero(ctx, exfile_buffer_t));
+	*eb = (exfile_buffer_t) {
+		.ef = ef,
+		.el = el,
+		.conf = *conf,
+		.permissions = permissions,
+		.group = group,
+		.fsync = fsync
+	};
+
+	eb->files = fr_rb_inline_talloc_alloc(eb, exfile_buffer_file_t, node, exfile_buffer_file_cmp, NULL);
+	if (!eb->files) {
+		talloc_free(eb);
+		return NULL;
+	}
+	talloc_set_destructor(eb, _exfile_buffer_free);
+
+	return eb;
+}
+
+static int _exfile_buffer_wait_free(exfile_buffer_wait_t *wait)
+{
+	if (fr_dlist_entry_in_list(&wait->entry)) fr_dlist_entry_unlink(&wait->entry);
+
+	return 0;
+}
+
+/** Buffer data to be written to a file
+ *
+ * If the buffer is full, all buffered data is written immediately,
+ * blocking the caller.  This limits the amount of memory used, and
+ * slows callers down to the speed at which data can be written.
+ *
+ * @param[in] ctx		to allocate the wait handle in.
+ * @param[out] wait		If not NULL, and the data was buffered, a handle
+ *				the caller can yield on.  The request is marked
+ *				runnable once the data has been written, and
+ *				#exfile_buffer_wait_result returns the result.
+ *				Freeing the handle stops the request being resumed.
+ * @param[in] eb		to buffer data in.
+ * @param[in] request		to resume once the data has been written.
+ * @param[in] filename		to write data to.
+ * @param[in] header		Optional data to write before any other data,
+ *				if the file is empty.
+ * @param[in] header_len	Number of elements in header.
+ * @param[in] vector		Data to write.
+ * @param[in] vector_len	Number of elements in vector.
+ * @return
+ *	- 1 if the data was buffered, and *wait is populated.
+ *	- 0 if the data was written, or buffered without a wait handle.
+ *	- -1 on failure.
+ */
+int exfile_buffer_write(TALLOC_CTX *ctx, exfile_buffer_wait_t **wait,
+			exfile_buffer_t *eb, request_t *request, char const *filename,
+			struct iovec const *header, size_t header_len,
+			struct iovec const *vector, size_t vector_len)
+{
+	exfile_buffer_file_t	*file;
+	size_t			i, len = 0;
+
+	if (wait) *wait = NULL;
+
+	file = fr_rb_find(eb->files, &(exfile_buffer_file_t){ .filename = UNCONST(char *, filename) });
+	if (!file) {
+		MEM(file = talloc_zero(eb, exfile_buffer_file_t));
+		MEM(file->filename = talloc_typed_strdup(file, filename));
+		fr_dlist_init(&file->waiting, exfile_buffer_wait_t, entry);
+		if (!fr_rb_insert(eb->files, file)) {
+			talloc_free(file);
+			fr_strerror_printf("Failed buffering data for \"%s\"", filename);
+			return -1;
+		}
+	}
+
+	/*
+	 *	Only the first header is kept, it's only
+	 *	written if the file is empty.
+	 */
+	if (header && !file->header) {
+		for (i = 0; i < header_len; i++) len += header[i].iov_len;
+
+		MEM(file->header = talloc_array(file, uint8_t, len));
+		for (i = 0, len = 0; i < header_len; i++) {
+			memcpy(file->header + len, header[i].iov_base, header[i].iov_len);
+			len += header[i].iov_len;
+		}
+		len = 0;
+	}
+
+	for (i = 0; i < vector_len; i++) len += vector[i].iov_len;
+
+	if ((file->used + len) > talloc_array_length(file->data)) {
+		size_t	size = talloc_array_length(file->data) * 2;
+
+		if (size < (file->used + len)) size = file->used + len;
+		MEM(file->data = talloc_realloc(file, file->data, uint8_t, size));
+	}
+
+	for (i = 0; i < vector_len; i++) {
+		memcpy(file->data + file->used, vector[i].iov_base, vector[i].iov_len);
+		file->used += vector[i].iov_len;
+	}
+	eb->used += len;
+
+	/*
+	 *	Full, write everything now.  Our own file goes first
+	 *	so we get the result for our data.
+	 */
+	if (eb->used >= eb->conf.size) {
+		int	ret;
+
+		ret = exfile_buffer_file_flush(eb, file);
+		(void) exfile_buffer_flush(eb);
+
+		return ret;
+	}
+
+	if (!fr_timer_armed(eb->ev) &&
+	    (fr_timer_in(eb, eb->el->tl, &eb->ev, eb->conf.interval, false, _exfile_buffer_flush_timer, eb) < 0)) {
+		int	ret;
+
+		PERROR("Failed inserting flush timer, writing immediately");
+		ret = exfile_buffer_file_flush(eb, file);
+		(void) exfile_buffer_flush(eb);
+
+		return ret;
+	}
+
+	if (!wait) return 0;
+
+	MEM(*wait = talloc_zero(ctx, exfile_buffer_wait_t));
+	(*wait)->request = request;
+	fr_dlist_insert_tail(&file->waiting, *wait);
+	talloc_set_destructor(*wait, _exfile_buffer_wait_free);
+
+	return 1;
+}
+
+/** Return the result of writing the data a request was waiting on
+ *
+ * @param[in] wait	handle returned by #exfile_buffer_write.
+ * @return
+ *	- 0 if the data was written.
+ *	- -1 on failure.
+ */
+int exfile_buffer_wait_result(exfile_buffer_wait_t const *wait)
+{
+	return wait->ret;
+}
@@ -25,7 +25,11 @@
  */
 RCSIDH(exfile_h, "$Id$")
 
+#include <freeradius-devel/server/cf_parse.h>
 #include <freeradius-devel/server/request.h>
+#include <freeradius-devel/util/event.h>
+
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -45,6 +49,34 @@ int		exfile_open(exfile_t *lf, char const *filename, mode_t permissions, off_t *
 
 int		exfile_close(exfile_t *lf, CC_RELEASE_HANDLE("exfile_fd") int fd);
 
+/*
+ *	Per-thread buffering of writes to one or more files.
+ */
+typedef struct exfile_buffer_s exfile_buffer_t;
+typedef struct exfile_buffer_wait_s exfile_buffer_wait_t;
+
+/** Configuration for buffered writes
+ *
+ */
+typedef struct {
+	size_t			size;		//!< Maximum amount of data to buffer.  0 disables buffering.
+	fr_time_delta_t		interval;	//!< Maximum time data is buffered for before it's written.
+} exfile_buffer_conf_t;
+
+extern conf_parser_t const exfile_buffer_config[];
+
+exfile_buffer_t	*exfile_buffer_alloc(TALLOC_CTX *ctx, exfile_t *ef, fr_event_list_t *el,
+				     exfile_buffer_conf_t const *conf, mode_t permissions, gid_t group, bool fsync);
+
+int		exfile_buffer_write(TALLOC_CTX *ctx, exfile_buffer_wait_t **wait,
+				    exfile_buffer_t *eb, request_t *request, char const *filename,
+				    struct iovec const *header, size_t header_len,
+				    struct iovec const *vector, size_t vector_len);
+
+int		exfile_buffer_wait_result(exfile_buffer_wait_t const *wait);
+
+int		exfile_buffer_flush(exfile_buffer_t *eb);
+
 #ifdef __cplusplus
 }
 #endif
@@ -164,6 +164,12 @@ static const conf_parser_t thread_config[] = {
 
 	{ FR_CONF_OFFSET_TYPE_FLAGS("stats_interval", FR_TYPE_TIME_DELTA, CONF_FLAG_HIDDEN, main_config_t, stats_interval) },
 
+	{ FR_CONF_OFFSET("network_cpus", main_config_t, network_cpus) },
+	{ FR_CONF_OFFSET("worker_cpus", main_config_t, worker_cpus) },
+	{ FR_CONF_OFFSET_IS_SET("numa_node", FR_TYPE_UINT32, 0, main_config_t, numa_node) },
+
+	{ FR_CONF_OFFSET("steal_threshold", main_config_t, worker.steal_threshold), .dflt = "0" },
+
 #ifdef WITH_TLS
 	{ FR_CONF_OFFSET_TYPE_FLAGS("openssl_async_pool_init", FR_TYPE_SIZE, 0, main_config_t, openssl_async_pool_init), .dflt = "64" },
 	{ FR_CONF_OFFSET_TYPE_FLAGS("openssl_async_pool_max", FR_TYPE_SIZE, 0, main_config_t, openssl_async_pool_max), .dflt = "1024" },
@@ -416,7 +422,8 @@ static int num_networks_parse(TALLOC_CTX *ctx, void *out, void *parent,
 
 	memcpy(&value, out, sizeof(value));
 
-	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, ==, 1);
+	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, >=, 1);
+	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, <=, 64);
 
 	memcpy(out, &value, sizeof(value));
 
@@ -148,6 +148,11 @@ struct main_config_s {
 	uint32_t	max_workers;			//!< for the scheduler
 	fr_time_delta_t	stats_interval;			//!< for the scheduler
 
+	char const	*network_cpus;			//!< for the scheduler
+	char const	*worker_cpus;			//!< for the scheduler
+	uint32_t	numa_node;			//!< for the scheduler
+	bool		numa_node_is_set;		//!< for the scheduler
+
 #ifndef NDEBUG
 	uint32_t	ins_max;			//!< max instruction count
 	bool		ins_countup;			//!< count up to "max"
@@ -53,9 +53,14 @@ RCSID("$Id$")
 #include <freeradius-devel/io/listen.h>
 
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/md5.h>
 #include <freeradius-devel/util/rand.h>
 
+#include <stdatomic.h>
+
+typedef struct fr_state_shard_s fr_state_shard_t;
+
 /** Holds a state value, and associated fr_pair_ts and data
  *
  */
@@ -119,6 +124,7 @@ typedef struct {
 	request_t		*thawed;			//!< The request that thawed this entry.
 
 	fr_state_tree_t		*state_tree;			//!< Tree this entry belongs to.
+	fr_state_shard_t	*shard;				//!< Shard this entry is in.
 } fr_state_entry_t;
 
 /** A child of a fr_state_entry_t
@@ -140,19 +146,33 @@ typedef struct {
 	request_t		*thawed;			//!< The request that thawed this entry.
 } state_child_entry_t;
 
-struct fr_state_tree_s {
-	uint64_t		id;				//!< Next ID to assign.
+/** A subset of the state entries, with its own mutex
+ *
+ * Entries are assigned to a shard based on their State value, so
+ * requests for different sessions rarely contend for the same mutex.
+ */
+struct fr_state_shard_s {
+	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
+	fr_rb_tree_t		*tree;				//!< rbtree used to lookup state value.
+	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
+
 	uint64_t		timed_out;			//!< Number of states that were cleaned up due to
 								//!< timeout.
+};
+
+struct fr_state_tree_s {
 	uint32_t		max_sessions;			//!< Maximum number of sessions we track.
-	uint32_t		used_sessions;			//!< How many sessions are currently in progress.
-	fr_rb_tree_t		*tree;				//!< rbtree used to lookup state value.
-	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
+	_Atomic(uint32_t)	used_sessions;			//!< How many sessions are currently in progress,
+								///< across all shards.
+	_Atomic(uint64_t)	id;				//!< Next ID to assign.  Shared by all shards, so
+								///< IDs are unique in the tree.
+
+	fr_state_shard_t	*shards;			//!< Entries, split by State value.
+	uint32_t		num_shards;			//!< Number of shards.  Always a power of 2.
 
 	fr_time_delta_t		timeout;			//!< How long to wait before cleaning up state entries.
 
 	bool			thread_safe;			//!< Whether we lock the tree whilst modifying it.
-	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
 
 	uint8_t			server_id;			//!< ID to use for load balancing.
 	uint32_t		context_id;			//!< ID binding state values to a context such
@@ -161,10 +181,18 @@ struct fr_state_tree_s {
 	fr_dict_attr_t const	*da;				//!< State attribute used.
 };
 
+/*
+ *	Thread safe trees are split into this many shards, unless
+ *	that would leave fewer than STATE_SHARD_MIN_SESSIONS
+ *	sessions in each shard.
+ */
+#define STATE_SHARDS_MAX		(32)
+#define STATE_SHARD_MIN_SESSIONS	(64)
+
 #define PTHREAD_MUTEX_LOCK if (state->thread_safe) pthread_mutex_lock
 #define PTHREAD_MUTEX_UNLOCK if (state->thread_safe) pthread_mutex_unlock
 
-static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry);
+static void state_entry_unlink(fr_state_shard_t *shard, fr_state_entry_t *entry);
 
 /** Compare two fr_state_entry_t based on their state value i.e. the value of the attribute
  *
@@ -178,27 +206,45 @@ static int8_t state_entry_cmp(void const *one, void const *two)
 	return CMP(ret, 0);
 }
 
+/** Return the shard which holds a state value
+ *
+ */
+static inline CC_HINT(always_inline)
+fr_state_shard_t *state_shard(fr_state_tree_t *state, fr_state_entry_t const *entry)
+{
+	if (state->num_shards == 1) return &state->shards[0];
+
+	return &state->shards[fr_hash(entry->state, sizeof(entry->state)) & (state->num_shards - 1)];
+}
+
 /** Free the state tree
  *
  */
 static int _state_tree_free(fr_state_tree_t *state)
 {
-	fr_state_entry_t *entry;
-
-	if (state->thread_safe) pthread_mutex_destroy(&state->mutex);
+	fr_state_entry_t	*entry;
+	uint32_t		i;
 
 	DEBUG4("Freeing state tree %p", state);
 
-	while ((entry = fr_dlist_head(&state->to_expire))) {
-		DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
-		state_entry_unlink(state, entry);
-		talloc_free(entry);
-	}
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
 
-	/*
-	 *	Free the rbtree
-	 */
-	talloc_free(state->tree);
+		if (!shard->tree) continue;
+
+		if (state->thread_safe) pthread_mutex_destroy(&shard->mutex);
+
+		while ((entry = fr_dlist_head(&shard->to_expire))) {
+			DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
+			state_entry_unlink(shard, entry);
+			talloc_free(entry);
+		}
+
+		/*
+		 *	Free the rbtree
+		 */
+		talloc_free(shard->tree);
+	}
 
 	return 0;
 }
@@ -222,6 +268,7 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 				    uint8_t server_id, uint32_t context_id)
 {
 	fr_state_tree_t *state;
+	uint32_t	i;
 
 	state = talloc_zero(NULL, fr_state_tree_t);
 	if (!state) return 0;
@@ -238,26 +285,51 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 	 */
 	talloc_link_ctx(ctx, state);
 
-	if (thread_safe && (pthread_mutex_init(&state->mutex, NULL) != 0)) {
-		talloc_free(state);
-		return NULL;
-	}
-
-	fr_dlist_talloc_init(&state->to_expire, fr_state_entry_t, free_entry);
-
 	/*
-	 *	We need to do controlled freeing of the
-	 *	rbtree, so that all the state entries
-	 *	are freed before it's destroyed.  Hence
-	 *	it being parented from the NULL ctx.
+	 *	Each shard has its own mutex, so that workers
+	 *	handling different sessions don't contend.
 	 */
-	state->tree = fr_rb_inline_talloc_alloc(NULL, fr_state_entry_t, node, state_entry_cmp, NULL);
-	if (!state->tree) {
+	state->num_shards = 1;
+	if (thread_safe) {
+		state->num_shards = STATE_SHARDS_MAX;
+		while ((state->num_shards > 1) && ((max_sessions / state->num_shards) < STATE_SHARD_MIN_SESSIONS)) {
+			state->num_shards >>= 1;
+		}
+	}
+
+	state->shards = talloc_zero_array(state, fr_state_shard_t, state->num_shards);
+	if (!state->shards) {
 		talloc_free(state);
 		return NULL;
 	}
+
 	talloc_set_destructor(state, _state_tree_free);
 
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shards[i];
+
+		fr_dlist_talloc_init(&shard->to_expire, fr_state_entry_t, free_entry);
+
+		/*
+		 *	We need to do controlled freeing of the
+		 *	rbtree, so that all the state entries
+		 *	are freed before it's destroyed.  Hence
+		 *	it being parented from the NULL ctx.
+		 */
+		shard->tree = fr_rb_inline_talloc_alloc(NULL, fr_state_entry_t, node, state_entry_cmp, NULL);
+		if (!shard->tree) {
+			talloc_free(state);
+			return NULL;
+		}
+
+		if (thread_safe && (pthread_mutex_init(&shard->mutex, NULL) != 0)) {
+			talloc_free(shard->tree);
+			shard->tree = NULL;
+			talloc_free(state);
+			return NULL;
+		}
+	}
+
 	state->da = da;		/* Remember which attribute we use to load/store state */
 	state->server_id = server_id;
 	state->context_id = context_id;
@@ -270,15 +342,15 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
  *
  */
 static inline CC_HINT(always_inline)
-void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry)
+void state_entry_unlink(fr_state_shard_t *shard, fr_state_entry_t *entry)
 {
 	/*
 	 *	Check the memory is still valid
 	 */
 	(void) talloc_get_type_abort(entry, fr_state_entry_t);
 
-	fr_dlist_remove(&state->to_expire, entry);
-	fr_rb_delete(state->tree, entry);
+	fr_dlist_remove(&shard->to_expire, entry);
+	fr_rb_delete(shard->tree, entry);
 
 	DEBUG4("State ID %" PRIu64 " unlinked", entry->id);
 }
@@ -318,14 +390,44 @@ static int _state_entry_free(fr_state_entry_t *entry)
 
 	DEBUG4("State ID %" PRIu64 " freed", entry->id);
 
-	entry->state_tree->used_sessions--;
+	atomic_fetch_sub_explicit(&entry->state_tree->used_sessions, 1, memory_order_relaxed);
 
 	return 0;
 }
 
+/** Convert a State value to the binary form we use as a key
+ *
+ */
+static inline CC_HINT(always_inline)
+void state_entry_value_set(fr_state_entry_t *entry, uint8_t const *value, size_t len)
+{
+	/*
+	 *	Assume our own State first.
+	 */
+	if (len == sizeof(entry->state)) {
+		memcpy(entry->state, value, sizeof(entry->state));
+
+	/*
+	 *	Too big?  Get the MD5 hash, in order
+	 *	to depend on the entire contents of State.
+	 */
+	} else if (len > sizeof(entry->state)) {
+		fr_md5_calc(entry->state, value, len);
+
+	/*
+	 *	Too small?  Use the whole thing, and
+	 *	set the rest of my_entry.state to zero.
+	 */
+	} else {
+		memcpy(entry->state, value, len);
+		memset(&entry->state[len], 0, sizeof(entry->state) - len);
+	}
+}
+
 /** Create a new state entry
  *
- * @note Called with the mutex held.
+ * @note Called with no mutex held.  On success, returns with the
+ *	 mutex of the entry's shard held.
  */
 static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *request,
 					    fr_pair_list_t *reply_list, fr_state_entry_t *old)
@@ -334,12 +436,11 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	uint32_t		x;
 	fr_time_t		now = fr_time();
 	fr_pair_t		*vp;
-	fr_state_entry_t	*entry, *next;
-
-	uint8_t			old_state[sizeof(old->state)];
-	int			old_tries = 0;
+	fr_state_entry_t	*entry, *next, my_entry;
+	fr_state_shard_t	*shard;
 	uint64_t		timed_out = 0;
 	bool			too_many = false;
+	bool			added = false;
 	fr_dlist_head_t		to_free;
 
 	/*
@@ -351,14 +452,90 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 
 	fr_dlist_init(&to_free, fr_state_entry_t, free_entry);
 
+	/*
+	 *	Work out the State value first, as it determines
+	 *	which shard the entry goes into.
+	 */
+	my_entry.tries = 0;
+
+	/*
+	 *	Some modules create their own magic
+	 *	state attributes.  If a state value already exists
+	 *	int the reply, we use that in preference to the
+	 *	old state.
+	 */
+	vp = fr_pair_find_by_da(reply_list, NULL, state->da);
+	if (vp) {
+		if (DEBUG_ENABLED && (vp->vp_length > sizeof(my_entry.state))) {
+			WARN("State too long, will be truncated.  Expected <= %zd bytes, got %zu bytes",
+			     sizeof(my_entry.state), vp->vp_length);
+		}
+
+		state_entry_value_set(&my_entry, vp->vp_octets, vp->vp_length);
+	} else {
+		/*
+		 *	Base the new state on the old state if we had one.
+		 */
+		if (old) {
+			memcpy(my_entry.state, old->state, sizeof(my_entry.state));
+			my_entry.tries = old->tries + 1;
+
+		/*
+		 *	16 octets of randomness should be enough to
+		 *	have a globally unique state.
+		 */
+		} else {
+			for (i = 0; i < sizeof(my_entry.state) / sizeof(x); i++) {
+				x = fr_rand();
+				memcpy(my_entry.state + (i * 4), &x, sizeof(x));
+			}
+		}
+
+		my_entry.state_comp.tries = my_entry.tries + 1;
+
+		my_entry.state_comp.tx = my_entry.state_comp.tries ^ my_entry.tries;
+
+		my_entry.state_comp.vx_0 = my_entry.state_comp.r_0 ^
+					   ((((uint32_t) HEXIFY(RADIUSD_VERSION)) >> 24) & 0xff);
+		my_entry.state_comp.vx_1 = my_entry.state_comp.r_0 ^
+					   ((((uint32_t) HEXIFY(RADIUSD_VERSION)) >> 16) & 0xff);
+		my_entry.state_comp.vx_2 = my_entry.state_comp.r_0 ^
+					   ((((uint32_t) HEXIFY(RADIUSD_VERSION)) >> 8) & 0xff);
+		my_entry.state_comp.vx_3 = my_entry.state_comp.r_0 ^
+					   (((uint32_t) HEXIFY(RADIUSD_VERSION)) & 0xff);
+
+		/*
+		 *	Allow a portion of the State attribute to be set,
+		 *	this is useful for debugging purposes.
+		 */
+		my_entry.state_comp.server_id = state->server_id;
+
+		MEM(vp = fr_pair_afrom_da(request->reply_ctx, state->da));
+		fr_pair_value_memdup(vp, my_entry.state, sizeof(my_entry.state), false);
+		fr_pair_append(reply_list, vp);
+		added = true;
+	}
+
+	/*
+	 *	XOR the server hash with four bytes of random data.
+	 *	We XOR is again before resolving, to ensure state lookups
+	 *	only succeed in the virtual server that created the state
+	 *	value.
+	 */
+	my_entry.state_comp.context_id ^= state->context_id;
+
+	shard = state_shard(state, &my_entry);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+
 	/*
 	 *	Clean up expired entries
 	 */
-	for (entry = fr_dlist_head(&state->to_expire);
+	for (entry = fr_dlist_head(&shard->to_expire);
 	     entry != NULL;
 	     entry = next) {
  		(void)talloc_get_type_abort(entry, fr_state_entry_t);	/* Allow examination */
-		next = fr_dlist_next(&state->to_expire, entry);		/* Advance *before* potential unlinking */
+		next = fr_dlist_next(&shard->to_expire, entry);		/* Advance *before* potential unlinking */
 
 		if (entry == old) continue;
 
@@ -366,7 +543,7 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 		 *	Too old, we can delete it.
 		 */
 		if (fr_time_lt(entry->cleanup, now)) {
-			state_entry_unlink(state, entry);
+			state_entry_unlink(shard, entry);
 			fr_dlist_insert_tail(&to_free, entry);
 			timed_out++;
 			continue;
@@ -375,18 +552,9 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 		break;
 	}
 
-	state->timed_out += timed_out;
+	shard->timed_out += timed_out;
 
-	if (!old) {
-		too_many = (state->used_sessions == (uint32_t) state->max_sessions);
-		if (!too_many) state->used_sessions++;	/* preemptively increment whilst we hold the mutex */
-		memset(old_state, 0, sizeof(old_state));
-	} else {
-		old_tries = old->tries;
-		memcpy(old_state, old->state, sizeof(old_state));
-	}
-
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 
 	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
 
@@ -405,15 +573,25 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 		talloc_free(entry);
 	}
 
+	/*
+	 *	The limit is for the whole tree, not for each shard.
+	 *	Ongoing sessions are never refused.
+	 */
+	if (atomic_fetch_add_explicit(&state->used_sessions, 1, memory_order_relaxed) >= state->max_sessions) {
+		too_many = !old;
+	}
+
 	/*
 	 *	Have to do this post-cleanup, else we end up returning with
 	 *	a list full of entries to free with none of them being
 	 *	freed which is bad...
 	 */
 	if (too_many) {
+		atomic_fetch_sub_explicit(&state->used_sessions, 1, memory_order_relaxed);
+
 		RERROR("Failed inserting state entry - At maximum ongoing session limit (%u)",
 		       state->max_sessions);
-		PTHREAD_MUTEX_LOCK(&state->mutex);	/* Caller expects this to be locked */
+		if (added) fr_pair_delete_by_da(reply_list, state->da);
 		return NULL;
 	}
 
@@ -424,10 +602,10 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	if (!old) {
 		MEM(entry = talloc_zero(NULL, fr_state_entry_t));
 		talloc_set_destructor(entry, _state_entry_free);
-		/* tree->used_sessions incremented above */
+
 	/*
 	 *	Reuse the old state entry cleaning up any memory associated
-	 *	with it.
+	 *	with it.  This also removes it from the session count.
 	 */
 	} else {
 		_state_entry_free(old);
@@ -437,11 +615,12 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	}
 
 	entry->state_tree = state;
+	entry->shard = shard;
+	entry->tries = my_entry.tries;
+	memcpy(entry->state, my_entry.state, sizeof(entry->state));
 
 	request_data_list_init(&entry->data);
 
-	entry->id = state->id++;
-
 	/*
 	 *	Limit the lifetime of this entry based on how long the
 	 *	server takes to process a request.  Doing it this way
@@ -450,97 +629,16 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	 */
 	entry->cleanup = fr_time_add(now, state->timeout);
 
-	/*
-	 *	Some modules create their own magic
-	 *	state attributes.  If a state value already exists
-	 *	int the reply, we use that in preference to the
-	 *	old state.
-	 */
-	vp = fr_pair_find_by_da(reply_list, NULL, state->da);
-	if (vp) {
-		if (DEBUG_ENABLED && (vp->vp_length > sizeof(entry->state))) {
-			WARN("State too long, will be truncated.  Expected <= %zd bytes, got %zu bytes",
-			     sizeof(entry->state), vp->vp_length);
-		}
-
-		/*
-		 *	Assume our own State first.
-		 */
-		if (vp->vp_length == sizeof(entry->state)) {
-			memcpy(entry->state, vp->vp_octets, sizeof(entry->state));
+	entry->id = atomic_fetch_add_explicit(&state->id, 1, memory_order_relaxed);
 
-		/*
-		 *	Too big?  Get the MD5 hash, in order
-		 *	to depend on the entire contents of State.
-		 */
-		} else if (vp->vp_length > sizeof(entry->state)) {
-			fr_md5_calc(entry->state, vp->vp_octets, vp->vp_length);
-
-		/*
-		 *	Too small?  Use the whole thing, and
-		 *	set the rest of my_entry.state to zero.
-		 */
-		} else {
-			memcpy(entry->state, vp->vp_octets, vp->vp_length);
-			memset(&entry->state[vp->vp_length], 0, sizeof(entry->state) - vp->vp_length);
-		}
-	} else {
-		/*
-		 *	Base the new state on the old state if we had one.
-		 */
-		if (old) {
-			memcpy(entry->state, old_state, sizeof(entry->state));
-			entry->tries = old_tries + 1;
-		/*
-		 *	16 octets of randomness should be enough to
-		 *	have a globally unique state.
-		 */
-		} else {
-			for (i = 0; i < sizeof(entry->state) / sizeof(x); i++) {
-				x = fr_rand();
-				memcpy(entry->state + (i * 4), &x, sizeof(x));
-			}
-		}
-
-		entry->state_comp.tries = entry->tries + 1;
-
-		entry->state_comp.tx = entry->state_comp.tries ^ entry->tries;
-
-		entry->state_comp.vx_0 = entry->state_comp.r_0 ^
-					 ((((uint32_t) HEXIFY(RADIUSD_VERSION)) >> 24) & 0xff);
-		entry->state_comp.vx_1 = entry->state_comp.r_0 ^
-					 ((((uint32_t) HEXIFY(RADIUSD_VERSION)) >> 16) & 0xff);
-		entry->state_comp.vx_2 = entry->state_comp.r_0 ^
-					 ((((uint32_t) HEXIFY(RADIUSD_VERSION)) >> 8) & 0xff);
-		entry->state_comp.vx_3 = entry->state_comp.r_0 ^
-					 (((uint32_t) HEXIFY(RADIUSD_VERSION)) & 0xff);
-
-		/*
-		 *	Allow a portion of the State attribute to be set,
-		 *	this is useful for debugging purposes.
-		 */
-		entry->state_comp.server_id = state->server_id;
-
-		MEM(vp = fr_pair_afrom_da(request->reply_ctx, state->da));
-		fr_pair_value_memdup(vp, entry->state, sizeof(entry->state), false);
-		fr_pair_append(reply_list, vp);
-	}
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
 
 	DEBUG4("State ID %" PRIu64 " created, value 0x%pH, expires %pV",
 	       entry->id, fr_box_octets(entry->state, sizeof(entry->state)),
 	       fr_box_time_delta(fr_time_sub(entry->cleanup, now)));
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-
-	/*
-	 *	XOR the server hash with four bytes of random data.
-	 *	We XOR is again before resolving, to ensure state lookups
-	 *	only succeed in the virtual server that created the state
-	 *	value.
-	 */
-	*((uint32_t *)(&entry->state_comp.context_id)) ^= state->context_id;
-
-	if (!fr_rb_insert(state->tree, entry)) {
+	if (!fr_rb_insert(shard->tree, entry)) {
+		PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 		RERROR("Failed inserting state entry - Insertion into state tree failed");
 		fr_pair_delete_by_da(reply_list, state->da);
 		talloc_free(entry);
@@ -551,50 +649,36 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	 *	Link it to the end of the list, which is implicitly
 	 *	ordered by cleanup time.
 	 */
-	fr_dlist_insert_tail(&state->to_expire, entry);
+	fr_dlist_insert_tail(&shard->to_expire, entry);
 
 	return entry;
 }
 
 /** Find the entry based on the State attribute and remove it from the state tree
  *
+ * @note Called with no mutex held.
  */
 static fr_state_entry_t *state_entry_find_and_unlink(fr_state_tree_t *state, fr_value_box_t const *vb)
 {
-	fr_state_entry_t *entry, my_entry;
-
-	/*
-	 *	Assume our own State first.
-	 */
-	if (vb->vb_length == sizeof(my_entry.state)) {
-		memcpy(my_entry.state, vb->vb_octets, sizeof(my_entry.state));
-
-		/*
-		 *	Too big?  Get the MD5 hash, in order
-		 *	to depend on the entire contents of State.
-		 */
-	} else if (vb->vb_length > sizeof(my_entry.state)) {
-		fr_md5_calc(my_entry.state, vb->vb_octets, vb->vb_length);
+	fr_state_entry_t	*entry, my_entry;
+	fr_state_shard_t	*shard;
 
-		/*
-		 *	Too small?  Use the whole thing, and
-		 *	set the rest of my_entry.state to zero.
-		 */
-	} else {
-		memcpy(my_entry.state, vb->vb_octets, vb->vb_length);
-		memset(&my_entry.state[vb->vb_length], 0, sizeof(my_entry.state) - vb->vb_length);
-	}
+	state_entry_value_set(&my_entry, vb->vb_octets, vb->vb_length);
 
 	/*
 	 *	Make it unique for different virtual servers handling the same request
 	 */
 	my_entry.state_comp.context_id ^= state->context_id;
 
-	entry = fr_rb_remove(state->tree, &my_entry);
+	shard = state_shard(state, &my_entry);
+
+	PTHREAD_MUTEX_LOCK(&shard->mutex);
+	entry = fr_rb_remove(shard->tree, &my_entry);
 	if (entry) {
 		(void) talloc_get_type_abort(entry, fr_state_entry_t);
-		fr_dlist_remove(&state->to_expire, entry);
+		fr_dlist_remove(&shard->to_expire, entry);
 	}
+	PTHREAD_MUTEX_UNLOCK(&shard->mutex);
 
 	return entry;
 }
@@ -610,13 +694,8 @@ void fr_state_discard(fr_state_tree_t *state, request_t *request)
 	vp = fr_pair_find_by_da(&request->request_pairs, NULL, state->da);
 	if (!vp) return;
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
 	entry = state_entry_find_and_unlink(state, &vp->data);
-	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
-		return;
-	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	if (!entry) return;
 
 	/*
 	 *	If fr_state_to_request was never called, this ensures
@@ -671,14 +750,11 @@ int fr_state_to_request(fr_state_tree_t *state, request_t *request)
 		return 1;
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
 	entry = state_entry_find_and_unlink(state, &vp->data);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
 		RDEBUG2("No state entry matching request.%pP found", vp);
 		return 2;
 	}
-   	PTHREAD_MUTEX_UNLOCK(&state->mutex);
 
 	/* Probably impossible in the current code */
 	if (unlikely(entry->thawed != NULL)) {
@@ -760,14 +836,13 @@ int fr_request_to_state(fr_state_tree_t *state, request_t *request)
 	}
 
 	MEM(state_ctx = request_state_replace(request, NULL));
-	PTHREAD_MUTEX_LOCK(&state->mutex);
 
 	/*
-	 *	Reuses old if possible
+	 *	Reuses old if possible.  Returns with the
+	 *	shard the entry was inserted into locked.
 	 */
 	entry = state_entry_create(state, request, &request->reply_pairs, old);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
 		RERROR("Creating state entry failed");
 
 		talloc_free(request_state_replace(request, state_ctx));
@@ -781,7 +856,7 @@ int fr_request_to_state(fr_state_tree_t *state, request_t *request)
 	entry->seq_start = request->seq_start;
 	entry->ctx = state_ctx;
 	fr_dlist_move(&entry->data, &data);
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	PTHREAD_MUTEX_UNLOCK(&entry->shard->mutex);
 
 	RDEBUG3("%s - saved", state->da->name);
 	REQUEST_VERIFY(request);
@@ -923,7 +998,7 @@ void fr_state_discard_child(request_t *parent, void const *unique_ptr, int uniqu
  */
 uint64_t fr_state_entries_created(fr_state_tree_t *state)
 {
-	return state->id;
+	return atomic_load_explicit(&state->id, memory_order_relaxed);
 }
 
 /** Return number of entries that timed out
@@ -931,7 +1006,12 @@ uint64_t fr_state_entries_created(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
 {
-	return state->timed_out;
+	uint64_t	total = 0;
+	uint32_t	i;
+
+	for (i = 0; i < state->num_shards; i++) total += state->shards[i].timed_out;
+
+	return total;
 }
 
 /** Return number of entries we're currently tracking
@@ -939,5 +1019,10 @@ uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_tracked(fr_state_tree_t *state)
 {
-	return fr_rb_num_elements(state->tree);
+	uint64_t	total = 0;
+	uint32_t	i;
+
+	for (i = 0; i < state->num_shards; i++) total += fr_rb_num_elements(state->shards[i].tree);
+
+	return total;
 }
@@ -0,0 +1,171 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the sharded state tree
+ *
+ * @file src/lib/server/state_tests.c
+ * @copyright 2026 The FreeRADIUS server project
+ */
+
+static void test_init(void);
+#  define TEST_INIT  test_init()
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/dict_test.h>
+
+#include <freeradius-devel/server/pair.h>
+#include <freeradius-devel/server/request.h>
+#include <freeradius-devel/server/state.h>
+
+/*
+ *	Large enough that a thread safe tree is split into
+ *	several shards.
+ */
+#define TEST_MAX_SESSIONS	(256)
+
+static TALLOC_CTX	*autofree;
+static fr_dict_t	*test_dict;
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("state_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) goto error;
+
+	if (fr_dict_test_init(autofree, &test_dict, NULL) < 0) goto error;
+
+	if (request_global_init() < 0) goto error;
+}
+
+static request_t *request_fake_alloc(void)
+{
+	request_t	*request;
+
+	request = request_local_alloc_external(autofree, (&(request_init_args_t){ .namespace = test_dict }));
+	TEST_CHECK(request != NULL);
+
+	return request;
+}
+
+/** Save session-state for a new session
+ *
+ * @return the result of fr_request_to_state().
+ */
+static int state_session_add(fr_state_tree_t *state, fr_pair_t **state_vp)
+{
+	request_t	*request = request_fake_alloc();
+	fr_pair_t	*vp;
+	int		ret;
+
+	TEST_CHECK(pair_append_session_state(&vp, fr_dict_attr_test_uint32) == 0);
+	vp->vp_uint32 = 1;
+
+	ret = fr_request_to_state(state, request);
+	if ((ret == 0) && state_vp) {
+		*state_vp = fr_pair_copy(autofree, fr_pair_find_by_da(&request->reply_pairs, NULL,
+								      fr_dict_attr_test_octets));
+		TEST_CHECK(*state_vp != NULL);
+	}
+
+	talloc_free(request);
+
+	return ret;
+}
+
+static void test_state_max_sessions(void)
+{
+	fr_state_tree_t	*state;
+	int		i;
+
+	TEST_CASE("Create a sharded state tree");
+	state = fr_state_tree_init(autofree, fr_dict_attr_test_octets, true, TEST_MAX_SESSIONS,
+				   fr_time_delta_from_sec(60), 0, 0);
+	TEST_CHECK(state != NULL);
+
+	TEST_CASE("All sessions up to max_sessions are accepted, whichever shard they land in");
+	for (i = 0; i < TEST_MAX_SESSIONS; i++) {
+		if (!TEST_CHECK(state_session_add(state, NULL) == 0)) {
+			TEST_MSG("Session %d was refused", i);
+			break;
+		}
+	}
+	TEST_CHECK(fr_state_entries_tracked(state) == (uint64_t) TEST_MAX_SESSIONS);
+
+	TEST_CASE("The next session is refused");
+	TEST_CHECK(state_session_add(state, NULL) < 0);
+	TEST_CHECK(fr_state_entries_tracked(state) == (uint64_t) TEST_MAX_SESSIONS);
+
+	TEST_CASE("Refused sessions are not assigned IDs");
+	TEST_CHECK(fr_state_entries_created(state) == (uint64_t) TEST_MAX_SESSIONS);
+
+	talloc_free(state);
+}
+
+static void test_state_resume_at_limit(void)
+{
+	fr_state_tree_t	*state;
+	fr_pair_t	*state_vp = NULL, *vp;
+	request_t	*request;
+	int		i;
+
+	state = fr_state_tree_init(autofree, fr_dict_attr_test_octets, true, TEST_MAX_SESSIONS,
+				   fr_time_delta_from_sec(60), 0, 0);
+	TEST_CHECK(state != NULL);
+
+	TEST_CASE("Fill the tree");
+	TEST_CHECK(state_session_add(state, &state_vp) == 0);
+	for (i = 1; i < TEST_MAX_SESSIONS; i++) TEST_CHECK(state_session_add(state, NULL) == 0);
+	TEST_CHECK(state_vp != NULL);
+
+	TEST_CASE("Restore the session-state of the first session");
+	request = request_fake_alloc();
+	MEM(vp = fr_pair_copy(request->request_ctx, state_vp));
+	fr_pair_append(&request->request_pairs, vp);
+
+	TEST_CHECK_RET(fr_state_to_request(state, request), 0);
+	TEST_CHECK((vp = fr_pair_find_by_da(&request->session_state_pairs, NULL, fr_dict_attr_test_uint32)) != NULL);
+	TEST_CHECK(vp && (vp->vp_uint32 == 1));
+	TEST_CHECK(fr_state_entries_tracked(state) == (uint64_t) TEST_MAX_SESSIONS - 1);
+
+	TEST_CASE("An ongoing session is saved again, even at the limit");
+	TEST_CHECK_RET(fr_request_to_state(state, request), 0);
+	TEST_CHECK(fr_state_entries_tracked(state) == (uint64_t) TEST_MAX_SESSIONS);
+
+	TEST_CASE("Each entry gets a new ID from the counter shared by all shards");
+	TEST_CHECK(fr_state_entries_created(state) == (uint64_t) TEST_MAX_SESSIONS + 1);
+
+	talloc_free(request);
+	talloc_free(state_vp);
+	talloc_free(state);
+}
+
+TEST_LIST = {
+	{ "state_max_sessions",		test_state_max_sessions },
+	{ "state_resume_at_limit",	test_state_resume_at_limit },
+
+	TEST_TERMINATOR
+};
@@ -0,0 +1,6 @@
+TARGET      	:= state_tests$(E)
+SOURCES     	:= state_tests.c
+
+TGT_LDLIBS  	:= $(LIBS) $(GPERFTOOLS_LIBS)
+TGT_LDFLAGS 	:= $(LDFLAGS) $(GPERFTOOLS_LDFLAGS)
+TGT_PREREQS 	:= libfreeradius-util$(L) libfreeradius-server$(L) libfreeradius-unlang$(L)
@@ -36,6 +36,10 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 #include <freeradius-devel/unlang/subrequest.h>
 #include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/nbo.h>
+#include <freeradius-devel/util/rb.h>
 
 #include "attrs.h"
 #include "base.h"
@@ -46,6 +50,42 @@ USES_APPLE_DEPRECATED_API	/* OpenSSL API has been deprecated by Apple */
 
 #include <openssl/ssl.h>
 #include <openssl/kdf.h>
+#include <openssl/rand.h>
+#include <openssl/core_names.h>
+
+#include <pthread.h>
+
+/** Serialised session held in the in-memory session store
+ *
+ */
+typedef struct {
+	fr_rb_node_t		node;			//!< Entry in the shard's lookup tree.
+	fr_dlist_t		entry;			//!< Entry in the shard's list, oldest first.
+	fr_time_t		expires;		//!< When the session can no longer be resumed.
+	uint8_t			*id;			//!< Session ID.
+	uint8_t			*data;			//!< DER encoded session, including session-state.
+} tls_cache_store_entry_t;
+
+/** Independently locked partition of the in-memory session store
+ *
+ * Neither the tree nor the list allocate memory, and entries are allocated
+ * in the NULL ctx, so threads holding different shard locks never touch
+ * the same talloc hierarchy.
+ */
+typedef struct {
+	pthread_mutex_t		mutex;			//!< Protects the tree and list.
+	fr_rb_tree_t		tree;			//!< Entries keyed by session ID.
+	fr_dlist_head_t		list;			//!< Entries in insertion order.
+} tls_cache_store_shard_t;
+
+/** In-memory session store shared by all threads using a TLS configuration
+ *
+ */
+struct fr_tls_cache_store_s {
+	uint32_t		max_per_shard;		//!< Maximum entries in each shard.
+	uint32_t		num_shards;		//!< Number of shards.
+	tls_cache_store_shard_t	*shards;		//!< Array of shards.
+};
 
 /** Retrieve session ID (in binary form) from the session
  *
@@ -160,6 +200,197 @@ void _tls_cache_clear_state_reset(request_t *request, fr_tls_cache_t *cache, cha
 }
 #define tls_cache_clear_state_reset(_request, _cache) _tls_cache_clear_state_reset(_request, _cache, __FUNCTION__)
 
+/** Return when a session stops being resumable
+ *
+ */
+static inline CC_HINT(always_inline)
+fr_time_t tls_cache_session_expires(SSL_SESSION *sess)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30400000L
+	return fr_time_from_sec((time_t)(SSL_SESSION_get_time_ex(sess) + SSL_get_timeout(sess)));
+#else
+	return fr_time_from_sec((time_t)(SSL_SESSION_get_time(sess) + SSL_get_timeout(sess)));
+#endif
+}
+
+static int8_t tls_cache_store_entry_cmp(void const *one, void const *two)
+{
+	tls_cache_store_entry_t const *a = one, *b = two;
+	size_t a_len = talloc_array_length(a->id), b_len = talloc_array_length(b->id);
+	int ret;
+
+	ret = CMP(a_len, b_len);
+	if (ret != 0) return ret;
+
+	return CMP(memcmp(a->id, b->id, a_len), 0);
+}
+
+/** Find the shard responsible for a session ID
+ *
+ */
+static inline CC_HINT(always_inline)
+tls_cache_store_shard_t *tls_cache_store_shard(fr_tls_cache_store_t *store, uint8_t const *id, size_t id_len)
+{
+	return &store->shards[fr_hash(id, id_len) % store->num_shards];
+}
+
+/** Unlink an entry from its shard and free it
+ *
+ * Must be called with the shard mutex held.
+ */
+static void tls_cache_store_entry_delete(tls_cache_store_shard_t *shard, tls_cache_store_entry_t *e)
+{
+	fr_dlist_remove(&shard->list, e);
+	fr_rb_remove_by_inline_node(&shard->tree, &e->node);
+	talloc_free(e);
+}
+
+/** Add a serialised session to the in-memory store, replacing any existing entry
+ *
+ * If the shard is full, its oldest entry is evicted.
+ *
+ * @param[in] store	to add the session to.
+ * @param[in] id	Session ID.
+ * @param[in] id_len	Length of the session ID.
+ * @param[in] data	DER encoded session.
+ * @param[in] data_len	Length of the DER encoded session.
+ * @param[in] expires	When the session stops being resumable.
+ */
+static void tls_cache_store_add(fr_tls_cache_store_t *store, uint8_t const *id, size_t id_len,
+				uint8_t const *data, size_t data_len, fr_time_t expires)
+{
+	tls_cache_store_shard_t	*shard = tls_cache_store_shard(store, id, id_len);
+	tls_cache_store_entry_t	*e, *old;
+	fr_time_t		now = fr_time();
+
+	/*
+	 *	Allocate outside of the lock, there may be
+	 *	a lot of threads contending for this shard.
+	 */
+	MEM(e = talloc_zero(NULL, tls_cache_store_entry_t));
+	MEM(e->id = talloc_memdup(e, id, id_len));
+	MEM(e->data = talloc_memdup(e, data, data_len));
+	e->expires = expires;
+
+	pthread_mutex_lock(&shard->mutex);
+	while ((old = fr_dlist_head(&shard->list)) && fr_time_lteq(old->expires, now)) {
+		tls_cache_store_entry_delete(shard, old);
+	}
+
+	old = fr_rb_find(&shard->tree, e);
+	if (old) {
+		tls_cache_store_entry_delete(shard, old);
+	} else if (fr_rb_num_elements(&shard->tree) >= store->max_per_shard) {
+		tls_cache_store_entry_delete(shard, fr_dlist_head(&shard->list));
+	}
+
+	if (!fr_rb_insert(&shard->tree, e)) {
+		talloc_free(e);
+	} else {
+		fr_dlist_insert_tail(&shard->list, e);
+	}
+	pthread_mutex_unlock(&shard->mutex);
+}
+
+/** Deserialise a session from the in-memory store
+ *
+ * @param[in] store	to search.
+ * @param[in] id	Session ID.
+ * @param[in] id_len	Length of the session ID.
+ * @return
+ *	- A new SSL_SESSION on success.
+ *	- NULL if the session wasn't found, has expired, or couldn't be deserialised.
+ */
+static SSL_SESSION *tls_cache_store_find(fr_tls_cache_store_t *store, uint8_t const *id, size_t id_len)
+{
+	tls_cache_store_shard_t	*shard = tls_cache_store_shard(store, id, id_len);
+	tls_cache_store_entry_t	*e;
+	SSL_SESSION		*sess = NULL;
+
+	pthread_mutex_lock(&shard->mutex);
+	e = fr_rb_find(&shard->tree, &(tls_cache_store_entry_t){ .id = UNCONST(uint8_t *, id) });
+	if (e) {
+		if (fr_time_lteq(e->expires, fr_time())) {
+			tls_cache_store_entry_delete(shard, e);
+		} else {
+			uint8_t const *p = e->data;	/* openssl mutates p */
+
+			sess = d2i_SSL_SESSION(NULL, &p, talloc_array_length(e->data));
+			if (!sess) fr_tls_strerror_printf(NULL);	/* Drain the OpenSSL error stack */
+		}
+	}
+	pthread_mutex_unlock(&shard->mutex);
+
+	return sess;
+}
+
+/** Remove a session from the in-memory store
+ *
+ * @param[in] store	to remove the session from.
+ * @param[in] id	Session ID.
+ * @param[in] id_len	Length of the session ID.
+ */
+static void tls_cache_store_remove(fr_tls_cache_store_t *store, uint8_t const *id, size_t id_len)
+{
+	tls_cache_store_shard_t	*shard = tls_cache_store_shard(store, id, id_len);
+	tls_cache_store_entry_t	*e;
+
+	pthread_mutex_lock(&shard->mutex);
+	e = fr_rb_find(&shard->tree, &(tls_cache_store_entry_t){ .id = UNCONST(uint8_t *, id) });
+	if (e) tls_cache_store_entry_delete(shard, e);
+	pthread_mutex_unlock(&shard->mutex);
+}
+
+static int _tls_cache_store_free(fr_tls_cache_store_t *store)
+{
+	uint32_t i;
+
+	for (i = 0; i < store->num_shards; i++) {
+		tls_cache_store_shard_t	*shard = &store->shards[i];
+		tls_cache_store_entry_t	*e;
+
+		while ((e = fr_dlist_head(&shard->list))) tls_cache_store_entry_delete(shard, e);
+		pthread_mutex_destroy(&shard->mutex);
+	}
+
+	return 0;
+}
+
+/** Allocate an in-memory session store
+ *
+ * The store is shared by every thread using the TLS configuration, so
+ * that a session established on one thread can be resumed on another
+ * without calling `load session { ... }`.
+ *
+ * @param[in] ctx		to allocate the store in.  Usually the #fr_tls_conf_t.
+ * @param[in] max_entries	Maximum number of sessions to hold.
+ * @param[in] num_shards	How many independently locked partitions to use.
+ * @return A new session store.
+ */
+fr_tls_cache_store_t *fr_tls_cache_store_alloc(TALLOC_CTX *ctx, uint32_t max_entries, uint32_t num_shards)
+{
+	fr_tls_cache_store_t	*store;
+	uint32_t		i;
+
+	fr_assert((num_shards > 0) && (num_shards <= max_entries));
+
+	MEM(store = talloc_zero(ctx, fr_tls_cache_store_t));
+	MEM(store->shards = talloc_zero_array(store, tls_cache_store_shard_t, num_shards));
+	store->num_shards = num_shards;
+	store->max_per_shard = (max_entries + num_shards - 1) / num_shards;
+
+	for (i = 0; i < num_shards; i++) {
+		tls_cache_store_shard_t	*shard = &store->shards[i];
+
+		fr_rb_inline_talloc_init(&shard->tree, tls_cache_store_entry_t, node, tls_cache_store_entry_cmp, NULL);
+		fr_dlist_talloc_init(&shard->list, tls_cache_store_entry_t, entry);
+		pthread_mutex_init(&shard->mutex, NULL);
+	}
+	talloc_set_destructor(store, _tls_cache_store_free);
+
+	return store;
+}
+
 /** Serialize the session-state list and store it in the SSL_SESSION *
  *
  */
@@ -321,6 +552,19 @@ static void tls_cache_delete_request(SSL_SESSION *sess)
 
 	tls_cache->clear.state = FR_TLS_CACHE_CLEAR_REQUESTED;
 
+	/*
+	 *	The in-memory store can be updated immediately,
+	 *	`clear session { ... }` is still called later.
+	 */
+	{
+		fr_tls_conf_t *conf = fr_tls_session_conf(tls_session->ssl);
+
+		if (conf->cache.store) {
+			tls_cache_store_remove(conf->cache.store, tls_cache->clear.id,
+					       talloc_array_length(tls_cache->clear.id));
+		}
+	}
+
 	/*
 	 *	We store a copy of the pointer for the session
 	 *	in tls_session->session.  If the session is
@@ -398,6 +642,23 @@ static unlang_action_t tls_cache_load_result(request_t *request, void *uctx)
 	 */
 	SSL_SESSION_set_ex_data(sess, FR_TLS_EX_INDEX_TLS_SESSION, fr_tls_session(tls_session->ssl));
 
+	/*
+	 *	Populate the in-memory store so the next resumption
+	 *	attempt, on any thread, doesn't need to call
+	 *	`load session { ... }`.
+	 */
+	{
+		fr_tls_conf_t *conf = fr_tls_session_conf(tls_session->ssl);
+
+		if (conf->cache.store) {
+			unsigned int	id_len;
+			uint8_t const	*id = SSL_SESSION_get_id(sess, &id_len);
+
+			tls_cache_store_add(conf->cache.store, id, id_len, vp->vp_octets, vp->vp_length,
+					    tls_cache_session_expires(sess));
+		}
+	}
+
 	tls_cache->load.state = FR_TLS_CACHE_LOAD_RETRIEVED;
 	tls_cache->load.sess = sess;	/* This is consumed in tls_cache_load_cb */
 
@@ -498,11 +759,7 @@ unlang_action_t tls_cache_store_push(request_t *request, fr_tls_conf_t *conf, fr
 	fr_pair_t		*vp;
 	SSL_SESSION		*sess = tls_session->cache->store.sess;
 	unlang_action_t		ua;
-#if OPENSSL_VERSION_NUMBER >= 0x30400000L
-	fr_time_t		expires = fr_time_from_sec((time_t)(SSL_SESSION_get_time_ex(sess) + SSL_get_timeout(sess)));
-#else
-	fr_time_t		expires = fr_time_from_sec((time_t)(SSL_SESSION_get_time(sess) + SSL_get_timeout(sess)));
-#endif
+	fr_time_t		expires = tls_cache_session_expires(sess);
 	fr_time_t		now = fr_time();
 
 	fr_assert(tls_cache->store.sess);
@@ -580,6 +837,19 @@ unlang_action_t tls_cache_store_push(request_t *request, fr_tls_conf_t *conf, fr
 	}
 	fr_pair_value_memdup_buffer_shallow(vp, data, true);
 
+	/*
+	 *	Write through to the in-memory store, the
+	 *	virtual server is still called so sessions
+	 *	survive restarts and can be shared with
+	 *	other servers.
+	 */
+	if (conf->cache.store) {
+		unsigned int	id_len;
+		uint8_t const	*id = SSL_SESSION_get_id(sess, &id_len);
+
+		tls_cache_store_add(conf->cache.store, id, id_len, data, len, expires);
+	}
+
 	/*
 	 *	Allocate a child, and set it up to call
 	 *      the TLS virtual server.
@@ -790,11 +1060,13 @@ static SSL_SESSION *tls_cache_load_cb(SSL *ssl,
 {
 	fr_tls_session_t	*tls_session;
 	fr_tls_cache_t		*tls_cache;
+	fr_tls_conf_t		*conf;
 	request_t		*request;
 
 	tls_session = fr_tls_session(ssl);
 	request = fr_tls_session_request(tls_session->ssl);
 	tls_cache = tls_session->cache;
+	conf = fr_tls_session_conf(ssl);
 
 	/*
 	 *	Request was cancelled, don't return any session and hopefully
@@ -825,6 +1097,26 @@ again:
 	case FR_TLS_CACHE_LOAD_INIT:
 		fr_assert(!tls_cache->load.id);
 
+		/*
+		 *	Check the in-memory store first.  On a hit we
+		 *	skip `load session { ... }` entirely, but still
+		 *	re-validate the certificate chain below.
+		 */
+		if (conf->cache.store) {
+			SSL_SESSION *sess;
+
+			sess = tls_cache_store_find(conf->cache.store, (uint8_t const *)key, (size_t)key_len);
+			if (sess) {
+				RDEBUG3("Session ID %pV - Found in memory",
+					fr_box_octets((uint8_t const *)key, (size_t)key_len));
+
+				SSL_SESSION_set_ex_data(sess, FR_TLS_EX_INDEX_TLS_SESSION, tls_session);
+				tls_cache->load.sess = sess;
+				tls_cache->load.state = FR_TLS_CACHE_LOAD_RETRIEVED;
+				goto again;
+			}
+		}
+
 		tls_cache->load.state = FR_TLS_CACHE_LOAD_REQUESTED;
 		MEM(tls_cache->load.id = talloc_typed_memdup(tls_cache, (uint8_t const *)key, key_len));
 
@@ -1370,6 +1662,229 @@ static SSL_TICKET_RETURN tls_cache_session_ticket_app_data_get(SSL *ssl, SSL_SES
 	return (status == SSL_TICKET_SUCCESS_RENEW) ? SSL_TICKET_RETURN_USE_RENEW : SSL_TICKET_RETURN_USE;
 }
 
+#define SESSION_TICKET_KEY_INFO "freeradius-session-ticket"
+
+/** Derive session ticket key material from the configured session_ticket_key
+ *
+ * @param[out] out		Where to write the key material.
+ * @param[in] out_len		How much key material to derive.
+ * @param[in] cache_conf	containing the session_ticket_key.
+ * @param[in] info		HKDF info, binds the output to a purpose.
+ * @param[in] info_len		Length of info.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int tls_cache_session_ticket_key_derive(uint8_t *out, size_t out_len, fr_tls_cache_conf_t const *cache_conf,
+					       uint8_t const *info, size_t info_len)
+{
+	EVP_PKEY_CTX *pkey_ctx = NULL;
+
+	if (unlikely((pkey_ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL)) == NULL)) {
+		fr_tls_strerror_printf(NULL);
+		PERROR("Failed initialising KDF");
+	kdf_error:
+		if (pkey_ctx) EVP_PKEY_CTX_free(pkey_ctx);
+		return -1;
+	}
+	if (unlikely(EVP_PKEY_derive_init(pkey_ctx) != 1)) {
+		fr_tls_strerror_printf(NULL);
+		PERROR("Failed initialising KDF derivation ctx");
+		goto kdf_error;
+	}
+	if (unlikely(EVP_PKEY_CTX_set_hkdf_md(pkey_ctx, UNCONST(struct evp_md_st *, EVP_sha256())) != 1)) {
+		fr_tls_strerror_printf(NULL);
+		PERROR("Failed setting KDF MD");
+		goto kdf_error;
+	}
+	if (unlikely(EVP_PKEY_CTX_set1_hkdf_key(pkey_ctx,
+						UNCONST(unsigned char *, cache_conf->session_ticket_key),
+						talloc_array_length(cache_conf->session_ticket_key)) != 1)) {
+		fr_tls_strerror_printf(NULL);
+		PERROR("Failed setting KDF key");
+		goto kdf_error;
+	}
+	if (unlikely(EVP_PKEY_CTX_add1_hkdf_info(pkey_ctx, UNCONST(unsigned char *, info), info_len) != 1)) {
+		fr_tls_strerror_printf(NULL);
+		PERROR("Failed setting KDF label");
+		goto kdf_error;
+	}
+	if (EVP_PKEY_derive(pkey_ctx, out, &out_len) != 1) {
+		fr_tls_strerror_printf(NULL);
+		PERROR("Failed deriving session ticket key");
+		goto kdf_error;
+	}
+	EVP_PKEY_CTX_free(pkey_ctx);
+
+	return 0;
+}
+
+/** Key material for one session ticket key rotation interval
+ *
+ */
+typedef struct {
+	uint8_t		name[8];			//!< Identifies the key, sent in the ticket.
+	uint8_t		hmac[32];			//!< HMAC-SHA256 key.
+	uint8_t		aes[32];			//!< AES-256-CBC key.
+} tls_cache_ticket_key_t;
+
+#define TLS_CACHE_TICKET_KEYS	4
+
+/** Cached key material for one rotation interval
+ *
+ */
+typedef struct {
+	bool			valid;			//!< Whether the slot holds a key.
+	uint64_t		epoch;			//!< Rotation interval the key was derived for.
+	tls_cache_ticket_key_t	key;			//!< Derived key material.
+} tls_cache_ticket_key_slot_t;
+
+/** Recently derived session ticket keys, shared by all threads using a TLS configuration
+ *
+ * Each key takes an HKDF derivation, so keys are derived once per rotation
+ * interval, not once per ticket.  The slot is selected by the interval number,
+ * so the current interval and the few before it are all usually cached.
+ */
+struct fr_tls_cache_ticket_keys_s {
+	pthread_mutex_t			mutex;			//!< Protects the slots.
+	tls_cache_ticket_key_slot_t	slot[TLS_CACHE_TICKET_KEYS];
+};
+
+/** Derive the session ticket keys for a rotation interval
+ *
+ * Every thread (and every server sharing the session_ticket_key) derives
+ * the same keys for the same interval, so no coordination is needed.
+ */
+static int tls_cache_session_ticket_key_epoch(tls_cache_ticket_key_t *out, fr_tls_cache_conf_t const *cache_conf,
+					      uint64_t epoch)
+{
+	uint8_t info[sizeof(SESSION_TICKET_KEY_INFO) - 1 + sizeof(uint64_t)];
+
+	memcpy(info, SESSION_TICKET_KEY_INFO, sizeof(SESSION_TICKET_KEY_INFO) - 1);
+	fr_nbo_from_uint64(info + sizeof(SESSION_TICKET_KEY_INFO) - 1, epoch);
+
+	return tls_cache_session_ticket_key_derive((uint8_t *)out, sizeof(*out), cache_conf, info, sizeof(info));
+}
+
+/** Get the session ticket keys for a rotation interval, deriving them only if they're not cached
+ *
+ */
+static int tls_cache_session_ticket_key_get(tls_cache_ticket_key_t *out, fr_tls_cache_conf_t const *cache_conf,
+					    uint64_t epoch)
+{
+	fr_tls_cache_ticket_keys_t	*keys = cache_conf->ticket_keys;
+	tls_cache_ticket_key_slot_t	*slot;
+	int				ret = 0;
+
+	if (!keys) return tls_cache_session_ticket_key_epoch(out, cache_conf, epoch);
+
+	slot = &keys->slot[epoch % TLS_CACHE_TICKET_KEYS];
+
+	pthread_mutex_lock(&keys->mutex);
+	if (!slot->valid || (slot->epoch != epoch)) {
+		ret = tls_cache_session_ticket_key_epoch(&slot->key, cache_conf, epoch);
+		slot->valid = (ret == 0);
+		slot->epoch = epoch;
+	}
+	if (ret == 0) memcpy(out, &slot->key, sizeof(*out));
+	pthread_mutex_unlock(&keys->mutex);
+
+	return ret;
+}
+
+static int _tls_cache_ticket_keys_free(fr_tls_cache_ticket_keys_t *keys)
+{
+	OPENSSL_cleanse(keys->slot, sizeof(keys->slot));
+	pthread_mutex_destroy(&keys->mutex);
+
+	return 0;
+}
+
+/** Allocate a cache for rotating session ticket keys
+ *
+ * @param[in] ctx	to allocate the cache in.  Usually the #fr_tls_conf_t.
+ * @return A new, empty, key cache.
+ */
+fr_tls_cache_ticket_keys_t *fr_tls_cache_ticket_keys_alloc(TALLOC_CTX *ctx)
+{
+	fr_tls_cache_ticket_keys_t	*keys;
+
+	MEM(keys = talloc_zero(ctx, fr_tls_cache_ticket_keys_t));
+	pthread_mutex_init(&keys->mutex, NULL);
+	talloc_set_destructor(keys, _tls_cache_ticket_keys_free);
+
+	return keys;
+}
+
+/** Encrypt or decrypt a session ticket using the key for the current rotation interval
+ *
+ * The key name is the big-endian interval number followed by an identifier
+ * derived with the key.  Tickets from previous intervals are accepted for
+ * as long as the session lifetime allows, but the client is sent a new
+ * ticket encrypted with the current key.
+ *
+ * @return
+ *	- -1 on error.
+ *	- 0 if the ticket can't be decrypted (full handshake).
+ *	- 1 on success.
+ *	- 2 on success, but the ticket should be renewed.
+ */
+static int tls_cache_session_ticket_key_cb(SSL *ssl, unsigned char key_name[16], unsigned char *iv,
+					   EVP_CIPHER_CTX *cipher_ctx, EVP_MAC_CTX *mac_ctx, int enc)
+{
+	fr_tls_cache_conf_t const	*cache_conf = &fr_tls_session_conf(ssl)->cache;
+	uint64_t			interval = fr_time_delta_to_sec(cache_conf->session_ticket_key_rotation);
+	uint64_t			current, epoch;
+	tls_cache_ticket_key_t		key;
+	OSSL_PARAM			params[3];
+	int				ret = -1;
+
+	current = (uint64_t)fr_unix_time_to_sec(fr_time_to_unix_time(fr_time())) / interval;
+
+	if (enc) {
+		epoch = current;
+		if (tls_cache_session_ticket_key_get(&key, cache_conf, epoch) < 0) return -1;
+
+		fr_nbo_from_uint64(key_name, epoch);
+		memcpy(key_name + sizeof(uint64_t), key.name, sizeof(key.name));
+
+		if (RAND_bytes(iv, EVP_CIPHER_get_iv_length(EVP_aes_256_cbc())) != 1) goto done;
+		if (EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, key.aes, iv) != 1) goto done;
+	} else {
+		epoch = fr_nbo_to_uint64(key_name);
+
+		/*
+		 *	Tickets from the future, or from intervals so
+		 *	old the session would have expired anyway.
+		 */
+		if ((epoch > current) ||
+		    ((current - epoch) > ((uint64_t)fr_time_delta_to_sec(cache_conf->lifetime) + interval - 1) / interval)) {
+			return 0;
+		}
+
+		if (tls_cache_session_ticket_key_get(&key, cache_conf, epoch) < 0) return -1;
+		if (CRYPTO_memcmp(key_name + sizeof(uint64_t), key.name, sizeof(key.name)) != 0) {
+			ret = 0;
+			goto done;
+		}
+
+		if (EVP_DecryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, key.aes, iv) != 1) goto done;
+	}
+
+	params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmac, sizeof(key.hmac));
+	params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, UNCONST(char *, "SHA256"), 0);
+	params[2] = OSSL_PARAM_construct_end();
+	if (EVP_MAC_CTX_set_params(mac_ctx, params) != 1) goto done;
+
+	ret = (enc || (epoch == current)) ? 1 : 2;
+
+done:
+	if (ret < 0) fr_tls_strerror_printf(NULL);	/* Drain the OpenSSL error stack */
+	OPENSSL_cleanse(&key, sizeof(key));
+
+	return ret;
+}
+
 /** Sets callbacks and flags on a SSL_CTX to enable/disable session resumption
  *
  * @param[in] ctx			to modify.
@@ -1422,81 +1937,59 @@ int fr_tls_cache_ctx_init(SSL_CTX *ctx, fr_tls_cache_conf_t const *cache_conf)
 	{
 		size_t key_len;
 		uint8_t *key_buff;
-		EVP_PKEY_CTX *pkey_ctx = NULL;
 
 		if (!(cache_conf->mode & FR_TLS_CACHE_STATEFUL)) tls_cache_disable_statefull_resumption(ctx);
 
 		/*
-		 *	If keys is NULL, then OpenSSL returns the expected
-		 *	key length, which may be different across different
-		 *	flavours/versions of OpenSSL.
-		 *
-		 *	We could calculate this in conf.c, but, if in future
-		 *	OpenSSL decides to use different key lengths based
-		 *	on other parameters in the ctx, that'd break.
+		 *	Derive a new key every rotation interval,
+		 *	tickets encrypted with older keys are
+		 *	accepted, but renewed.
 		 */
-		key_len = SSL_CTX_set_tlsext_ticket_keys(ctx, NULL, 0);
+		if (fr_time_delta_ispos(cache_conf->session_ticket_key_rotation)) {
+			if (unlikely(SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, tls_cache_session_ticket_key_cb) != 1)) {
+				fr_tls_strerror_printf(NULL);
+				PERROR("Failed setting session ticket key callback");
+				return -1;
+			}
+		} else {
+			/*
+			 *	If keys is NULL, then OpenSSL returns the expected
+			 *	key length, which may be different across different
+			 *	flavours/versions of OpenSSL.
+			 *
+			 *	We could calculate this in conf.c, but, if in future
+			 *	OpenSSL decides to use different key lengths based
+			 *	on other parameters in the ctx, that'd break.
+			 */
+			key_len = SSL_CTX_set_tlsext_ticket_keys(ctx, NULL, 0);
 
-		if (unlikely((pkey_ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL)) == NULL)) {
-			fr_tls_strerror_printf(NULL);
-			PERROR("Failed initialising KDF");
-		kdf_error:
-			if (pkey_ctx) EVP_PKEY_CTX_free(pkey_ctx);
-			return -1;
-		}
-		if (unlikely(EVP_PKEY_derive_init(pkey_ctx) != 1)) {
-			fr_tls_strerror_printf(NULL);
-			PERROR("Failed initialising KDF derivation ctx");
-			goto kdf_error;
-		}
-		if (unlikely(EVP_PKEY_CTX_set_hkdf_md(pkey_ctx, UNCONST(struct evp_md_st *, EVP_sha256())) != 1)) {
-			fr_tls_strerror_printf(NULL);
-			PERROR("Failed setting KDF MD");
-			goto kdf_error;
-		}
-		if (unlikely(EVP_PKEY_CTX_set1_hkdf_key(pkey_ctx,
-							UNCONST(unsigned char *, cache_conf->session_ticket_key),
-							talloc_array_length(cache_conf->session_ticket_key)) != 1)) {
-			fr_tls_strerror_printf(NULL);
-			PERROR("Failed setting KDF key");
-			goto kdf_error;
-		}
-		if (unlikely(EVP_PKEY_CTX_add1_hkdf_info(pkey_ctx,
-							 UNCONST(unsigned char *, "freeradius-session-ticket"),
-							 sizeof("freeradius-session-ticket") - 1) != 1)) {
-			fr_tls_strerror_printf(NULL);
-			PERROR("Failed setting KDF label");
-			goto kdf_error;
-		}
+			/*
+			 *	SSL_CTX_set_tlsext_ticket_keys memcpys its
+			 *	inputs so this is just a temporary buffer.
+			 */
+			MEM(key_buff = talloc_array(NULL, uint8_t, key_len));
+			if (tls_cache_session_ticket_key_derive(key_buff, key_len, cache_conf,
+								(uint8_t const *)SESSION_TICKET_KEY_INFO,
+								sizeof(SESSION_TICKET_KEY_INFO) - 1) < 0) {
+				talloc_free(key_buff);
+				return -1;
+			}
 
-		/*
-		 *	SSL_CTX_set_tlsext_ticket_keys memcpys its
-		 *	inputs so this is just a temporary buffer.
-		 */
-		MEM(key_buff = talloc_array(NULL, uint8_t, key_len));
-		if (EVP_PKEY_derive(pkey_ctx, key_buff, &key_len) != 1) {
-			fr_tls_strerror_printf(NULL);
-			PERROR("Failed deriving session ticket key");
+			/*
+			 *	Ensure the same keys are used across all threads
+			 */
+			if (SSL_CTX_set_tlsext_ticket_keys(ctx,
+							   key_buff, key_len) != 1) {
+				fr_tls_strerror_printf(NULL);
+				PERROR("Failed setting session ticket keys");
+				talloc_free(key_buff);
+				return -1;
+			}
 
+			DEBUG3("Derived session-ticket-key:");
+			HEXDUMP3(key_buff, key_len, NULL);
 			talloc_free(key_buff);
-			goto kdf_error;
 		}
-		EVP_PKEY_CTX_free(pkey_ctx);
-
-		fr_assert(talloc_array_length(key_buff) == key_len);
-		/*
-		 *	Ensure the same keys are used across all threads
-		 */
-		if (SSL_CTX_set_tlsext_ticket_keys(ctx,
-						   key_buff, key_len) != 1) {
-			fr_tls_strerror_printf(NULL);
-			PERROR("Failed setting session ticket keys");
-			return -1;
-		}
-
-		DEBUG3("Derived session-ticket-key:");
-		HEXDUMP3(key_buff, key_len, NULL);
-		talloc_free(key_buff);
 
 		/*
 		 *	These callbacks embed and extract the
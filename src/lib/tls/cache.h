@@ -111,6 +111,10 @@ int		fr_tls_cache_disable_cb(SSL *ssl, int is_forward_secure);
 
 void		fr_tls_cache_session_alloc(fr_tls_session_t *tls_session);
 
+fr_tls_cache_store_t *fr_tls_cache_store_alloc(TALLOC_CTX *ctx, uint32_t max_entries, uint32_t num_shards);
+
+fr_tls_cache_ticket_keys_t *fr_tls_cache_ticket_keys_alloc(TALLOC_CTX *ctx);
+
 int		fr_tls_cache_ctx_init(SSL_CTX *ctx, fr_tls_cache_conf_t const *cache_conf);
 
 #ifdef __cplusplus
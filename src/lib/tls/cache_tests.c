@@ -0,0 +1,347 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the in-memory session store and rotating session ticket keys
+ *
+ * @file src/lib/tls/cache_tests.c
+ * @copyright 2026 The FreeRADIUS server project
+ */
+
+static void test_init(void);
+#  define TEST_INIT  test_init()
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include "cache.c"
+
+#define TEST_ROTATION		(3600)
+#define TEST_LIFETIME		(86400)
+
+static TALLOC_CTX	*autofree;
+static SSL_CTX		*ssl_ctx;
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("cache_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) goto error;
+
+	if (fr_openssl_init() < 0) goto error;
+
+	ssl_ctx = SSL_CTX_new(TLS_server_method());
+	if (!ssl_ctx) goto error;
+}
+
+/** Allocate a TLS configuration using rotating session ticket keys
+ *
+ */
+static fr_tls_conf_t *test_conf_alloc(void)
+{
+	fr_tls_conf_t	*conf;
+
+	MEM(conf = talloc_zero(autofree, fr_tls_conf_t));
+	MEM(conf->cache.session_ticket_key = talloc_memdup(conf, (uint8_t const *)"testing123", 10));
+	conf->cache.lifetime = fr_time_delta_from_sec(TEST_LIFETIME);
+	conf->cache.session_ticket_key_rotation = fr_time_delta_from_sec(TEST_ROTATION);
+	conf->cache.ticket_keys = fr_tls_cache_ticket_keys_alloc(conf);
+
+	return conf;
+}
+
+/** Create a DER encoded session with every byte of the session ID set to id
+ *
+ */
+static uint8_t *test_session_alloc(uint8_t id)
+{
+	SSL		*ssl;
+	SSL_SESSION	*sess;
+	uint8_t		id_buff[SSL_MAX_SSL_SESSION_ID_LENGTH];
+	uint8_t		master_key[SSL_MAX_MASTER_KEY_LENGTH];
+	uint8_t		*der, *p;
+	int		len;
+
+	memset(id_buff, id, sizeof(id_buff));
+	memset(master_key, 0x42, sizeof(master_key));
+
+	MEM(ssl = SSL_new(ssl_ctx));
+	MEM(sess = SSL_SESSION_new());
+	TEST_CHECK(SSL_SESSION_set1_id(sess, id_buff, sizeof(id_buff)) == 1);
+	TEST_CHECK(SSL_SESSION_set_protocol_version(sess, TLS1_3_VERSION) == 1);
+	TEST_CHECK(SSL_SESSION_set_cipher(sess, sk_SSL_CIPHER_value(SSL_get_ciphers(ssl), 0)) == 1);
+	TEST_CHECK(SSL_SESSION_set1_master_key(sess, master_key, sizeof(master_key)) == 1);
+
+	len = i2d_SSL_SESSION(sess, NULL);
+	TEST_CHECK(len > 0);
+	MEM(p = der = talloc_array(autofree, uint8_t, len));
+	i2d_SSL_SESSION(sess, &p);
+
+	SSL_SESSION_free(sess);
+	SSL_free(ssl);
+
+	return der;
+}
+
+/** Check whether a session with the given ID can be resumed from the store
+ *
+ */
+static bool test_session_found(fr_tls_cache_store_t *store, uint8_t id)
+{
+	SSL_SESSION	*sess;
+	uint8_t		id_buff[SSL_MAX_SSL_SESSION_ID_LENGTH];
+	uint8_t const	*found_id;
+	unsigned int	found_id_len;
+
+	memset(id_buff, id, sizeof(id_buff));
+
+	sess = tls_cache_store_find(store, id_buff, sizeof(id_buff));
+	if (!sess) return false;
+
+	found_id = SSL_SESSION_get_id(sess, &found_id_len);
+	TEST_CHECK(found_id_len == sizeof(id_buff));
+	TEST_CHECK(memcmp(found_id, id_buff, sizeof(id_buff)) == 0);
+	SSL_SESSION_free(sess);
+
+	return true;
+}
+
+static void test_session_add(fr_tls_cache_store_t *store, uint8_t id, fr_time_t expires)
+{
+	uint8_t		id_buff[SSL_MAX_SSL_SESSION_ID_LENGTH];
+	uint8_t		*der = test_session_alloc(id);
+
+	memset(id_buff, id, sizeof(id_buff));
+	tls_cache_store_add(store, id_buff, sizeof(id_buff), der, talloc_array_length(der), expires);
+	talloc_free(der);
+}
+
+static void test_store_resume(void)
+{
+	fr_tls_cache_store_t	*store;
+	fr_time_t		expires = fr_time_add(fr_time(), fr_time_delta_from_sec(60));
+	uint8_t			id_buff[SSL_MAX_SSL_SESSION_ID_LENGTH];
+
+	store = fr_tls_cache_store_alloc(autofree, 16, 4);
+
+	TEST_CASE("Stored sessions can be resumed");
+	test_session_add(store, 1, expires);
+	test_session_add(store, 2, expires);
+	TEST_CHECK(test_session_found(store, 1));
+	TEST_CHECK(test_session_found(store, 2));
+
+	TEST_CASE("Unknown sessions are not found");
+	TEST_CHECK(!test_session_found(store, 3));
+
+	TEST_CASE("Expired sessions can't be resumed");
+	test_session_add(store, 4, fr_time_sub(fr_time(), fr_time_delta_from_sec(1)));
+	TEST_CHECK(!test_session_found(store, 4));
+
+	TEST_CASE("Removed sessions can't be resumed");
+	memset(id_buff, 1, sizeof(id_buff));
+	tls_cache_store_remove(store, id_buff, sizeof(id_buff));
+	TEST_CHECK(!test_session_found(store, 1));
+	TEST_CHECK(test_session_found(store, 2));
+
+	talloc_free(store);
+}
+
+static void test_store_evict(void)
+{
+	fr_tls_cache_store_t	*store;
+	fr_time_t		expires = fr_time_add(fr_time(), fr_time_delta_from_sec(60));
+
+	store = fr_tls_cache_store_alloc(autofree, 2, 1);
+
+	TEST_CASE("Fill the store");
+	test_session_add(store, 1, expires);
+	test_session_add(store, 2, expires);
+	TEST_CHECK(fr_rb_num_elements(&store->shards[0].tree) == 2);
+
+	TEST_CASE("Replacing a session doesn't evict anything");
+	test_session_add(store, 2, expires);
+	TEST_CHECK(fr_rb_num_elements(&store->shards[0].tree) == 2);
+	TEST_CHECK(test_session_found(store, 1));
+
+	TEST_CASE("The oldest session is evicted when the store is full");
+	test_session_add(store, 3, expires);
+	TEST_CHECK(fr_rb_num_elements(&store->shards[0].tree) == 2);
+	TEST_CHECK(!test_session_found(store, 1));
+	TEST_CHECK(test_session_found(store, 2));
+	TEST_CHECK(test_session_found(store, 3));
+
+	talloc_free(store);
+}
+
+static void test_ticket_key_cache(void)
+{
+	fr_tls_conf_t		*conf = test_conf_alloc();
+	tls_cache_ticket_key_t	derived, cached, next;
+
+	TEST_CASE("Cached keys match the derived keys");
+	TEST_CHECK(tls_cache_session_ticket_key_epoch(&derived, &conf->cache, 100) == 0);
+	TEST_CHECK(tls_cache_session_ticket_key_get(&cached, &conf->cache, 100) == 0);
+	TEST_CHECK(memcmp(&derived, &cached, sizeof(derived)) == 0);
+	TEST_CHECK(conf->cache.ticket_keys->slot[100 % TLS_CACHE_TICKET_KEYS].valid);
+
+	TEST_CASE("Keys are served from the cache");
+	TEST_CHECK(tls_cache_session_ticket_key_get(&cached, &conf->cache, 100) == 0);
+	TEST_CHECK(memcmp(&derived, &cached, sizeof(derived)) == 0);
+
+	TEST_CASE("Each interval has different keys");
+	TEST_CHECK(tls_cache_session_ticket_key_get(&next, &conf->cache, 101) == 0);
+	TEST_CHECK(memcmp(&derived, &next, sizeof(derived)) != 0);
+
+	TEST_CASE("An interval using the same slot replaces the cached keys");
+	TEST_CHECK(tls_cache_session_ticket_key_get(&next, &conf->cache, 100 + TLS_CACHE_TICKET_KEYS) == 0);
+	TEST_CHECK(memcmp(&derived, &next, sizeof(derived)) != 0);
+	TEST_CHECK(conf->cache.ticket_keys->slot[100 % TLS_CACHE_TICKET_KEYS].epoch == 100 + TLS_CACHE_TICKET_KEYS);
+	TEST_CHECK(tls_cache_session_ticket_key_get(&cached, &conf->cache, 100) == 0);
+	TEST_CHECK(memcmp(&derived, &cached, sizeof(derived)) == 0);
+
+	talloc_free(conf);
+}
+
+/** Call the ticket key callback, as OpenSSL would
+ *
+ */
+static int test_ticket_key_cb(SSL *ssl, unsigned char key_name[16], unsigned char iv[EVP_MAX_IV_LENGTH],
+			      EVP_CIPHER_CTX **cipher_ctx, EVP_MAC_CTX **mac_ctx, int enc)
+{
+	EVP_MAC		*mac;
+
+	MEM(*cipher_ctx = EVP_CIPHER_CTX_new());
+	MEM(mac = EVP_MAC_fetch(NULL, "HMAC", NULL));
+	MEM(*mac_ctx = EVP_MAC_CTX_new(mac));
+	EVP_MAC_free(mac);
+
+	return tls_cache_session_ticket_key_cb(ssl, key_name, iv, *cipher_ctx, *mac_ctx, enc);
+}
+
+/** Compute the HMAC of a ticket with a context set up by the callback
+ *
+ */
+static size_t test_ticket_mac(EVP_MAC_CTX *mac_ctx, uint8_t const *in, size_t in_len, uint8_t *out, size_t out_len)
+{
+	size_t		len = 0;
+
+	TEST_CHECK(EVP_MAC_init(mac_ctx, NULL, 0, NULL) == 1);
+	TEST_CHECK(EVP_MAC_update(mac_ctx, in, in_len) == 1);
+	TEST_CHECK(EVP_MAC_final(mac_ctx, out, &len, out_len) == 1);
+
+	return len;
+}
+
+static void test_ticket_key_rotation(void)
+{
+	fr_tls_conf_t		*conf = test_conf_alloc();
+	SSL			*ssl;
+	EVP_CIPHER_CTX		*cipher_ctx;
+	EVP_MAC_CTX		*mac_ctx;
+	tls_cache_ticket_key_t	key;
+
+	unsigned char		key_name[16], old_key_name[16];
+	unsigned char		iv[EVP_MAX_IV_LENGTH];
+	uint8_t			plaintext[] = "session ticket";
+	uint8_t			ticket[sizeof(plaintext) + EVP_MAX_BLOCK_LENGTH], decrypted[sizeof(ticket)];
+	uint8_t			mac[EVP_MAX_MD_SIZE], check_mac[EVP_MAX_MD_SIZE];
+	size_t			mac_len;
+	int			len, ticket_len, decrypted_len;
+	uint64_t		current;
+
+	MEM(ssl = SSL_new(ssl_ctx));
+	SSL_set_ex_data(ssl, FR_TLS_EX_INDEX_CONF, conf);
+
+	current = (uint64_t)fr_unix_time_to_sec(fr_time_to_unix_time(fr_time())) / TEST_ROTATION;
+
+	TEST_CASE("Tickets are encrypted with the key for the current interval");
+	TEST_CHECK(test_ticket_key_cb(ssl, key_name, iv, &cipher_ctx, &mac_ctx, 1) == 1);
+	TEST_CHECK(fr_nbo_to_uint64(key_name) == current);
+
+	TEST_CHECK(EVP_EncryptUpdate(cipher_ctx, ticket, &len, plaintext, sizeof(plaintext)) == 1);
+	ticket_len = len;
+	TEST_CHECK(EVP_EncryptFinal_ex(cipher_ctx, ticket + ticket_len, &len) == 1);
+	ticket_len += len;
+	mac_len = test_ticket_mac(mac_ctx, ticket, ticket_len, mac, sizeof(mac));
+
+	EVP_CIPHER_CTX_free(cipher_ctx);
+	EVP_MAC_CTX_free(mac_ctx);
+
+	TEST_CASE("Tickets from the current interval are decrypted without renewal");
+	TEST_CHECK(test_ticket_key_cb(ssl, key_name, iv, &cipher_ctx, &mac_ctx, 0) == 1);
+	TEST_CHECK(test_ticket_mac(mac_ctx, ticket, ticket_len, check_mac, sizeof(check_mac)) == mac_len);
+	TEST_CHECK(memcmp(mac, check_mac, mac_len) == 0);
+
+	TEST_CHECK(EVP_DecryptUpdate(cipher_ctx, decrypted, &len, ticket, ticket_len) == 1);
+	decrypted_len = len;
+	TEST_CHECK(EVP_DecryptFinal_ex(cipher_ctx, decrypted + decrypted_len, &len) == 1);
+	decrypted_len += len;
+	TEST_CHECK(decrypted_len == sizeof(plaintext));
+	TEST_CHECK(memcmp(decrypted, plaintext, sizeof(plaintext)) == 0);
+
+	EVP_CIPHER_CTX_free(cipher_ctx);
+	EVP_MAC_CTX_free(mac_ctx);
+
+	TEST_CASE("Tickets from a previous interval are accepted, but renewed");
+	TEST_CHECK(tls_cache_session_ticket_key_epoch(&key, &conf->cache, current - 1) == 0);
+	fr_nbo_from_uint64(old_key_name, current - 1);
+	memcpy(old_key_name + sizeof(uint64_t), key.name, sizeof(key.name));
+	TEST_CHECK(test_ticket_key_cb(ssl, old_key_name, iv, &cipher_ctx, &mac_ctx, 0) == 2);
+	EVP_CIPHER_CTX_free(cipher_ctx);
+	EVP_MAC_CTX_free(mac_ctx);
+
+	TEST_CASE("Tickets older than the session lifetime are rejected");
+	TEST_CHECK(tls_cache_session_ticket_key_epoch(&key, &conf->cache,
+						      current - (TEST_LIFETIME / TEST_ROTATION) - 1) == 0);
+	fr_nbo_from_uint64(old_key_name, current - (TEST_LIFETIME / TEST_ROTATION) - 1);
+	memcpy(old_key_name + sizeof(uint64_t), key.name, sizeof(key.name));
+	TEST_CHECK(test_ticket_key_cb(ssl, old_key_name, iv, &cipher_ctx, &mac_ctx, 0) == 0);
+	EVP_CIPHER_CTX_free(cipher_ctx);
+	EVP_MAC_CTX_free(mac_ctx);
+
+	TEST_CASE("Tickets from the future are rejected");
+	fr_nbo_from_uint64(old_key_name, current + 1);
+	TEST_CHECK(test_ticket_key_cb(ssl, old_key_name, iv, &cipher_ctx, &mac_ctx, 0) == 0);
+	EVP_CIPHER_CTX_free(cipher_ctx);
+	EVP_MAC_CTX_free(mac_ctx);
+
+	TEST_CASE("Tickets with an unknown key name are rejected");
+	key_name[sizeof(key_name) - 1] ^= 0xff;
+	TEST_CHECK(test_ticket_key_cb(ssl, key_name, iv, &cipher_ctx, &mac_ctx, 0) == 0);
+	EVP_CIPHER_CTX_free(cipher_ctx);
+	EVP_MAC_CTX_free(mac_ctx);
+
+	SSL_free(ssl);
+	talloc_free(conf);
+}
+
+TEST_LIST = {
+	{ "store_resume",		test_store_resume },
+	{ "store_evict",		test_store_evict },
+	{ "ticket_key_cache",		test_ticket_key_cache },
+	{ "ticket_key_rotation",	test_ticket_key_rotation },
+
+	TEST_TERMINATOR
+};
@@ -81,6 +81,13 @@ static fr_table_num_sorted_t const verify_mode_table[] = {
 };
 static size_t verify_mode_table_len = NUM_ELEMENTS(verify_mode_table);
 
+static conf_parser_t tls_cache_local_config[] = {
+	{ FR_CONF_OFFSET("max_entries", fr_tls_cache_conf_t, local.max_entries), .dflt = "0" },
+	{ FR_CONF_OFFSET("shards", fr_tls_cache_conf_t, local.shards), .dflt = "16" },
+
+	CONF_PARSER_TERMINATOR
+};
+
 static conf_parser_t tls_cache_config[] = {
 	{ FR_CONF_OFFSET("mode", fr_tls_cache_conf_t, mode),
 			 .func = tls_conf_parse_cache_mode,
@@ -97,6 +104,9 @@ static conf_parser_t tls_cache_config[] = {
 	{ FR_CONF_OFFSET("require_perfect_forward_secrecy", fr_tls_cache_conf_t, require_pfs), .dflt = "no" },
 
 	{ FR_CONF_OFFSET("session_ticket_key", fr_tls_cache_conf_t, session_ticket_key) },
+	{ FR_CONF_OFFSET("session_ticket_key_rotation", fr_tls_cache_conf_t, session_ticket_key_rotation), .dflt = "0" },
+
+	{ FR_CONF_POINTER("local", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) tls_cache_local_config },
 
 	/*
 	 *	Deprecated
@@ -517,6 +527,36 @@ fr_tls_conf_t *fr_tls_conf_parse_server(CONF_SECTION *cs)
 
 	FR_INTEGER_BOUND_CHECK("padding", conf->padding_block_size, <=, SSL3_RT_MAX_PLAIN_LENGTH);
 
+	/*
+	 *	Rotating more often than this would mean clients
+	 *	renew their tickets on almost every resumption.
+	 */
+	if (fr_time_delta_ispos(conf->cache.session_ticket_key_rotation)) {
+		FR_TIME_DELTA_BOUND_CHECK("cache.session_ticket_key_rotation",
+					  conf->cache.session_ticket_key_rotation, >=, fr_time_delta_from_sec(60));
+
+		conf->cache.ticket_keys = fr_tls_cache_ticket_keys_alloc(conf);
+	}
+
+	/*
+	 *	The in-memory store only holds stateful sessions.
+	 */
+	if (conf->cache.local.max_entries > 0) {
+		if (!(conf->cache.mode & FR_TLS_CACHE_STATEFUL)) {
+			cf_log_warn(cs, "cache.local.max_entries is only used with stateful session-resumption, "
+				    "ignoring");
+		} else {
+			FR_INTEGER_BOUND_CHECK("cache.local.shards", conf->cache.local.shards, >=, 1);
+			FR_INTEGER_BOUND_CHECK("cache.local.shards", conf->cache.local.shards, <=, 1024);
+			if (conf->cache.local.shards > conf->cache.local.max_entries) {
+				conf->cache.local.shards = conf->cache.local.max_entries;
+			}
+
+			conf->cache.store = fr_tls_cache_store_alloc(conf, conf->cache.local.max_entries,
+								     conf->cache.local.shards);
+		}
+	}
+
 #ifdef __APPLE__
 	if (conf_cert_admin_password(conf) < 0) goto error;
 #endif
@@ -5,7 +5,9 @@ SUBMAKEFILES := \
 	dcursor_typed_tests.mk \
 	dlist_tests.mk \
 	edit_tests.mk \
+	event_tests.mk \
 	heap_tests.mk \
+	histogram_tests.mk \
 	hmac_tests.mk \
 	libfreeradius-util.mk \
 	lst_tests.mk \
@@ -44,6 +44,34 @@ typedef struct fr_event_list_s fr_event_list_t;
 #include <sys/stat.h>
 #include <sys/wait.h>
 
+/*
+ *	On Linux, socket and pipe I/O is serviced by epoll directly
+ *	instead of going through libkqueue's emulation layer.  PID,
+ *	user and vnode events, and regular files, still use kqueue.
+ *
+ *	libkqueue doesn't document a way to wait for its events with
+ *	epoll, so kqueue is polled with a zero timeout on every pass
+ *	through the event loop.  While any events are registered with
+ *	kqueue, we don't sleep in epoll_wait() for longer than
+ *	EVENT_KQUEUE_POLL_MSEC.
+ *
+ *	Define WITHOUT_EVENT_EPOLL to use kqueue for everything.
+ */
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H) && !defined(WITHOUT_EVENT_EPOLL)
+#  define WITH_EVENT_EPOLL 1
+#  include <sys/epoll.h>
+#  include <sys/ioctl.h>
+#  include <sys/timerfd.h>
+
+#  define EVENT_KQUEUE_POLL_MSEC	(10)
+
+#  define EVENT_KQ_WATCH_ADD(_el)	((_el)->kq_watches++)
+#  define EVENT_KQ_WATCH_DEL(_el)	((_el)->kq_watches--)
+#else
+#  define EVENT_KQ_WATCH_ADD(_el)
+#  define EVENT_KQ_WATCH_DEL(_el)
+#endif
+
 #ifdef NDEBUG
 /*
  *	Turn off documentation warnings as file/line
@@ -280,6 +308,12 @@ struct fr_event_fd {
 	bool			is_registered;		//!< Whether this fr_event_fd_t's FD has been registered with
 							///< kevent.  Mostly for debugging.
 
+#ifdef WITH_EVENT_EPOLL
+	bool			epoll;			//!< I/O events for this FD are handled by epoll
+							///< instead of kqueue.
+	uint32_t		epoll_events;		//!< Events currently registered with epoll.
+#endif
+
 	void			*uctx;			//!< Context pointer to pass to each file descriptor callback.
 	TALLOC_CTX		*linked_ctx;		//!< talloc ctx this event was bound to.
 
@@ -397,6 +431,18 @@ struct fr_event_list_s {
 
 	struct kevent			events[FR_EV_BATCH_FDS]; /* so it doesn't go on the stack every time */
 
+#ifdef WITH_EVENT_EPOLL
+	int				epfd;			//!< epoll instance for socket and pipe I/O.
+	int				timerfd;		//!< Wakes us from epoll_wait() for timer events.
+	fr_time_t			timer_armed;		//!< When timerfd is set to fire, zero if disarmed.
+	unsigned int			kq_watches;		//!< PID, user and FD events registered with kqueue.
+
+	/*
+	 *	Each epoll event can produce a read and a write kevent.
+	 */
+	struct epoll_event		epoll_events[FR_EV_BATCH_FDS / 2];
+#endif
+
 	bool				in_handler;		//!< Deletes should be deferred until after the
 								///< handlers complete.
 
@@ -740,6 +786,71 @@ static ssize_t fr_event_build_evset(
 	return out - out_kev;
 }
 
+#ifdef WITH_EVENT_EPOLL
+/** Apply a set of EVFILT_READ/EVFILT_WRITE changes to the epoll set
+ *
+ * @param[in] el	the FD is registered with.
+ * @param[in] ef	the changes apply to.
+ * @param[in] evset	produced by #fr_event_build_evset.
+ * @param[in] count	number of changes in evset.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, errno will be set.
+ */
+static int event_epoll_apply(fr_event_list_t *el, fr_event_fd_t *ef, struct kevent const evset[], int count)
+{
+	uint32_t		events = ef->epoll_events;
+	struct epoll_event	ev;
+	int			i, op;
+
+	for (i = 0; i < count; i++) {
+		uint32_t mask = (evset[i].filter == EVFILT_READ) ? (EPOLLIN | EPOLLRDHUP) : EPOLLOUT;
+
+		if (evset[i].flags & EV_DELETE) {
+			events &= ~mask;
+		} else {
+			events |= mask;
+		}
+	}
+
+	if (events == ef->epoll_events) return 0;
+
+	if (!ef->epoll_events) {
+		op = EPOLL_CTL_ADD;
+	} else if (!events) {
+		op = EPOLL_CTL_DEL;
+	} else {
+		op = EPOLL_CTL_MOD;
+	}
+
+	ev = (struct epoll_event){ .events = events, .data.ptr = ef };
+	if (epoll_ctl(el->epfd, op, ef->fd, &ev) < 0) return -1;
+
+	ef->epoll_events = events;
+
+	return 0;
+}
+#endif
+
+/** Submit filter changes for a file descriptor
+ *
+ * @param[in] el	the FD is registered with.
+ * @param[in] ef	the changes apply to.
+ * @param[in] evset	produced by #fr_event_build_evset.
+ * @param[in] count	number of changes in evset.
+ * @return
+ *	- >= 0 on success.
+ *	- -1 on failure, errno will be set.
+ */
+static inline CC_HINT(always_inline)
+int event_fd_changes_apply(fr_event_list_t *el, fr_event_fd_t *ef, struct kevent evset[], int count)
+{
+#ifdef WITH_EVENT_EPOLL
+	if (ef->epoll) return event_epoll_apply(el, ef, evset, count);
+#endif
+	return kevent(el->kq, evset, count, NULL, 0, NULL);
+}
+
 /** Discover the type of a file descriptor
  *
  * This function writes the result of the discovery to the ef->type,
@@ -772,6 +883,9 @@ static int fr_event_fd_type_set(fr_event_fd_t *ef, int fd)
 		{
 			ef->type = FR_EVENT_FD_SOCKET;
 		}
+#ifdef WITH_EVENT_EPOLL
+		ef->epoll = true;
+#endif
 
 	/*
 	 *	It's a file or directory
@@ -794,6 +908,14 @@ static int fr_event_fd_type_set(fr_event_fd_t *ef, int fd)
 		} else {
 			ef->type = FR_EVENT_FD_FILE;
 		}
+
+#ifdef WITH_EVENT_EPOLL
+		/*
+		 *	epoll can't watch regular files, but
+		 *	pipes are fine.
+		 */
+		ef->epoll = S_ISFIFO(buf.st_mode);
+#endif
 	}
 	ef->fd = fd;
 
@@ -835,7 +957,7 @@ static int _event_fd_delete(fr_event_fd_t *ef)
 			/*
 			 *	If this fails, assert on debug builds.
 			 */
-			ret = kevent(el->kq, evset, count, NULL, 0, NULL);
+			ret = event_fd_changes_apply(el, ef, evset, count);
 			if (!fr_cond_assert_msg(ret >= 0,
 						"FD %i was closed without being removed from the KQ: %s",
 						ef->fd, fr_syserror(errno))) {
@@ -845,6 +967,9 @@ static int _event_fd_delete(fr_event_fd_t *ef)
 
 		fr_rb_delete(el->fds, ef);
 		ef->is_registered = false;
+#ifdef WITH_EVENT_EPOLL
+		if (!ef->epoll) EVENT_KQ_WATCH_DEL(el);
+#endif
 	}
 
 	/*
@@ -997,7 +1122,7 @@ int _fr_event_filter_update(NDEBUG_LOCATION_ARGS
 		return -1;
 	}
 
-	if (count && unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0)) {
+	if (count && unlikely(event_fd_changes_apply(el, ef, evset, count) < 0)) {
 		fr_strerror_printf("Failed updating filters for FD %i: %s", ef->fd, fr_syserror(errno));
 		goto error;
 	}
@@ -1100,11 +1225,14 @@ int _fr_event_filter_insert(NDEBUG_LOCATION_ARGS
 		}
 		ef->map = &filter_maps[filter];
 		if (ef->map->idx_type == FR_EVENT_FUNC_IDX_NONE) goto not_supported;
+#ifdef WITH_EVENT_EPOLL
+		if (filter != FR_EVENT_FILTER_IO) ef->epoll = false;
+#endif
 
 		count = fr_event_build_evset(el, evset, sizeof(evset)/sizeof(*evset),
 					     &ef->active, ef, funcs, &ef->active);
 		if (count < 0) goto free;
-		if (count && (unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0))) {
+		if (count && (unlikely(event_fd_changes_apply(el, ef, evset, count) < 0))) {
 			fr_strerror_printf("Failed inserting filters for FD %i: %s", fd, fr_syserror(errno));
 			goto free;
 		}
@@ -1112,6 +1240,9 @@ int _fr_event_filter_insert(NDEBUG_LOCATION_ARGS
 		ef->filter = filter;
 		fr_rb_insert(el->fds, ef);
 		ef->is_registered = true;
+#ifdef WITH_EVENT_EPOLL
+		if (!ef->epoll) EVENT_KQ_WATCH_ADD(el);
+#endif
 
 	/*
 	 *	Pre-existing event, update the filters and
@@ -1136,7 +1267,7 @@ int _fr_event_filter_insert(NDEBUG_LOCATION_ARGS
 			memcpy(&ef->active, &active, sizeof(ef->active));
 			return -1;
 		}
-		if (count && (unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0))) {
+		if (count && (unlikely(event_fd_changes_apply(el, ef, evset, count) < 0))) {
 			fr_strerror_printf("Failed modifying filters for FD %i: %s", fd, fr_syserror(errno));
 			goto error;
 		}
@@ -1346,6 +1477,7 @@ static int _event_pid_free(fr_event_pid_t *ev)
 	EV_SET(&evset, ev->pid, EVFILT_PROC, EV_DELETE, NOTE_EXIT, 0, ev);
 
 	(void) kevent(ev->el->kq, &evset, 1, NULL, 0, NULL);
+	EVENT_KQ_WATCH_DEL(ev->el);
 
 	return 0;
 }
@@ -1374,6 +1506,7 @@ void event_pid_eval(fr_event_list_t *el, struct kevent *kev)
 	callback = ev->callback;
 	uctx = ev->uctx;
 
+	if (ev->is_registered) EVENT_KQ_WATCH_DEL(el);
 	ev->is_registered = false;	/* so we won't hit kevent again when it's freed */
 
 	/*
@@ -1596,6 +1729,8 @@ int _fr_event_pid_wait(NDEBUG_LOCATION_ARGS
 		}
 	}
 
+	if (ev->is_registered) EVENT_KQ_WATCH_ADD(el);
+
 	/*
 	 *	Sometimes the caller doesn't care about getting the
 	 *	PID.  But we still want to clean it up.
@@ -1845,6 +1980,7 @@ static int _event_user_delete(fr_event_user_t *ev)
 			return -1;
 		}
 		ev->is_registered = false;
+		EVENT_KQ_WATCH_DEL(ev->el);
 	}
 
 	return 0;
@@ -1910,6 +2046,7 @@ int _fr_event_user_insert(NDEBUG_LOCATION_ARGS
 		return -1;
 	}
 	ev->is_registered = true;
+	EVENT_KQ_WATCH_ADD(el);
 	talloc_set_destructor(ev, _event_user_delete);
 
 	if (ev_p) *ev_p = ev;
@@ -2046,6 +2183,144 @@ int fr_event_post_delete(fr_event_list_t *el, fr_event_post_cb_t callback, void
 	return -1;
 }
 
+#ifdef WITH_EVENT_EPOLL
+/** Convert an epoll event into the kevents kqueue would have produced
+ *
+ * @param[out] out	Where to write the kevents.
+ * @param[in] ef	the epoll event is for.
+ * @param[in] events	returned by epoll_wait().
+ * @return The number of kevents written to out.
+ */
+static int event_epoll_to_kevent(struct kevent out[static 2], fr_event_fd_t *ef, uint32_t events)
+{
+	int		count = 0;
+	uint16_t	flags = 0;
+	uint32_t	fflags = 0;
+
+	/*
+	 *	kqueue sets EV_EOF on both filters, and for
+	 *	sockets reports the socket error in fflags.
+	 */
+	if (unlikely(events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR))) {
+		flags |= EV_EOF;
+
+		if ((events & EPOLLERR) && (ef->type & (FR_EVENT_FD_SOCKET | FR_EVENT_FD_PCAP))) {
+			int		sock_error = 0;
+			socklen_t	len = sizeof(sock_error);
+
+			if (getsockopt(ef->fd, SOL_SOCKET, SO_ERROR, &sock_error, &len) == 0) fflags = sock_error;
+		}
+	}
+
+	if ((ef->epoll_events & EPOLLIN) && (events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP | EPOLLERR))) {
+		intptr_t data = 0;
+
+		/*
+		 *	Only the read filter reports the number of
+		 *	bytes still available to read at EOF.
+		 */
+		if (flags & EV_EOF) {
+			int avail;
+
+			if (ioctl(ef->fd, FIONREAD, &avail) == 0) data = avail;
+		}
+
+		EV_SET(&out[count++], ef->fd, EVFILT_READ, flags, fflags, data, ef);
+	}
+
+	if ((ef->epoll_events & EPOLLOUT) && (events & (EPOLLOUT | EPOLLHUP | EPOLLERR))) {
+		EV_SET(&out[count++], ef->fd, EVFILT_WRITE, flags, fflags, 0, ef);
+	}
+
+	return count;
+}
+
+/** Wait for I/O, timer, or kqueue events
+ *
+ * Events for sockets and pipes are converted to kevents, so they're
+ * serviced by exactly the same code as events from kqueue.
+ *
+ * kqueue is polled with a zero timeout first.  If it has events, we
+ * only collect the I/O events which are already ready.  Otherwise,
+ * while anything is registered with kqueue, we don't sleep for more
+ * than EVENT_KQUEUE_POLL_MSEC, as nothing would wake us up for a
+ * kqueue event.
+ *
+ * epoll_wait() only has millisecond resolution, so timer events are
+ * delivered via a timerfd, which is only re-armed when the next timer
+ * event changes.
+ *
+ * @param[in] el	to wait for events on.
+ * @param[in] next	When the next timer event fires, zero if there are none.
+ * @param[in] wake	How long to wait.  NULL to wait indefinitely.
+ * @return
+ *	- >= 0 the number of events written to el->events.
+ *	- -1 on error, errno will be set.
+ */
+static int event_epoll_wait(fr_event_list_t *el, fr_time_t next, fr_time_delta_t const *wake)
+{
+	int	num, i, timeout, max, count;
+
+	count = kevent(el->kq, NULL, 0, el->events, FR_EV_BATCH_FDS, &(struct timespec){});
+	if (count < 0) return -1;
+
+	if (count || (wake && !fr_time_delta_ispos(*wake))) {
+		timeout = 0;
+	} else {
+		timeout = el->kq_watches ? EVENT_KQUEUE_POLL_MSEC : -1;
+
+		if (wake && fr_time_neq(el->timer_armed, next)) {
+			struct itimerspec its = { .it_value = fr_time_delta_to_timespec(*wake) };
+
+			if (unlikely(timerfd_settime(el->timerfd, 0, &its, NULL) < 0)) return -1;
+			el->timer_armed = next;
+
+		/*
+		 *	Stop stale timers waking us up.
+		 */
+		} else if (!wake && fr_time_neq(el->timer_armed, fr_time_wrap(0))) {
+			if (unlikely(timerfd_settime(el->timerfd, 0, &(struct itimerspec){}, NULL) < 0)) return -1;
+			el->timer_armed = fr_time_wrap(0);
+		}
+	}
+
+	/*
+	 *	No room for more events, the rest will be
+	 *	collected on the next pass.
+	 */
+	max = (FR_EV_BATCH_FDS - count) / 2;
+	if (!max) return count;
+
+	num = epoll_wait(el->epfd, el->epoll_events, max, timeout);
+	if (num < 0) {
+		/*
+		 *	Don't lose the kqueue events, PID events
+		 *	are oneshot.
+		 */
+		if ((errno == EINTR) && count) return count;
+		return -1;
+	}
+
+	for (i = 0; i < num; i++) {
+		struct epoll_event *ev = &el->epoll_events[i];
+
+		/*
+		 *	Always re-arm after the timerfd fires, so
+		 *	we can't miss a timer event if the event
+		 *	list's clock lags the monotonic clock.
+		 */
+		if (ev->data.ptr == &el->timerfd) {
+			el->timer_armed = fr_time_wrap(0);
+			continue;
+		}
+
+		count += event_epoll_to_kevent(&el->events[count], ev->data.ptr, ev->events);
+	}
+
+	return count;
+}
+#endif
+
 /** Gather outstanding timer and file descriptor events
  *
  * @param[in] el	to process events for.
@@ -2058,7 +2333,9 @@ int fr_event_post_delete(fr_event_list_t *el, fr_event_post_cb_t callback, void
 int fr_event_corral(fr_event_list_t *el, fr_time_t now, bool wait)
 {
 	fr_time_delta_t		when, *wake;
+#ifndef WITH_EVENT_EPOLL
 	struct timespec		ts_when, *ts_wake;
+#endif
 	fr_event_pre_t		*pre;
 	int			num_fd_events;
 	bool			timer_event_ready = false;
@@ -2122,6 +2399,14 @@ int fr_event_corral(fr_event_list_t *el, fr_time_t now, bool wait)
 		}
 	}
 
+#ifdef WITH_EVENT_EPOLL
+	/*
+	 *	Populate el->events with the list of I/O events
+	 *	that occurred since this function was last called
+	 *	or wait for the next timer event.
+	 */
+	num_fd_events = event_epoll_wait(el, next, wake);
+#else
 	/*
 	 *	Wake is the delta between el->now
 	 *	(the event loops view of the current time)
@@ -2140,6 +2425,7 @@ int fr_event_corral(fr_event_list_t *el, fr_time_t now, bool wait)
 	 *	or wait for the next timer event.
 	 */
 	num_fd_events = kevent(el->kq, NULL, 0, el->events, FR_EV_BATCH_FDS, ts_wake);
+#endif
 
 	/*
 	 *	Interrupt is different from timeout / FD events.
@@ -2425,6 +2711,10 @@ static int _event_list_free(fr_event_list_t *el)
 	talloc_free_children(el);
 
 	if (el->kq >= 0) close(el->kq);
+#ifdef WITH_EVENT_EPOLL
+	if (el->epfd >= 0) close(el->epfd);
+	if (el->timerfd >= 0) close(el->timerfd);
+#endif
 
 	return 0;
 }
@@ -2540,6 +2830,10 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 		return NULL;
 	}
 	el->kq = -1;	/* So destructor can be used before kqueue() provides us with fd */
+#ifdef WITH_EVENT_EPOLL
+	el->epfd = -1;
+	el->timerfd = -1;
+#endif
 	talloc_set_destructor(el, _event_list_free);
 
 	el->pub.tl = fr_timer_list_lst_alloc(el, NULL);
@@ -2562,6 +2856,30 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 		goto error;
 	}
 
+#ifdef WITH_EVENT_EPOLL
+	el->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (el->epfd < 0) {
+		fr_strerror_printf("Failed allocating epoll instance: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	el->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (el->timerfd < 0) {
+		fr_strerror_printf("Failed allocating timerfd: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	/*
+	 *	Edge triggered, so the timerfd never needs
+	 *	to be read.  Re-arming it resets the count.
+	 */
+	if (epoll_ctl(el->epfd, EPOLL_CTL_ADD, el->timerfd,
+		      &(struct epoll_event){ .events = EPOLLIN | EPOLLET, .data.ptr = &el->timerfd }) < 0) {
+		fr_strerror_printf("Failed adding timerfd to epoll: %s", fr_syserror(errno));
+		goto error;
+	}
+#endif
+
 	fr_dlist_talloc_init(&el->pre_callbacks, fr_event_pre_t, entry);
 	fr_dlist_talloc_init(&el->post_callbacks, fr_event_post_t, entry);
 	fr_dlist_talloc_init(&el->pid_to_reap, fr_event_pid_reap_t, entry);
@@ -0,0 +1,351 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the event loop
+ *
+ * On Linux these run through the epoll backend, with PID and user
+ * events still going through kqueue.
+ *
+ * @file src/lib/util/event_tests.c
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+
+static void test_init(void);
+#  define TEST_INIT  test_init()
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/version.h>
+
+#include "event.c"
+
+#include <sys/wait.h>
+
+/*
+ *	Upper bound on how long any one test waits for its events.
+ */
+#define TEST_GUARD_SEC	(5)
+
+static TALLOC_CTX	*autofree;
+
+typedef struct {
+	int		read;		//!< times the read callback ran.
+	int		write;		//!< times the write callback ran.
+	int		error;		//!< times the error callback ran.
+	int		flags;		//!< flags from the last callback.
+	int		fd_errno;	//!< errno from the error callback.
+	char		buffer[16];	//!< data read by the read callback.
+	ssize_t		len;		//!< bytes read by the read callback.
+} test_fd_t;
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("event_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) goto error;
+
+	if (fr_time_start() < 0) goto error;
+}
+
+static void test_guard(UNUSED fr_timer_list_t *tl, UNUSED fr_time_t now, void *uctx)
+{
+	bool *expired = uctx;
+
+	*expired = true;
+}
+
+/** Run the event loop until "done" is non-zero, or the guard timer fires
+ *
+ * The event loop is always allowed to block, so this also checks
+ * that kqueue events wake it up when there are no timers to do so.
+ */
+static void test_run(fr_event_list_t *el, int const *done)
+{
+	fr_timer_t	*guard = NULL;
+	bool		expired = false;
+
+	TEST_CHECK(fr_timer_in(NULL, el->pub.tl, &guard, fr_time_delta_from_sec(TEST_GUARD_SEC),
+			       false, test_guard, &expired) == 0);
+
+	while (!*done && !expired) {
+		if (fr_event_corral(el, fr_event_list_time(el), true) < 0) {
+			TEST_MSG("fr_event_corral failed: %s", fr_strerror());
+			break;
+		}
+		fr_event_service(el);
+	}
+
+	TEST_CHECK(!expired);
+	TEST_MSG("Timed out waiting for events");
+
+	talloc_free(guard);
+}
+
+static void test_fd_read(UNUSED fr_event_list_t *el, int fd, int flags, void *uctx)
+{
+	test_fd_t	*t = uctx;
+	ssize_t		len;
+
+	t->read++;
+	t->flags = flags;
+
+	len = read(fd, t->buffer, sizeof(t->buffer));
+	if (len > 0) t->len = len;
+}
+
+static void test_fd_write(UNUSED fr_event_list_t *el, UNUSED int fd, int flags, void *uctx)
+{
+	test_fd_t	*t = uctx;
+
+	t->write++;
+	t->flags = flags;
+}
+
+static void test_fd_error(UNUSED fr_event_list_t *el, UNUSED int fd, int flags, int fd_errno, void *uctx)
+{
+	test_fd_t	*t = uctx;
+
+	t->error++;
+	t->flags = flags;
+	t->fd_errno = fd_errno;
+}
+
+static void test_socket_io(void)
+{
+	fr_event_list_t	*el;
+	int		sockets[2];
+	test_fd_t	t = {};
+
+	MEM(el = fr_event_list_alloc(autofree, NULL, NULL));
+	TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+
+	TEST_CASE("Socket write callback runs when the socket is writable");
+	TEST_CHECK(fr_event_fd_insert(NULL, NULL, el, sockets[0], NULL, test_fd_write, test_fd_error, &t) == 0);
+#ifdef WITH_EVENT_EPOLL
+	TEST_CHECK(fr_event_fd_handle(el, sockets[0], FR_EVENT_FILTER_IO)->epoll);
+	TEST_CHECK(el->kq_watches == 0);
+#endif
+
+	test_run(el, &t.write);
+	TEST_CHECK(t.write > 0);
+	TEST_CHECK(!(t.flags & EV_EOF));
+	TEST_CHECK(t.read == 0);
+	TEST_CHECK(t.error == 0);
+
+	TEST_CHECK(fr_event_fd_delete(el, sockets[0], FR_EVENT_FILTER_IO) == 0);
+
+	TEST_CASE("Socket read callback runs when data arrives");
+	t = (test_fd_t){};
+	TEST_CHECK(fr_event_fd_insert(NULL, NULL, el, sockets[0], test_fd_read, NULL, test_fd_error, &t) == 0);
+	TEST_CHECK(write(sockets[1], "hello", 5) == 5);
+
+	test_run(el, &t.read);
+	TEST_CHECK(t.read == 1);
+	TEST_CHECK(t.len == 5);
+	TEST_CHECK(memcmp(t.buffer, "hello", 5) == 0);
+	TEST_CHECK(!(t.flags & EV_EOF));
+	TEST_CHECK(t.error == 0);
+
+	TEST_CASE("Socket error callback runs with EV_EOF when the peer closes");
+	t = (test_fd_t){};
+	close(sockets[1]);
+
+	test_run(el, &t.error);
+	TEST_CHECK(t.error == 1);
+	TEST_CHECK(t.flags & EV_EOF);
+	TEST_CHECK(t.fd_errno == 0);
+	TEST_MSG("Expected fd_errno 0, got %i", t.fd_errno);
+	TEST_CHECK(t.read == 0);
+
+	close(sockets[0]);
+	talloc_free(el);
+}
+
+static void test_socket_eof_pending(void)
+{
+	fr_event_list_t	*el;
+	int		sockets[2];
+	test_fd_t	t = {};
+
+	MEM(el = fr_event_list_alloc(autofree, NULL, NULL));
+	TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0);
+
+	TEST_CASE("Pending data is read before the error callback runs at EOF");
+	TEST_CHECK(write(sockets[1], "bye", 3) == 3);
+	close(sockets[1]);
+
+	TEST_CHECK(fr_event_fd_insert(NULL, NULL, el, sockets[0], test_fd_read, NULL, test_fd_error, &t) == 0);
+
+	test_run(el, &t.error);
+	TEST_CHECK(t.read == 1);
+	TEST_CHECK(t.len == 3);
+	TEST_CHECK(memcmp(t.buffer, "bye", 3) == 0);
+	TEST_CHECK(t.error == 1);
+	TEST_CHECK(t.flags & EV_EOF);
+
+	close(sockets[0]);
+	talloc_free(el);
+}
+
+static void test_pipe_eof(void)
+{
+	fr_event_list_t	*el;
+	int		pipes[2];
+	test_fd_t	t = {};
+
+	MEM(el = fr_event_list_alloc(autofree, NULL, NULL));
+	TEST_CHECK(pipe(pipes) == 0);
+
+	TEST_CASE("Pipe read callback runs with EV_EOF when the writer closes");
+	TEST_CHECK(fr_event_fd_insert(NULL, NULL, el, pipes[0], test_fd_read, NULL, test_fd_error, &t) == 0);
+#ifdef WITH_EVENT_EPOLL
+	TEST_CHECK(fr_event_fd_handle(el, pipes[0], FR_EVENT_FILTER_IO)->epoll);
+#endif
+	TEST_CHECK(write(pipes[1], "data", 4) == 4);
+	close(pipes[1]);
+
+	/*
+	 *	Pipes are files, so EOF goes to the read
+	 *	callback, and never to the error callback.
+	 */
+	test_run(el, &t.read);
+	TEST_CHECK(t.read == 1);
+	TEST_CHECK(t.len == 4);
+	TEST_CHECK(t.flags & EV_EOF);
+	TEST_CHECK(t.error == 0);
+
+	TEST_CHECK(fr_event_fd_delete(el, pipes[0], FR_EVENT_FILTER_IO) == 0);
+	close(pipes[0]);
+	talloc_free(el);
+}
+
+static void test_user_cb(UNUSED fr_event_list_t *el, void *uctx)
+{
+	int *fired = uctx;
+
+	(*fired)++;
+}
+
+static void test_user(void)
+{
+	fr_event_list_t		*el;
+	fr_event_user_t		*ev = NULL;
+	int			fired = 0;
+
+	MEM(el = fr_event_list_alloc(autofree, NULL, NULL));
+
+	TEST_CASE("User event fires when triggered");
+	TEST_CHECK(fr_event_user_insert(NULL, el, &ev, false, test_user_cb, &fired) == 0);
+#ifdef WITH_EVENT_EPOLL
+	TEST_CHECK(el->kq_watches == 1);
+#endif
+	TEST_CHECK(fr_event_user_trigger(ev) == 0);
+
+	test_run(el, &fired);
+	TEST_CHECK(fired == 1);
+
+	TEST_CASE("User event fires again when triggered again");
+	TEST_CHECK(fr_event_user_trigger(ev) == 0);
+
+	fired = 0;
+	test_run(el, &fired);
+	TEST_CHECK(fired == 1);
+
+	talloc_free(ev);
+#ifdef WITH_EVENT_EPOLL
+	TEST_CHECK(el->kq_watches == 0);
+#endif
+
+	talloc_free(el);
+}
+
+typedef struct {
+	pid_t		pid;		//!< PID the callback ran for.
+	int		status;		//!< exit status passed to the callback.
+	int		done;		//!< times the callback ran.
+} test_pid_t;
+
+static void test_pid_cb(UNUSED fr_event_list_t *el, pid_t pid, int status, void *uctx)
+{
+	test_pid_t *t = uctx;
+
+	t->pid = pid;
+	t->status = status;
+	t->done++;
+}
+
+static void test_pid(void)
+{
+	fr_event_list_t		*el;
+	fr_event_pid_t const	*ev = NULL;
+	test_pid_t		t = {};
+	pid_t			pid;
+
+	MEM(el = fr_event_list_alloc(autofree, NULL, NULL));
+
+	TEST_CASE("PID callback runs with the exit status when the child exits");
+	pid = fork();
+	TEST_ASSERT(pid >= 0);
+	if (pid == 0) {
+		/*
+		 *	Exit once the parent is blocked in the
+		 *	event loop.
+		 */
+		usleep(100000);
+		_exit(3);
+	}
+
+	TEST_CHECK(fr_event_pid_wait(NULL, el, &ev, pid, test_pid_cb, &t) == 0);
+#ifdef WITH_EVENT_EPOLL
+	TEST_CHECK(el->kq_watches == 1);
+#endif
+
+	/*
+	 *	Nothing else is registered, so only polling
+	 *	kqueue can wake the loop before the guard.
+	 */
+	test_run(el, &t.done);
+	TEST_CHECK(t.done == 1);
+	TEST_CHECK(t.pid == pid);
+	TEST_CHECK(WIFEXITED(t.status) && (WEXITSTATUS(t.status) == 3));
+	TEST_MSG("Expected exit status 3, got status %i", t.status);
+#ifdef WITH_EVENT_EPOLL
+	TEST_CHECK(el->kq_watches == 0);
+#endif
+
+	talloc_free(el);
+}
+
+TEST_LIST = {
+	{ "socket_io",		test_socket_io },
+	{ "socket_eof_pending",	test_socket_eof_pending },
+	{ "pipe_eof",		test_pipe_eof },
+	{ "user",		test_user },
+	{ "pid",		test_pid },
+
+	TEST_TERMINATOR
+};
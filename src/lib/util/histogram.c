@@ -0,0 +1,118 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Log-linear histograms for recording latencies
+ *
+ * Recording a value is a handful of instructions and never allocates, so
+ * histograms can be updated for every packet.  Percentiles are calculated
+ * by walking the buckets, which is only done when reporting.
+ *
+ * @file src/lib/util/histogram.c
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/histogram.h>
+
+#include <math.h>
+#include <string.h>
+
+/** Initialise, or reset, a histogram
+ *
+ * @param[in] h		to initialise.
+ */
+void fr_histogram_init(fr_histogram_t *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = UINT64_MAX;
+}
+
+/** Add all of the values recorded in one histogram to another
+ *
+ * @param[out] out	to add the values to.
+ * @param[in] in	to add the values from.
+ */
+void fr_histogram_merge(fr_histogram_t *out, fr_histogram_t const *in)
+{
+	unsigned int i;
+
+	if (!in->count) return;
+
+	for (i = 0; i < FR_HISTOGRAM_BUCKETS; i++) out->bucket[i] += in->bucket[i];
+
+	out->count += in->count;
+	out->sum += in->sum;
+	if (in->min < out->min) out->min = in->min;
+	if (in->max > out->max) out->max = in->max;
+}
+
+/** Return the highest value which maps to a bucket
+ *
+ */
+static uint64_t histogram_bucket_highest(unsigned int idx)
+{
+	unsigned int shift;
+	uint64_t sub;
+
+	if (idx < (2 * FR_HISTOGRAM_HALF)) return idx;
+
+	shift = (idx / FR_HISTOGRAM_HALF) - 1;
+	sub = idx - (shift * FR_HISTOGRAM_HALF);
+
+	return ((sub + 1) << shift) - 1;
+}
+
+/** Return the value at a given percentile
+ *
+ * The value returned is the largest value equivalent to the one at the
+ * percentile, limited to the range of values recorded.  So the 100th
+ * percentile is always the maximum value recorded.
+ *
+ * @param[in] h			to query.
+ * @param[in] percentile	to return the value of, 0 to 100.
+ * @return
+ *	- The value at the percentile.
+ *	- 0 if no values have been recorded.
+ */
+uint64_t fr_histogram_percentile(fr_histogram_t const *h, double percentile)
+{
+	uint64_t	target, seen = 0, value;
+	unsigned int	i;
+
+	if (!h->count) return 0;
+
+	if (percentile <= 0) return h->min;
+	if (percentile >= 100) return h->max;
+
+	/*
+	 *	The number of values which must be less than
+	 *	or equal to the one we return.
+	 */
+	target = (uint64_t)ceil((percentile / 100) * (double)h->count);
+	if (target == 0) target = 1;
+
+	for (i = 0; i < FR_HISTOGRAM_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen >= target) break;
+	}
+
+	value = histogram_bucket_highest(i);
+	if (value < h->min) return h->min;
+	if (value > h->max) return h->max;
+
+	return value;
+}
@@ -0,0 +1,116 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Log-linear histograms for recording latencies
+ *
+ * @file src/lib/util/histogram.h
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+RCSIDH(histogram_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+#include <freeradius-devel/util/math.h>
+
+#include <stdint.h>
+
+/** Number of bits of precision kept for each recorded value
+ *
+ * Values are bucketed by their highest set bit, and each power of two is
+ * then split into 2^(FR_HISTOGRAM_SUB_BITS - 1) linear sub-buckets.  Any
+ * recorded value can therefore be reported with a relative error of less
+ * than 1 / 2^(FR_HISTOGRAM_SUB_BITS - 1), i.e. ~3%.
+ */
+#define FR_HISTOGRAM_SUB_BITS	6
+
+#define FR_HISTOGRAM_HALF	(1 << (FR_HISTOGRAM_SUB_BITS - 1))	//!< Sub-buckets per power of two.
+
+/** Buckets needed to cover the full range of a uint64_t
+ *
+ */
+#define FR_HISTOGRAM_BUCKETS	((64 - FR_HISTOGRAM_SUB_BITS + 2) * FR_HISTOGRAM_HALF)
+
+/** A histogram of values, with constant relative precision
+ *
+ * The structure is fixed size and contains no pointers, so it can be
+ * embedded in other structures, copied, and reset with #fr_histogram_init.
+ * The units of the values are up to the caller.
+ */
+typedef struct {
+	uint64_t	count;				//!< Number of values recorded.
+	uint64_t	sum;				//!< Of all values recorded, for calculating the mean.
+	uint64_t	min;				//!< Smallest value recorded.
+	uint64_t	max;				//!< Largest value recorded.
+	uint64_t	bucket[FR_HISTOGRAM_BUCKETS];	//!< Count of values in each bucket.
+} fr_histogram_t;
+
+/** Map a value to its bucket
+ *
+ * @param[in] value	to map.
+ * @return the index of the bucket holding value.
+ */
+static inline unsigned int fr_histogram_bucket(uint64_t value)
+{
+	unsigned int shift;
+
+	if (value < (2 * FR_HISTOGRAM_HALF)) return value;
+
+	shift = fr_high_bit_pos(value) - FR_HISTOGRAM_SUB_BITS;
+
+	return (shift * FR_HISTOGRAM_HALF) + (value >> shift);
+}
+
+/** Record a value
+ *
+ * @param[in] h		to record the value in.
+ * @param[in] value	to record.
+ */
+static inline void fr_histogram_add(fr_histogram_t *h, uint64_t value)
+{
+	h->bucket[fr_histogram_bucket(value)]++;
+	h->count++;
+	h->sum += value;
+	if (value < h->min) h->min = value;
+	if (value > h->max) h->max = value;
+}
+
+/** Return the mean of all recorded values
+ *
+ * @param[in] h		to return the mean of.
+ * @return the mean, or 0 if no values have been recorded.
+ */
+static inline uint64_t fr_histogram_mean(fr_histogram_t const *h)
+{
+	if (!h->count) return 0;
+
+	return h->sum / h->count;
+}
+
+void		fr_histogram_init(fr_histogram_t *h) CC_HINT(nonnull);
+
+void		fr_histogram_merge(fr_histogram_t *out, fr_histogram_t const *in) CC_HINT(nonnull);
+
+uint64_t	fr_histogram_percentile(fr_histogram_t const *h, double percentile) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,147 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for log-linear histograms
+ *
+ * @file src/lib/util/histogram_tests.c
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include "histogram.c"
+
+/*
+ *	Maximum relative error of a reported value.
+ */
+#define WITHIN(_value, _expected) \
+	(((_value) >= (_expected)) && (((_value) - (_expected)) <= ((_expected) / FR_HISTOGRAM_HALF)))
+
+static void test_histogram_empty(void)
+{
+	fr_histogram_t h;
+
+	fr_histogram_init(&h);
+
+	TEST_CHECK(h.count == 0);
+	TEST_CHECK(fr_histogram_percentile(&h, 50) == 0);
+	TEST_CHECK(fr_histogram_percentile(&h, 100) == 0);
+	TEST_CHECK(fr_histogram_mean(&h) == 0);
+}
+
+static void test_histogram_bucket(void)
+{
+	uint64_t	i;
+	unsigned int	prev = 0;
+
+	/*
+	 *	Buckets must be monotonic, and every bucket must
+	 *	contain the values it claims to.
+	 */
+	for (i = 1; i < (1 << 20); i++) {
+		unsigned int idx = fr_histogram_bucket(i);
+
+		TEST_CHECK(idx >= prev);
+		TEST_CHECK(histogram_bucket_highest(idx) >= i);
+		TEST_MSG("value %" PRIu64 " bucket %u highest %" PRIu64, i, idx, histogram_bucket_highest(idx));
+		if (idx > 0) TEST_CHECK(histogram_bucket_highest(idx - 1) < i);
+		prev = idx;
+	}
+
+	TEST_CHECK(fr_histogram_bucket(UINT64_MAX) == (FR_HISTOGRAM_BUCKETS - 1));
+	TEST_CHECK(histogram_bucket_highest(FR_HISTOGRAM_BUCKETS - 1) == UINT64_MAX);
+}
+
+static void test_histogram_exact(void)
+{
+	fr_histogram_t	h;
+	uint64_t	i;
+
+	fr_histogram_init(&h);
+
+	/*
+	 *	Small values are recorded exactly.
+	 */
+	for (i = 0; i < (2 * FR_HISTOGRAM_HALF); i++) fr_histogram_add(&h, i);
+
+	TEST_CHECK(h.count == (2 * FR_HISTOGRAM_HALF));
+	TEST_CHECK(h.min == 0);
+	TEST_CHECK(h.max == ((2 * FR_HISTOGRAM_HALF) - 1));
+	TEST_CHECK(fr_histogram_percentile(&h, 50) == (FR_HISTOGRAM_HALF - 1));
+	TEST_CHECK(fr_histogram_percentile(&h, 0) == 0);
+	TEST_CHECK(fr_histogram_percentile(&h, 100) == ((2 * FR_HISTOGRAM_HALF) - 1));
+}
+
+static void test_histogram_percentiles(void)
+{
+	fr_histogram_t	h;
+	uint64_t	i, value;
+
+	fr_histogram_init(&h);
+
+	for (i = 1; i <= 100000; i++) fr_histogram_add(&h, i * 1000);
+
+	TEST_CHECK(h.count == 100000);
+	TEST_CHECK(h.min == 1000);
+	TEST_CHECK(h.max == 100000000);
+	TEST_CHECK(fr_histogram_mean(&h) == 50000500);
+
+	value = fr_histogram_percentile(&h, 50);
+	TEST_CHECK(WITHIN(value, 50000000));
+	TEST_MSG("p50 %" PRIu64, value);
+
+	value = fr_histogram_percentile(&h, 99);
+	TEST_CHECK(WITHIN(value, 99000000));
+	TEST_MSG("p99 %" PRIu64, value);
+
+	value = fr_histogram_percentile(&h, 99.9);
+	TEST_CHECK(WITHIN(value, 99900000));
+	TEST_MSG("p99.9 %" PRIu64, value);
+
+	TEST_CHECK(fr_histogram_percentile(&h, 100) == 100000000);
+}
+
+static void test_histogram_merge(void)
+{
+	fr_histogram_t	a, b, all;
+	uint64_t	i;
+
+	fr_histogram_init(&a);
+	fr_histogram_init(&b);
+	fr_histogram_init(&all);
+
+	for (i = 0; i < 10000; i++) {
+		uint64_t value = (i * 7919) % 1000003;
+
+		fr_histogram_add((i & 0x01) ? &a : &b, value);
+		fr_histogram_add(&all, value);
+	}
+
+	fr_histogram_merge(&a, &b);
+
+	TEST_CHECK(memcmp(&a, &all, sizeof(a)) == 0);
+}
+
+TEST_LIST = {
+	{ "empty",		test_histogram_empty },
+	{ "bucket",		test_histogram_bucket },
+	{ "exact",		test_histogram_exact },
+	{ "percentiles",	test_histogram_percentiles },
+	{ "merge",		test_histogram_merge },
+
+	TEST_TERMINATOR
+};
@@ -23,11 +23,14 @@
 
 #define CACHE_LINE_DEFAULT	128
 #define CORES_DEFAULT		1
+#define CPUS_MAX		65536
 
 #include <freeradius-devel/util/hw.h>
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/strerror.h>
 
+#include <stdlib.h>
+
 #if defined(__APPLE__) || defined(__FreeBSD__)
 #include <sys/sysctl.h>
 size_t fr_hw_cache_line_size(void)
@@ -123,3 +126,149 @@ uint32_t fr_hw_num_cores_active(void)
 	return CORES_DEFAULT;
 }
 #endif
+
+/** Parse a list of CPUs, e.g. "0-3,8,10-11"
+ *
+ *  This is the format used by taskset, and by the "cpulist" files in
+ *  /sys.
+ *
+ * @param[in] ctx	to allocate the array of CPUs in.
+ * @param[out] out	array of CPU numbers, in the order they were given.
+ * @param[in] str	to parse.
+ * @return
+ *	- The number of CPUs in the list.
+ *	- -1 on error.
+ */
+int fr_hw_cpu_list_parse(TALLOC_CTX *ctx, uint32_t **out, char const *str)
+{
+	char const	*p = str;
+	uint32_t	*cpus = NULL, *tmp;
+	int		num = 0;
+
+	*out = NULL;
+
+	while (*p && (*p != '\n')) {
+		unsigned long	first, last, i;
+		char		*end;
+
+		first = strtoul(p, &end, 10);
+		if (end == p) goto invalid;
+		p = end;
+
+		last = first;
+		if (*p == '-') {
+			p++;
+			last = strtoul(p, &end, 10);
+			if ((end == p) || (last < first)) goto invalid;
+			p = end;
+		}
+
+		if (last >= CPUS_MAX) {
+			fr_strerror_printf("CPU %lu is too large", last);
+			talloc_free(cpus);
+			return -1;
+		}
+
+		tmp = talloc_realloc(ctx, cpus, uint32_t, num + (last - first) + 1);
+		if (!tmp) {
+			fr_strerror_const("Out of memory");
+			talloc_free(cpus);
+			return -1;
+		}
+		cpus = tmp;
+
+		for (i = first; i <= last; i++) cpus[num++] = i;
+
+		if (*p == ',') p++;
+	}
+
+	if (!num) {
+	invalid:
+		fr_strerror_printf("Invalid CPU list \"%s\"", str);
+		talloc_free(cpus);
+		return -1;
+	}
+
+	*out = cpus;
+	return num;
+}
+
+#ifdef __linux__
+#include <dirent.h>
+
+/** Return the list of CPUs on a NUMA node
+ *
+ * @param[in] ctx	to allocate the array of CPUs in.
+ * @param[out] out	array of CPU numbers.
+ * @param[in] node	NUMA node to return CPUs for.
+ * @return
+ *	- The number of CPUs on the node.
+ *	- -1 on error.
+ */
+int fr_hw_numa_node_cpus(TALLOC_CTX *ctx, uint32_t **out, unsigned int node)
+{
+	FILE	*file;
+	char	path[64];
+	char	buff[4096];
+
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", node);
+
+	file = fopen(path, "r");
+	if (!file) {
+		fr_strerror_printf("Failed opening %s: %s", path, fr_syserror(errno));
+		return -1;
+	}
+
+	if (!fgets(buff, sizeof(buff), file)) {
+		fr_strerror_printf("Failed reading %s", path);
+		fclose(file);
+		return -1;
+	}
+	fclose(file);
+
+	return fr_hw_cpu_list_parse(ctx, out, buff);
+}
+
+/** Return the NUMA node a CPU is on
+ *
+ * @param[in] cpu	to look up.
+ * @return
+ *	- The NUMA node.
+ *	- -1 if the NUMA node is unknown.
+ */
+int fr_hw_cpu_numa_node(unsigned int cpu)
+{
+	DIR		*dir;
+	struct dirent	*dp;
+	char		path[64];
+	unsigned int	node;
+	int		ret = -1;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u", cpu);
+
+	dir = opendir(path);
+	if (!dir) return -1;
+
+	while ((dp = readdir(dir)) != NULL) {
+		if (sscanf(dp->d_name, "node%u", &node) == 1) {
+			ret = node;
+			break;
+		}
+	}
+	closedir(dir);
+
+	return ret;
+}
+#else
+int fr_hw_numa_node_cpus(UNUSED TALLOC_CTX *ctx, uint32_t **out, UNUSED unsigned int node)
+{
+	*out = NULL;
+	fr_strerror_const("NUMA nodes are not supported on this system");
+	return -1;
+}
+
+int fr_hw_cpu_numa_node(UNUSED unsigned int cpu)
+{
+	return -1;
+}
+#endif
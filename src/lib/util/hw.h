@@ -30,10 +30,18 @@ extern "C" {
 #include <stddef.h>
 #include <stdint.h>
 
+#include <freeradius-devel/util/talloc.h>
+
 size_t		fr_hw_cache_line_size(void);
 
 uint32_t	fr_hw_num_cores_active(void);
 
+int		fr_hw_cpu_list_parse(TALLOC_CTX *ctx, uint32_t **out, char const *str);
+
+int		fr_hw_numa_node_cpus(TALLOC_CTX *ctx, uint32_t **out, unsigned int node);
+
+int		fr_hw_cpu_numa_node(unsigned int cpu);
+
 #ifdef __cplusplus
 }
 #endif
@@ -26,13 +26,17 @@ RCSID("$Id$")
 #define _PAIR_PRIVATE 1
 #define _PAIR_INLINE 1
 
+#include <freeradius-devel/util/atexit.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/math.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/pair.h>
 #include <freeradius-devel/util/pair_legacy.h>
 #include <freeradius-devel/util/proto.h>
 #include <freeradius-devel/util/regex.h>
 
+#include <stdatomic.h>
+
 FR_TLIST_FUNCS(fr_pair_order_list, fr_pair_t, order_entry)
 
 #include <freeradius-devel/util/pair_inline.c>
@@ -57,6 +61,7 @@ void fr_pair_list_init(fr_pair_list_t *list)
 	list->verified = true;
 #endif
 	list->is_child = false;
+	list->generation = 0;
 }
 
 /** Free a fr_pair_t
@@ -320,7 +325,8 @@ fr_pair_t *fr_pair_afrom_da(TALLOC_CTX *ctx, fr_dict_attr_t const *da)
  */
 int fr_pair_reinit_from_da(fr_pair_list_t *list, fr_pair_t *vp, fr_dict_attr_t const *da)
 {
-	fr_dict_attr_t const *to_free;
+	fr_dict_attr_t const	*to_free;
+	fr_pair_list_t		*parent;
 
 	/*
 	 *	vp may be created from fr_pair_alloc_null(), in which case it has no da.
@@ -340,6 +346,13 @@ int fr_pair_reinit_from_da(fr_pair_list_t *list, fr_pair_t *vp, fr_dict_attr_t c
 	to_free = vp->da;
 	vp->da = da;
 
+	/*
+	 *	Any index of the list the pair is in
+	 *	will still have it under the old da.
+	 */
+	parent = fr_pair_parent_list(vp);
+	if (parent) fr_pair_list_modified(parent);
+
 	/*
 	 *	Only frees unknown fr_dict_attr_t's
 	 */
@@ -602,7 +615,8 @@ int fr_pair_steal_prepend(TALLOC_CTX *list_ctx, fr_pair_list_t *list, fr_pair_t
  */
 int fr_pair_raw_afrom_pair(fr_pair_t *vp, uint8_t const *data, size_t data_len)
 {
-	fr_dict_attr_t *unknown;
+	fr_dict_attr_t	*unknown;
+	fr_pair_list_t	*parent;
 
 	PAIR_VERIFY(vp);
 
@@ -616,6 +630,9 @@ int fr_pair_raw_afrom_pair(fr_pair_t *vp, uint8_t const *data, size_t data_len)
 	vp->da = unknown;
 	fr_assert(vp->da->type == FR_TYPE_OCTETS);
 
+	parent = fr_pair_parent_list(vp);
+	if (parent) fr_pair_list_modified(parent);
+
 	fr_value_box_init(&vp->data, FR_TYPE_OCTETS, NULL, true);
 
 	fr_pair_value_memdup(vp, data, data_len, true);
@@ -689,6 +706,200 @@ unsigned int fr_pair_count_by_da(fr_pair_list_t const *list, fr_dict_attr_t cons
 	return count;
 }
 
+/*
+ *	Lookup indexes for large lists
+ *
+ *	Each thread keeps an index mapping da -> first pair for a few
+ *	of the large lists it has searched recently.  An index is only
+ *	used whilst the list's generation matches the one recorded when
+ *	the index was built.  Every edit gives the list a new generation,
+ *	so stale indexes are never consulted, and no locking is needed
+ *	even if the list moves between threads.
+ */
+#define PAIR_INDEX_MIN_ELEMENTS		32		//!< Shorter lists are always searched linearly.
+#define PAIR_INDEX_MIN_SLOTS		64		//!< Smallest index table.
+#define PAIR_INDEX_NUM			4		//!< How many lists each thread keeps indexes for.
+#define PAIR_GENERATION_BLOCK		(1 << 16)	//!< How many generations each thread reserves at once.
+
+typedef struct {
+	fr_dict_attr_t const	*da;			//!< Attribute this slot is for.
+	fr_pair_t		*vp;			//!< First pair in the list with this da.
+} pair_index_slot_t;
+
+typedef struct {
+	fr_pair_list_t const	*list;			//!< List the index was built for.
+	uint64_t		generation;		//!< Generation of the list when the index was built.
+	uint32_t		mask;			//!< Number of slots - 1.
+	pair_index_slot_t	*slots;			//!< Open addressing table of the first pair for each da.
+} pair_index_t;
+
+typedef struct {
+	pair_index_t		index[PAIR_INDEX_NUM];	//!< Indexes, replaced round robin.
+	unsigned int		next;			//!< Index to replace next.
+
+	fr_pair_list_t const	*searched[PAIR_INDEX_NUM];	//!< Lists searched linearly since they were
+								///< last edited.
+	uint64_t		searched_generation[PAIR_INDEX_NUM];
+	unsigned int		searched_next;		//!< Searched entry to replace next.
+} pair_index_ctx_t;
+
+static _Thread_local pair_index_ctx_t	*pair_index_ctx;
+static _Thread_local uint64_t		pair_generation;
+static _Thread_local uint64_t		pair_generation_end;
+static _Atomic(uint64_t)		pair_generation_block = 1;	//!< 0 is reserved for unmodified lists.
+
+/** Mark a list as modified, invalidating any lookup indexes built for it
+ *
+ * Generations are handed out from blocks reserved by each thread,
+ * so they're unique across all threads without per-edit atomics.
+ *
+ * @param[in] list	which has been modified.
+ *
+ * @hidecallergraph
+ */
+void fr_pair_list_modified(fr_pair_list_t *list)
+{
+	if (unlikely(pair_generation == pair_generation_end)) {
+		pair_generation = atomic_fetch_add_explicit(&pair_generation_block, PAIR_GENERATION_BLOCK,
+							    memory_order_relaxed);
+		pair_generation_end = pair_generation + PAIR_GENERATION_BLOCK;
+	}
+
+	list->generation = pair_generation++;
+}
+
+static int _pair_index_ctx_free(void *arg)
+{
+	return talloc_free(arg);
+}
+
+static inline CC_HINT(always_inline) uint32_t pair_index_hash(fr_dict_attr_t const *da)
+{
+	return (uint32_t)(((uintptr_t)da * UINT64_C(0x9e3779b97f4a7c15)) >> 32);
+}
+
+/** Build an index of the first pair with each da in a list
+ *
+ */
+static pair_index_t *pair_index_build(pair_index_ctx_t *ctx, fr_pair_list_t const *list)
+{
+	pair_index_t	*index = &ctx->index[ctx->next];
+	uint32_t	num_slots;
+	fr_pair_t	*vp = NULL;
+
+	num_slots = fr_roundup_pow2_uint64(fr_pair_list_num_elements(list) * 2);
+	if (num_slots < PAIR_INDEX_MIN_SLOTS) num_slots = PAIR_INDEX_MIN_SLOTS;
+
+	/*
+	 *	Only grow the table, the same list is likely
+	 *	to be indexed again after its next edit.
+	 */
+	if (!index->slots || ((index->mask + 1) < num_slots)) {
+		pair_index_slot_t *slots;
+
+		slots = talloc_array(ctx, pair_index_slot_t, num_slots);
+		if (unlikely(!slots)) return NULL;
+
+		talloc_free(index->slots);
+		index->slots = slots;
+		index->mask = num_slots - 1;
+	}
+	memset(index->slots, 0, sizeof(index->slots[0]) * (index->mask + 1));
+
+	while ((vp = fr_pair_list_next(list, vp))) {
+		uint32_t i;
+
+		for (i = pair_index_hash(vp->da) & index->mask;
+		     index->slots[i].da && (index->slots[i].da != vp->da);
+		     i = (i + 1) & index->mask);
+
+		if (index->slots[i].da) continue;	/* Only record the first instance */
+
+		index->slots[i].da = vp->da;
+		index->slots[i].vp = vp;
+	}
+
+	index->list = list;
+	index->generation = list->generation;
+
+	ctx->next = (ctx->next + 1) % PAIR_INDEX_NUM;
+
+	return index;
+}
+
+/** Return a valid index for a list, building one if the list has been searched before
+ *
+ * Indexes are only built the second time a list is searched
+ * after it's edited, so lists which are modified between
+ * every search don't pay for building indexes they never use.
+ *
+ * @return
+ *	- An index for the list.
+ *	- NULL if the list should be searched linearly.
+ */
+static pair_index_t *pair_index_get(fr_pair_list_t const *list)
+{
+	pair_index_ctx_t	*ctx = pair_index_ctx;
+	unsigned int		i;
+
+	if (unlikely(!ctx)) {
+		ctx = talloc_zero(NULL, pair_index_ctx_t);
+		if (unlikely(!ctx)) return NULL;
+		fr_atexit_thread_local(pair_index_ctx, _pair_index_ctx_free, ctx);
+	}
+
+	for (i = 0; i < PAIR_INDEX_NUM; i++) {
+		if ((ctx->index[i].list == list) && (ctx->index[i].generation == list->generation)) {
+			return &ctx->index[i];
+		}
+	}
+
+	for (i = 0; i < PAIR_INDEX_NUM; i++) {
+		if ((ctx->searched[i] == list) && (ctx->searched_generation[i] == list->generation)) {
+			ctx->searched[i] = NULL;
+			return pair_index_build(ctx, list);
+		}
+	}
+
+	ctx->searched[ctx->searched_next] = list;
+	ctx->searched_generation[ctx->searched_next] = list->generation;
+	ctx->searched_next = (ctx->searched_next + 1) % PAIR_INDEX_NUM;
+
+	return NULL;
+}
+
+/** Find the first pair with a da using an index
+ *
+ */
+static inline CC_HINT(always_inline) fr_pair_t *pair_index_find(pair_index_t const *index, fr_dict_attr_t const *da)
+{
+	uint32_t i;
+
+	for (i = pair_index_hash(da) & index->mask; index->slots[i].da; i = (i + 1) & index->mask) {
+		if (index->slots[i].da == da) return index->slots[i].vp;
+	}
+
+	return NULL;
+}
+
+/** Find the first pair with a da, using an index if the list is large
+ *
+ */
+static inline CC_HINT(always_inline) fr_pair_t *pair_find_first(fr_pair_list_t const *list, fr_dict_attr_t const *da)
+{
+	fr_pair_t *vp = NULL;
+
+	if ((list->generation != 0) && (fr_pair_list_num_elements(list) >= PAIR_INDEX_MIN_ELEMENTS)) {
+		pair_index_t *index = pair_index_get(list);
+
+		if (index) return pair_index_find(index, da);
+	}
+
+	while ((vp = fr_pair_list_next(list, vp))) if (da == vp->da) return vp;
+
+	return NULL;
+}
+
 /** Find the first pair with a matching da
  *
  * @param[in] list	to search in.
@@ -708,6 +919,8 @@ fr_pair_t *fr_pair_find_by_da(fr_pair_list_t const *list, fr_pair_t const *prev,
 
 	PAIR_LIST_VERIFY(list);
 
+	if (!vp) return pair_find_first(list, da);
+
 	while ((vp = fr_pair_list_next(list, vp))) if (da == vp->da) return vp;
 
 	return NULL;
@@ -756,12 +969,16 @@ fr_pair_t *fr_pair_find_by_da_idx(fr_pair_list_t const *list, fr_dict_attr_t con
 
 	PAIR_LIST_VERIFY(list);
 
+	/*
+	 *	Skip straight to the first instance.
+	 */
+	vp = pair_find_first(list, da);
+	if (!vp || (idx == 0)) return vp;
+
 	while ((vp = fr_pair_list_next(list, vp))) {
 		if (da != vp->da) continue;
 
-		if (idx == 0) return vp;
-
-		idx--;
+		if (--idx == 0) return vp;
 	}
 	return NULL;
 }
@@ -991,6 +1208,7 @@ static int _pair_list_dcursor_insert(fr_dcursor_t *cursor, void *to_insert, UNUS
 	 *	Mark the pair as inserted into the list.
 	 */
 	fr_pair_order_list_set_head(tlist, vp);
+	fr_pair_list_modified(fr_pair_list_from_dlist(cursor->dlist));
 
 	PAIR_VERIFY(vp);
 
@@ -1031,7 +1249,10 @@ static int _pair_list_dcursor_remove(NDEBUG_UNUSED fr_dcursor_t *cursor, void *t
 
 	PAIR_VERIFY(vp);
 
-	if (&parent->order.head.dlist_head == cursor->dlist) return 0;
+	if (&parent->order.head.dlist_head == cursor->dlist) {
+		fr_pair_list_modified(parent);
+		return 0;
+	}
 
 	fr_pair_remove(parent, vp);
 	return 1;
@@ -1329,6 +1550,7 @@ int fr_pair_prepend(fr_pair_list_t *list, fr_pair_t *to_add)
 	}
 
 	fr_pair_order_list_insert_head(&list->order, to_add);
+	fr_pair_list_modified(list);
 
 	return 0;
 }
@@ -1358,6 +1580,7 @@ int fr_pair_append(fr_pair_list_t *list, fr_pair_t *to_add)
 	}
 
 	fr_pair_order_list_insert_tail(&list->order, to_add);
+	fr_pair_list_modified(list);
 
 	return 0;
 }
@@ -1391,6 +1614,7 @@ int fr_pair_insert_after(fr_pair_list_t *list, fr_pair_t *pos, fr_pair_t *to_add
 	}
 
 	fr_pair_order_list_insert_after(&list->order, pos, to_add);
+	fr_pair_list_modified(list);
 
 	return 0;
 }
@@ -1425,6 +1649,7 @@ int fr_pair_insert_before(fr_pair_list_t *list, fr_pair_t *pos, fr_pair_t *to_ad
 	}
 
 	fr_pair_order_list_insert_before(&list->order, pos, to_add);
+	fr_pair_list_modified(list);
 
 	return 0;
 }
@@ -2335,6 +2560,7 @@ int fr_pair_list_copy(TALLOC_CTX *ctx, fr_pair_list_t *to, fr_pair_list_t const
 		new_vp = fr_pair_copy(ctx, vp);
 		if (!new_vp) {
 			fr_pair_order_list_talloc_free_to_tail(&to->order, first_added);
+			fr_pair_list_modified(to);
 			return -1;
 		}
 
@@ -2437,6 +2663,7 @@ int fr_pair_list_copy_by_da(TALLOC_CTX *ctx, fr_pair_list_t *to,
 		new_vp = fr_pair_copy(ctx, vp);
 		if (!new_vp) {
 			fr_pair_order_list_talloc_free_to_tail(&to->order, first_added);
+			fr_pair_list_modified(to);
 			return -1;
 		}
 
@@ -2542,8 +2769,6 @@ int fr_pair_sublist_copy(TALLOC_CTX *ctx, fr_pair_list_t *to,
  */
 void fr_pair_value_clear(fr_pair_t *vp)
 {
-	fr_pair_t *child;
-
 	switch (vp->vp_type) {
 	default:
 		fr_value_box_clear_value(&vp->data);
@@ -2552,10 +2777,10 @@ void fr_pair_value_clear(fr_pair_t *vp)
 	case FR_TYPE_STRUCTURAL:
 		if (!fr_pair_list_empty(&vp->vp_group)) return;
 
-		while ((child = fr_pair_order_list_pop_tail(&vp->vp_group.order))) {
-			fr_pair_value_clear(child);
-			talloc_free(child);
-		}
+		/*
+		 *	Also invalidates any lookup index for the children.
+		 */
+		fr_pair_list_free(&vp->vp_group);
 		break;
 	}
 }
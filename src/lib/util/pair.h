@@ -52,6 +52,10 @@ FR_TLIST_TYPES(fr_pair_order_list)
 typedef struct pair_list_s {
         FR_TLIST_HEAD(fr_pair_order_list)	order;			//!< Maintains the relative order of pairs in a list.
 
+	uint64_t			 _CONST generation;		//!< Changes whenever the list is modified, so
+									///< lookup indexes can tell if they're stale.
+									///< 0 if the list has never been modified.
+
 	bool				 _CONST is_child;		//!< is a child of a VP
 
 #ifdef WITH_VERIFY_PTR
@@ -724,6 +728,9 @@ int		fr_pair_sublist_copy(TALLOC_CTX *ctx, fr_pair_list_t *to,
 				     fr_pair_list_t const *from,
 				     fr_pair_t const *start, unsigned int count) CC_HINT(nonnull(2,3));
 
+/** @hidecallergraph */
+void		fr_pair_list_modified(fr_pair_list_t *list) CC_HINT(nonnull);
+
 #ifndef _PAIR_INLINE
 /** @hidecallergraph */
 void		fr_pair_list_free(fr_pair_list_t *list) CC_HINT(nonnull);
@@ -102,6 +102,8 @@ _INLINE fr_pair_t *fr_pair_remove(fr_pair_list_t *list, fr_pair_t *vp)
 	list->verified = false;
 #endif
 
+	fr_pair_list_modified(list);
+
 	return fr_pair_order_list_remove(&list->order, vp);
 }
 
@@ -112,6 +114,7 @@ _INLINE fr_pair_t *fr_pair_remove(fr_pair_list_t *list, fr_pair_t *vp)
 _INLINE void fr_pair_list_free(fr_pair_list_t *list)
 {
 	fr_pair_order_list_talloc_free(&list->order);
+	fr_pair_list_modified(list);
 }
 
 /** Is a valuepair list empty
@@ -139,6 +142,7 @@ _INLINE bool fr_pair_list_empty(fr_pair_list_t const *list)
 _INLINE void fr_pair_list_sort(fr_pair_list_t *list, fr_cmp_t cmp)
 {
 	fr_pair_order_list_sort(&list->order, cmp);
+	fr_pair_list_modified(list);
 }
 
 /** Get the length of a list of fr_pair_t
@@ -184,6 +188,8 @@ _INLINE void fr_pair_list_append(fr_pair_list_t *dst, fr_pair_list_t *src)
 	dst->verified = false;
 #endif
 	fr_pair_order_list_move(&dst->order, &src->order);
+	fr_pair_list_modified(dst);
+	fr_pair_list_modified(src);
 }
 
 /** Move a list of fr_pair_t from a temporary list to the head of a destination list
@@ -194,4 +200,6 @@ _INLINE void fr_pair_list_append(fr_pair_list_t *dst, fr_pair_list_t *src)
 _INLINE void fr_pair_list_prepend(fr_pair_list_t *dst, fr_pair_list_t *src)
 {
 	fr_pair_order_list_move_head(&dst->order, &src->order);
+	fr_pair_list_modified(dst);
+	fr_pair_list_modified(src);
 }
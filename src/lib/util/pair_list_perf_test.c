@@ -399,6 +399,115 @@ static void do_test_fr_pair_find_by_da_idx(unsigned int len, unsigned int perc,
 	TEST_MSG_ALWAYS("per_sec=%0.0lf", (reps * len)/(fr_time_delta_unwrap(used) / (double)NSEC));
 }
 
+static void do_test_find_linear(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
+{
+	fr_pair_list_t		test_vps;
+	unsigned int		i, j;
+	fr_pair_t		*new_vp, *vp;
+	fr_time_t		start, end;
+	fr_time_delta_t		used = fr_time_delta_wrap(0);
+	fr_dict_attr_t const	*da;
+	size_t			input_count = talloc_array_length(source_vps);
+	fr_fast_rand_t		rand_ctx;
+
+	fr_pair_list_init(&test_vps);
+	if (input_count > len) input_count = len;
+	rand_ctx.a = fr_rand();
+	rand_ctx.b = fr_rand();
+
+	/*
+	 *  Initialise the test list
+	 */
+	for (i = 0; i < len; i++) {
+		int idx = fr_fast_rand(&rand_ctx) % input_count;
+		new_vp = fr_pair_copy(autofree, source_vps[idx]);
+		fr_pair_append(&test_vps, new_vp);
+	}
+
+	/*
+	 *  Find first instance of specific DA by walking the list,
+	 *  as a baseline for the indexed lookups done by fr_pair_find_by_da.
+	 */
+	for (i = 0; i < reps; i++) {
+		for (j = 0; j < len; j++) {
+			int idx = fr_fast_rand(&rand_ctx) % input_count;
+			da = source_vps[idx]->da;
+			start = fr_time();
+			for (vp = fr_pair_list_head(&test_vps); vp; vp = fr_pair_list_next(&test_vps, vp)) {
+				if (vp->da == da) break;
+			}
+			end = fr_time();
+			TEST_CHECK(vp == fr_pair_find_by_da(&test_vps, NULL, da));
+			used = fr_time_delta_add(used, fr_time_sub(end, start));
+		}
+	}
+	fr_pair_list_free(&test_vps);
+	TEST_MSG_ALWAYS("repetitions=%u", reps);
+	TEST_MSG_ALWAYS("perc_rep=%u", perc);
+	TEST_MSG_ALWAYS("list_length=%u", len);
+	TEST_MSG_ALWAYS("used=%"PRId64, fr_time_delta_unwrap(used));
+	TEST_MSG_ALWAYS("per_sec=%0.0lf", (reps * len)/(fr_time_delta_unwrap(used) / (double)NSEC));
+}
+
+static void do_test_fr_pair_find_by_da_edit(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
+{
+	fr_pair_list_t		test_vps;
+	unsigned int		i, j;
+	fr_pair_t		*new_vp, *vp;
+	fr_time_t		start, end;
+	fr_time_delta_t		used = fr_time_delta_wrap(0);
+	fr_dict_attr_t const	*da;
+	size_t			input_count = talloc_array_length(source_vps);
+	fr_fast_rand_t		rand_ctx;
+
+	fr_pair_list_init(&test_vps);
+	if (input_count > len) input_count = len;
+	rand_ctx.a = fr_rand();
+	rand_ctx.b = fr_rand();
+
+	/*
+	 *  Initialise the test list
+	 */
+	for (i = 0; i < len; i++) {
+		int idx = fr_fast_rand(&rand_ctx) % input_count;
+		new_vp = fr_pair_copy(autofree, source_vps[idx]);
+		fr_pair_append(&test_vps, new_vp);
+	}
+
+	/*
+	 *  Find first instance of specific DA, replacing the head
+	 *  of the list every 8 lookups, so any index has to be
+	 *  rebuilt, and must not return stale pairs.
+	 */
+	for (i = 0; i < reps; i++) {
+		for (j = 0; j < len; j++) {
+			int idx = fr_fast_rand(&rand_ctx) % input_count;
+
+			if ((j % 8) == 0) {
+				vp = fr_pair_list_head(&test_vps);
+				fr_pair_remove(&test_vps, vp);
+				talloc_free(vp);
+
+				new_vp = fr_pair_copy(autofree, source_vps[idx]);
+				fr_pair_prepend(&test_vps, new_vp);
+			}
+
+			da = source_vps[idx]->da;
+			start = fr_time();
+			vp = fr_pair_find_by_da(&test_vps, NULL, da);
+			end = fr_time();
+			TEST_CHECK(vp && (vp->da == da));
+			used = fr_time_delta_add(used, fr_time_sub(end, start));
+		}
+	}
+	fr_pair_list_free(&test_vps);
+	TEST_MSG_ALWAYS("repetitions=%u", reps);
+	TEST_MSG_ALWAYS("perc_rep=%u", perc);
+	TEST_MSG_ALWAYS("list_length=%u", len);
+	TEST_MSG_ALWAYS("used=%"PRId64, fr_time_delta_unwrap(used));
+	TEST_MSG_ALWAYS("per_sec=%0.0lf", (reps * len)/(fr_time_delta_unwrap(used) / (double)NSEC));
+}
+
 static void do_test_find_nth(unsigned int len, unsigned int perc, unsigned int reps, fr_pair_t *source_vps[])
 {
 	fr_pair_list_t	  	test_vps;
@@ -504,6 +613,8 @@ static void test_ ## _func ## _ ## _count ## _ ## _perc(void)\
 
 all_test_funcs(fr_pair_append)
 all_test_funcs(fr_pair_find_by_da_idx)
+all_test_funcs(find_linear)
+all_test_funcs(fr_pair_find_by_da_edit)
 all_test_funcs(find_nth)
 all_test_funcs(fr_pair_list_free)
 
@@ -524,6 +635,8 @@ all_test_funcs(fr_pair_list_free)
 TEST_LIST = {
 	all_repetition_tests(fr_pair_append)
 	all_repetition_tests(fr_pair_find_by_da_idx)
+	all_repetition_tests(find_linear)
+	all_repetition_tests(fr_pair_find_by_da_edit)
 	all_repetition_tests(find_nth)
 	all_repetition_tests(fr_pair_list_free)
 
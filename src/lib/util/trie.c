@@ -48,9 +48,11 @@ RCSID("$Id$")
  *	after deleting 10/8, the trie should contain only the 0/0
  *	network and associated destination.
  *
- *	As of yet, it does not do level compression.  This can be
- *	added without (hopefully) too much work.  That would require
- *	an additional step to "normalize" the trie.
+ *	The dynamic trie does not do level compression.  Instead, a
+ *	trie which is read far more often than it is changed can be
+ *	"frozen" via fr_trie_freeze().  That builds a level-compressed
+ *	copy of the trie in one array, which is used for longest
+ *	prefix matches until the trie is next changed.
  *
  *	This code could be extended to do packet matching, through the
  *	inclusion of "don't care" paths.  e.g. parsing an IP header,
@@ -363,7 +365,7 @@ static CC_HINT(nonnull) uint16_t get_chunk(uint8_t const *key, uint32_t start_bi
 	 *	Catch some simple use-cases.
 	 */
 	if (start_bit == 0) {
-		if (num_bits < 7) return key[0] >> (8 - num_bits);
+		if (num_bits < 8) return key[0] >> (8 - num_bits);
 		if (num_bits == 8) return key[0];
 
 		chunk = (key[0] << 8) | key[1];
@@ -422,7 +424,7 @@ static void write_chunk(uint8_t *out, int start_bit, int num_bits, uint16_t chun
 	 *	Special-case 1-bit writes.
 	 */
 	if (num_bits == 1) {
-		out[0] &= ~((1 << (7 - start_bit)) - 1);
+		out[0] &= ~((1 << (8 - start_bit)) - 1);
 		out[0] |= chunk << (7 - start_bit);
 		return;
 	}
@@ -723,10 +725,48 @@ static fr_trie_comp_t *fr_trie_comp_alloc(TALLOC_CTX *ctx, int bits)
 }
 #endif	/* WITH_NODE_COMPRESSION */
 
+/** One slot of a node in a frozen trie
+ *
+ *  A frozen trie is a level-compressed copy of the trie, stored as
+ *  one contiguous array of slots.  Each node is a run of 2^N slots,
+ *  indexed by the next N bits of the key.  A prefix which ends inside
+ *  of a node is expanded to all of the slots which it covers, so a
+ *  lookup touches one slot (and one cache line) per level.
+ *
+ *  Slot 0 is the entry point.  It holds the data for the zero length
+ *  key, and describes the top level node.
+ */
+typedef struct {
+	void		*data;		//!< Longest prefix which ends in this node, and covers this slot.
+	uint32_t	child;		//!< Index of the first slot of the child node, or offset of the leaf.
+	uint16_t	skip_chunk;	//!< Bits which every key below this slot has in common.
+	uint8_t		skip;		//!< How many bits to compare before indexing the child.
+	uint8_t		bits;		//!< How many bits index the child.  0 for no child.
+} fr_trie_slot_t;
+
+/** The child of a slot is a single key
+ *
+ *  Sparse parts of a trie would otherwise need a long chain of small
+ *  nodes.  Instead, we just compare the whole key.
+ */
+#define FR_TRIE_FROZEN_LEAF	(0xff)
+
+typedef struct {
+	void		*data;		//!< User ctx.
+	uint16_t	bits;		//!< Length of the key.
+	uint8_t		key[];		//!< The key, with any trailing bits masked off.
+} fr_trie_leaf_t;
+
+typedef struct {
+	fr_trie_slot_t	*slot;		//!< All of the nodes.
+	uint8_t		*leaf;		//!< All of the leaves, 8 byte aligned.
+} fr_trie_frozen_t;
+
 typedef struct {
 	uint8_t		buffer[16]; /* for get_key callbacks */
 	fr_trie_key_t	get_key;
 	fr_free_t	free_data;
+	fr_trie_frozen_t *frozen;	//!< read-optimized copy of the trie, see fr_trie_freeze()
 } fr_trie_ctx_t;
 
 /** Allocate a trie
@@ -1247,6 +1287,70 @@ static void *trie_key_match(fr_trie_t *trie, uint8_t const *key, int start_bit,
 	return trie_match_table[trie->type](trie, key, start_bit, end_bit, exact);
 }
 
+/** Check if a key matches a leaf of a frozen trie
+ *
+ *  The key must be at least as long as the leaf.
+ */
+static inline CC_HINT(always_inline) bool trie_frozen_leaf_match(fr_trie_leaf_t const *leaf, uint8_t const *key)
+{
+	int len = BYTEOF(leaf->bits);
+
+	if (memcmp(key, leaf->key, len) != 0) return false;
+
+	if ((leaf->bits & 0x07) == 0) return true;
+
+	return ((key[len] & used_bit_mask[(leaf->bits & 0x07) - 1]) == leaf->key[len]);
+}
+
+/** Longest prefix match in a frozen trie
+ *
+ *  If the key ends part way through a node, the expanded slots may
+ *  contain prefixes which are longer than the key.  That is rare, as
+ *  callers generally look up full length addresses, so we just let
+ *  the caller fall back to the normal trie.
+ *
+ * @param[out] out	the user ctx of the longest prefix, or NULL for no match.
+ * @param frozen	the frozen trie.
+ * @param key		the key.
+ * @param end_bit	the end bit.
+ * @return
+ *	- false if the frozen trie cannot answer the question.
+ *	- true if *out contains the answer.
+ */
+static bool trie_frozen_match(void **out, fr_trie_frozen_t const *frozen, uint8_t const *key, int end_bit)
+{
+	fr_trie_slot_t const	*slot = &frozen->slot[0];
+	void			*data = slot->data;
+	int			start_bit = 0;
+
+	while (slot->bits && (start_bit < end_bit)) {
+		uint16_t chunk;
+
+		if (slot->bits == FR_TRIE_FROZEN_LEAF) {
+			fr_trie_leaf_t const *leaf = (fr_trie_leaf_t const *) &frozen->leaf[slot->child];
+
+			if ((leaf->bits <= end_bit) && trie_frozen_leaf_match(leaf, key)) data = leaf->data;
+			break;
+		}
+
+		if ((start_bit + slot->skip + slot->bits) > end_bit) return false;
+
+		if (slot->skip) {
+			if (get_chunk(key, start_bit, slot->skip) != slot->skip_chunk) break;
+			start_bit += slot->skip;
+		}
+
+		chunk = get_chunk(key, start_bit, slot->bits);
+		start_bit += slot->bits;
+
+		slot = &frozen->slot[slot->child + chunk];
+		if (slot->data) data = slot->data;
+	}
+
+	*out = data;
+	return true;
+}
+
 /** Lookup a key in a trie and return user ctx, if any
  *
  *  The key may be LONGER than entries in the trie.  In which case the
@@ -1262,12 +1366,17 @@ static void *trie_key_match(fr_trie_t *trie, uint8_t const *key, int start_bit,
 void *fr_trie_lookup_by_key(fr_trie_t const *ft, void const *key, size_t keylen)
 {
 	fr_trie_user_t *user;
+	fr_trie_ctx_t *uctx;
+	void *data;
 
 	if (keylen > MAX_KEY_BITS) return NULL;
 
 	if (!ft->trie) return NULL;
 
 	user = UNCONST(fr_trie_user_t *, ft);
+	uctx = user->data;
+
+	if (uctx->frozen && trie_frozen_match(&data, uctx->frozen, key, keylen)) return data;
 
 	return trie_key_match(user->trie, key, 0, keylen, false);
 }
@@ -1896,6 +2005,8 @@ int fr_trie_insert_by_key(fr_trie_t *ft, void const *key, size_t keylen, void co
 		return -1;
 	}
 
+	TALLOC_FREE(((fr_trie_ctx_t *) user->data)->frozen);
+
 	my_data = UNCONST(void *, data);
 	MPRINT2("No match for data, inserting...\n");
 
@@ -2154,6 +2265,7 @@ static void *trie_key_remove(TALLOC_CTX *ctx, fr_trie_t **trie_p, uint8_t const
 void *fr_trie_remove_by_key(fr_trie_t *ft, void const *key, size_t keylen)
 {
 	fr_trie_user_t *user;
+	void *data;
 
 	if (keylen > MAX_KEY_BITS) return NULL;
 
@@ -2164,7 +2276,10 @@ void *fr_trie_remove_by_key(fr_trie_t *ft, void const *key, size_t keylen)
 	/*
 	 *	Remove the user trie, not ft->trie.
 	 */
-	return trie_key_remove(user->data, &user->trie, key, 0, (int) keylen);
+	data = trie_key_remove(user->data, &user->trie, key, 0, (int) keylen);
+	if (data) TALLOC_FREE(((fr_trie_ctx_t *) user->data)->frozen);
+
+	return data;
 }
 
 /* WALK FUNCTIONS */
@@ -2624,6 +2739,345 @@ int fr_trie_walk(fr_trie_t *ft, void *ctx, fr_trie_walk_t callback)
 }
 
 
+/* FREEZE FUNCTIONS */
+
+/** A key, and the user ctx associated with it
+ *
+ */
+typedef struct {
+	uint32_t	offset;		//!< of the key in the key buffer
+	uint16_t	bits;		//!< length of the key
+	void		*data;		//!< user ctx
+} fr_trie_frozen_entry_t;
+
+typedef struct {
+	uint8_t			*keys;		//!< all of the keys, one after the other
+	size_t			keys_used;
+	fr_trie_frozen_entry_t	*entry;		//!< keys in the order of the walk, which is sorted.
+	size_t			num_entries;
+	fr_trie_slot_t		*slot;		//!< the nodes we're building
+	size_t			slots_used;
+	uint8_t			*leaf;		//!< the leaves we're building
+	size_t			leaf_used;
+} fr_trie_freeze_t;
+
+#define FROZEN_KEY(_f, _i) (&(_f)->keys[(_f)->entry[_i].offset])
+
+/** Copy a key and user ctx out of the trie
+ *
+ *  Each key is followed by a zero byte, so that get_chunk() can read
+ *  past the end of short keys.  The walk buffer isn't cleaned between
+ *  keys, so we mask off any trailing bits.
+ */
+static int _trie_freeze_entry(uint8_t const *key, size_t keylen, void *data, void *uctx)
+{
+	fr_trie_freeze_t	*freeze = uctx;
+	size_t			len = BYTES(keylen);
+	uint8_t			*p;
+
+	if (freeze->keys_used > UINT32_MAX) {
+		fr_strerror_const("Too many keys to freeze trie");
+		return -1;
+	}
+
+	if (freeze->num_entries == talloc_array_length(freeze->entry)) {
+		freeze->entry = talloc_realloc(freeze, freeze->entry, fr_trie_frozen_entry_t, freeze->num_entries * 2);
+		if (!freeze->entry) {
+		oom:
+			fr_strerror_const("Failed allocating frozen trie");
+			return -1;
+		}
+	}
+
+	if ((freeze->keys_used + len + 1) > talloc_array_length(freeze->keys)) {
+		freeze->keys = talloc_realloc(freeze, freeze->keys, uint8_t, (freeze->keys_used + len + 1) * 2);
+		if (!freeze->keys) goto oom;
+	}
+
+	p = &freeze->keys[freeze->keys_used];
+	if (len) {
+		memcpy(p, key, len);
+		if ((keylen & 0x07) != 0) p[len - 1] &= used_bit_mask[(keylen & 0x07) - 1];
+	}
+	p[len] = 0;
+
+	freeze->entry[freeze->num_entries++] = (fr_trie_frozen_entry_t) {
+		.offset = freeze->keys_used,
+		.bits = keylen,
+		.data = data,
+	};
+	freeze->keys_used += len + 1;
+
+	return 0;
+}
+
+/** Allocate a node of 2^bits slots in the frozen trie
+ *
+ * @return
+ *	- 0 on error (slot 0 is never a node).
+ *	- the index of the first slot of the node.
+ */
+static uint32_t trie_freeze_node_alloc(fr_trie_freeze_t *freeze, int bits)
+{
+	size_t	size = ((size_t) 1) << bits;
+	size_t	first = freeze->slots_used;
+
+	if ((first + size) > UINT32_MAX) {
+		fr_strerror_const("Too many nodes to freeze trie");
+		return 0;
+	}
+
+	if ((first + size) > talloc_array_length(freeze->slot)) {
+		size_t len = talloc_array_length(freeze->slot) * 2;
+
+		if (len < (first + size)) len = first + size;
+
+		freeze->slot = talloc_realloc(freeze, freeze->slot, fr_trie_slot_t, len);
+		if (!freeze->slot) {
+			fr_strerror_const("Failed allocating frozen trie");
+			return 0;
+		}
+	}
+
+	memset(&freeze->slot[first], 0, size * sizeof(freeze->slot[0]));
+	freeze->slots_used += size;
+
+	return first;
+}
+
+/** Make the child of a slot in the frozen trie a single key
+ *
+ */
+static int trie_freeze_leaf(fr_trie_freeze_t *freeze, uint32_t parent, size_t i)
+{
+	fr_trie_frozen_entry_t	*entry = &freeze->entry[i];
+	size_t			len = BYTES(entry->bits);
+	size_t			size = ROUND_UP(sizeof(fr_trie_leaf_t) + len, 8);
+	fr_trie_leaf_t		*leaf;
+
+	if ((freeze->leaf_used + size) > UINT32_MAX) {
+		fr_strerror_const("Too many keys to freeze trie");
+		return -1;
+	}
+
+	if ((freeze->leaf_used + size) > talloc_array_length(freeze->leaf)) {
+		freeze->leaf = talloc_realloc(freeze, freeze->leaf, uint8_t, (freeze->leaf_used + size) * 2);
+		if (!freeze->leaf) {
+			fr_strerror_const("Failed allocating frozen trie");
+			return -1;
+		}
+	}
+
+	leaf = (fr_trie_leaf_t *) &freeze->leaf[freeze->leaf_used];
+	leaf->data = entry->data;
+	leaf->bits = entry->bits;
+	memcpy(leaf->key, FROZEN_KEY(freeze, i), len);
+
+	freeze->slot[parent].child = freeze->leaf_used;
+	freeze->slot[parent].bits = FR_TRIE_FROZEN_LEAF;
+	freeze->leaf_used += size;
+
+	return 0;
+}
+
+/** Build the node below a slot of a frozen trie
+ *
+ *  All of the keys share the first "start_bit" bits, and are longer
+ *  than "start_bit".
+ *
+ *  A single key becomes a leaf.  Otherwise, we first skip any bits
+ *  which all of the keys have in common, and
+ *  which are not the end of a key.  That is path compression.
+ *
+ *  We then pick the widest node where at least half of the slots are
+ *  used by different keys.  That is level compression.  Sparse parts
+ *  of the trie get narrow nodes, and dense parts (e.g. the top of a
+ *  large IPv4 table) get up to 2^16 way fan-out.  Nodes are limited
+ *  to what get_chunk() can do.
+ *
+ * @param freeze	the frozen trie we're building.
+ * @param parent	index of the slot which points to this node.
+ * @param first		the first key.
+ * @param last		one past the last key.
+ * @param start_bit	the start bit.
+ * @return
+ *	- <0 on error
+ *	- 0 on success
+ */
+static int trie_freeze_node(fr_trie_freeze_t *freeze, uint32_t parent, size_t first, size_t last, int start_bit)
+{
+	fr_trie_frozen_entry_t	*entry = freeze->entry;
+	size_t			i, j;
+	int			min_bits, max_bits, skip, bits, end_bit, max_node_bits;
+	uint32_t		child;
+	uint16_t		skip_chunk = 0;
+
+	if ((last - first) == 1) return trie_freeze_leaf(freeze, parent, first);
+
+	min_bits = max_bits = entry[first].bits;
+	for (i = first + 1; i < last; i++) {
+		if (entry[i].bits < min_bits) min_bits = entry[i].bits;
+		if (entry[i].bits > max_bits) max_bits = entry[i].bits;
+	}
+
+	/*
+	 *	The keys are sorted, so the bits shared by the first
+	 *	and last keys are shared by all of them.  We can't skip
+	 *	past the end of a key, as it has to end up in a slot.
+	 */
+	max_node_bits = 16 - (start_bit & 0x07);
+	if (max_node_bits > (min_bits - start_bit - 1)) max_node_bits = min_bits - start_bit - 1;
+
+	for (skip = 0; skip < max_node_bits; skip++) {
+		if (get_chunk(FROZEN_KEY(freeze, first), start_bit + skip, 1) !=
+		    get_chunk(FROZEN_KEY(freeze, last - 1), start_bit + skip, 1)) break;
+	}
+
+	if (skip) {
+		skip_chunk = get_chunk(FROZEN_KEY(freeze, first), start_bit, skip);
+		start_bit += skip;
+	}
+
+	max_node_bits = 16 - (start_bit & 0x07);
+	if (max_node_bits > (max_bits - start_bit)) max_node_bits = max_bits - start_bit;
+
+	for (bits = 1; bits < max_node_bits; bits++) {
+		size_t used = 1;
+
+		if ((((size_t) 1) << bits) > (last - first)) break;
+
+		for (i = first + 1; i < last; i++) {
+			if (get_chunk(FROZEN_KEY(freeze, i), start_bit, bits + 1) !=
+			    get_chunk(FROZEN_KEY(freeze, i - 1), start_bit, bits + 1)) used++;
+		}
+
+		if (used < (((size_t) 1) << bits)) break;
+	}
+
+	child = trie_freeze_node_alloc(freeze, bits);
+	if (!child) return -1;
+
+	freeze->slot[parent].child = child;
+	freeze->slot[parent].skip_chunk = skip_chunk;
+	freeze->slot[parent].skip = skip;
+	freeze->slot[parent].bits = bits;
+
+	/*
+	 *	Keys which end in this node are expanded to all of the
+	 *	slots which they cover.  Shorter keys sort before the
+	 *	longer keys they contain, so the longest prefix wins.
+	 *
+	 *	Longer keys are grouped by chunk, and go into a child
+	 *	node.  They sort after any key which ends in the same
+	 *	slot.
+	 */
+	end_bit = start_bit + bits;
+	i = first;
+	while (i < last) {
+		uint16_t chunk = get_chunk(FROZEN_KEY(freeze, i), start_bit, bits);
+
+		if (entry[i].bits <= end_bit) {
+			size_t num = ((size_t) 1) << (end_bit - entry[i].bits);
+
+			for (j = 0; j < num; j++) freeze->slot[child + chunk + j].data = entry[i].data;
+			i++;
+			continue;
+		}
+
+		for (j = i + 1; j < last; j++) {
+			if (get_chunk(FROZEN_KEY(freeze, j), start_bit, bits) != chunk) break;
+			fr_cond_assert(entry[j].bits > end_bit);
+		}
+
+		if (trie_freeze_node(freeze, child + chunk, i, j, end_bit) < 0) return -1;
+		i = j;
+	}
+
+	return 0;
+}
+
+/** Build a read-optimized copy of a trie
+ *
+ *  The trie is rebuilt into a level-compressed array, which is used
+ *  by fr_trie_lookup_by_key() and fr_trie_find().  A longest prefix
+ *  match then touches one slot per level, which for a large IPv4 or
+ *  IPv6 table is a handful of cache lines instead of a pointer chase
+ *  through a node per 4 bits.
+ *
+ *  The normal trie is kept, and is used for exact matches.  Any
+ *  insert or remove discards the frozen copy, so a trie should be
+ *  frozen only after it has been loaded, and only if it changes
+ *  rarely.  Call this function again after changes to re-freeze it.
+ *
+ * @param ft	the trie to freeze.
+ * @return
+ *	- <0 on error.  The trie is unchanged, and still usable.
+ *	- 0 on success.
+ */
+int fr_trie_freeze(fr_trie_t *ft)
+{
+	fr_trie_user_t		*user = (fr_trie_user_t *) ft;
+	fr_trie_ctx_t		*uctx = talloc_get_type_abort(user->data, fr_trie_ctx_t);
+	fr_trie_freeze_t	*freeze;
+	fr_trie_frozen_t	*frozen;
+	size_t			first = 0;
+
+	TALLOC_FREE(uctx->frozen);
+
+	freeze = talloc_zero(NULL, fr_trie_freeze_t);
+	if (!freeze) {
+	oom:
+		fr_strerror_const("Failed allocating frozen trie");
+	error:
+		talloc_free(freeze);
+		return -1;
+	}
+
+	freeze->entry = talloc_array(freeze, fr_trie_frozen_entry_t, 64);
+	freeze->keys = talloc_array(freeze, uint8_t, 1024);
+	freeze->slot = talloc_zero_array(freeze, fr_trie_slot_t, 1);
+	freeze->leaf = talloc_array(freeze, uint8_t, 1024);
+	if (!freeze->entry || !freeze->keys || !freeze->slot || !freeze->leaf) goto oom;
+	freeze->slots_used = 1;
+
+	if (fr_trie_walk(ft, freeze, _trie_freeze_entry) < 0) goto error;
+
+	/*
+	 *	The zero length key can only be first, and goes into
+	 *	the entry point.
+	 */
+	if (freeze->num_entries && (freeze->entry[0].bits == 0)) {
+		freeze->slot[0].data = freeze->entry[0].data;
+		first++;
+	}
+
+	if ((first < freeze->num_entries) &&
+	    (trie_freeze_node(freeze, 0, first, freeze->num_entries, 0) < 0)) goto error;
+
+	/*
+	 *	Keep only the nodes and leaves, and free everything else.
+	 */
+	freeze->slot = talloc_realloc(freeze, freeze->slot, fr_trie_slot_t, freeze->slots_used);
+	if (!freeze->slot) goto oom;
+
+	if (freeze->leaf_used) {
+		freeze->leaf = talloc_realloc(freeze, freeze->leaf, uint8_t, freeze->leaf_used);
+		if (!freeze->leaf) goto oom;
+	}
+
+	frozen = talloc_zero(uctx, fr_trie_frozen_t);
+	if (!frozen) goto oom;
+
+	frozen->slot = talloc_steal(frozen, freeze->slot);
+	frozen->leaf = talloc_steal(frozen, freeze->leaf);
+	talloc_free(freeze);
+
+	uctx->frozen = frozen;
+
+	return 0;
+}
+
+
 /**********************************************************************/
 
 /*
@@ -3075,6 +3529,7 @@ static int command_clear(fr_trie_t *ft, UNUSED int argc, UNUSED char **argv, UNU
 
 	trie_free(ft->trie);
 	ft->trie = NULL;
+	TALLOC_FREE(((fr_trie_ctx_t *) ((fr_trie_user_t *) ft)->data)->frozen);
 
 	/*
 	 *	Clean up our internal data ctx, too.
@@ -3086,6 +3541,21 @@ static int command_clear(fr_trie_t *ft, UNUSED int argc, UNUSED char **argv, UNU
 }
 
 
+/**  Freeze the trie, so that lookups use the level-compressed copy.
+ *
+ *  Any insert or remove discards the frozen copy.
+ */
+static int command_freeze(fr_trie_t *ft, UNUSED int argc, UNUSED char **argv, UNUSED char *out, UNUSED size_t outlen)
+{
+	if (fr_trie_freeze(ft) < 0) {
+		MPRINT("Failed freezing trie - %s\n", fr_strerror());
+		return -1;
+	}
+
+	return 0;
+}
+
+
 /**  Turn on line number debugging.
  *
  *  @todo - add general "debug" functionality.
@@ -3429,6 +3899,7 @@ static fr_trie_command_t commands[] = {
 	{ "verify",	command_verify,	0, 0, false },
 	{ "lineno",	command_lineno, 1, 1, false },
 	{ "clear",	command_clear,	0, 0, false },
+	{ "freeze",	command_freeze,	0, 0, false },
 	{ .name = NULL }
 };
 
@@ -27,6 +27,10 @@ RCSID("$Id$")
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/udp.h>
 
+#ifdef __linux__
+#  include <linux/filter.h>
+#endif
+
 #define FR_DEBUG_STRERROR_PRINTF if (fr_debug_lvl) fr_strerror_printf
 
 /** Send a packet via a UDP socket.
@@ -207,3 +211,430 @@ done:
 
 	return slen;
 }
+
+/** A batch of UDP packets read from a socket in one system call
+ *
+ */
+struct udp_recv_batch_s {
+	unsigned int		num;		//!< Maximum number of packets to read at once.
+	unsigned int		received;	//!< How many packets the last read returned.
+	unsigned int		next;		//!< The next packet to return to the caller.
+
+#ifdef HAVE_RECVMMSG
+	udpfromto_mmsg_t	*msgs;		//!< Received packets, and their addresses.
+#endif
+};
+
+/** Allocate a structure for reading multiple UDP packets at once
+ *
+ * @param[in] ctx		to allocate the batch in.
+ * @param[in] num		maximum number of packets to read in one system call.
+ * @param[in] max_packet_size	the largest packet we will accept.
+ * @return
+ *	- NULL on error, or if batching is not supported on this platform.
+ *	- a new batch structure.
+ */
+udp_recv_batch_t *udp_recv_batch_alloc(TALLOC_CTX *ctx, unsigned int num, size_t max_packet_size)
+{
+#ifdef HAVE_RECVMMSG
+	udp_recv_batch_t	*batch;
+	uint8_t			*buffer;
+	unsigned int		i;
+
+	if (num < 2) return NULL;
+	if (num > UDPFROMTO_MMSG_MAX) num = UDPFROMTO_MMSG_MAX;
+
+	batch = talloc_zero(ctx, udp_recv_batch_t);
+	if (!batch) return NULL;
+
+	batch->num = num;
+	batch->msgs = talloc_zero_array(batch, udpfromto_mmsg_t, num);
+	buffer = talloc_array(batch, uint8_t, num * max_packet_size);
+	if (!batch->msgs || !buffer) {
+		talloc_free(batch);
+		return NULL;
+	}
+
+	for (i = 0; i < num; i++) {
+		batch->msgs[i].buf = buffer + (i * max_packet_size);
+		batch->msgs[i].len = max_packet_size;
+	}
+
+	return batch;
+#else
+	return NULL;
+#endif
+}
+
+/** Read a UDP packet, using a batch of packets read from the kernel
+ *
+ * Has the same semantics as udp_recv(), except that when there are no
+ * packets left in the batch, up to batch->num packets are read from
+ * the socket using one system call.  The caller should keep calling
+ * this function while udp_recv_batch_pending() returns true, as the
+ * socket will not be signalled as readable for packets which have
+ * already been read into the batch.
+ *
+ * @param[in] batch		to read from.  If NULL, this function is
+ *				identical to udp_recv().
+ * @param[in] sockfd		we're reading from.
+ * @param[in] flags		for things
+ * @param[out] socket_out	Information about the src/dst address of the packet
+ *				and the interface it was received on.
+ * @param[out] data		pointer where data will be written
+ * @param[in] data_len		length of data to read
+ * @param[out] when		the packet was received.
+ * @return
+ *	- > 0 on success (number of bytes read).
+ *	- 0 if there is no data.
+ *	- < 0 on failure.
+ */
+ssize_t udp_recv_batch(udp_recv_batch_t *batch, int sockfd, int flags,
+		       fr_socket_t *socket_out, void *data, size_t data_len, fr_time_t *when)
+{
+#ifdef HAVE_RECVMMSG
+	udpfromto_mmsg_t	*msg;
+	size_t			len;
+
+	/*
+	 *	Connected sockets are mostly fed packets by the
+	 *	master socket, and peeking doesn't consume the
+	 *	packet.  Neither benefits from batching.
+	 */
+	if (!batch || ((flags & (UDP_FLAGS_CONNECTED | UDP_FLAGS_PEEK)) != 0)) {
+		return udp_recv(sockfd, flags, socket_out, data, data_len, when);
+	}
+
+	if (batch->next == batch->received) {
+		int ret;
+
+		batch->next = batch->received = 0;
+
+		ret = recvmmsgfromto(sockfd, batch->msgs, batch->num, 0);
+		if (ret < 0) {
+			if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) return 0;
+
+			fr_strerror_printf("Failed reading socket: %s", fr_syserror(errno));
+			return -1;
+		}
+		if (ret == 0) return 0;
+
+		batch->received = ret;
+	}
+
+	msg = &batch->msgs[batch->next++];
+
+	*socket_out = (fr_socket_t){
+		.fd = sockfd,
+		.type = SOCK_DGRAM,
+		.inet = {
+			.ifindex = msg->ifindex
+		}
+	};
+
+	if (fr_ipaddr_from_sockaddr(&socket_out->inet.src_ipaddr, &socket_out->inet.src_port,
+				    &msg->from, msg->from_len) < 0) {
+		fr_strerror_const_push("Failed converting src sockaddr to ipaddr");
+		return -1;
+	}
+	if (fr_ipaddr_from_sockaddr(&socket_out->inet.dst_ipaddr, &socket_out->inet.dst_port,
+				    &msg->to, msg->to_len) < 0) {
+		fr_strerror_const_push("Failed converting dst sockaddr to ipaddr");
+		return -1;
+	}
+
+	/*
+	 *	As with recv(), anything which doesn't fit into the
+	 *	caller's buffer is discarded.
+	 */
+	len = msg->data_len;
+	if (len > data_len) len = data_len;
+
+	memcpy(data, msg->buf, len);
+	if (when) *when = msg->when;
+
+	return len;
+#else
+	fr_assert(batch == NULL);
+
+	return udp_recv(sockfd, flags, socket_out, data, data_len, when);
+#endif
+}
+
+/** Check if there are packets in the batch which haven't been returned yet
+ *
+ * @param[in] batch	to check.  May be NULL.
+ * @return
+ *	- true if udp_recv_batch() will return a packet without reading the socket.
+ *	- false if the batch is empty.
+ */
+bool udp_recv_batch_pending(udp_recv_batch_t const *batch)
+{
+	if (!batch) return false;
+
+	return (batch->next < batch->received);
+}
+
+/** A queue of UDP packets which are written to a socket in one system call
+ *
+ */
+struct udp_send_batch_s {
+	unsigned int		num;		//!< Maximum number of packets to queue.
+	unsigned int		queued;		//!< How many packets are in the queue.
+	unsigned int		sent;		//!< How many of the queued packets have been written.
+	unsigned int		written;	//!< Packets written since udp_send_batch_written() was last called.
+	size_t			max_packet_size;	//!< Largest packet we can queue.
+
+	udpfromto_mmsg_t	*msgs;		//!< Queued packets, and their addresses.
+};
+
+/** Allocate a structure for writing multiple UDP packets at once
+ *
+ * @param[in] ctx		to allocate the batch in.
+ * @param[in] num		maximum number of packets to write in one system call.
+ * @param[in] max_packet_size	the largest packet we will queue.  Larger
+ *				packets are written immediately.
+ * @return
+ *	- NULL on error.
+ *	- a new batch structure.
+ */
+udp_send_batch_t *udp_send_batch_alloc(TALLOC_CTX *ctx, unsigned int num, size_t max_packet_size)
+{
+	udp_send_batch_t	*batch;
+	uint8_t			*buffer;
+	unsigned int		i;
+
+	if (num < 2) return NULL;
+	if (num > UDPFROMTO_MMSG_MAX) num = UDPFROMTO_MMSG_MAX;
+
+	batch = talloc_zero(ctx, udp_send_batch_t);
+	if (!batch) return NULL;
+
+	batch->num = num;
+	batch->max_packet_size = max_packet_size;
+	batch->msgs = talloc_zero_array(batch, udpfromto_mmsg_t, num);
+	buffer = talloc_array(batch, uint8_t, num * max_packet_size);
+	if (!batch->msgs || !buffer) {
+		talloc_free(batch);
+		return NULL;
+	}
+
+	for (i = 0; i < num; i++) {
+		batch->msgs[i].buf = buffer + (i * max_packet_size);
+		batch->msgs[i].len = max_packet_size;
+	}
+
+	return batch;
+}
+
+/** Queue a packet to be sent via a UDP socket
+ *
+ * The packet is copied into the batch, and is written by a later call to
+ * udp_send_batch_flush().  If the queue is full, it is flushed first.
+ *
+ * @param[in] batch		to add the packet to.  If NULL, this function
+ *				is identical to udp_send().
+ * @param[in] sock		we're writing to.
+ * @param[in] flags		to pass to send(), or sendto()
+ * @param[in] data		to data to send
+ * @param[in] data_len		length of data to send
+ * @return
+ *	- data_len on success.
+ *	- -1 on failure.  errno is set to EWOULDBLOCK if the queue is full,
+ *	  and the socket isn't writable, or to EINVAL if the addresses are
+ *	  invalid.
+ */
+int udp_send_batch(udp_send_batch_t *batch, fr_socket_t const *sock, int flags, void *data, size_t data_len)
+{
+	udpfromto_mmsg_t	*msg;
+	socklen_t		from_len, to_len;
+	int			ret;
+
+	if (!batch) return udp_send(sock, flags, data, data_len);
+
+	if ((flags & UDP_FLAGS_CONNECTED) != 0) {
+		ret = udp_send(sock, flags, data, data_len);
+		if (ret > 0) batch->written++;
+		return ret;
+	}
+
+	fr_assert(sock->type == SOCK_DGRAM);
+
+	/*
+	 *	Make room for the packet.
+	 */
+	if (batch->queued == batch->num) {
+		(void) udp_send_batch_flush(batch, sock->fd);
+
+		if (batch->queued == batch->num) {
+			errno = EWOULDBLOCK;
+			fr_strerror_const("udp_send failed: send queue is full");
+			return -1;
+		}
+	}
+
+	/*
+	 *	Jumbo packets don't fit in the batch.  Write
+	 *	everything which is queued, so that the packets go out
+	 *	in order, and then write this one.
+	 */
+	if (data_len > batch->max_packet_size) {
+		(void) udp_send_batch_flush(batch, sock->fd);
+
+		if (batch->queued > 0) {
+			errno = EWOULDBLOCK;
+			fr_strerror_const("udp_send failed: send queue is full");
+			return -1;
+		}
+
+		ret = udp_send(sock, flags, data, data_len);
+		if (ret > 0) batch->written++;
+		return ret;
+	}
+
+	msg = &batch->msgs[batch->queued];
+
+	if ((fr_ipaddr_to_sockaddr(&msg->to, &to_len,
+				   &sock->inet.dst_ipaddr, sock->inet.dst_port) < 0) ||
+	    (fr_ipaddr_to_sockaddr(&msg->from, &from_len,
+				   &sock->inet.src_ipaddr, sock->inet.src_port) < 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	msg->to_len = to_len;
+	msg->from_len = from_len;
+	msg->ifindex = sock->inet.ifindex;
+
+	memcpy(msg->buf, data, data_len);
+	msg->data_len = data_len;
+
+	batch->queued++;
+
+	return data_len;
+}
+
+/** Write all queued packets to a UDP socket
+ *
+ * Packets which the OS refuses to send (e.g. no route to the destination)
+ * are discarded, so that one bad destination doesn't block replies to all
+ * of the others.
+ *
+ * @param[in] batch		to write.  May be NULL.
+ * @param[in] sockfd		to write the packets to.
+ * @return
+ *	- 0 if all queued packets were written.
+ *	- 1 if the socket would block.  The remaining packets stay queued, and
+ *	  this function should be called again when the socket is writable.
+ *	- -1 if one or more packets were discarded due to errors.
+ */
+int udp_send_batch_flush(udp_send_batch_t *batch, int sockfd)
+{
+	int ret, rcode = 0;
+
+	if (!batch) return 0;
+
+	while (batch->sent < batch->queued) {
+		ret = sendmmsgfromto(sockfd, batch->msgs + batch->sent, batch->queued - batch->sent, 0);
+		if (ret < 0) {
+			if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) return 1;
+
+			/*
+			 *	The first packet failed.  Skip it, and
+			 *	try the rest.
+			 */
+			fr_strerror_printf("udp_send failed: %s", fr_syserror(errno));
+			rcode = -1;
+			batch->sent++;
+			continue;
+		}
+
+		batch->sent += ret;
+		batch->written += ret;
+	}
+
+	batch->queued = batch->sent = 0;
+
+	return rcode;
+}
+
+/** Return how many packets were written since the last call to this function
+ *
+ * Packets which are queued, or which were discarded due to errors, are
+ * not counted.
+ *
+ * @param[in] batch		to check.  May be NULL.
+ * @return the number of packets written.
+ */
+unsigned int udp_send_batch_written(udp_send_batch_t *batch)
+{
+	unsigned int written;
+
+	if (!batch) return 0;
+
+	written = batch->written;
+	batch->written = 0;
+
+	return written;
+}
+
+/** Steer packets to a socket in an SO_REUSEPORT group by source IP address
+ *
+ *  By default the kernel picks a socket using a hash of the source
+ *  and destination IP addresses and ports.  A client which changes
+ *  its source port may then hit a different socket for each packet.
+ *
+ *  This function attaches a classic BPF program which instead picks
+ *  socket "src_ipaddr % num".  Sockets are numbered in the order in
+ *  which they were bound, so all of the sockets should be bound
+ *  before any packets arrive.
+ *
+ *  It should be called for the first socket, after SO_REUSEPORT has
+ *  been set.  The program applies to the whole group.
+ *
+ * @param[in] sockfd	the first socket in the group.
+ * @param[in] num	the number of sockets in the group.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, or if the OS doesn't support steering.
+ */
+int udp_reuseport_steer(int sockfd, uint32_t num)
+{
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+	/*
+	 *	The program runs with the data pointing to the UDP
+	 *	payload, so we use SKF_NET_OFF to get at the IP
+	 *	header.  IPv4 packets can arrive on IPv6 sockets, so
+	 *	we check the IP version.  For IPv6, we use the low 32
+	 *	bits of the source address.
+	 */
+	struct sock_filter code[] = {
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF),		/* A = version << 4 */
+		BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 4),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 4, 0, 2),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),		/* IPv4 source address */
+		BPF_JUMP(BPF_JMP | BPF_JA, 1, 0, 0),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 20),		/* low 32 bits of the IPv6 source address */
+		BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, num),
+		BPF_STMT(BPF_RET | BPF_A, 0),
+	};
+	struct sock_fprog prog = {
+		.len = NUM_ELEMENTS(code),
+		.filter = code,
+	};
+
+	if (num < 2) return 0;
+
+	if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+		fr_strerror_printf("Failed attaching reuseport program: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+#else
+	if (num < 2) return 0;
+
+	fr_strerror_const("Steering packets by source IP address is not supported on this system");
+	return -1;
+#endif
+}
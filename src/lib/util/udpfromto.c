@@ -172,6 +172,105 @@ int udpfromto_init(int s, int af)
 	return setsockopt(s, proto, flag, &opt, sizeof(opt));
 }
 
+/** Process the auxiliary data returned by recvmsg()
+ *
+ * @param[in] msgh	as filled in by recvmsg() or recvmmsg().
+ * @param[out] ifindex	The interface which received the datagram (may be NULL).
+ * @param[out] to	Where to write the destination address.  Must already
+ *			contain the address the socket is bound to.
+ * @param[out] to_len	Length of the structure pointed to by to.
+ * @param[out] when	the packet was received (may be NULL).
+ */
+static void recvfromto_cmsg(struct msghdr *msgh, int *ifindex,
+			    struct sockaddr *to, socklen_t *to_len, fr_time_t *when)
+{
+	struct cmsghdr		*cmsg;
+
+/*
+ *	Needed for emscripten, seems to be an issue in CMSG_NXTHDR
+ */
+DIAG_OFF(sign-compare)
+	/* Process auxiliary received data in msgh */
+	for (cmsg = CMSG_FIRSTHDR(msgh);
+	     cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(msgh, cmsg)) {
+DIAG_ON(sign-compare)
+
+#ifdef IP_PKTINFO
+		if ((cmsg->cmsg_level == SOL_IP) &&
+		    (cmsg->cmsg_type == IP_PKTINFO)) {
+			struct in_pktinfo *i = (struct in_pktinfo *) CMSG_DATA(cmsg);
+
+			((struct sockaddr_in *)to)->sin_addr = i->ipi_addr;
+			*to_len = sizeof(struct sockaddr_in);
+
+			if (ifindex) *ifindex = i->ipi_ifindex;
+
+			break;
+		}
+#endif
+
+#ifdef IP_RECVDSTADDR
+		if ((cmsg->cmsg_level == IPPROTO_IP) &&
+		    (cmsg->cmsg_type == IP_RECVDSTADDR)) {
+			struct in_addr *i = (struct in_addr *) CMSG_DATA(cmsg);
+
+			((struct sockaddr_in *)to)->sin_addr = *i;
+
+			*to_len = sizeof(struct sockaddr_in);
+
+#ifdef   IP_RECVIF
+			continue;
+#else
+			break;
+#endif
+		}
+#endif
+
+#ifdef IP_RECVIF
+		if ((cmsg->cmsg_level == IPPROTO_IP) &&
+		    (cmsg->cmsg_type == IP_RECVIF)) {
+			struct sockaddr_dl *sd = (struct sockaddr_dl *) CMSG_DATA(cmsg);
+
+			if (ifindex) *ifindex = sd->sdl_index;
+
+#ifdef   IP_RECVDSTADDR
+			continue;
+#else
+			break;
+#endif
+		}
+#endif
+
+#ifdef IPV6_PKTINFO
+		if ((cmsg->cmsg_level == IPPROTO_IPV6) &&
+		    (cmsg->cmsg_type == IPV6_PKTINFO)) {
+			struct in6_pktinfo *i = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+
+			((struct sockaddr_in6 *)to)->sin6_addr = i->ipi6_addr;
+			*to_len = sizeof(struct sockaddr_in6);
+
+			if (ifindex) *ifindex = i->ipi6_ifindex;
+
+			break;
+		}
+#endif
+
+#ifdef SO_TIMESTAMP
+		if (when && (cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == SO_TIMESTAMP)) {
+			*when = fr_time_from_timeval((struct timeval *)CMSG_DATA(cmsg));
+		}
+#endif
+
+#ifdef SO_TIMESTAMPNS
+		if (when && (cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == SO_TIMESTAMPNS)) {
+			*when = fr_time_from_timespec((struct timespec *)CMSG_DATA(cmsg));
+		}
+#endif
+	}
+
+}
+
 /** Read a packet from a file descriptor, retrieving additional header information
  *
  * Abstracts away the complexity of using the complexity of using recvmsg().
@@ -206,7 +305,6 @@ int recvfromto(int fd, void *buf, size_t len, int flags,
 	       fr_time_t *when)
 {
 	struct msghdr		msgh;
-	struct cmsghdr		*cmsg;
 	struct iovec		iov;
 	char			cbuf[256];
 	int			ret;
@@ -312,92 +410,196 @@ int recvfromto(int fd, void *buf, size_t len, int flags,
 	if (ifindex) *ifindex = 0;
 	if (when) *when = fr_time_wrap(0);
 
-/*
- *	Needed for emscripten, seems to be an issue in CMSG_NXTHDR
- */
-DIAG_OFF(sign-compare)
-	/* Process auxiliary received data in msgh */
-	for (cmsg = CMSG_FIRSTHDR(&msgh);
-	     cmsg != NULL;
-	     cmsg = CMSG_NXTHDR(&msgh, cmsg)) {
-DIAG_ON(sign-compare)
+	recvfromto_cmsg(&msgh, ifindex, to, to_len, when);
 
-#ifdef IP_PKTINFO
-		if ((cmsg->cmsg_level == SOL_IP) &&
-		    (cmsg->cmsg_type == IP_PKTINFO)) {
-			struct in_pktinfo *i = (struct in_pktinfo *) CMSG_DATA(cmsg);
+	if (when && fr_time_eq(*when, fr_time_wrap(0))) *when = fr_time();
 
-			((struct sockaddr_in *)to)->sin_addr = i->ipi_addr;
-			*to_len = sizeof(struct sockaddr_in);
+	return ret;
+}
 
-			if (ifindex) *ifindex = i->ipi_ifindex;
+#ifdef HAVE_RECVMMSG
+/** Read multiple packets from a file descriptor, retrieving additional header information
+ *
+ * As with recvfromto(), but uses recvmmsg() to read up to num datagrams in one
+ * system call.  The socket's local address is only looked up once per call,
+ * instead of once per packet.
+ *
+ * @param[in] fd	The file descriptor to read from.
+ * @param[in,out] msgs	Array of message structures.  The caller initialises
+ *			buf and len, everything else is written by this function.
+ * @param[in] num	Number of entries in msgs.  Values larger than
+ *			#UDPFROMTO_MMSG_MAX are clamped.
+ * @param[in] flags	passed unmolested to recvmmsg.
+ * @return
+ *	- >= 0 the number of datagrams received.
+ *	- -1 on failure.
+ */
+int recvmmsgfromto(int fd, udpfromto_mmsg_t *msgs, unsigned int num, int flags)
+{
+	struct mmsghdr		msgvec[UDPFROMTO_MMSG_MAX];
+	struct iovec		iov[UDPFROMTO_MMSG_MAX];
+	struct sockaddr_storage	si;
+	socklen_t		si_len = sizeof(si);
+	unsigned int		i;
+	int			ret;
+	fr_time_t		now;
 
-			break;
-		}
+	if (num > UDPFROMTO_MMSG_MAX) num = UDPFROMTO_MMSG_MAX;
+
+#ifdef STATIC_ANALYZER
+	memset(&si, 0, sizeof(si));
 #endif
 
-#ifdef IP_RECVDSTADDR
-		if ((cmsg->cmsg_level == IPPROTO_IP) &&
-		    (cmsg->cmsg_type == IP_RECVDSTADDR)) {
-			struct in_addr *i = (struct in_addr *) CMSG_DATA(cmsg);
+	/*
+	 *	recvmsg doesn't provide sin_port so we have to
+	 *	retrieve it using getsockname().  The local
+	 *	address is the same for every packet in the batch.
+	 */
+	if (getsockname(fd, (struct sockaddr *)&si, &si_len) < 0) return -1;
 
-			((struct sockaddr_in *)to)->sin_addr = *i;
+	if ((si.ss_family != AF_INET) && (si.ss_family != AF_INET6)) {
+		errno = EINVAL;
+		return -1;
+	}
 
-			*to_len = sizeof(struct sockaddr_in);
+	memset(msgvec, 0, sizeof(msgvec[0]) * num);
 
-#ifdef   IP_RECVIF
-			continue;
-#else
-			break;
-#endif
-		}
-#endif
+	for (i = 0; i < num; i++) {
+		iov[i].iov_base = msgs[i].buf;
+		iov[i].iov_len = msgs[i].len;
 
-#ifdef IP_RECVIF
-		if ((cmsg->cmsg_level == IPPROTO_IP) &&
-		    (cmsg->cmsg_type == IP_RECVIF)) {
-			struct sockaddr_dl *sd = (struct sockaddr_dl *) CMSG_DATA(cmsg);
+		msgvec[i].msg_hdr.msg_name = &msgs[i].from;
+		msgvec[i].msg_hdr.msg_namelen = sizeof(msgs[i].from);
+		msgvec[i].msg_hdr.msg_iov = &iov[i];
+		msgvec[i].msg_hdr.msg_iovlen = 1;
+		msgvec[i].msg_hdr.msg_control = msgs[i].cbuf;
+		msgvec[i].msg_hdr.msg_controllen = sizeof(msgs[i].cbuf);
+	}
 
-			if (ifindex) *ifindex = sd->sdl_index;
+	ret = recvmmsg(fd, msgvec, num, flags, NULL);
+	if (ret <= 0) return ret;
 
-#ifdef   IP_RECVDSTADDR
-			continue;
-#else
-			break;
-#endif
-		}
-#endif
+	now = fr_time();
 
-#ifdef IPV6_PKTINFO
-		if ((cmsg->cmsg_level == IPPROTO_IPV6) &&
-		    (cmsg->cmsg_type == IPV6_PKTINFO)) {
-			struct in6_pktinfo *i = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+	for (i = 0; i < (unsigned int) ret; i++) {
+		msgs[i].data_len = msgvec[i].msg_len;
+		msgs[i].from_len = msgvec[i].msg_hdr.msg_namelen;
 
-			((struct sockaddr_in6 *)to)->sin6_addr = i->ipi6_addr;
-			*to_len = sizeof(struct sockaddr_in6);
+		/*
+		 *	Initialize the 'to' address.  It may be INADDR_ANY here,
+		 *	with a more specific address given by the ancillary data.
+		 */
+		memcpy(&msgs[i].to, &si, si_len);
+		msgs[i].to_len = si_len;
+		msgs[i].ifindex = 0;
+		msgs[i].when = fr_time_wrap(0);
 
-			if (ifindex) *ifindex = i->ipi6_ifindex;
+		recvfromto_cmsg(&msgvec[i].msg_hdr, &msgs[i].ifindex,
+				(struct sockaddr *)&msgs[i].to, &msgs[i].to_len, &msgs[i].when);
 
-			break;
-		}
-#endif
+		if (fr_time_eq(msgs[i].when, fr_time_wrap(0))) msgs[i].when = now;
+	}
 
-#ifdef SO_TIMESTAMP
-		if (when && (cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == SO_TIMESTAMP)) {
-			*when = fr_time_from_timeval((struct timeval *)CMSG_DATA(cmsg));
-		}
+	return ret;
+}
 #endif
 
-#ifdef SO_TIMESTAMPNS
-		if (when && (cmsg->cmsg_level == SOL_IP) && (cmsg->cmsg_type == SO_TIMESTAMPNS)) {
-			*when = fr_time_from_timespec((struct timespec *)CMSG_DATA(cmsg));
-		}
+/** Add the source address and outbound interface to a message as ancillary data
+ *
+ * @param[in,out] msgh	to add the ancillary data to.
+ * @param[in] cbuf	buffer for the ancillary data.  Must be zeroed, and
+ *			large enough for a pktinfo structure.
+ * @param[in] ifindex	The interface on which to send the datagram.
+ * @param[in] from	The source address.
+ */
+static void sendfromto_cmsg(struct msghdr *msgh, char *cbuf, int ifindex, struct sockaddr *from)
+{
+# if defined(IP_PKTINFO) || defined(IP_SENDSRCADDR)
+	if (from->sa_family == AF_INET) {
+		struct sockaddr_in *s4 = (struct sockaddr_in *) from;
+
+#  ifdef IP_PKTINFO
+		struct cmsghdr *cmsg;
+		struct in_pktinfo *pkt;
+
+		msgh->msg_control = cbuf;
+		msgh->msg_controllen = CMSG_SPACE(sizeof(*pkt));
+
+		cmsg = CMSG_FIRSTHDR(msgh);
+		cmsg->cmsg_level = SOL_IP;
+		cmsg->cmsg_type = IP_PKTINFO;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
+
+		pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
+		memset(pkt, 0, sizeof(*pkt));
+		pkt->ipi_spec_dst = s4->sin_addr;
+		pkt->ipi_ifindex = ifindex;
+
+#  elif defined(IP_SENDSRCADDR)
+		struct cmsghdr *cmsg;
+		struct in_addr *in;
+
+		msgh->msg_control = cbuf;
+		msgh->msg_controllen = CMSG_SPACE(sizeof(*in));
+
+		cmsg = CMSG_FIRSTHDR(msgh);
+		cmsg->cmsg_level = IPPROTO_IP;
+		cmsg->cmsg_type = IP_SENDSRCADDR;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(*in));
+
+		in = (struct in_addr *) CMSG_DATA(cmsg);
+		*in = s4->sin_addr;
+#  endif
+	}
 #endif
+
+#  if defined(IPV6_PKTINFO)
+	if (from->sa_family == AF_INET6) {
+		struct sockaddr_in6 *s6 = (struct sockaddr_in6 *) from;
+
+		struct cmsghdr *cmsg;
+		struct in6_pktinfo *pkt;
+
+		msgh->msg_control = cbuf;
+		msgh->msg_controllen = CMSG_SPACE(sizeof(*pkt));
+
+		cmsg = CMSG_FIRSTHDR(msgh);
+		cmsg->cmsg_level = IPPROTO_IPV6;
+		cmsg->cmsg_type = IPV6_PKTINFO;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
+
+		pkt = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+		memset(pkt, 0, sizeof(*pkt));
+		pkt->ipi6_addr = s6->sin6_addr;
+		pkt->ipi6_ifindex = ifindex;
 	}
+#  endif	/* IPV6_PKTINFO */
+}
 
-	if (when && fr_time_eq(*when, fr_time_wrap(0))) *when = fr_time();
+/** Whether a datagram needs ancillary data to set its source address or interface
+ *
+ */
+static bool sendfromto_has_src(struct sockaddr const *from, socklen_t from_len, int ifindex)
+{
+	if (!from || (from_len == 0)) return false;
 
-	return ret;
+#  if !defined(IP_PKTINFO) && !defined(IP_SENDSRCADDR)
+	if (from->sa_family == AF_INET) return false;
+#  endif
+
+#  if !defined(IPV6_PKTINFO)
+	if (from->sa_family == AF_INET6) return false;
+#  endif
+
+	if (ifindex != 0) return true;
+
+	if ((from->sa_family == AF_INET) &&
+	    (((struct sockaddr_in const *) from)->sin_addr.s_addr == INADDR_ANY)) return false;
+
+	if ((from->sa_family == AF_INET6) &&
+	    IN6_IS_ADDR_UNSPECIFIED(&((struct sockaddr_in6 const *) from)->sin6_addr)) return false;
+
+	return true;
 }
 
 /** Send packet via a file descriptor, setting the src address and outbound interface
@@ -505,71 +707,84 @@ int sendfromto(int fd, void *buf, size_t len, int flags,
 	msgh.msg_name = to;
 	msgh.msg_namelen = to_len;
 
-# if defined(IP_PKTINFO) || defined(IP_SENDSRCADDR)
-	if (from->sa_family == AF_INET) {
-		struct sockaddr_in *s4 = (struct sockaddr_in *) from;
+	sendfromto_cmsg(&msgh, cbuf, ifindex, from);
 
-#  ifdef IP_PKTINFO
-		struct cmsghdr *cmsg;
-		struct in_pktinfo *pkt;
+	return sendmsg(fd, &msgh, flags);
+}
 
-		msgh.msg_control = cbuf;
-		msgh.msg_controllen = CMSG_SPACE(sizeof(*pkt));
 
-		cmsg = CMSG_FIRSTHDR(&msgh);
-		cmsg->cmsg_level = SOL_IP;
-		cmsg->cmsg_type = IP_PKTINFO;
-		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
+/** Send multiple packets via a file descriptor, setting the src address and outbound interface
+ *
+ * As with sendfromto(), but uses sendmmsg() to write up to num datagrams in
+ * one system call.  On platforms without sendmmsg(), it is emulated in
+ * userland, which still allows callers to batch their writes.
+ *
+ * @param[in] fd	The file descriptor to write to.
+ * @param[in] msgs	Array of message structures.  buf, data_len, ifindex,
+ *			from and to must be initialised by the caller.
+ *			from_len may be zero if the source address should be
+ *			chosen by the OS.
+ * @param[in] num	Number of entries in msgs.  Values larger than
+ *			#UDPFROMTO_MMSG_MAX are clamped.
+ * @param[in] flags	passed unmolested to sendmmsg.
+ * @return
+ *	- >= 0 the number of datagrams sent.  Check against num to determine
+ *	  if all of the datagrams were sent.
+ *	- -1 on failure.  Only returned if the first datagram could not be sent.
+ */
+int sendmmsgfromto(int fd, udpfromto_mmsg_t *msgs, unsigned int num, int flags)
+{
+	struct mmsghdr	msgvec[UDPFROMTO_MMSG_MAX];
+	struct iovec	iov[UDPFROMTO_MMSG_MAX];
+	unsigned int	i;
+	bool		use_src = true;
 
-		pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
-		memset(pkt, 0, sizeof(*pkt));
-		pkt->ipi_spec_dst = s4->sin_addr;
-		pkt->ipi_ifindex = ifindex;
+	if (num > UDPFROMTO_MMSG_MAX) num = UDPFROMTO_MMSG_MAX;
 
-#  elif defined(IP_SENDSRCADDR)
-		struct cmsghdr *cmsg;
-		struct in_addr *in;
+#ifdef __FreeBSD__
+	/*
+	 *	See sendfromto() for why FreeBSD needs this.
+	 */
+	{
+	struct sockaddr_storage bound;
+	socklen_t bound_len = sizeof(bound);
 
-		msgh.msg_control = cbuf;
-		msgh.msg_controllen = CMSG_SPACE(sizeof(*in));
+	if (getsockname(fd, (struct sockaddr *) &bound, &bound_len) < 0) return -1;
 
-		cmsg = CMSG_FIRSTHDR(&msgh);
-		cmsg->cmsg_level = IPPROTO_IP;
-		cmsg->cmsg_type = IP_SENDSRCADDR;
-		cmsg->cmsg_len = CMSG_LEN(sizeof(*in));
+	switch (bound.ss_family) {
+	case AF_INET:
+		if (((struct sockaddr_in *) &bound)->sin_addr.s_addr != INADDR_ANY) use_src = false;
+		break;
 
-		in = (struct in_addr *) CMSG_DATA(cmsg);
-		*in = s4->sin_addr;
-#  endif
+	case AF_INET6:
+		if (!IN6_IS_ADDR_UNSPECIFIED(&((struct sockaddr_in6 *) &bound)->sin6_addr)) use_src = false;
+		break;
+	}
 	}
 #endif
 
-#  if defined(IPV6_PKTINFO)
-	if (from->sa_family == AF_INET6) {
-		struct sockaddr_in6 *s6 = (struct sockaddr_in6 *) from;
+	memset(msgvec, 0, sizeof(msgvec[0]) * num);
 
-		struct cmsghdr *cmsg;
-		struct in6_pktinfo *pkt;
+	for (i = 0; i < num; i++) {
+		struct sockaddr *from = (struct sockaddr *) &msgs[i].from;
 
-		msgh.msg_control = cbuf;
-		msgh.msg_controllen = CMSG_SPACE(sizeof(*pkt));
+		iov[i].iov_base = msgs[i].buf;
+		iov[i].iov_len = msgs[i].data_len;
 
-		cmsg = CMSG_FIRSTHDR(&msgh);
-		cmsg->cmsg_level = IPPROTO_IPV6;
-		cmsg->cmsg_type = IPV6_PKTINFO;
-		cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
+		msgvec[i].msg_hdr.msg_iov = &iov[i];
+		msgvec[i].msg_hdr.msg_iovlen = 1;
+		msgvec[i].msg_hdr.msg_name = &msgs[i].to;
+		msgvec[i].msg_hdr.msg_namelen = msgs[i].to_len;
 
-		pkt = (struct in6_pktinfo *) CMSG_DATA(cmsg);
-		memset(pkt, 0, sizeof(*pkt));
-		pkt->ipi6_addr = s6->sin6_addr;
-		pkt->ipi6_ifindex = ifindex;
+		if (!use_src || !sendfromto_has_src(from, msgs[i].from_len, msgs[i].ifindex)) continue;
+
+		memset(msgs[i].cbuf, 0, sizeof(msgs[i].cbuf));
+		sendfromto_cmsg(&msgvec[i].msg_hdr, msgs[i].cbuf, msgs[i].ifindex, from);
 	}
-#  endif	/* IPV6_PKTINFO */
 
-	return sendmsg(fd, &msgh, flags);
+	return sendmmsg(fd, msgvec, num, flags);
 }
 
-
 #ifdef TESTING
 /*
  *	Small test program to test recvfromto/sendfromto
@@ -36,6 +36,7 @@ extern "C" {
 #include <netinet/in.h>
 #include <stddef.h>
 #include <stdlib.h>
+#include <sys/socket.h>
 
 int	udpfromto_init(int s, int af);
 
@@ -49,6 +50,33 @@ int	sendfromto(int s, void *buf, size_t len, int flags,
 		   int ifindex,
 		   struct sockaddr *from, socklen_t fromlen,
 		   struct sockaddr *to, socklen_t tolen);
+
+#define UDPFROMTO_MMSG_MAX	(64)		//!< Maximum number of datagrams in one recvmmsgfromto()
+						///< or sendmmsgfromto() call.
+
+/** A datagram read by recvmmsgfromto(), or written by sendmmsgfromto()
+ *
+ */
+typedef struct {
+	void			*buf;		//!< Datagram data.
+	size_t			len;		//!< Length of buf.
+
+	size_t			data_len;	//!< How much data was received, or is to be sent.
+	int			ifindex;	//!< The interface the datagram was received, or is sent on.
+	struct sockaddr_storage	from;		//!< Source address.
+	socklen_t		from_len;	//!< Length of the source address.
+	struct sockaddr_storage	to;		//!< Destination address.
+	socklen_t		to_len;		//!< Length of the destination address.
+	fr_time_t		when;		//!< When the datagram was received.
+
+	char			cbuf[256];	//!< Ancillary data, i.e. IP_PKTINFO.
+} udpfromto_mmsg_t;
+
+#ifdef HAVE_RECVMMSG
+int	recvmmsgfromto(int s, udpfromto_mmsg_t *msgs, unsigned int num, int flags);
+#endif
+
+int	sendmmsgfromto(int s, udpfromto_mmsg_t *msgs, unsigned int num, int flags);
 #ifdef __cplusplus
 }
 #endif
@@ -89,6 +89,7 @@ struct proto_detail_work_s {
 
 	fr_retry_config_t		retry_config;		//!< retry config with irt, mrt, etc.
 	uint16_t			max_outstanding;	//!< number of packets to run in parallel
+	char const			*order_by;		//!< attribute whose values are processed in order
 
 	bool				track_progress;		//!< do we track progress by writing?
 	bool				retransmit;		//!< are we retransmitting on error?
@@ -117,6 +118,7 @@ struct proto_detail_work_thread_s {
 
 	char const			*filename_work;		//!< work file name
 	fr_dlist_head_t			list;			//!< for retransmissions
+	fr_rb_tree_t			*order_tree;		//!< in-flight entries, indexed by their order_by key
 
 	uint32_t       			outstanding;		//!< number of currently outstanding records;
 	fr_time_delta_t			lock_interval;		//!< interval between trying the locks.
@@ -127,15 +129,11 @@ struct proto_detail_work_thread_s {
 
 	int				count;			//!< number of packets we read from this file.
 
-	size_t				leftover;
-	uint8_t				*leftover_buffer;
-
-	size_t				last_search;		//!< where we last searched in the buffer
-								//!< MUST be offset, as the buffers can change.
 	unsigned int			last_line;		//!< line number of the last record read.
 
-	off_t				file_size;		//!< size of the file
-	off_t				header_offset;		//!< offset of the current header we're reading
+	uint8_t				*map;			//!< read-only mapping of filename_work
+	size_t				map_size;		//!< size of the mapping
+
 	off_t				read_offset;		//!< where we're reading from in filename_work
 
 	fr_timer_t			*ev;			//!< for detail file timers.
@@ -32,6 +32,7 @@
 #include "proto_detail.h"
 
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
 #ifndef NDEBUG
@@ -56,12 +57,16 @@ typedef struct {
 
 	int				id;			//!< for retransmission counters
 
-	uint8_t				*packet;		//!< for retransmissions
+	off_t				offset;			//!< where the record starts in the map
 	size_t				packet_len;		//!< for retransmissions
 
 	fr_retry_t			retry;			//!< our retry timers
 	fr_timer_t			*ev;			//!< retransmission timer
 	fr_dlist_t			entry;			//!< for the retransmission list
+
+	char const			*key;			//!< value of the order_by attribute
+	fr_rb_node_t			order_node;		//!< for the order tree
+	fr_dlist_head_t			waiting;		//!< later entries with the same key
 } fr_detail_entry_t;
 
 static conf_parser_t limit_config[] = {
@@ -88,6 +93,8 @@ static const conf_parser_t file_listen_config[] = {
 
 	{ FR_CONF_OFFSET("retransmit", proto_detail_work_t, retransmit ), .dflt = "yes" },
 
+	{ FR_CONF_OFFSET("order_by", proto_detail_work_t, order_by ) },
+
 	{ FR_CONF_POINTER("limit", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) limit_config },
 	CONF_PARSER_TERMINATOR
 };
@@ -141,19 +148,224 @@ static fr_event_update_t resume_read[] = {
 	{ 0 }
 };
 
+/** Validate a record which has been copied out of the map, and split it into lines
+ *
+ * Each LF is replaced with a NUL, so that the decoder can parse each
+ * line individually.
+ *
+ * @param[in] thread		the worker reading the file.
+ * @param[in] buffer		containing a copy of the record.
+ * @param[in] packet_len	length of the record, including any end of record marker.
+ * @param[in] record_offset	where the record starts in the file.
+ * @param[out] done_offset	where the "Timestamp" attribute is in the file, or 0.
+ * @return
+ *	- 1 if the record has already been marked "Done".
+ *	- 0 on success.
+ *	- -1 if the record is malformed.
+ */
+static int work_record_parse(proto_detail_work_thread_t *thread, uint8_t *buffer, size_t packet_len,
+			     off_t record_offset, off_t *done_offset)
+{
+	uint8_t *p, *end;
+
+	end = buffer + packet_len;
+	p = buffer;
+
+	/*
+	 *	Note that all of the data MUST be printable, and raw
+	 *	LFs are forbidden in attribute contents.
+	 */
+	while ((p = memchr(p, '\n', end - p)) != NULL) {
+		/*
+		 *	At EOF, it's OK to not have an "end of record"
+		 *	marker.
+		 */
+		if ((p + 1) == end) {
+			p[0] = '\0';
+			break;
+		}
+
+		if (p[1] == '\n') {
+			p[0] = '\0';
+			p[1] = '\0';
+			break;
+		}
+
+		/*
+		 *	If we're not at end of record, every line MUST
+		 *	have a leading tab.
+		 */
+		if (p[1] != '\t') {
+			ERROR("proto_detail (%s): Missing tab indent at %s[%u], offset from start of file %zu",
+			      thread->name,
+			      thread->filename_work, thread->last_line,
+			      (size_t)((p - buffer) + record_offset));
+			return -1;
+		}
+
+		/*
+		 *	Smash the \n with zero, and skip the \n\t
+		 */
+		p[0] = '\0';
+		p += 2;
+
+		/*
+		 *	Skip attribute name
+		 */
+		while ((p < end) && !isspace((uint8_t) *p)) p++;
+
+		/*
+		 *	Check for " = ".  If the line doesn't contain
+		 *	this, it's malformed.
+		 */
+		if (((end - p) < 3) || (memcmp(p, " = ", 3) != 0)) {
+			ERROR("proto_detail (%s): Missing pair assignment operator at %s[%u], offset from start of file %zu: %.*s",
+			      thread->name,
+			      thread->filename_work, thread->last_line,
+			      (size_t)((p - buffer) + record_offset), (int) (end - p), p);
+			return -1;
+		}
+
+		p += 3;
+	}
+
+	/*
+	 *	Search for the "Timestamp" attribute.  We overload
+	 *	that to track which entries have been used.
+	 */
+	*done_offset = 0;
+	p = buffer;
+
+	while ((p = memchr(p, '\0', end - p)) != NULL) {
+		p++;
+		if (p == end) break;
+
+		if (((end - p) >= 5) &&
+		    (memcmp(p, "\tDone", 5) == 0)) {
+			return 1;
+		}
+
+		if (((end - p) > 10) &&
+		    (memcmp(p, "\tTimestamp", 10) == 0)) {
+			p++;
+			*done_offset = record_offset + (p - buffer);
+		}
+	}
+
+	return 0;
+}
+
+/** Find the value of the order_by attribute in a record which has been parsed
+ *
+ * @param[in] ctx		to allocate the key in.
+ * @param[in] inst		our configuration.
+ * @param[in] buffer		containing the record, with each line NUL terminated.
+ * @param[in] packet_len	length of the record.
+ * @return
+ *	- the value of the attribute, as it was written to the file.
+ *	- NULL if the record doesn't contain the attribute.
+ */
+static char const *work_record_key(TALLOC_CTX *ctx, proto_detail_work_t const *inst,
+				   uint8_t const *buffer, size_t packet_len)
+{
+	size_t		name_len = strlen(inst->order_by);
+	uint8_t const	*p, *q, *end;
+
+	end = buffer + packet_len;
+
+	for (p = buffer; p < end; p = q + 1) {
+		q = memchr(p, '\0', end - p);
+		if (!q) q = end;
+
+		if (((size_t) (q - p) <= (name_len + 4)) || (p[0] != '\t')) continue;
+
+		if ((memcmp(p + 1, inst->order_by, name_len) != 0) ||
+		    (memcmp(p + 1 + name_len, " = ", 3) != 0)) continue;
+
+		p += name_len + 4;
+		return talloc_bstrndup(ctx, (char const *) p, q - p);
+	}
+
+	return NULL;
+}
+
+static int8_t work_order_cmp(void const *one, void const *two)
+{
+	fr_detail_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = strcmp(a->key, b->key);
+	return CMP(ret, 0);
+}
+
+/** Hold a new entry until all earlier entries with the same key have been processed
+ *
+ * @return
+ *	- true if the entry can be processed now.
+ *	- false if it has to wait.
+ */
+static bool work_order_add(proto_detail_work_thread_t *thread, fr_detail_entry_t *track)
+{
+	fr_detail_entry_t *first;
+
+	fr_dlist_init(&track->waiting, fr_detail_entry_t, entry);
+
+	first = fr_rb_find(thread->order_tree, track);
+	if (!first) {
+		fr_rb_insert(thread->order_tree, track);
+		return true;
+	}
+
+	DEBUG("%s - holding packet %d until packet %d with %s %s is done",
+	      thread->name, track->id, first->id, thread->inst->order_by, track->key);
+
+	fr_dlist_insert_tail(&first->waiting, track);
+	return false;
+}
+
+static void work_retransmit(fr_timer_list_t *tl, fr_time_t now, void *uctx);
+
+/** Release the next entry waiting behind one which has finished
+ *
+ */
+static void work_order_release(proto_detail_work_thread_t *thread, fr_detail_entry_t *track)
+{
+	fr_detail_entry_t *next;
+
+	(void) fr_rb_remove(thread->order_tree, track);
+
+	next = fr_dlist_pop_head(&track->waiting);
+	if (!next) return;
+
+	/*
+	 *	The next entry now owns the key, and everything
+	 *	else which is waiting for it.
+	 */
+	fr_dlist_move(&next->waiting, &track->waiting);
+	fr_rb_insert(thread->order_tree, next);
+
+	/*
+	 *	Re-use the retransmission path to feed the entry back
+	 *	through mod_read().  We can't do that directly from
+	 *	mod_write(), so just fire the timer immediately.
+	 */
+	if (fr_timer_in(thread, thread->el->tl, &next->ev, fr_time_delta_wrap(0),
+			false, work_retransmit, next) < 0) {
+		ERROR("%s - Failed inserting timer for packet %d", thread->name, next->id);
+	}
+}
+
 static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time_p, uint8_t *buffer, size_t buffer_len, size_t *leftover)
 {
 	proto_detail_work_t const	*inst = talloc_get_type_abort_const(li->app_io_instance, proto_detail_work_t);
 	proto_detail_work_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_detail_work_thread_t);
 
-	ssize_t				data_size;
 	size_t				packet_len;
 	fr_detail_entry_t		*track;
-	uint8_t				*partial, *end, *next, *p, *record_end;
-	uint8_t				*stopped_search;
-	off_t				done_offset;
+	uint8_t				*start, *end, *p;
+	off_t				record_offset, done_offset;
 
-	fr_assert(*leftover < buffer_len);
+	fr_assert(*leftover == 0);
 	fr_assert(thread->fd >= 0);
 	fr_assert(thread->el);
 
@@ -161,28 +373,23 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 
 	/*
 	 *	Process retransmissions before anything else in the
-	 *	file.
+	 *	file.  The record is still in the map, so we just
+	 *	copy it out again.
 	 */
 	track = fr_dlist_head(&thread->list);
 	if (track) {
 		fr_dlist_remove(&thread->list, track);
 
-		/*
-		 *	Don't over-write "leftover" bytes!
-		 */
-		if (*leftover) {
-			fr_assert(thread->leftover == 0);
-			if (!thread->leftover_buffer) MEM(thread->leftover_buffer = talloc_array(thread, uint8_t, buffer_len));
-
-			memcpy(thread->leftover_buffer, buffer, *leftover);
-			thread->leftover = *leftover;
-			*leftover = 0;
-		}
-
 		fr_assert(buffer_len >= track->packet_len);
-		memcpy(buffer, track->packet, track->packet_len);
+		memcpy(buffer, thread->map + track->offset, track->packet_len);
+		if (work_record_parse(thread, buffer, track->packet_len, track->offset, &done_offset) < 0) return -1;
 
-		DEBUG("Retrying packet %d (retransmission %u)", track->id, track->retry.count);
+		if (!track->retry.count) {
+			DEBUG("Releasing packet %d", track->id);
+			track->timestamp = fr_time();
+		} else {
+			DEBUG("Retrying packet %d (retransmission %u)", track->id, track->retry.count);
+		}
 		*packet_ctx = track;
 		*recv_time_p = track->timestamp;
 		return track->packet_len;
@@ -194,7 +401,7 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	 *	without locking it first.  So too bad for them.
 	 */
 	if (thread->closing) {
-		if (inst->track_progress) thread->read_offset = lseek(thread->fd, 0, SEEK_END);
+		(void) lseek(thread->fd, 0, SEEK_END);
 		return 0;
 	}
 
@@ -208,277 +415,74 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 		return 0;
 	}
 
-	/*
-	 *	If we've cached leftover data from the ring buffer,
-	 *	copy it back.
-	 */
-	if (thread->leftover) {
-		fr_assert(*leftover == 0);
-		fr_assert(thread->leftover < buffer_len);
-
-		memcpy(buffer, thread->leftover_buffer, thread->leftover);
-		*leftover = thread->leftover;
-		thread->leftover = 0;
-	}
-
-	/*
-	 *	Seek to the current read offset.
-	 */
-	(void) lseek(thread->fd, thread->read_offset, SEEK_SET);
-
-	/*
-	 *	There will be "leftover" bytes left over in the buffer
-	 *	from any previous read.  At the start of the file,
-	 *	"leftover" will be zero.
-	 */
-	partial = buffer + *leftover;
-
-	MPRINT("READ leftover %zd", *leftover);
-
-	/*
-	 *	Try to read as much data as possible.
-	 */
-	if (!thread->eof) {
-		size_t room;
-
-		room = buffer_len - *leftover;
-
-		data_size = read(thread->fd, partial, room);
-		if (data_size < 0) {
-			ERROR("proto_detail (%s): Failed reading file %s: %s",
-			      thread->name, thread->filename_work, fr_syserror(errno));
-			return -1;
-		}
-
-		MPRINT("GOT %zd bytes", data_size);
+	end = thread->map + thread->map_size;
 
+next:
+	if ((size_t) thread->read_offset >= thread->map_size) {
 		/*
-		 *	Remember the read offset, and whether we got EOF.
+		 *	We're at EOF, mark us as "closing".  Leave the
+		 *	FD at EOF, so that it's no longer readable.
 		 */
-		thread->read_offset = lseek(thread->fd, 0, SEEK_CUR);
+		MPRINT("AT EOF, outstanding %u", thread->outstanding);
+		thread->eof = true;
+		thread->closing = true;
+		(void) lseek(thread->fd, 0, SEEK_END);
 
 		/*
-		 *	Only set EOF if there's no more data in the buffer to manage.
+		 *	Nothing left to wait for, so the caller should
+		 *	close the file.
 		 */
-		thread->eof = (data_size == 0) || (thread->read_offset == thread->file_size) || ((size_t) data_size < room);
-		if (thread->eof) {
-			MPRINT("Set EOF data_size %ld vs room %ld", data_size, room);
-			MPRINT("Set EOF read %ld vs file %ld", (long) thread->read_offset, (long) thread->file_size);
+		if (!thread->outstanding) {
+			errno = ECONNRESET;
+			return -1;
 		}
-		end = partial + data_size;
-
-	} else {
-		MPRINT("READ UNTIL EOF");
-		/*
-		 *	We didn't read any more data from the file,
-		 *	but there should be data left in the buffer.
-		 */
-		fr_assert(*leftover > 0);
-		end = buffer + *leftover;
+		return 0;
 	}
 
-redo:
-	next = NULL;
-	stopped_search = end;
-
 	/*
-	 *	Look for "end of record" marker, starting from the
-	 *	beginning of the buffer.
-	 *
-	 *	Note that all of the data MUST be printable, and raw
-	 *	LFs are forbidden in attribute contents.
+	 *	Look for the "end of record" marker.  memchr() is
+	 *	much faster than checking each byte ourselves.
 	 */
-	fr_assert((buffer + thread->last_search) <= end);
-
-	MPRINT("Starting search from offset %ld", thread->last_search);
-
-	p = buffer + thread->last_search;
-	while (p < end) {
-		if (p[0] != '\n') {
-			p++;
-			continue;
-		}
-		if ((p + 1) == end) {
-			/*
-			 *	Remember the last LF, so if the next
-			 *	read starts with a LF, we can find the
-			 *	end of record marker.
-			 */
-			stopped_search = p;
-			break; /* no more data */
-		}
-
-		if (p[1] == '\n') {
-			p[0] = '\0';
-			p[1] = '\0';
-			next = p + 2;
-			stopped_search = next;
-			thread->last_line++;
-			break;
-		}
-
-		/*
-		 *	If we're not at EOF, and we're not at end of
-		 *	record, every line MUST have a leading tab.
-		 */
-		if (p[1] != '\t') {
-			ERROR("proto_detail (%s): Missing tab indent at %s[%u], offset from start of file %zu",
-			      thread->name,
-			      thread->filename_work, thread->last_line,
-			      (size_t)((p - buffer) + thread->header_offset));
-			return -1;
-		}
-
-		/*
-		 *	Smash the \n with zero, so that each line can
-		 *	be parsed individually.
-		 */
-		p[0] = '\0';
-
-		/*
-		 *	Skip the \n\t
-		 */
-		if ((p + 2) >= end) {
-			stopped_search = p;
-			break;
-		}
-
-		p += 2;
-
-		/*
-		 *	Skip attribute name
-		 */
-		while ((p < end) && !isspace((uint8_t) *p)) p++;
+	record_offset = thread->read_offset;
+	start = p = thread->map + record_offset;
+	packet_len = end - start;
 
-		/*
-		 *	Not enough room for " = ", skip this sanity
-		 *	check, and just search for a \n on the next
-		 *	round through the loop.
-		 */
-		if ((end - p) < 3) {
-			stopped_search = p;
+	while ((p = memchr(p, '\n', end - p)) != NULL) {
+		if (((p + 1) < end) && (p[1] == '\n')) {
+			packet_len = (p + 2) - start;
 			break;
 		}
-
-		/*
-		 *	Check for " = ".  If the line doesn't contain
-		 *	this, it's malformed.
-		 */
-		if (memcmp(p, " = ", 3) != 0) {
-			ERROR("proto_detail (%s): Missing pair assignment operator at %s[%u], offset from start of file %zu: %.*s",
-			      thread->name,
-			      thread->filename_work, thread->last_line,
-			      (size_t)((p - buffer) + thread->header_offset), (int) (end - p), p);
-			return -1;
-		}
-
-		/*
-		 *	Skip the " = ", and go back to the top of the
-		 *	loop where we check for the next \n.
-		 */
-		p += 3;
+		p++;
 	}
 
-	thread->last_search = (stopped_search - buffer);
+	thread->read_offset += packet_len;
+	thread->last_line++;
 
-	/*
-	 *	If there is a next record, remember how large this
-	 *	record is, and update "leftover" bytes.
-	 */
-	if (next) {
-		packet_len = next - buffer;
-		*leftover = end - next;
-
-		MPRINT("FOUND next at %zd, leftover is %zd", packet_len, *leftover);
-
-	} else if (!thread->eof) {
-		if ((size_t) (end - buffer) == buffer_len) {
-			ERROR("proto_detail (%s): Too large entry (>%d bytes) found at offset %zu: %.*s of file %s",
-			      thread->name, (int) buffer_len,
-			      (size_t)((p - buffer) + thread->header_offset), (int) (end - p), p,
-			      thread->filename_work);
-			return -1;
-		}
-
-		/*
-		 *	We're not at EOF, and there is no "next"
-		 *	entry.  Remember all of the leftover data in
-		 *	the buffer, and ask the caller to call us when
-		 *	there's more data.
-		 */
-		*leftover = end - buffer;
-		MPRINT("Not at EOF, and no next.  Leftover is %zd", *leftover);
-		return 0;
-
-	} else {
-		/*
-		 *	Else we're at EOF, it's OK to not have an "end
-		 *	of record" marker.  We just eat all of the
-		 *	remaining data.
-		 */
-		packet_len = end - buffer;
-		*leftover = 0;
-
-		MPRINT("NO end of record, but at EOF, found %zd leftover is 0", packet_len);
-	}
+	MPRINT("FOUND record at %ld, length %zu", (long) record_offset, packet_len);
 
 	/*
 	 *	Too big?  Ignore it.
-	 *
-	 *	@todo - skip the record, using memmove() etc.
 	 */
-	if (packet_len > inst->parent->max_packet_size) {
+	if ((packet_len > buffer_len) || (packet_len > inst->parent->max_packet_size)) {
 		DEBUG("Ignoring 'too large' entry at offset %zu of %s",
-		      (size_t) thread->header_offset, thread->filename_work);
-		DEBUG("Entry size %lu is greater than allowed maximum %u",
-		      packet_len, inst->parent->max_packet_size);
-	skip_record:
-		MPRINT("Skipping record");
-		if (next) {
-			memmove(buffer, next, (end - next));
-			data_size = (end - next);
-			*leftover = 0;
-			end = buffer + data_size;
-			thread->last_search = 0;
-
-			/*
-			 *	No more data, we're done.
-			 */
-			if (end == buffer) return 0;
-			goto redo;
-		}
-
-		fr_assert(*leftover == 0);
-		goto done;
+		      (size_t) record_offset, thread->filename_work);
+		DEBUG("Entry size %zu is greater than allowed maximum %zu",
+		      packet_len, (packet_len > buffer_len) ? buffer_len : (size_t) inst->parent->max_packet_size);
+		goto next;
 	}
 
-	/*
-	 *	Search for the "Timestamp" attribute.  We overload
-	 *	that to track which entries have been used.
-	 */
-	record_end = buffer + packet_len;
-	p = buffer;
-	done_offset = 0;
-
-	while (p < record_end) {
-		if (*p != '\0') {
-			p++;
-			continue;
-		}
+	memcpy(buffer, start, packet_len);
 
-		p++;
-		if (p == record_end) break;
+	switch (work_record_parse(thread, buffer, packet_len, record_offset, &done_offset)) {
+	case 0:
+		break;
 
-		if (((record_end - p) >= 5) &&
-		    (memcmp(p, "\tDone", 5) == 0)) {
-			goto skip_record;
-		}
+	case 1:
+		MPRINT("Skipping record");
+		goto next;
 
-		if (((record_end - p) > 10) &&
-		    (memcmp(p, "\tTimestamp", 10) == 0)) {
-			p++;
-			done_offset = thread->header_offset + (p - buffer);
-		}
+	default:
+		return -1;
 	}
 
 	/*
@@ -490,28 +494,8 @@ redo:
 	track->id = thread->count++;
 
 	track->done_offset = done_offset;
-	if (inst->retransmit) {
-		MEM(track->packet = talloc_memdup(track, buffer, packet_len));
-		track->packet_len = packet_len;
-	}
-
-	/*
-	 *	We've read one more packet.
-	 */
-	thread->header_offset += packet_len;
-
-	*packet_ctx = track;
-	*recv_time_p = track->timestamp;
-
-done:
-	/*
-	 *	If we're at EOF, mark us as "closing".
-	 */
-	if (thread->eof) {
-		fr_assert(!thread->closing);
-		thread->closing = (*leftover == 0);
-		MPRINT("AT EOF, BUT CLOSING %d", thread->closing);
-	}
+	track->offset = record_offset;
+	track->packet_len = packet_len;
 
 	thread->outstanding++;
 
@@ -521,30 +505,52 @@ done:
 	if (!thread->paused && (thread->outstanding >= inst->max_outstanding)) {
 		(void) fr_event_filter_update(thread->el, thread->fd, FR_EVENT_FILTER_IO, pause_read);
 		thread->paused = true;
-
-		/*
-		 *	Back up so that read() knows there's more data.
-		 */
-		if (*leftover) (void) lseek(thread->fd, thread->read_offset - 1, SEEK_SET);
 	}
 
 	/*
-	 *	Next time, start searching from the start of the
-	 *	buffer.
+	 *	An earlier entry with the same key is still being
+	 *	processed.  Leave this one in the map, and go read the
+	 *	next entry.
 	 */
-	thread->last_search = 0;
+	if (thread->order_tree) {
+		track->key = work_record_key(track, inst, buffer, packet_len);
+		if (track->key && !work_order_add(thread, track)) {
+			if (thread->paused) return 0;
+			goto next;
+		}
+	}
+
+	*packet_ctx = track;
+	*recv_time_p = track->timestamp;
 
 	MPRINT("Returning NUM %u - %.*s", thread->outstanding, (int) packet_len, buffer);
 	return packet_len;
 }
 
+/** Tell the network side to keep reading records
+ *
+ * The whole file is mapped, so once the FD has been signalled, we can
+ * hand back records until we hit max_outstanding or EOF, without
+ * waiting for another event.
+ */
+static bool mod_read_pending(fr_listen_t *li)
+{
+	proto_detail_work_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_detail_work_thread_t);
+
+	if (fr_dlist_num_elements(&thread->list) > 0) return true;
+
+	if (thread->closing || thread->paused) return false;
+
+	return ((size_t) thread->read_offset < thread->map_size);
+}
+
 
 static void work_retransmit(UNUSED fr_timer_list_t *tl, UNUSED fr_time_t now, void *uctx)
 {
 	fr_detail_entry_t		*track = talloc_get_type_abort(uctx, fr_detail_entry_t);
 	proto_detail_work_thread_t     	*thread = track->parent;
 
-	DEBUG("%s - retransmitting packet %d", thread->name, track->id);
+	if (track->retry.count) DEBUG("%s - retransmitting packet %d", thread->name, track->id);
 
 	fr_dlist_insert_tail(&thread->list, track);
 
@@ -626,19 +632,20 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	} else if (inst->track_progress && (track->done_offset > 0)) {
 	mark_done:
 		/*
-		 *	Seek to the entry, mark it as done, and then seek to
-		 *	the point in the file where we were reading from.
+		 *	Mark the entry as done.  pwrite() doesn't
+		 *	touch the file offset, which we use to control
+		 *	whether or not the FD is readable.
 		 */
-		(void) lseek(thread->fd, track->done_offset, SEEK_SET);
-		if (write(thread->fd, "Done", 4) < 0) {
+		if (pwrite(thread->fd, "Done", 4, track->done_offset) < 0) {
 			ERROR("%s - Failed marking entry as done: %s", thread->name, fr_syserror(errno));
 		}
-		(void) lseek(thread->fd, thread->read_offset, SEEK_SET);
 	}
 
 free_track:
 	thread->outstanding--;
 
+	if (track->key) work_order_release(thread, track);
+
 	/*
 	 *	If we need to read some more packet, let's do so.
 	 */
@@ -683,6 +690,11 @@ static int mod_open(fr_listen_t *li)
 
 	fr_dlist_init(&thread->list, fr_detail_entry_t, entry);
 
+	if (inst->order_by) {
+		MEM(thread->order_tree = fr_rb_inline_talloc_alloc(thread, fr_detail_entry_t, order_node,
+								   work_order_cmp, NULL));
+	}
+
 	/*
 	 *	Open the file if we haven't already been given one.
 	 */
@@ -697,9 +709,11 @@ static int mod_open(fr_listen_t *li)
 	}
 
 	/*
-	 *	If we're tracking progress, learn where the EOF is.
+	 *	The work file is locked, and no one else should be
+	 *	writing to it.  So we can map the whole thing, and
+	 *	read records directly from the page cache.
 	 */
-	if (inst->track_progress) {
+	{
 		struct stat buf;
 
 		if (fstat(thread->fd, &buf) < 0) {
@@ -707,12 +721,23 @@ static int mod_open(fr_listen_t *li)
 			return -1;
 		}
 
-		thread->file_size = buf.st_size;
-	} else {
-		/*
-		 *	Avoid triggering erroneous EOF.
-		 */
-		thread->file_size = 1;
+		thread->map_size = buf.st_size;
+	}
+
+	if (thread->map_size > 0) {
+		void *map;
+
+		map = mmap(NULL, thread->map_size, PROT_READ, MAP_SHARED, thread->fd, 0);
+		if (map == MAP_FAILED) {
+			cf_log_err(inst->cs, "Failed mapping %s: %s", thread->filename_work, fr_syserror(errno));
+			thread->map_size = 0;
+			return -1;
+		}
+		thread->map = map;
+
+#ifdef MADV_SEQUENTIAL
+		(void) madvise(thread->map, thread->map_size, MADV_SEQUENTIAL);
+#endif
 	}
 
 	fr_assert(thread->name == NULL);
@@ -759,6 +784,12 @@ static int mod_close_internal(proto_detail_work_thread_t *thread)
 
 	if (thread->outstanding == 0) unlink(thread->filename_work);
 
+	if (thread->map) {
+		(void) munmap(thread->map, thread->map_size);
+		thread->map = NULL;
+		thread->map_size = 0;
+	}
+
 	close(thread->fd);
 	thread->fd = -1;
 
@@ -902,6 +933,7 @@ fr_app_io_t proto_detail_work = {
 	.open			= mod_open,
 	.close			= mod_close,
 	.read			= mod_read,
+	.read_pending		= mod_read_pending,
 	.decode			= mod_decode,
 	.write			= mod_write,
 	.event_list_set		= mod_event_list_set,
@@ -51,6 +51,8 @@ typedef struct {
 	int				sockfd;
 
 	fr_io_address_t			*connection;		//!< for connected sockets.
+	udp_recv_batch_t		*recv_batch;		//!< packets read in one system call, but not yet processed.
+	udp_send_batch_t		*send_batch;		//!< replies queued to be written in one system call.
 
 	fr_stats_t			stats;			//!< statistics for this socket
 
@@ -72,6 +74,8 @@ typedef struct {
 	uint32_t			recv_buff;		//!< How big the kernel's receive buffer should be.
 
 	uint32_t			max_packet_size;	//!< for message ring buffer.
+	uint32_t			recv_batch;		//!< Maximum number of packets to read in one system call.
+	uint32_t			send_batch;		//!< Maximum number of packets to write in one system call.
 	uint32_t			max_attributes;		//!< Limit maximum decodable attributes.
 
 	uint16_t			port;			//!< Port to listen on.
@@ -123,6 +127,8 @@ static const conf_parser_t udp_listen_config[] = {
 	{ FR_CONF_POINTER("networks", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) networks_config },
 
 	{ FR_CONF_OFFSET("max_packet_size", proto_dhcpv4_udp_t, max_packet_size), .dflt = "4096" } ,
+	{ FR_CONF_OFFSET("recv_batch", proto_dhcpv4_udp_t, recv_batch), .dflt = "16" } ,
+	{ FR_CONF_OFFSET("send_batch", proto_dhcpv4_udp_t, send_batch), .dflt = "16" } ,
        	{ FR_CONF_OFFSET("max_attributes", proto_dhcpv4_udp_t, max_attributes), .dflt = STRINGIFY(DHCPV4_MAX_ATTRIBUTES) } ,
 
 #ifdef HAVE_LIBPCAP
@@ -231,7 +237,7 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	 */
 	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
 
-	data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	data_size = udp_recv_batch(thread->recv_batch, thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
 	if (data_size < 0) {
 		RATE_LIMIT_GLOBAL(PERROR, "Read error (%zd)", data_size);
 		return data_size;
@@ -279,6 +285,13 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 }
 
 
+static bool mod_read_pending(fr_listen_t *li)
+{
+	proto_dhcpv4_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_dhcpv4_udp_thread_t);
+
+	return udp_recv_batch_pending(thread->recv_batch);
+}
+
 static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t request_time,
 			 uint8_t *buffer, size_t buffer_len, UNUSED size_t written)
 {
@@ -296,8 +309,10 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	 *	@todo - share a stats interface with the parent?  or
 	 *	put the stats in the listener, so that proto_dhcpv4
 	 *	can update them, too.. <sigh>
+	 *
+	 *	Batched replies are counted when they're written.
 	 */
-	thread->stats.total_responses++;
+	if (!thread->send_batch) thread->stats.total_responses++;
 
 	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
 
@@ -626,7 +641,7 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	/*
 	 *	proto_dhcpv4 takes care of suppressing do-not-respond, etc.
 	 */
-	data_size = udp_send(&socket, flags, buffer, buffer_len);
+	data_size = udp_send_batch(thread->send_batch, &socket, flags, buffer, buffer_len);
 
 	/*
 	 *	This socket is dead.  That's an error...
@@ -637,6 +652,17 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 }
 
 
+static int mod_flush(fr_listen_t *li)
+{
+	proto_dhcpv4_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_dhcpv4_udp_thread_t);
+	int				rcode;
+
+	rcode = udp_send_batch_flush(thread->send_batch, thread->sockfd);
+	thread->stats.total_responses += udp_send_batch_written(thread->send_batch);
+
+	return rcode;
+}
+
 static int mod_connection_set(fr_listen_t *li, fr_io_address_t *connection)
 {
 	proto_dhcpv4_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_dhcpv4_udp_thread_t);
@@ -722,6 +748,12 @@ static int mod_open(fr_listen_t *li)
 
 	thread->sockfd = sockfd;
 
+	/*
+	 *	Read and write multiple packets per system call, if we can.
+	 */
+	if (inst->recv_batch > 1) thread->recv_batch = udp_recv_batch_alloc(thread, inst->recv_batch, inst->max_packet_size);
+	if (inst->send_batch > 1) thread->send_batch = udp_send_batch_alloc(thread, inst->send_batch, inst->max_packet_size);
+
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
 
 	thread->name = fr_app_io_socket_name(thread, &proto_dhcpv4_udp,
@@ -896,6 +928,9 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, MIN_PACKET_SIZE);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
+	FR_INTEGER_BOUND_CHECK("recv_batch", inst->recv_batch, <=, 64);
+	FR_INTEGER_BOUND_CHECK("send_batch", inst->send_batch, <=, 64);
+
 	if (!inst->port) {
 		struct servent *s;
 
@@ -1012,7 +1047,9 @@ fr_app_io_t proto_dhcpv4_udp = {
 
 	.open			= mod_open,
 	.read			= mod_read,
+	.read_pending		= mod_read_pending,
 	.write			= mod_write,
+	.flush			= mod_flush,
 #ifdef HAVE_LIBPCAP
 	.close			= mod_close,
 #endif
@@ -333,6 +333,11 @@ static int mod_priority_set(void const *instance, uint8_t const *buffer, UNUSED
 	return inst->priorities[buffer[0]];
 }
 
+static uint8_t mod_packet_type(UNUSED void const *instance, uint8_t const *buffer, UNUSED size_t buflen)
+{
+	return buffer[0];
+}
+
 /** Open listen sockets/connect to external event source
  *
  * @param[in] instance	Ctx data for this application.
@@ -457,5 +462,6 @@ fr_app_t proto_dhcpv6 = {
 	.open			= mod_open,
 	.decode			= mod_decode,
 	.encode			= mod_encode,
-	.priority		= mod_priority_set
+	.priority		= mod_priority_set,
+	.packet_type		= mod_packet_type
 };
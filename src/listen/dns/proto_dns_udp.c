@@ -41,6 +41,8 @@ typedef struct {
 	int				sockfd;
 
 	fr_io_address_t			*connection;		//!< for connected sockets.
+	udp_recv_batch_t		*recv_batch;		//!< packets read in one system call, but not yet processed.
+	udp_send_batch_t		*send_batch;		//!< replies queued to be written in one system call.
 
 	fr_stats_t			stats;			//!< statistics for this socket
 }  proto_dns_udp_thread_t;
@@ -55,12 +57,16 @@ typedef struct {
 	uint32_t			recv_buff;		//!< How big the kernel's receive buffer should be.
 
 	uint32_t			max_packet_size;	//!< for message ring buffer.
+	uint32_t			recv_batch;		//!< Maximum number of packets to read in one system call.
+	uint32_t			send_batch;		//!< Maximum number of packets to write in one system call.
+	uint32_t			shards;			//!< Number of sockets to bind to the same address.
 	uint32_t			max_attributes;		//!< Limit maximum decodable attributes.
 
 	uint16_t			port;			//!< Port to listen on.
 
 	bool				recv_buff_is_set;	//!< Whether we were provided with a receive
 								//!< buffer value.
+	bool				shard_by_src_ipaddr;	//!< Send all packets from one client to the same socket.
 
 	fr_client_list_t			*clients;		//!< local clients
 	fr_client_t			*default_client;	//!< default 0/0 client
@@ -92,8 +98,13 @@ static const conf_parser_t udp_listen_config[] = {
 	{ FR_CONF_POINTER("networks", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) networks_config },
 
 	{ FR_CONF_OFFSET("max_packet_size", proto_dns_udp_t, max_packet_size), .dflt = "576" } ,
+	{ FR_CONF_OFFSET("recv_batch", proto_dns_udp_t, recv_batch), .dflt = "16" } ,
+	{ FR_CONF_OFFSET("send_batch", proto_dns_udp_t, send_batch), .dflt = "16" } ,
 	{ FR_CONF_OFFSET("max_attributes", proto_dns_udp_t, max_attributes), .dflt = STRINGIFY(DNS_MAX_ATTRIBUTES) } ,
 
+	{ FR_CONF_OFFSET("shards", proto_dns_udp_t, shards), .dflt = "1" } ,
+	{ FR_CONF_OFFSET("shard_by_src_ipaddr", proto_dns_udp_t, shard_by_src_ipaddr), .dflt = "yes" } ,
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -142,7 +153,7 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	 */
 	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
 
-	data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	data_size = udp_recv_batch(thread->recv_batch, thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
 	if (data_size < 0) {
 		RATE_LIMIT_GLOBAL(PERROR, "Read error (%zd)", data_size);
 		return data_size;
@@ -186,6 +197,13 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	return packet_len;
 }
 
+static bool mod_read_pending(fr_listen_t *li)
+{
+	proto_dns_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_dns_udp_thread_t);
+
+	return udp_recv_batch_pending(thread->recv_batch);
+}
+
 static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t request_time,
 			 uint8_t *buffer, size_t buffer_len, UNUSED size_t written)
 {
@@ -202,8 +220,10 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	 *	@todo - share a stats interface with the parent?  or
 	 *	put the stats in the listener, so that proto_dns
 	 *	can update them, too.. <sigh>
+	 *
+	 *	Batched replies are counted when they're written.
 	 */
-	thread->stats.total_responses++;
+	if (!thread->send_batch) thread->stats.total_responses++;
 
 	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
 
@@ -222,7 +242,7 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	/*
 	 *	proto_dns takes care of suppressing do-not-respond, etc.
 	 */
-	data_size = udp_send(&socket, flags, buffer, buffer_len);
+	data_size = udp_send_batch(thread->send_batch, &socket, flags, buffer, buffer_len);
 
 	/*
 	 *	This socket is dead.  That's an error...
@@ -233,6 +253,17 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 }
 
 
+static int mod_flush(fr_listen_t *li)
+{
+	proto_dns_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_dns_udp_thread_t);
+	int				rcode;
+
+	rcode = udp_send_batch_flush(thread->send_batch, thread->sockfd);
+	thread->stats.total_responses += udp_send_batch_written(thread->send_batch);
+
+	return rcode;
+}
+
 static int mod_connection_set(fr_listen_t *li, fr_io_address_t *connection)
 {
 	proto_dns_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_dns_udp_thread_t);
@@ -251,6 +282,13 @@ static void mod_network_get(int *ipproto, bool *dynamic_clients, fr_trie_t const
 	*trie = inst->trie;
 }
 
+static uint32_t mod_shards_get(void const *instance)
+{
+	proto_dns_udp_t const *inst = talloc_get_type_abort_const(instance, proto_dns_udp_t);
+
+	return inst->shards;
+}
+
 
 /** Open a UDP listener for DHCPv6
  *
@@ -287,6 +325,19 @@ static int mod_open(fr_listen_t *li)
 		}
 	}
 
+	/*
+	 *	If there are multiple sockets bound to this address,
+	 *	then try to send all packets from one client to the
+	 *	same socket.  Otherwise retransmissions from a client
+	 *	which changes its source port may end up in a
+	 *	different socket, where they won't be seen as
+	 *	duplicates.
+	 */
+	if (inst->shard_by_src_ipaddr && (li->shard == 0) &&
+	    (udp_reuseport_steer(sockfd, li->num_shards) < 0)) {
+		PWARN("Failed steering packets by source IP address");
+	}
+
 	/*
 	 *	SUID up is really only needed if interface is set, OR port <1024.
 	 */
@@ -301,6 +352,12 @@ static int mod_open(fr_listen_t *li)
 
 	thread->sockfd = sockfd;
 
+	/*
+	 *	Read and write multiple packets per system call, if we can.
+	 */
+	if (inst->recv_batch > 1) thread->recv_batch = udp_recv_batch_alloc(thread, inst->recv_batch, inst->max_packet_size);
+	if (inst->send_batch > 1) thread->send_batch = udp_send_batch_alloc(thread, inst->send_batch, inst->max_packet_size);
+
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
 
 	thread->name = fr_app_io_socket_name(thread, &proto_dns_udp,
@@ -378,6 +435,12 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 64);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
+	FR_INTEGER_BOUND_CHECK("recv_batch", inst->recv_batch, <=, 64);
+	FR_INTEGER_BOUND_CHECK("send_batch", inst->send_batch, <=, 64);
+
+	FR_INTEGER_BOUND_CHECK("shards", inst->shards, >=, 1);
+	FR_INTEGER_BOUND_CHECK("shards", inst->shards, <=, 64);
+
 	/*
 	 *	Parse and create the trie for dynamic clients, even if
 	 *	there's no dynamic clients.
@@ -457,10 +520,13 @@ fr_app_io_t proto_dns_udp = {
 
 	.open			= mod_open,
 	.read			= mod_read,
+	.read_pending		= mod_read_pending,
 	.write			= mod_write,
+	.flush			= mod_flush,
 	.fd_set			= mod_fd_set,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
+	.shards_get		= mod_shards_get,
 	.client_find		= mod_client_find,
 	.get_name      		= mod_name,
 };
@@ -24,6 +24,7 @@
  */
 #include <netdb.h>
 #include <fcntl.h>
+#include <freeradius-devel/server/main_config.h>
 #include <freeradius-devel/server/protocol.h>
 #include <freeradius-devel/io/application.h>
 #include <freeradius-devel/io/listen.h>
@@ -53,6 +54,7 @@ typedef struct {
 
 	int				fd;			//!< for CSV files
 	fr_timer_t			*ev;			//!< for writing statistics
+	size_t				steps_logged;		//!< number of completed steps we've logged
 
 	fr_listen_t			*parent;		//!< master IO handler
 } proto_load_step_thread_t;
@@ -73,14 +75,25 @@ struct proto_load_step_s {
 	fr_load_config_t		load;			//!< load configuration
 	bool				repeat;			//!, do we repeat the load generation
 	char const     			*csv;			//!< where to write CSV stats
+	char const			*report;		//!< where to write the per-step report
+	int				report_format;		//!< CSV or JSON
 
 	fr_dict_t const			*dict;			//!< Our namespace.
 };
 
 
+static fr_table_num_sorted_t const load_report_format_table[] = {
+	{ L("csv"),	FR_LOAD_REPORT_CSV },
+	{ L("json"),	FR_LOAD_REPORT_JSON },
+};
+static size_t load_report_format_table_len = NUM_ELEMENTS(load_report_format_table);
+
 static const conf_parser_t load_listen_config[] = {
 	{ FR_CONF_OFFSET_FLAGS("filename", CONF_FLAG_FILE_READABLE | CONF_FLAG_REQUIRED | CONF_FLAG_NOT_EMPTY, proto_load_step_t, filename) },
 	{ FR_CONF_OFFSET("csv", proto_load_step_t, csv) },
+	{ FR_CONF_OFFSET("report", proto_load_step_t, report) },
+	{ FR_CONF_OFFSET("report_format", proto_load_step_t, report_format),
+	  .func = cf_table_parse_int, .uctx = &(cf_table_parse_ctx_t){ .table = load_report_format_table, .len = &load_report_format_table_len }, .dflt = "csv" },
 
 	{ FR_CONF_OFFSET("max_attributes", proto_load_step_t, max_attributes), .dflt = STRINGIFY(RADIUS_MAX_ATTRIBUTES) } ,
 
@@ -91,6 +104,7 @@ static const conf_parser_t load_listen_config[] = {
 	{ FR_CONF_OFFSET("max_backlog", proto_load_step_t, load.milliseconds) },
 	{ FR_CONF_OFFSET("parallel", proto_load_step_t, load.parallel) },
 	{ FR_CONF_OFFSET("repeat", proto_load_step_t, repeat) },
+	{ FR_CONF_OFFSET("p99_limit", proto_load_step_t, load.p99_limit) },
 
 	CONF_PARSER_TERMINATOR
 };
@@ -155,11 +169,90 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 }
 
 
+/** Log the summaries of any steps which have completed since we last looked
+ *
+ */
+static void load_steps_log(proto_load_step_thread_t *thread)
+{
+	fr_load_step_t const	*steps;
+	size_t			i, num;
+
+	steps = fr_load_generator_steps(thread->l, &num);
+
+	for (i = thread->steps_logged; i < num; i++) {
+		INFO("%s - step %zu: %u pps offered, %u pps accepted, %" PRIu64 " lost, rtt p50 %" PRId64 "us, "
+		     "p90 %" PRId64 "us, p99 %" PRId64 "us, p99.9 %" PRId64 "us, max %" PRId64 "us%s",
+		     thread->name, i + 1, steps[i].pps, steps[i].pps_accepted, steps[i].lost,
+		     fr_time_delta_to_usec(steps[i].p50), fr_time_delta_to_usec(steps[i].p90),
+		     fr_time_delta_to_usec(steps[i].p99), fr_time_delta_to_usec(steps[i].p999),
+		     fr_time_delta_to_usec(steps[i].max), steps[i].passed ? "" : " - FAILED");
+	}
+
+	thread->steps_logged = num;
+}
+
+/** The load test is done, write out the results
+ *
+ */
+static void load_done(proto_load_step_thread_t *thread)
+{
+	proto_load_step_t const	*inst = thread->inst;
+	FILE			*fp;
+
+	load_steps_log(thread);
+
+	if (fr_time_delta_ispos(inst->load.p99_limit)) {
+		uint32_t pps = fr_load_generator_stats(thread->l)->sustained_pps;
+
+		if (pps) {
+			INFO("%s - maximum sustainable rate with p99 below %pVs is %u pps",
+			     thread->name, fr_box_time_delta(inst->load.p99_limit), pps);
+		} else {
+			INFO("%s - no rate kept p99 below %pVs", thread->name, fr_box_time_delta(inst->load.p99_limit));
+		}
+	}
+
+	if (!inst->report) return;
+
+	fp = fopen(inst->report, "w");
+	if (!fp) {
+		ERROR("Failed opening %s - %s", inst->report, fr_syserror(errno));
+		return;
+	}
+
+	if (fr_load_generator_report(thread->l, fp, inst->report_format) < 0) {
+		ERROR("Failed writing to %s - %s", inst->report, fr_syserror(errno));
+	}
+
+	fclose(fp);
+}
+
+/** The load test is done, either stop, or start again
+ *
+ *  Called directly by the load generator if the test ends without a
+ *  reply, e.g. when the last replies were lost.
+ */
+static void mod_done(void *uctx)
+{
+	fr_listen_t			*li = uctx;
+	proto_load_step_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_load_step_thread_t);
+
+	load_done(thread);
+
+	if (!thread->inst->repeat) {
+		thread->done = true;
+		return;
+	}
+
+	(void) fr_load_generator_stop(thread->l); /* ensure l->ev is gone */
+	(void) fr_load_generator_start(thread->l);
+	thread->steps_logged = 0;
+}
+
 static ssize_t mod_write(fr_listen_t *li, UNUSED void *packet_ctx, fr_time_t request_time,
 			 UNUSED uint8_t *buffer, size_t buffer_len, UNUSED size_t written)
 {
 	proto_load_step_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_load_step_thread_t);
-	fr_load_reply_t state;
 
 	/*
 	 *	@todo - share a stats interface with the parent?  or
@@ -173,15 +266,7 @@ static ssize_t mod_write(fr_listen_t *li, UNUSED void *packet_ctx, fr_time_t req
 	 *	reply.  Then if the load test is done, exit the
 	 *	server.
 	 */
-	state = fr_load_generator_have_reply(thread->l, request_time);
-	if (state == FR_LOAD_DONE) {
-		if (!thread->inst->repeat) {
-			thread->done = true;
-		} else {
-			(void) fr_load_generator_stop(thread->l); /* ensure l->ev is gone */
-			(void) fr_load_generator_start(thread->l);
-		}
-	}
+	if (fr_load_generator_have_reply(thread->l, request_time) == FR_LOAD_DONE) mod_done(li);
 
 	return buffer_len;
 }
@@ -243,6 +328,10 @@ static void write_stats(fr_timer_list_t *tl, fr_time_t now, void *uctx)
 
 	(void) fr_timer_in(thread, tl, &thread->ev, fr_time_delta_from_sec(1), false, write_stats, thread);
 
+	load_steps_log(thread);
+
+	if (thread->fd < 0) return;
+
 	len = fr_load_generator_stats_sprint(thread->l, now, buffer, sizeof(buffer));
 	if (write(thread->fd, buffer, len) < 0) {
 		DEBUG("Failed writing to %s - %s", thread->inst->csv, fr_syserror(errno));
@@ -302,11 +391,17 @@ static void mod_event_list_set(fr_listen_t *li, fr_event_list_t *el, void *nr)
 	thread->inst = inst;
 	thread->load = inst->load;
 
-	thread->l = fr_load_generator_create(thread, el, &thread->load, mod_generate, li);
+	thread->l = fr_load_generator_create(thread, el, &thread->load, mod_generate, mod_done, li);
 	if (!thread->l) return;
 
 	(void) fr_load_generator_start(thread->l);
 
+	/*
+	 *	The timer also logs each step as it completes.
+	 */
+	thread->fd = -1;
+	(void) fr_timer_in(thread, thread->el->tl, &thread->ev, fr_time_delta_from_sec(1), false, write_stats, thread);
+
 	if (!inst->csv) return;
 
 	thread->fd = open(inst->csv, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
@@ -315,8 +410,6 @@ static void mod_event_list_set(fr_listen_t *li, fr_event_list_t *el, void *nr)
 		return;
 	}
 
-	(void) fr_timer_in(thread, thread->el->tl, &thread->ev, fr_time_delta_from_sec(1), false, write_stats, thread);
-
 	len = fr_load_generator_stats_sprint(thread->l, fr_time(), buffer, sizeof(buffer));
 	if (write(thread->fd, buffer, len) < 0) {
 		DEBUG("Failed writing to %s - %s", thread->inst->csv, fr_syserror(errno));
@@ -401,6 +494,17 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	FR_INTEGER_BOUND_CHECK("max_backlog", inst->load.milliseconds, >=, 1);
 	FR_INTEGER_BOUND_CHECK("max_backlog", inst->load.milliseconds, <, 100000);
 
+	if (fr_time_delta_ispos(inst->load.p99_limit)) {
+		FR_TIME_DELTA_BOUND_CHECK("p99_limit", inst->load.p99_limit, >=, fr_time_delta_from_usec(1));
+		FR_TIME_DELTA_BOUND_CHECK("p99_limit", inst->load.p99_limit, <=, inst->load.duration);
+	}
+
+	/*
+	 *	Requests which haven't had a reply by the time the
+	 *	worker gives up on them never will.
+	 */
+	inst->load.drain_timeout = main_config->worker.max_request_time;
+
 	return 0;
 }
 
@@ -40,6 +40,8 @@ typedef struct {
 	int				sockfd;
 
 	fr_io_address_t			*connection;		//!< for connected sockets.
+	udp_recv_batch_t		*recv_batch;		//!< packets read in one system call, but not yet processed.
+	udp_send_batch_t		*send_batch;		//!< replies queued to be written in one system call.
 
 	fr_stats_t			stats;			//!< statistics for this socket
 
@@ -61,6 +63,9 @@ typedef struct {
 	uint32_t			send_buff;		//!< How big the kernel's send buffer should be.
 
 	uint32_t			max_packet_size;	//!< for message ring buffer.
+	uint32_t			recv_batch;		//!< Maximum number of packets to read in one system call.
+	uint32_t			send_batch;		//!< Maximum number of packets to write in one system call.
+	uint32_t			shards;			//!< Number of sockets to bind to the same address.
 	uint32_t			max_attributes;		//!< Limit maximum decodable attributes.
 
 	uint16_t			port;			//!< Port to listen on.
@@ -68,6 +73,7 @@ typedef struct {
 	bool				recv_buff_is_set;	//!< Whether we were provided with a recv_buff
 	bool				send_buff_is_set;	//!< Whether we were provided with a send_buff
 	bool				dynamic_clients;	//!< whether we have dynamic clients
+	bool				shard_by_src_ipaddr;	//!< Send all packets from one client to the same socket.
 
 	fr_client_list_t		*clients;		//!< local clients
 
@@ -107,8 +113,13 @@ static const conf_parser_t udp_listen_config[] = {
 	{ FR_CONF_POINTER("networks", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) networks_config },
 
 	{ FR_CONF_OFFSET("max_packet_size", proto_radius_udp_t, max_packet_size), .dflt = "4096" } ,
+	{ FR_CONF_OFFSET("recv_batch", proto_radius_udp_t, recv_batch), .dflt = "16" } ,
+	{ FR_CONF_OFFSET("send_batch", proto_radius_udp_t, send_batch), .dflt = "16" } ,
        	{ FR_CONF_OFFSET("max_attributes", proto_radius_udp_t, max_attributes), .dflt = STRINGIFY(RADIUS_MAX_ATTRIBUTES) } ,
 
+	{ FR_CONF_OFFSET("shards", proto_radius_udp_t, shards), .dflt = "1" } ,
+	{ FR_CONF_OFFSET("shard_by_src_ipaddr", proto_radius_udp_t, shard_by_src_ipaddr), .dflt = "yes" } ,
+
 	{ FR_CONF_OFFSET("read_hexdump", proto_radius_udp_t, read_hexdump) },
 	{ FR_CONF_OFFSET("write_hexdump", proto_radius_udp_t, write_hexdump) },
 
@@ -142,7 +153,7 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	 */
 	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
 
-	data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	data_size = udp_recv_batch(thread->recv_batch, thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
 	if (data_size < 0) {
 		PDEBUG2("proto_radius_udp got read error");
 		return data_size;
@@ -200,6 +211,13 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	return packet_len;
 }
 
+static bool mod_read_pending(fr_listen_t *li)
+{
+	proto_radius_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_udp_thread_t);
+
+	return udp_recv_batch_pending(thread->recv_batch);
+}
+
 static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t request_time,
 			 uint8_t *buffer, size_t buffer_len, UNUSED size_t written)
 {
@@ -216,8 +234,10 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	 *	@todo - share a stats interface with the parent?  or
 	 *	put the stats in the listener, so that proto_radius
 	 *	can update them, too.. <sigh>
+	 *
+	 *	Batched replies are counted when they're written.
 	 */
-	thread->stats.total_responses++;
+	if (!thread->send_batch) thread->stats.total_responses++;
 
 	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
 
@@ -249,7 +269,7 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 
 			memcpy(&packet, &track->reply, sizeof(packet)); /* const issues */
 
-			return udp_send(&socket, flags, packet, track->reply_len);
+			return udp_send_batch(thread->send_batch, &socket, flags, packet, track->reply_len);
 		}
 
 		return buffer_len;
@@ -264,7 +284,7 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	 *	Only write replies if they're RADIUS packets.
 	 *	sometimes we want to NOT send a reply...
 	 */
-	data_size = udp_send(&socket, flags, buffer, buffer_len);
+	data_size = udp_send_batch(thread->send_batch, &socket, flags, buffer, buffer_len);
 
 	/*
 	 *	This socket is dead.  That's an error...
@@ -283,6 +303,17 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 }
 
 
+static int mod_flush(fr_listen_t *li)
+{
+	proto_radius_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_udp_thread_t);
+	int				rcode;
+
+	rcode = udp_send_batch_flush(thread->send_batch, thread->sockfd);
+	thread->stats.total_responses += udp_send_batch_written(thread->send_batch);
+
+	return rcode;
+}
+
 static int mod_connection_set(fr_listen_t *li, fr_io_address_t *connection)
 {
 	proto_radius_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_udp_thread_t);
@@ -301,6 +332,13 @@ static void mod_network_get(int *ipproto, bool *dynamic_clients, fr_trie_t const
 	*trie = inst->trie;
 }
 
+static uint32_t mod_shards_get(void const *instance)
+{
+	proto_radius_udp_t const *inst = talloc_get_type_abort_const(instance, proto_radius_udp_t);
+
+	return inst->shards;
+}
+
 /** Open a UDP listener for RADIUS
  *
  */
@@ -357,6 +395,19 @@ static int mod_open(fr_listen_t *li)
 	}
 #endif
 
+	/*
+	 *	If there are multiple sockets bound to this address,
+	 *	then try to send all packets from one client to the
+	 *	same socket.  Otherwise retransmissions from a client
+	 *	which changes its source port may end up in a
+	 *	different socket, where they won't be seen as
+	 *	duplicates.
+	 */
+	if (inst->shard_by_src_ipaddr && (li->shard == 0) &&
+	    (udp_reuseport_steer(sockfd, li->num_shards) < 0)) {
+		PWARN("Failed steering packets by source IP address");
+	}
+
 	if (fr_socket_bind(sockfd, inst->interface, &ipaddr, &port) < 0) {
 		close(sockfd);
 		PERROR("Failed binding socket");
@@ -365,6 +416,12 @@ static int mod_open(fr_listen_t *li)
 
 	thread->sockfd = sockfd;
 
+	/*
+	 *	Read and write multiple packets per system call, if we can.
+	 */
+	if (inst->recv_batch > 1) thread->recv_batch = udp_recv_batch_alloc(thread, inst->recv_batch, inst->max_packet_size);
+	if (inst->send_batch > 1) thread->send_batch = udp_send_batch_alloc(thread, inst->send_batch, inst->max_packet_size);
+
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
 
 	thread->name = fr_app_io_socket_name(thread, &proto_radius_udp,
@@ -465,6 +522,12 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 20);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
+	FR_INTEGER_BOUND_CHECK("recv_batch", inst->recv_batch, <=, 64);
+	FR_INTEGER_BOUND_CHECK("send_batch", inst->send_batch, <=, 64);
+
+	FR_INTEGER_BOUND_CHECK("shards", inst->shards, >=, 1);
+	FR_INTEGER_BOUND_CHECK("shards", inst->shards, <=, 64);
+
 	if (!inst->port) {
 		struct servent *s;
 
@@ -554,12 +617,15 @@ fr_app_io_t proto_radius_udp = {
 
 	.open			= mod_open,
 	.read			= mod_read,
+	.read_pending		= mod_read_pending,
 	.write			= mod_write,
+	.flush			= mod_flush,
 	.fd_set			= mod_fd_set,
 	.track_create  		= mod_track_create,
 	.track_compare		= mod_track_compare,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
+	.shards_get		= mod_shards_get,
 	.client_find		= mod_client_find,
 	.get_name      		= mod_name,
 	.hexdump_set		= mod_hexdump_set,
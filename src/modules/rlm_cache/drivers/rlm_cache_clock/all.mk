@@ -0,0 +1,4 @@
+TARGETNAME	:= rlm_cache_clock
+
+TARGET		:= $(TARGETNAME)$(L)
+SOURCES		:= $(TARGETNAME).c
@@ -0,0 +1,630 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_cache_clock.c
+ * @brief Sharded in memory cache with CLOCK eviction.
+ *
+ * Entries are spread over a number of shards by the hash of their key.  Each
+ * shard is an open addressing hash table with its own mutex, so requests for
+ * different keys rarely contend with each other.
+ *
+ * When the cache reaches max_entries or max_memory, entries are evicted
+ * using the CLOCK algorithm.  A "hand" sweeps over the slots of the shard
+ * being inserted into, clearing the referenced flag of entries which have
+ * been retrieved since the last sweep, and evicting the first entry which
+ * is either expired, or hasn't been referenced.  If that shard is empty,
+ * entries are evicted from the other shards instead.  Both limits are hard
+ * limits; if no entries can be evicted, the insert fails.
+ *
+ * @copyright 2026 The FreeRADIUS server project
+ */
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/math.h>
+#include <freeradius-devel/util/value.h>
+#include "../../rlm_cache.h"
+
+#include <stdatomic.h>
+
+typedef struct rlm_cache_clock_shard_s rlm_cache_clock_shard_t;
+
+typedef struct {
+	rlm_cache_entry_t		fields;		//!< Entry data.
+	uint32_t			hash;		//!< Hash of the key.
+	bool				referenced;	//!< Entry has been retrieved since the CLOCK
+							///< hand last passed over it.
+	size_t				size;		//!< Memory used by the entry, counted against
+							///< max_memory.
+} rlm_cache_clock_entry_t;
+
+/** A subset of the cache, with its own mutex
+ *
+ */
+struct rlm_cache_clock_shard_s {
+	pthread_mutex_t			mutex;		//!< Protect the table from multiple readers/writers.
+
+	rlm_cache_clock_entry_t		**slots;	//!< Open addressing hash table.
+	uint32_t			num_slots;	//!< Size of the table.  Always a power of 2.
+	uint32_t			num_entries;	//!< Entries in the table.
+
+	uint32_t			hand;		//!< Slot the CLOCK hand is pointing at.
+};
+
+typedef struct {
+	rlm_cache_clock_shard_t		*shards;	//!< Array of shards.
+
+	_Atomic(uint64_t)		num_entries;	//!< Entries in all shards.
+	_Atomic(uint64_t)		used_memory;	//!< Memory used by entries in all shards.
+} rlm_cache_clock_mutable_t;
+
+typedef struct {
+	uint32_t			num_shards;	//!< How many shards the cache is split into.
+	size_t				max_memory;	//!< Maximum memory used by entries.  0 means no limit.
+
+	uint32_t			shard_shift;	//!< How far to shift the hash to get the shard index.
+
+	rlm_cache_clock_mutable_t	*mutable;	//!< Mutable instance data.
+} rlm_cache_clock_t;
+
+static conf_parser_t driver_config[] = {
+	{ FR_CONF_OFFSET("shards", rlm_cache_clock_t, num_shards), .dflt = "16" },
+	{ FR_CONF_OFFSET("max_memory", rlm_cache_clock_t, max_memory), .dflt = "0" },
+	CONF_PARSER_TERMINATOR
+};
+
+/** The shard locked by the current acquire/release pair
+ *
+ * Driver calls between acquire and release never yield, so one
+ * per thread is sufficient.  Tracking it here rather than in the
+ * handle allows the shard to be chosen when the key is known.
+ */
+static _Thread_local rlm_cache_clock_shard_t *clock_locked;
+
+#define CLOCK_MIN_SLOTS		(64)
+
+/** Return the shard holding a key, locking it if it's not already locked
+ *
+ */
+static rlm_cache_clock_shard_t *clock_shard_lock(rlm_cache_clock_t const *driver, uint32_t hash)
+{
+	rlm_cache_clock_shard_t *shard = &driver->mutable->shards[driver->shard_shift < 32 ? hash >> driver->shard_shift : 0];
+
+	if (clock_locked == shard) return shard;
+
+	/*
+	 *	All the operations between an acquire and a release
+	 *	use the same key, so we shouldn't ever have to
+	 *	switch shards, but handle it in case.
+	 */
+	if (clock_locked) pthread_mutex_unlock(&clock_locked->mutex);
+
+	pthread_mutex_lock(&shard->mutex);
+	clock_locked = shard;
+
+	return shard;
+}
+
+/** Find the slot holding a key, or the empty slot where it would be inserted
+ *
+ */
+static uint32_t clock_slot_find(rlm_cache_clock_shard_t *shard, uint32_t hash, fr_value_box_t const *key)
+{
+	uint32_t	mask = shard->num_slots - 1;
+	uint32_t	i;
+
+	for (i = hash & mask; shard->slots[i]; i = (i + 1) & mask) {
+		rlm_cache_clock_entry_t *e = shard->slots[i];
+
+		if ((e->hash == hash) && (fr_value_box_cmp(&e->fields.key, key) == 0)) break;
+	}
+
+	return i;
+}
+
+/** Remove the entry at a slot, shifting subsequent entries back to fill the gap
+ *
+ * Using backwards shift deletion means we don't need tombstones, so
+ * lookups never have to probe past deleted entries.
+ */
+static void clock_slot_remove(rlm_cache_clock_mutable_t *mutable, rlm_cache_clock_shard_t *shard, uint32_t i)
+{
+	rlm_cache_clock_entry_t	*e = shard->slots[i];
+	uint32_t		mask = shard->num_slots - 1;
+	uint32_t		j;
+
+	shard->slots[i] = NULL;
+	shard->num_entries--;
+	atomic_fetch_sub_explicit(&mutable->num_entries, 1, memory_order_relaxed);
+	atomic_fetch_sub_explicit(&mutable->used_memory, e->size, memory_order_relaxed);
+
+	for (j = (i + 1) & mask; shard->slots[j]; j = (j + 1) & mask) {
+		uint32_t home = shard->slots[j]->hash & mask;
+
+		/*
+		 *	Only move entries whose home slot
+		 *	doesn't lie cyclically in (i, j].
+		 */
+		if ((i <= j) ? ((i < home) && (home <= j)) : ((i < home) || (home <= j))) continue;
+
+		shard->slots[i] = shard->slots[j];
+		shard->slots[j] = NULL;
+		i = j;
+	}
+}
+
+/** Double the size of a shard's table
+ *
+ */
+static int clock_shard_grow(rlm_cache_clock_shard_t *shard)
+{
+	rlm_cache_clock_entry_t	**old = shard->slots;
+	uint32_t		old_slots = shard->num_slots;
+	uint32_t		i;
+
+	shard->slots = talloc_zero_array(NULL, rlm_cache_clock_entry_t *, old_slots * 2);
+	if (!shard->slots) {
+		shard->slots = old;
+		return -1;
+	}
+	shard->num_slots = old_slots * 2;
+	shard->hand = 0;
+
+	for (i = 0; i < old_slots; i++) {
+		rlm_cache_clock_entry_t *e = old[i];
+		uint32_t		j;
+
+		if (!e) continue;
+
+		for (j = e->hash & (shard->num_slots - 1); shard->slots[j]; j = (j + 1) & (shard->num_slots - 1));
+		shard->slots[j] = e;
+	}
+
+	talloc_free(old);
+
+	return 0;
+}
+
+/** Evict one entry from a shard using the CLOCK algorithm
+ *
+ * @return
+ *	- 0 if an entry was evicted.
+ *	- -1 if the shard was empty.
+ */
+static int clock_shard_evict(rlm_cache_clock_mutable_t *mutable, rlm_cache_clock_shard_t *shard,
+			     request_t *request)
+{
+	rlm_cache_clock_entry_t	*e;
+	fr_unix_time_t		now = fr_time_to_unix_time(request->packet->timestamp);
+	uint32_t		mask = shard->num_slots - 1;
+	uint32_t		i;
+
+	if (shard->num_entries == 0) return -1;
+
+	/*
+	 *	Two passes are enough to clear every referenced
+	 *	flag and then find an entry without one.
+	 */
+	for (i = 0; i < (shard->num_slots * 2); i++) {
+		e = shard->slots[shard->hand];
+		if (!e) goto next;
+
+		if (e->referenced && !fr_unix_time_lt(e->fields.expires, now)) {
+			e->referenced = false;
+			goto next;
+		}
+
+		RDEBUG3("Evicting cache entry for \"%pV\"", &e->fields.key);
+		clock_slot_remove(mutable, shard, shard->hand);
+		talloc_free(e);
+
+		/*
+		 *	The hand now points to whichever entry
+		 *	was shifted into the evicted slot, which
+		 *	we've not yet examined.
+		 */
+		return 0;
+
+	next:
+		shard->hand = (shard->hand + 1) & mask;
+	}
+
+	return -1;
+}
+
+/** Evict one entry from the cache
+ *
+ * Entries are evicted from the shard we're inserting into if possible.
+ * Other shards are only used if their mutex is free, as we already
+ * hold one shard mutex, and waiting for another could deadlock with
+ * a thread doing the same thing.
+ *
+ * @return
+ *	- 0 if an entry was evicted.
+ *	- -1 if no entries could be evicted.
+ */
+static int clock_evict(rlm_cache_clock_t const *driver, rlm_cache_clock_shard_t *shard, request_t *request)
+{
+	rlm_cache_clock_mutable_t	*mutable = driver->mutable;
+	uint32_t			start = shard - mutable->shards;
+	uint32_t			i;
+
+	if (clock_shard_evict(mutable, shard, request) == 0) return 0;
+
+	for (i = 1; i < driver->num_shards; i++) {
+		rlm_cache_clock_shard_t	*other = &mutable->shards[(start + i) & (driver->num_shards - 1)];
+		int			ret;
+
+		if (pthread_mutex_trylock(&other->mutex) != 0) continue;
+		ret = clock_shard_evict(mutable, other, request);
+		pthread_mutex_unlock(&other->mutex);
+
+		if (ret == 0) return 0;
+	}
+
+	return -1;
+}
+
+/** Custom allocation function for the driver
+ *
+ * Allows allocation of cache entry structures with additional fields.
+ *
+ * @copydetails cache_entry_alloc_t
+ */
+static rlm_cache_entry_t *cache_entry_alloc(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					    request_t *request)
+{
+	rlm_cache_clock_entry_t *c;
+
+	c = talloc_zero(NULL, rlm_cache_clock_entry_t);
+	if (!c) {
+		RERROR("Failed allocating cache entry");
+		return NULL;
+	}
+
+	return (rlm_cache_entry_t *)c;
+}
+
+/** Locate a cache entry
+ *
+ * The entry is returned in place, and remains valid until the handle
+ * is released, as its shard stays locked.
+ *
+ * @note handle not used except for sanity checks.
+ *
+ * @copydetails cache_entry_find_t
+ */
+static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
+				       UNUSED rlm_cache_config_t const *config, void *instance,
+				       UNUSED request_t *request, UNUSED void *handle, fr_value_box_t const *key)
+{
+	rlm_cache_clock_t	*driver = talloc_get_type_abort(instance, rlm_cache_clock_t);
+	rlm_cache_clock_shard_t	*shard;
+	rlm_cache_clock_entry_t	*c;
+	uint32_t		hash = fr_value_box_hash(key);
+
+	shard = clock_shard_lock(driver, hash);
+
+	c = shard->slots[clock_slot_find(shard, hash, key)];
+	if (!c) {
+		*out = NULL;
+		return CACHE_MISS;
+	}
+
+	c->referenced = true;
+	*out = &c->fields;
+
+	return CACHE_OK;
+}
+
+/** Free an entry and remove it from the data store
+ *
+ * @note handle not used except for sanity checks.
+ *
+ * @copydetails cache_entry_expire_t
+ */
+static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, void *instance,
+					 request_t *request, UNUSED void *handle,
+					 fr_value_box_t const *key)
+{
+	rlm_cache_clock_t	*driver = talloc_get_type_abort(instance, rlm_cache_clock_t);
+	rlm_cache_clock_shard_t	*shard;
+	rlm_cache_clock_entry_t	*c;
+	uint32_t		hash, i;
+
+	if (!request) return CACHE_ERROR;
+
+	hash = fr_value_box_hash(key);
+	shard = clock_shard_lock(driver, hash);
+
+	i = clock_slot_find(shard, hash, key);
+	c = shard->slots[i];
+	if (!c) return CACHE_MISS;
+
+	clock_slot_remove(driver->mutable, shard, i);
+	talloc_free(c);
+
+	return CACHE_OK;
+}
+
+/** Insert a new entry into the data store
+ *
+ * Evicts entries if the cache has reached max_entries or max_memory.
+ *
+ * @note handle not used except for sanity checks.
+ *
+ * @copydetails cache_entry_insert_t
+ */
+static cache_status_t cache_entry_insert(rlm_cache_config_t const *config, void *instance,
+					 request_t *request, void *handle,
+					 rlm_cache_entry_t const *c)
+{
+	rlm_cache_clock_t	*driver = talloc_get_type_abort(instance, rlm_cache_clock_t);
+	rlm_cache_clock_mutable_t *mutable = driver->mutable;
+	rlm_cache_clock_entry_t	*entry = UNCONST(rlm_cache_clock_entry_t *, (rlm_cache_clock_entry_t const *)c);
+	rlm_cache_clock_shard_t	*shard;
+	uint64_t		num_entries, used_memory;
+	uint32_t		i;
+
+	fr_assert(handle == request);
+
+	if (!request) return CACHE_ERROR;
+
+	entry->hash = fr_value_box_hash(&c->key);
+	entry->size = talloc_total_size(entry);
+	entry->referenced = false;
+
+	if (driver->max_memory && (entry->size > driver->max_memory)) {
+		RERROR("Entry size %zu exceeds max_memory (%zu)", entry->size, driver->max_memory);
+		return CACHE_ERROR;
+	}
+
+	shard = clock_shard_lock(driver, entry->hash);
+
+	/*
+	 *	Allow overwriting
+	 */
+	i = clock_slot_find(shard, entry->hash, &c->key);
+	if (shard->slots[i]) {
+		rlm_cache_clock_entry_t *old = shard->slots[i];
+
+		if (old == entry) return CACHE_OK;
+
+		clock_slot_remove(mutable, shard, i);
+		talloc_free(old);
+	}
+
+	/*
+	 *	Count the entry before checking the limits, so that
+	 *	concurrent inserts into other shards can't take the
+	 *	cache over them.
+	 */
+	num_entries = atomic_fetch_add_explicit(&mutable->num_entries, 1, memory_order_relaxed) + 1;
+	used_memory = atomic_fetch_add_explicit(&mutable->used_memory, entry->size, memory_order_relaxed) + entry->size;
+
+	/*
+	 *	Make space.
+	 */
+	while (((config->max_entries > 0) && (num_entries > config->max_entries)) ||
+	       (driver->max_memory && (used_memory > driver->max_memory))) {
+		if (clock_evict(driver, shard, request) < 0) {
+			RERROR("Cache is full, and no entries could be evicted");
+			goto error;
+		}
+
+		num_entries = atomic_load_explicit(&mutable->num_entries, memory_order_relaxed);
+		used_memory = atomic_load_explicit(&mutable->used_memory, memory_order_relaxed);
+	}
+
+	/*
+	 *	Keep the load factor at or below 50%.
+	 */
+	if (((shard->num_entries + 1) * 2) > shard->num_slots) {
+		if (clock_shard_grow(shard) < 0) {
+			RERROR("Failed growing cache table");
+			goto error;
+		}
+	}
+
+	shard->slots[clock_slot_find(shard, entry->hash, &c->key)] = entry;
+	shard->num_entries++;
+
+	return CACHE_OK;
+
+error:
+	atomic_fetch_sub_explicit(&mutable->num_entries, 1, memory_order_relaxed);
+	atomic_fetch_sub_explicit(&mutable->used_memory, entry->size, memory_order_relaxed);
+
+	return CACHE_ERROR;
+}
+
+/** Update the TTL of an entry
+ *
+ * Expiry is checked on retrieval and during eviction, so there's
+ * nothing to reorder.
+ *
+ * @note handle not used except for sanity checks.
+ *
+ * @copydetails cache_entry_set_ttl_t
+ */
+static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					  UNUSED request_t *request, UNUSED void *handle,
+					  UNUSED rlm_cache_entry_t *c)
+{
+	return CACHE_OK;
+}
+
+/** Return the number of entries in the cache
+ *
+ * @note handle not used except for sanity checks.
+ *
+ * @copydetails cache_entry_count_t
+ */
+static uint64_t cache_entry_count(UNUSED rlm_cache_config_t const *config, void *instance,
+				  request_t *request, UNUSED void *handle)
+{
+	rlm_cache_clock_t *driver = talloc_get_type_abort(instance, rlm_cache_clock_t);
+
+	if (!request) return CACHE_ERROR;
+
+	return atomic_load_explicit(&driver->mutable->num_entries, memory_order_relaxed);
+}
+
+/** Prepare to access the cache
+ *
+ * The shard mutex is taken by the first operation, once the key is known.
+ *
+ * @note handle not used except for sanity checks.
+ *
+ * @copydetails cache_acquire_t
+ */
+static int cache_acquire(void **handle, UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+			 request_t *request)
+{
+	fr_assert(!clock_locked);
+
+	*handle = request;		/* handle is unused, this is just for sanity checking */
+
+	return 0;
+}
+
+/** Release a handle unlocking any shard mutexes
+ *
+ * @note handle not used except for sanity checks.
+ *
+ * @copydetails cache_release_t
+ */
+static void cache_release(UNUSED rlm_cache_config_t const *config, UNUSED void *instance, request_t *request,
+			  UNUSED rlm_cache_handle_t *handle)
+{
+	if (!clock_locked) return;
+
+	pthread_mutex_unlock(&clock_locked->mutex);
+	clock_locked = NULL;
+
+	RDEBUG3("Mutex released");
+}
+
+/** Cleanup a cache_clock instance
+ *
+ */
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_cache_clock_t		*driver = talloc_get_type_abort(mctx->mi->data, rlm_cache_clock_t);
+	rlm_cache_clock_mutable_t	*mutable = driver->mutable;
+	uint32_t			i, j;
+
+	if (!mutable) return 0;
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_clock_shard_t *shard = &mutable->shards[i];
+
+		if (!shard->slots) continue;
+
+		for (j = 0; j < shard->num_slots; j++) talloc_free(shard->slots[j]);
+		talloc_free(shard->slots);
+
+		pthread_mutex_destroy(&shard->mutex);
+	}
+
+	talloc_free(mutable);
+
+	return 0;
+}
+
+/** Create a new cache_clock instance
+ *
+ * @param[in] mctx		Data required for instantiation.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_instantiate(module_inst_ctx_t const *mctx)
+{
+	rlm_cache_clock_t		*driver = talloc_get_type_abort(mctx->mi->data, rlm_cache_clock_t);
+	rlm_cache_t const		*parent = talloc_get_type_abort_const(mctx->mi->parent->data, rlm_cache_t);
+	rlm_cache_clock_mutable_t	*mutable;
+	uint32_t			i, num_slots = CLOCK_MIN_SLOTS;
+	int				ret;
+
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, >=, 1);
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, <=, 1024);
+
+	driver->num_shards = fr_roundup_pow2_uint64(driver->num_shards);
+	driver->shard_shift = 32 - (fr_low_bit_pos(driver->num_shards) - 1);
+
+	/*
+	 *	Size the tables so they rarely need to grow
+	 *	when there's a limit on the number of entries.
+	 */
+	if (parent->config.max_entries > 0) {
+		uint32_t max_entries = (parent->config.max_entries + driver->num_shards - 1) / driver->num_shards;
+
+		num_slots = fr_roundup_pow2_uint64((uint64_t)max_entries * 2);
+		if (num_slots < CLOCK_MIN_SLOTS) num_slots = CLOCK_MIN_SLOTS;
+	}
+
+	MEM(mutable = talloc_zero(NULL, rlm_cache_clock_mutable_t));
+	MEM(mutable->shards = talloc_zero_array(mutable, rlm_cache_clock_shard_t, driver->num_shards));
+	driver->mutable = mutable;
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_clock_shard_t *shard = &mutable->shards[i];
+
+		if ((ret = pthread_mutex_init(&shard->mutex, NULL)) != 0) {
+			ERROR("Failed initializing mutex: %s", fr_syserror(ret));
+		error:
+			driver->num_shards = i;
+			mod_detach(&(module_detach_ctx_t){ .mi = mctx->mi });
+			driver->mutable = NULL;
+			return -1;
+		}
+
+		shard->num_slots = num_slots;
+		shard->slots = talloc_zero_array(NULL, rlm_cache_clock_entry_t *, num_slots);
+		if (!shard->slots) {
+			ERROR("Failed allocating cache table");
+			pthread_mutex_destroy(&shard->mutex);
+			goto error;
+		}
+	}
+
+	return 0;
+}
+
+extern rlm_cache_driver_t rlm_cache_clock;
+rlm_cache_driver_t rlm_cache_clock = {
+	.common = {
+		.magic		= MODULE_MAGIC_INIT,
+		.name		= "cache_clock",
+		.config		= driver_config,
+		.instantiate	= mod_instantiate,
+		.detach		= mod_detach,
+		.inst_size	= sizeof(rlm_cache_clock_t),
+		.inst_type	= "rlm_cache_clock_t",
+	},
+	.alloc		= cache_entry_alloc,
+
+	.find		= cache_entry_find,
+	.insert		= cache_entry_insert,
+	.expire		= cache_entry_expire,
+	.set_ttl	= cache_entry_set_ttl,
+	.count		= cache_entry_count,
+
+	.acquire	= cache_acquire,
+	.release	= cache_release
+};
@@ -186,7 +186,11 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 		return memcached_fatal(mret) ? CACHE_RECONNECT : CACHE_ERROR;
 	}
 	RDEBUG2("Retrieved %zu bytes from memcached", len);
-	RDEBUG2("%s", from_store);
+	if ((len > 0) && ((uint8_t)from_store[0] == CACHE_SERIALIZE_BINARY_MAGIC)) {
+		RHEXDUMP3((uint8_t const *)from_store, len, "Binary entry");
+	} else {
+		RDEBUG2("%s", from_store);
+	}
 
 	MEM(c = talloc_zero(NULL, rlm_cache_entry_t));
 	map_list_init(&c->maps);
@@ -220,20 +224,33 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config
 	memcached_return_t ret;
 
 	TALLOC_CTX *pool;
-	char *to_store;
+	uint8_t *to_store;
+	size_t len;
 
 	pool = talloc_pool(NULL, 1024);
 	if (!pool) return CACHE_ERROR;
 
-	if (cache_serialize(pool, &to_store, c) < 0) {
-		talloc_free(pool);
+	/*
+	 *	Prefer the binary format, it's much cheaper to
+	 *	decode.  Entries it can't represent are stored
+	 *	as text.
+	 */
+	if (cache_serialize_binary(pool, &to_store, &len, c, request->proto_dict) < 0) {
+		char *text;
 
-		return CACHE_ERROR;
+		RDEBUG3("%s, storing entry as text", fr_strerror());
+
+		if (cache_serialize(pool, &text, c) < 0) {
+			talloc_free(pool);
+
+			return CACHE_ERROR;
+		}
+		to_store = (uint8_t *)text;
+		len = talloc_array_length(text) - 1;
 	}
 
 	ret = memcached_set(mandle->handle, (char const *)c->key.vb_strvalue, c->key.vb_length,
-		            to_store ? to_store : "",
-		            to_store ? talloc_array_length(to_store) - 1 : 0, fr_unix_time_to_sec(c->expires), 0);
+		            (char const *)to_store, len, fr_unix_time_to_sec(c->expires), 0);
 	talloc_free(pool);
 	if (ret != MEMCACHED_SUCCESS) {
 		RERROR("Failed storing entry: %s: %s", memcached_strerror(mandle->handle, ret),
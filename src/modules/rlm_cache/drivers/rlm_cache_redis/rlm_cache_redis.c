@@ -28,6 +28,7 @@
 #include <freeradius-devel/util/value.h>
 
 #include "../../rlm_cache.h"
+#include "../../serialize.h"
 #include <freeradius-devel/redis/base.h>
 #include <freeradius-devel/redis/cluster.h>
 static conf_parser_t driver_config[] = {
@@ -169,6 +170,25 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 		return CACHE_MISS;
 	}
 
+	/*
+	 *	A single element is an entry in the binary format,
+	 *	which carries its own created and expires times.
+	 */
+	if ((reply->elements == 1) && (reply->element[0]->type == REDIS_REPLY_STRING) &&
+	    (reply->element[0]->len > 0) && ((uint8_t)reply->element[0]->str[0] == CACHE_SERIALIZE_BINARY_MAGIC)) {
+		MEM(c = talloc_zero(NULL, rlm_cache_entry_t));
+		map_list_init(&c->maps);
+
+		if (cache_deserialize(request, c, request->proto_dict,
+				      reply->element[0]->str, reply->element[0]->len) < 0) {
+			RPERROR("Invalid entry");
+			talloc_free(c);
+			goto error;
+		}
+		fr_redis_reply_free(&reply);
+		goto finish;
+	}
+
 	if (reply->elements % 3) {
 		REDEBUG("Invalid number of reply elements (%zu).  "
 			"Reply must contain triplets of keys operators and values",
@@ -232,9 +252,14 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 		talloc_free(map);
 	}
 
-	if (unlikely(fr_value_box_copy(c, &c->key, key) < 0)) goto error;
-
 	map_list_move(&c->maps, &head);
+
+finish:
+	if (unlikely(fr_value_box_copy(c, &c->key, key) < 0)) {
+		talloc_free(c);
+		goto error;
+	}
+
 	*out = c;
 
 	return CACHE_OK;
@@ -271,6 +296,9 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config
 
 	int			cnt;
 
+	uint8_t			*to_store;
+	size_t			to_store_len;
+
 	tmpl_t		expires_value;
 	map_t		expires = {
 					.op	= T_OP_SET,
@@ -312,6 +340,25 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config
 	pool = talloc_pool(request, 1024);
 	if (!pool) return CACHE_ERROR;
 
+	/*
+	 *	Prefer storing the entry as a single element in
+	 *	the binary format, it's much cheaper to decode
+	 *	than the triplets.
+	 */
+	if (cache_serialize_binary(pool, &to_store, &to_store_len, c, request->proto_dict) == 0) {
+		argv = talloc_array(pool, char const *, 3);	/* cmd + key + entry */
+		argv_len = talloc_array(pool, size_t, 3);
+
+		argv[0] = command;
+		argv_len[0] = sizeof(command) - 1;
+		argv[1] = (char const *)c->key.vb_strvalue;
+		argv_len[1] = c->key.vb_length;
+		argv[2] = (char const *)to_store;
+		argv_len[2] = to_store_len;
+		goto pipeline;
+	}
+	RDEBUG3("%s, storing entry as triplets", fr_strerror());
+
 	argv_p = argv = talloc_array(pool, char const *, (cnt * 3) + 2);	/* pair = 3 + cmd + key */
 	argv_len_p = argv_len = talloc_array(pool, size_t, (cnt * 3) + 2);	/* pair = 3 + cmd + key */
 
@@ -348,6 +395,7 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config
 		argv_len_p += 3;
 	}
 
+pipeline:
 	RDEBUG3("Pipelining commands");
 
 	for (s_ret = fr_redis_cluster_state_init(&state, &conn, driver->cluster, request, (uint8_t const *)c->key.vb_strvalue, c->key.vb_length, false);
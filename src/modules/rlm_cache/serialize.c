@@ -28,6 +28,22 @@ RCSID("$Id$")
 #include "rlm_cache.h"
 #include "serialize.h"
 
+#include <freeradius-devel/internal/internal.h>
+#include <freeradius-devel/util/proto.h>
+
+/** Lists which may appear at the head of the LHS of a binary serialized map
+ *
+ * The index into this array is what's written to the store, so new lists
+ * must only ever be appended.
+ */
+static fr_dict_attr_t const **cache_serialize_lists[] = {
+	&request_attr_request,
+	&request_attr_reply,
+	&request_attr_control,
+	&request_attr_state
+};
+
+
 /** Serialize a cache entry as a humanly readable string
  *
  * @param ctx to alloc new string in. Should be a talloc pool a little bigger
@@ -89,14 +105,331 @@ finish:
 	return 0;
 }
 
+/** Check whether a map can be represented in the binary format, and find its list identifier
+ *
+ * The binary format only records the list, the operator, and a pair.  The LHS
+ * is rebuilt from the ancestry of the pair's attribute, so we can only encode
+ * maps whose LHS is exactly that ancestry, with no request references other
+ * than the current request, and no filters.
+ *
+ * @param[out] list_id	Identifier of the list at the head of the LHS.
+ * @param[in] map	to check.
+ * @param[in] dict	the entry will be decoded with.
+ * @return
+ *	- true if the map can be encoded.
+ *	- false if the text format must be used.
+ */
+static bool cache_map_binary_ok(uint8_t *list_id, map_t const *map, fr_dict_t const *dict)
+{
+	fr_da_stack_t		da_stack;
+	fr_dict_attr_t const	*da, *list;
+	fr_dict_t const		*da_dict;
+	tmpl_attr_t const	*ar = NULL;
+	unsigned int		i;
+
+	if (!tmpl_is_attr(map->lhs) || !tmpl_is_data(map->rhs)) return false;
+
+	switch (tmpl_request_ref_count(map->lhs)) {
+	case 0:
+		break;
+
+	case 1:
+		if (tmpl_request_list_head(tmpl_request(map->lhs))->request == REQUEST_CURRENT) break;
+		FALL_THROUGH;
+
+	default:
+		return false;
+	}
+
+	list = tmpl_list(map->lhs);
+	if (!list) return false;
+
+	for (i = 0; i < NUM_ELEMENTS(cache_serialize_lists); i++) {
+		if (*cache_serialize_lists[i] == list) break;
+	}
+	if (i == NUM_ELEMENTS(cache_serialize_lists)) return false;
+	*list_id = i;
+
+	ar = tmpl_attr_list_head(tmpl_attr(map->lhs));
+
+	da = tmpl_attr_tail_da(map->lhs);
+	if (!fr_type_is_leaf(da->type) || da->flags.is_unknown ||
+	    (tmpl_value(map->rhs)->type != da->type)) return false;
+
+	/*
+	 *	The decoder resolves attributes relative to the
+	 *	protocol dictionary, or the internal dictionary.
+	 */
+	da_dict = fr_dict_by_da(da);
+	if ((da_dict != dict) && (da_dict != fr_dict_internal())) return false;
+
+	fr_proto_da_stack_build(&da_stack, da);
+	for (i = 0; i < da_stack.depth; i++) {
+		ar = tmpl_attr_list_next(tmpl_attr(map->lhs), ar);
+		if (!ar || (ar->ar_da != da_stack.da[i]) || !ar_filter_is_none(ar)) return false;
+
+		if (da_stack.da[i] == da) break;
+
+		/*
+		 *	Only ancestors the internal encoder can
+		 *	walk from a leaf pair.
+		 */
+		switch (da_stack.da[i]->type) {
+		case FR_TYPE_TLV:
+		case FR_TYPE_STRUCT:
+		case FR_TYPE_VSA:
+		case FR_TYPE_VENDOR:
+			break;
+
+		default:
+			return false;
+		}
+	}
+
+	return !tmpl_attr_list_next(tmpl_attr(map->lhs), ar);
+}
+
+/** Serialize a cache entry in the compact binary format
+ *
+ * The entry is written as:
+ *
+ @verbatim
+    magic (1) | version (1) | dict name length (1) | dict name | created (8) | expires (8) | map...
+ @endverbatim
+ *
+ * The dictionary name identifies the protocol the attribute numbers belong
+ * to, so entries written by one virtual server can't be decoded as a
+ * different protocol by another.
+ *
+ * Where each map is the operator (1), the list identifier (1), then the leaf
+ * pair encoded with the internal encoder, i.e. using attribute numbers
+ * rather than names.
+ *
+ * Not all maps can be represented in the binary format.  If this function
+ * fails the caller should fall back to #cache_serialize.
+ *
+ * @param[in] ctx	to allocate the serialized entry in.
+ * @param[out] out	Where to write pointer to serialized cache entry.
+ * @param[out] outlen	Length of the serialized cache entry.
+ * @param[in] c		Cache entry to serialize.
+ * @param[in] dict	the entry will be decoded with.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int cache_serialize_binary(TALLOC_CTX *ctx, uint8_t **out, size_t *outlen,
+			   rlm_cache_entry_t const *c, fr_dict_t const *dict)
+{
+	fr_dbuff_t			dbuff;
+	fr_dbuff_uctx_talloc_t		tctx;
+	fr_internal_encode_ctx_t	encode_ctx = { .allow_name_only = false };
+	map_t				*map = NULL;
+	char const			*dict_name = fr_dict_root(dict)->name;
+	size_t				dict_name_len = strlen(dict_name);
+
+	if (dict_name_len > UINT8_MAX) {
+		fr_strerror_printf("Dictionary name \"%s\" too long", dict_name);
+		return -1;
+	}
+
+	if (unlikely(!fr_dbuff_init_talloc(ctx, &dbuff, &tctx, 256, CACHE_SERIALIZE_BINARY_MAX))) return -1;
+
+	if ((fr_dbuff_in_bytes(&dbuff, CACHE_SERIALIZE_BINARY_MAGIC, CACHE_SERIALIZE_BINARY_VERSION,
+			       (uint8_t)dict_name_len) < 0) ||
+	    (fr_dbuff_in_memcpy(&dbuff, (uint8_t const *)dict_name, dict_name_len) < 0) ||
+	    (fr_dbuff_in(&dbuff, fr_unix_time_unwrap(c->created)) < 0) ||
+	    (fr_dbuff_in(&dbuff, fr_unix_time_unwrap(c->expires)) < 0)) {
+	too_big:
+		fr_strerror_const("Serialized entry too large");
+	error:
+		talloc_free(fr_dbuff_buff(&dbuff));
+		return -1;
+	}
+
+	while ((map = map_list_next(&c->maps, map))) {
+		fr_pair_list_t	list;
+		fr_dcursor_t	cursor;
+		fr_pair_t	*vp;
+		uint8_t		list_id;
+		ssize_t		slen;
+
+		if (!cache_map_binary_ok(&list_id, map, dict)) {
+			fr_strerror_printf("Map for \"%s\" can't be represented in binary format", map->lhs->name);
+			goto error;
+		}
+
+		if (fr_dbuff_in_bytes(&dbuff, (uint8_t)map->op, list_id) < 0) goto too_big;
+
+		MEM(vp = fr_pair_afrom_da(NULL, tmpl_attr_tail_da(map->lhs)));
+		if (unlikely(fr_value_box_copy(vp, &vp->data, tmpl_value(map->rhs)) < 0)) {
+			talloc_free(vp);
+			goto error;
+		}
+
+		fr_pair_list_init(&list);
+		fr_pair_append(&list, vp);
+		fr_pair_dcursor_init(&cursor, &list);
+
+		slen = fr_internal_encode_pair(&dbuff, &cursor, &encode_ctx);
+		fr_pair_list_free(&list);
+		if (slen < 0) goto error;
+	}
+
+	*out = fr_dbuff_buff(&dbuff);
+	*outlen = fr_dbuff_used(&dbuff);
+
+	return 0;
+}
+
+/** Converts a binary serialized cache entry back into a structure
+ *
+ * @param[in] c		Cache entry to populate (should already be allocated)
+ * @param[in] dict	to decode attributes in.
+ * @param[in] in	Binary representation of cache entry.
+ * @param[in] inlen	Length of the binary representation.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int cache_deserialize_binary(rlm_cache_entry_t *c, fr_dict_t const *dict, uint8_t const *in, size_t inlen)
+{
+	fr_dbuff_t	dbuff = FR_DBUFF_TMP(in, inlen);
+	TALLOC_CTX	*tmp_ctx;
+	tmpl_t		*lists[NUM_ELEMENTS(cache_serialize_lists)] = {};
+	uint8_t		magic, version, dict_name_len;
+	char		dict_name[UINT8_MAX + 1];
+	char const	*expected = fr_dict_root(dict)->name;
+	int64_t		created, expires;
+
+	if ((fr_dbuff_out(&magic, &dbuff) < 0) || (fr_dbuff_out(&version, &dbuff) < 0)) {
+	truncated:
+		fr_strerror_const("Serialized entry header truncated");
+		return -1;
+	}
+
+	if (magic != CACHE_SERIALIZE_BINARY_MAGIC) {
+		fr_strerror_const("Serialized entry has invalid magic");
+		return -1;
+	}
+
+	if (version != CACHE_SERIALIZE_BINARY_VERSION) {
+		fr_strerror_printf("Serialized entry has unsupported version %u", version);
+		return -1;
+	}
+
+	if ((fr_dbuff_out(&dict_name_len, &dbuff) < 0) ||
+	    (fr_dbuff_out_memcpy((uint8_t *)dict_name, &dbuff, dict_name_len) < 0) ||
+	    (fr_dbuff_out(&created, &dbuff) < 0) || (fr_dbuff_out(&expires, &dbuff) < 0)) goto truncated;
+	dict_name[dict_name_len] = '\0';
+
+	/*
+	 *	Attribute numbers mean nothing in another protocol.
+	 */
+	if (strcmp(dict_name, expected) != 0) {
+		fr_strerror_printf("Serialized entry is for dictionary \"%s\", expected \"%s\"",
+				   dict_name, expected);
+		return -1;
+	}
+
+	c->created = fr_unix_time_wrap(created);
+	c->expires = fr_unix_time_wrap(expires);
+
+	/*
+	 *	Holds the decoded pairs and the intermediary
+	 *	templates used to build the LHS of each map.
+	 */
+	MEM(tmp_ctx = talloc_new(NULL));
+
+	while (fr_dbuff_remaining(&dbuff) > 0) {
+		fr_pair_list_t	list;
+		fr_pair_t	*vp;
+		map_t		*map;
+		tmpl_t		*vpt;
+		uint8_t		op, list_id;
+		ssize_t		slen;
+
+		if ((fr_dbuff_out(&op, &dbuff) < 0) || (fr_dbuff_out(&list_id, &dbuff) < 0)) {
+			fr_strerror_const("Serialized map truncated");
+		error:
+			talloc_free(tmp_ctx);
+			return -1;
+		}
+
+		if (op >= T_TOKEN_LAST) {
+			fr_strerror_printf("Serialized map has invalid operator %u", op);
+			goto error;
+		}
+
+		if (list_id >= NUM_ELEMENTS(cache_serialize_lists)) {
+			fr_strerror_printf("Serialized map has invalid list %u", list_id);
+			goto error;
+		}
+
+		if (!lists[list_id]) {
+			MEM(lists[list_id] = tmpl_alloc(tmp_ctx, TMPL_TYPE_ATTR, T_BARE_WORD, NULL, 0));
+			tmpl_attr_set_da(lists[list_id], *cache_serialize_lists[list_id]);
+		}
+
+		fr_pair_list_init(&list);
+		slen = fr_internal_decode_pair_dbuff(tmp_ctx, &list, fr_dict_root(dict), &dbuff, NULL);
+		if (slen <= 0) {
+			fr_strerror_const_push("Failed decoding serialized pair");
+			goto error;
+		}
+
+		MEM(map = talloc_zero(c, map_t));
+		map->op = op;
+		map_list_init(&map->child);
+
+		/*
+		 *	The decoder produces the pair nested within its
+		 *	ancestors, walk down to the leaf, extending the
+		 *	LHS as we go.
+		 */
+		vpt = lists[list_id];
+		vp = fr_pair_list_head(&list);
+		for (;;) {
+			bool leaf = !fr_type_is_structural(vp->vp_type);
+
+			if (tmpl_attr_afrom_list(leaf ? (TALLOC_CTX *)map : tmp_ctx, &vpt, vpt, vp->da) < 0) {
+			map_error:
+				talloc_free(map);
+				goto error;
+			}
+			if (leaf) break;
+
+			if (fr_pair_list_num_elements(&vp->vp_group) != 1) {
+				fr_strerror_printf("Serialized pair \"%s\" must have exactly one child", vp->da->name);
+				goto map_error;
+			}
+			vp = fr_pair_list_head(&vp->vp_group);
+		}
+		map->lhs = vpt;
+
+		MEM(map->rhs = tmpl_alloc(map, TMPL_TYPE_DATA, T_BARE_WORD, NULL, 0));
+		if (unlikely(fr_value_box_copy(map->rhs, tmpl_value(map->rhs), &vp->data) < 0)) goto map_error;
+
+		fr_pair_list_free(&list);
+
+		MAP_VERIFY(map);
+
+		map_list_insert_tail(&c->maps, map);
+	}
+
+	talloc_free(tmp_ctx);
+
+	return 0;
+}
+
 /** Converts a serialized cache entry back into a structure
  *
  * @param[in] request	Current request
  * @param[in] c		Cache entry to populate (should already be allocated)
  * @param[in] dict	to use for unqualified attributes.
- * @param[in] in	String representation of cache entry.
- * @param[in] inlen	Length of string. May be < 0 in which case strlen will be
- *			used to calculate the length of the string.
+ * @param[in] in	Binary or string representation of cache entry.
+ * @param[in] inlen	Length of the representation. May be < 0 for string
+ *			representations, in which case strlen will be used to
+ *			calculate the length of the string.
  * @return
  *	- 0 on success.
  *	- -1 on failure.
@@ -105,6 +438,14 @@ int cache_deserialize(request_t *request, rlm_cache_entry_t *c, fr_dict_t const
 {
 	char		*p, *q;
 
+	/*
+	 *	The binary format starts with a byte that can't
+	 *	appear at the start of the text format.
+	 */
+	if ((inlen > 0) && ((uint8_t)in[0] == CACHE_SERIALIZE_BINARY_MAGIC)) {
+		return cache_deserialize_binary(c, dict, (uint8_t const *)in, (size_t)inlen);
+	}
+
 	if (inlen < 0) inlen = strlen(in);
 
 	p = in;
@@ -26,5 +26,22 @@
  */
 RCSIDH(serialize_h, "$Id$")
 
+/** First byte of a binary serialized entry
+ *
+ * Text serialized entries always start with an attribute name, so this can
+ * never be confused with the start of a text entry.
+ */
+#define CACHE_SERIALIZE_BINARY_MAGIC	0xca
+
+/** Version of the binary serialization format
+ *
+ * Must be incremented if the layout of binary serialized entries changes.
+ */
+#define CACHE_SERIALIZE_BINARY_VERSION	2
+
+#define CACHE_SERIALIZE_BINARY_MAX	(1024 * 1024)	//!< Largest binary serialized entry we'll produce.
+
+int cache_serialize_binary(TALLOC_CTX *ctx, uint8_t **out, size_t *outlen,
+			   rlm_cache_entry_t const *c, fr_dict_t const *dict);
 int cache_serialize(TALLOC_CTX *ctx, char **out, rlm_cache_entry_t const *c);
 int cache_deserialize(request_t *request, rlm_cache_entry_t *c, fr_dict_t const *dict, char *in, ssize_t inlen);
@@ -0,0 +1,196 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the binary cache entry serialization
+ *
+ * @file src/modules/rlm_cache/serialize_tests.c
+ * @copyright 2026 The FreeRADIUS server project
+ */
+
+static void test_init(void);
+#  define TEST_INIT  test_init()
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/dict_test.h>
+
+#include "serialize.c"
+
+static TALLOC_CTX	*autofree;
+static fr_dict_t	*test_dict;
+
+/** Global initialisation
+ */
+static void test_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("serialize_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) goto error;
+
+	if (fr_dict_test_init(autofree, &test_dict, NULL) < 0) goto error;
+
+	if (request_global_init() < 0) goto error;
+}
+
+static rlm_cache_entry_t *test_entry_alloc(void)
+{
+	rlm_cache_entry_t	*c;
+
+	MEM(c = talloc_zero(autofree, rlm_cache_entry_t));
+	map_list_init(&c->maps);
+
+	return c;
+}
+
+/** Add a map, parsed the same way as the text format, to a cache entry
+ *
+ */
+static void test_entry_add(rlm_cache_entry_t *c, char const *str)
+{
+	map_t		*map = NULL;
+	tmpl_rules_t	parse_rules = {
+				.attr = {
+					.dict_def = test_dict,
+					.list_def = request_attr_request,
+				},
+			};
+
+	TEST_CHECK_RET(map_afrom_attr_str(c, &map, str, &parse_rules, &parse_rules), 0);
+	TEST_CHECK_RET(tmpl_cast_in_place(map->rhs, tmpl_attr_tail_da(map->lhs)->type,
+					  tmpl_attr_tail_da(map->lhs)), 0);
+
+	map_list_insert_tail(&c->maps, map);
+}
+
+/** Print the maps of an entry, one per line
+ *
+ */
+static char *test_entry_print(rlm_cache_entry_t const *c)
+{
+	char		buff[1024];
+	fr_sbuff_t	sbuff = FR_SBUFF_OUT(buff, sizeof(buff));
+	map_t		*map = NULL;
+
+	while ((map = map_list_next(&c->maps, map))) {
+		TEST_CHECK(map_print(&sbuff, map) > 0);
+		TEST_CHECK(fr_sbuff_in_char(&sbuff, '\n') == 1);
+	}
+	fr_sbuff_terminate(&sbuff);
+
+	return talloc_strdup(autofree, buff);
+}
+
+static rlm_cache_entry_t *test_entry_example(void)
+{
+	rlm_cache_entry_t	*c = test_entry_alloc();
+
+	c->created = fr_unix_time_from_sec(1000);
+	c->expires = fr_unix_time_from_sec(2000);
+
+	test_entry_add(c, "reply.Test-String := 'hello'");
+	test_entry_add(c, "control.Test-Uint32 += 42");
+	test_entry_add(c, "Test-IPv4-Addr = 192.0.2.1");
+	test_entry_add(c, "session-state.Test-Nested-Top-TLV.Child-TLV.Leaf-Int32 := -7");
+
+	return c;
+}
+
+static void test_serialize_round_trip(void)
+{
+	rlm_cache_entry_t	*c = test_entry_example(), *out = test_entry_alloc();
+	uint8_t			*data;
+	size_t			data_len;
+
+	TEST_CASE("Serialize an entry");
+	TEST_CHECK_RET(cache_serialize_binary(autofree, &data, &data_len, c, test_dict), 0);
+	TEST_CHECK(data[0] == CACHE_SERIALIZE_BINARY_MAGIC);
+	TEST_CHECK(data[1] == CACHE_SERIALIZE_BINARY_VERSION);
+
+	TEST_CASE("Deserialize it again");
+	TEST_CHECK_RET(cache_deserialize(NULL, out, test_dict, (char *)data, data_len), 0);
+
+	TEST_CHECK(fr_unix_time_eq(out->created, c->created));
+	TEST_CHECK(fr_unix_time_eq(out->expires, c->expires));
+	TEST_CHECK(map_list_num_elements(&out->maps) == map_list_num_elements(&c->maps));
+	TEST_CHECK_STRCMP(test_entry_print(out), test_entry_print(c));
+
+	talloc_free(data);
+	talloc_free(out);
+	talloc_free(c);
+}
+
+static void test_serialize_reject(void)
+{
+	rlm_cache_entry_t	*c = test_entry_example(), *out = test_entry_alloc();
+	uint8_t			*data;
+	size_t			data_len;
+
+	TEST_CHECK_RET(cache_serialize_binary(autofree, &data, &data_len, c, test_dict), 0);
+
+	TEST_CASE("Entries for another dictionary are rejected");
+	TEST_CHECK(cache_deserialize(NULL, out, fr_dict_internal(), (char *)data, data_len) < 0);
+	TEST_CHECK(map_list_num_elements(&out->maps) == 0);
+
+	TEST_CASE("Entries with an unknown version are rejected");
+	data[1] = CACHE_SERIALIZE_BINARY_VERSION + 1;
+	TEST_CHECK(cache_deserialize(NULL, out, test_dict, (char *)data, data_len) < 0);
+	TEST_CHECK(map_list_num_elements(&out->maps) == 0);
+	data[1] = CACHE_SERIALIZE_BINARY_VERSION;
+
+	TEST_CASE("Entries with the wrong magic are rejected");
+	data[0] = (uint8_t)~CACHE_SERIALIZE_BINARY_MAGIC;
+	TEST_CHECK(cache_deserialize_binary(out, test_dict, data, data_len) < 0);
+	TEST_CHECK(map_list_num_elements(&out->maps) == 0);
+	data[0] = CACHE_SERIALIZE_BINARY_MAGIC;
+
+	TEST_CASE("Truncated headers are rejected");
+	TEST_CHECK(cache_deserialize(NULL, out, test_dict, (char *)data, 4) < 0);
+	TEST_CHECK(map_list_num_elements(&out->maps) == 0);
+
+	talloc_free(data);
+	talloc_free(out);
+	talloc_free(c);
+}
+
+static void test_serialize_unsupported(void)
+{
+	rlm_cache_entry_t	*c = test_entry_alloc();
+	uint8_t			*data = NULL;
+	size_t			data_len;
+
+	TEST_CASE("Maps using a request reference fall back to the text format");
+	test_entry_add(c, "parent.reply.Test-String := 'hello'");
+	TEST_CHECK(cache_serialize_binary(autofree, &data, &data_len, c, test_dict) < 0);
+	TEST_CHECK(data == NULL);
+
+	talloc_free(c);
+}
+
+TEST_LIST = {
+	{ "serialize_round_trip",	test_serialize_round_trip },
+	{ "serialize_reject",		test_serialize_reject },
+	{ "serialize_unsupported",	test_serialize_unsupported },
+
+	TEST_TERMINATOR
+};
@@ -0,0 +1,8 @@
+TARGET		:= serialize_tests$(E)
+SOURCES		:= serialize_tests.c
+
+TGT_LDLIBS	:= $(LIBS) $(GPERFTOOLS_LIBS)
+TGT_LDFLAGS	:= $(LDFLAGS) $(GPERFTOOLS_LDFLAGS)
+TGT_PREREQS	:= libfreeradius-util$(L) libfreeradius-server$(L) libfreeradius-unlang$(L) libfreeradius-internal$(L)
+
+TGT_INSTALLDIR	:=
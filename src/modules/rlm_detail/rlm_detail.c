@@ -57,11 +57,19 @@ typedef struct {
 
 	bool		escape;		//!< do filename escaping, yes / no
 
+	bool		fsync;		//!< fsync after writing.
+
+	exfile_buffer_conf_t buffer;	//!< How much to buffer, and for how long.
+
 	exfile_t    	*ef;		//!< Log file handler
 
 	bool		triggers;	//!< Do we run triggers.
 } rlm_detail_t;
 
+typedef struct {
+	exfile_buffer_t	*eb;		//!< Buffered writes for this thread, if buffering is enabled.
+} rlm_detail_thread_t;
+
 typedef struct {
 	fr_value_box_t	filename;	//!< File / path to write to.
 	tmpl_t		*filename_tmpl;	//!< tmpl used to expand filename (for debug output)
@@ -79,6 +87,8 @@ static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET("locking", rlm_detail_t, locking), .dflt = "no" },
 	{ FR_CONF_OFFSET("escape_filenames", rlm_detail_t, escape), .dflt = "no" },
 	{ FR_CONF_OFFSET("log_packet_header", rlm_detail_t, log_srcdst), .dflt = "no" },
+	{ FR_CONF_OFFSET("fsync", rlm_detail_t, fsync), .dflt = "no" },
+	{ FR_CONF_OFFSET_SUBSECTION("buffer", 0, rlm_detail_t, buffer, exfile_buffer_config) },
 	{ FR_CONF_OFFSET("triggers", rlm_detail_t, triggers) },
 	CONF_PARSER_TERMINATOR
 };
@@ -170,6 +180,35 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	return 0;
 }
 
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_detail_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_detail_t);
+	rlm_detail_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_detail_thread_t);
+
+	if (!inst->buffer.size) return 0;
+
+	t->eb = exfile_buffer_alloc(t, inst->ef, mctx->el, &inst->buffer, inst->perm,
+				    inst->group_is_set ? inst->group : (gid_t) -1, inst->fsync);
+	if (!t->eb) {
+		ERROR("Failed allocating write buffer");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_detail_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_detail_thread_t);
+
+	/*
+	 *	Write anything still buffered.
+	 */
+	TALLOC_FREE(t->eb);
+
+	return 0;
+}
+
 /*
  *	Wrapper for VPs allocated on the stack.
  */
@@ -305,6 +344,85 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, request_t *request,
 	return 0;
 }
 
+/** Collects a detail entry in memory, so it can be buffered
+ *
+ */
+static ssize_t _detail_entry_write(void *cookie, char const *buf, size_t size)
+{
+	uint8_t		**entry = cookie;
+	size_t		used = talloc_array_length(*entry);
+
+	MEM(*entry = talloc_realloc(NULL, *entry, uint8_t, used + size));
+	memcpy(*entry + used, buf, size);
+
+	return size;
+}
+
+static unlang_action_t CC_HINT(nonnull) detail_buffered_resume(unlang_result_t *p_result, module_ctx_t const *mctx,
+							       request_t *request)
+{
+	exfile_buffer_wait_t	*wait = talloc_get_type_abort(mctx->rctx, exfile_buffer_wait_t);
+
+	if (exfile_buffer_wait_result(wait) < 0) {
+		RERROR("Failed writing to detail file");
+		RETURN_UNLANG_FAIL;
+	}
+
+	RETURN_UNLANG_OK;
+}
+
+/** Write a detail entry to the thread's buffer
+ *
+ * The request yields until the buffer has been written out.
+ */
+static unlang_action_t CC_HINT(nonnull) detail_do_buffered(unlang_result_t *p_result, rlm_detail_t const *inst,
+							   rlm_detail_thread_t *t, rlm_detail_env_t *env,
+							   request_t *request, fr_packet_t *packet, fr_pair_list_t *list)
+{
+	FILE			*outfp;
+	uint8_t			*entry;
+	exfile_buffer_wait_t	*wait;
+	int			ret;
+
+	MEM(entry = talloc_array(request, uint8_t, 0));
+
+	outfp = fopencookie(&entry, "w", (cookie_io_functions_t){ .write = _detail_entry_write });
+	if (!outfp) {
+		RERROR("Failed opening detail buffer: %s", fr_syserror(errno));
+		talloc_free(entry);
+		RETURN_UNLANG_FAIL;
+	}
+
+	ret = detail_write(outfp, inst, request, &env->header, packet, list, env->ht);
+	fclose(outfp);
+	if (ret < 0) {
+		talloc_free(entry);
+		RETURN_UNLANG_FAIL;
+	}
+
+	if (talloc_array_length(entry) == 0) {
+		talloc_free(entry);
+		RETURN_UNLANG_OK;
+	}
+
+	ret = exfile_buffer_write(unlang_interpret_frame_talloc_ctx(request), &wait, t->eb, request,
+				  env->filename.vb_strvalue, NULL, 0,
+				  &(struct iovec){ .iov_base = entry, .iov_len = talloc_array_length(entry) }, 1);
+	talloc_free(entry);
+
+	switch (ret) {
+	case 1:
+		return unlang_module_yield(request, detail_buffered_resume, NULL, 0, wait);
+
+	case 0:
+		RETURN_UNLANG_OK;
+
+	default:
+		RPERROR("Failed writing to detail file %pV", &env->filename);
+		RETURN_UNLANG_FAIL;
+	}
+}
+
 /*
  *	Do detail, compatible with old accounting
  */
@@ -312,6 +430,7 @@ static unlang_action_t CC_HINT(nonnull) detail_do(unlang_result_t *p_result, mod
 						  fr_packet_t *packet, fr_pair_list_t *list)
 {
 	rlm_detail_env_t	*env = talloc_get_type_abort(mctx->env_data, rlm_detail_env_t);
+	rlm_detail_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_detail_thread_t);
 	int			outfd, dupfd;
 	FILE			*outfp = NULL;
 
@@ -319,6 +438,8 @@ static unlang_action_t CC_HINT(nonnull) detail_do(unlang_result_t *p_result, mod
 
 	RDEBUG2("%s expands to %pV", env->filename_tmpl->name, &env->filename);
 
+	if (t->eb) return detail_do_buffered(p_result, inst, t, env, request, packet, list);
+
 	outfd = exfile_open(inst->ef, env->filename.vb_strvalue, inst->perm, NULL);
 	if (outfd < 0) {
 		RPERROR("Couldn't open file %pV", &env->filename);
@@ -356,6 +477,14 @@ static unlang_action_t CC_HINT(nonnull) detail_do(unlang_result_t *p_result, mod
 	/*
 	 *	Flush everything
 	 */
+	if (fflush(outfp) != 0) {
+		RERROR("Failed writing to detail file: %s", fr_syserror(errno));
+		goto fail;
+	}
+	if (inst->fsync && (fsync(outfd) < 0)) {
+		RERROR("Failed syncing detail file to persistent storage: %s", fr_syserror(errno));
+		goto fail;
+	}
 	fclose(outfp);
 	exfile_close(inst->ef, outfd);
 
@@ -497,7 +626,11 @@ module_rlm_t rlm_detail = {
 		.name		= "detail",
 		.inst_size	= sizeof(rlm_detail_t),
 		.config		= module_config,
-		.instantiate	= mod_instantiate
+		.instantiate	= mod_instantiate,
+
+		.thread_inst_size	= sizeof(rlm_detail_thread_t),
+		.thread_instantiate	= mod_thread_instantiate,
+		.thread_detach		= mod_thread_detach
 	},
 	.method_group = {
 		.bindings = (module_method_binding_t[]){
@@ -400,6 +400,16 @@ static int getrecv_filename(TALLOC_CTX *ctx, rlm_files_t const *inst, fr_htrie_t
 		fr_dlist_insert_tail(&user_list->head, entry);
 	}
 
+	/*
+	 *	The entries don't change after they're loaded, so make
+	 *	longest prefix lookups on IP keys cheaper.
+	 */
+	if ((tree->type == FR_HTRIE_TRIE) && (fr_trie_freeze(tree->store) < 0)) {
+		PERROR("Failed freezing entries from %s", inst->filename);
+		talloc_free(tree);
+		return -1;
+	}
+
 	*ptree = tree;
 
 	return 0;
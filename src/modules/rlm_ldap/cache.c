@@ -0,0 +1,345 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file cache.c
+ * @brief LDAP module lookup cache.
+ *
+ * Caches the results of resolving user objects (user filter -> DN) and of
+ * resolving group DNs to group names, so they don't require a round trip
+ * to the directory for every request.
+ *
+ * The cache is shared between all worker threads of a module instance.
+ *
+ * @copyright 2026 The FreeRADIUS Server Project.
+ */
+RCSID("$Id$")
+
+USES_APPLE_DEPRECATED_API
+
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/heap.h>
+
+#define LOG_PREFIX "rlm_ldap cache"
+
+#include "rlm_ldap.h"
+
+/** Type of cached lookup
+ */
+typedef enum {
+	LDAP_CACHE_TYPE_USER = 0,				//!< User filter to user DN.
+	LDAP_CACHE_TYPE_GROUP					//!< Group DN to group name.
+} rlm_ldap_cache_type_t;
+
+/** Mutable cache data shared between all threads
+ */
+struct rlm_ldap_cache_s {
+	fr_rb_tree_t		*tree;				//!< Entries, keyed by type and key.
+	fr_heap_t		*heap;				//!< Entries, ordered by expiry.
+	pthread_mutex_t		mutex;				//!< Protects the tree and heap.
+};
+
+/** A cached lookup result
+ */
+typedef struct {
+	fr_rb_node_t		node;				//!< Entry in the lookup tree.
+	fr_heap_index_t		heap_id;			//!< Entry in the expiry heap.
+	rlm_ldap_cache_type_t	type;				//!< What kind of lookup this is.
+	char			*key;				//!< Base DN and filter, or group DN.
+	char			*value;				//!< User DN or group name.  NULL if the
+								///< lookup found nothing.
+	fr_time_t		expires;			//!< When the entry expires.
+} rlm_ldap_cache_entry_t;
+
+static int8_t cache_entry_cmp(void const *one, void const *two)
+{
+	rlm_ldap_cache_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = CMP(a->type, b->type);
+	if (ret != 0) return ret;
+
+	return CMP(strcmp(a->key, b->key), 0);
+}
+
+static int8_t cache_heap_cmp(void const *one, void const *two)
+{
+	rlm_ldap_cache_entry_t const *a = one, *b = two;
+
+	return fr_time_cmp(a->expires, b->expires);
+}
+
+/** Remove an entry from the tree and heap, and free it
+ *
+ * Must be called with the mutex held.
+ */
+static void cache_entry_delete(rlm_ldap_cache_t *cache, rlm_ldap_cache_entry_t *c)
+{
+	fr_heap_extract(&cache->heap, c);
+	fr_rb_delete(cache->tree, c);
+	talloc_free(c);
+}
+
+/** Remove expired entries
+ *
+ * Must be called with the mutex held.
+ */
+static void cache_expire(rlm_ldap_cache_t *cache, fr_time_t now)
+{
+	rlm_ldap_cache_entry_t	*c;
+
+	while ((c = fr_heap_peek(cache->heap)) && fr_time_lteq(c->expires, now)) cache_entry_delete(cache, c);
+}
+
+/** Look up an entry, copying its value into ctx
+ *
+ */
+static rlm_ldap_cache_status_t cache_find(TALLOC_CTX *ctx, char **out, rlm_ldap_t const *inst,
+					  rlm_ldap_cache_type_t type, char const *key)
+{
+	rlm_ldap_cache_t	*cache = inst->cache.mutable;
+	rlm_ldap_cache_entry_t	*c;
+	rlm_ldap_cache_status_t	ret = LDAP_CACHE_MISS;
+
+	*out = NULL;
+
+	pthread_mutex_lock(&cache->mutex);
+	cache_expire(cache, fr_time());
+
+	c = fr_rb_find(cache->tree, &(rlm_ldap_cache_entry_t){ .type = type, .key = UNCONST(char *, key) });
+	if (c) {
+		if (c->value) {
+			MEM(*out = talloc_typed_strdup(ctx, c->value));
+			ret = LDAP_CACHE_FOUND;
+		} else {
+			ret = LDAP_CACHE_NOTFOUND;
+		}
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	return ret;
+}
+
+/** Add or replace an entry
+ *
+ * If the cache is full, the entry closest to expiry is evicted.
+ */
+static void cache_add(rlm_ldap_t const *inst, rlm_ldap_cache_type_t type, char const *key,
+		      char const *value, size_t value_len, fr_time_delta_t lifetime)
+{
+	rlm_ldap_cache_t	*cache = inst->cache.mutable;
+	rlm_ldap_cache_entry_t	*c, *old;
+	fr_time_t		now = fr_time();
+
+	MEM(c = talloc_zero(NULL, rlm_ldap_cache_entry_t));
+	c->type = type;
+	MEM(c->key = talloc_typed_strdup(c, key));
+	if (value) MEM(c->value = talloc_bstrndup(c, value, value_len));
+	c->expires = fr_time_add(now, lifetime);
+
+	pthread_mutex_lock(&cache->mutex);
+	cache_expire(cache, now);
+
+	old = fr_rb_find(cache->tree, c);
+	if (old) {
+		cache_entry_delete(cache, old);
+	} else if (inst->cache.max_entries && (fr_rb_num_elements(cache->tree) >= inst->cache.max_entries)) {
+		cache_entry_delete(cache, fr_heap_peek(cache->heap));
+	}
+
+	if (!fr_rb_insert(cache->tree, c)) {
+		talloc_free(c);
+	} else if (fr_heap_insert(&cache->heap, c) < 0) {
+		fr_rb_delete(cache->tree, c);
+		talloc_free(c);
+	}
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/** Build the key for a user lookup
+ */
+static inline char *cache_user_key(TALLOC_CTX *ctx, char const *base_dn, char const *filter)
+{
+	return talloc_typed_asprintf(ctx, "%s\n%s", base_dn, filter ? filter : "");
+}
+
+/** Find the DN of a user object in the cache
+ *
+ * @param[in] ctx	to allocate the DN in.
+ * @param[out] dn	the cached user DN.  NULL if the user is not cached
+ *			or is cached as not existing.
+ * @param[in] inst	rlm_ldap configuration.
+ * @param[in] base_dn	the user search was performed in.
+ * @param[in] filter	the user search used.  May be NULL.
+ * @return
+ *	- LDAP_CACHE_FOUND if the user DN was cached.
+ *	- LDAP_CACHE_NOTFOUND if the search is cached as finding no user.
+ *	- LDAP_CACHE_MISS if the search has not been cached.
+ */
+rlm_ldap_cache_status_t rlm_ldap_cache_user_find(TALLOC_CTX *ctx, char **dn, rlm_ldap_t const *inst,
+						 char const *base_dn, char const *filter)
+{
+	rlm_ldap_cache_status_t	ret;
+	char			*key;
+
+	*dn = NULL;
+	if (!inst->cache.mutable) return LDAP_CACHE_MISS;
+
+	key = cache_user_key(NULL, base_dn, filter);
+	ret = cache_find(ctx, dn, inst, LDAP_CACHE_TYPE_USER, key);
+	talloc_free(key);
+
+	return ret;
+}
+
+/** Record the result of a user search
+ *
+ * @param[in] inst	rlm_ldap configuration.
+ * @param[in] base_dn	the user search was performed in.
+ * @param[in] filter	the user search used.  May be NULL.
+ * @param[in] dn	the search resolved to, or NULL if no user was found.
+ */
+void rlm_ldap_cache_user_add(rlm_ldap_t const *inst, char const *base_dn, char const *filter, char const *dn)
+{
+	fr_time_delta_t	lifetime = dn ? inst->cache.user_lifetime : inst->cache.negative_lifetime;
+	char		*key;
+
+	if (!inst->cache.mutable || !fr_time_delta_ispos(lifetime)) return;
+
+	key = cache_user_key(NULL, base_dn, filter);
+	cache_add(inst, LDAP_CACHE_TYPE_USER, key, dn, dn ? strlen(dn) : 0, lifetime);
+	talloc_free(key);
+}
+
+/** Find the name of a group in the cache
+ *
+ * @param[in] ctx	to allocate the name in.
+ * @param[out] name	the cached group name.
+ * @param[in] inst	rlm_ldap configuration.
+ * @param[in] dn	normalised DN of the group.
+ * @return
+ *	- LDAP_CACHE_FOUND if the group name was cached.
+ *	- LDAP_CACHE_MISS if the group has not been cached.
+ */
+rlm_ldap_cache_status_t rlm_ldap_cache_group_find(TALLOC_CTX *ctx, char **name, rlm_ldap_t const *inst, char const *dn)
+{
+	*name = NULL;
+	if (!inst->cache.mutable || !fr_time_delta_ispos(inst->cache.group_lifetime)) return LDAP_CACHE_MISS;
+
+	return cache_find(ctx, name, inst, LDAP_CACHE_TYPE_GROUP, dn);
+}
+
+/** Record the name a group DN resolved to
+ *
+ * @param[in] inst	rlm_ldap configuration.
+ * @param[in] dn	normalised DN of the group.
+ * @param[in] name	of the group.
+ * @param[in] name_len	length of the name.
+ */
+void rlm_ldap_cache_group_add(rlm_ldap_t const *inst, char const *dn, char const *name, size_t name_len)
+{
+	if (!inst->cache.mutable || !fr_time_delta_ispos(inst->cache.group_lifetime)) return;
+
+	cache_add(inst, LDAP_CACHE_TYPE_GROUP, dn, name, name_len, inst->cache.group_lifetime);
+}
+
+/** Remove cached lookups affected by a change to a directory object
+ *
+ * Removes the group entry for the DN, any user searches which resolved to
+ * the DN, and all negative user entries, as the changed object may now
+ * match a search which previously found nothing.
+ *
+ * If dn is NULL, the whole cache is flushed.
+ *
+ * @param[in] inst	rlm_ldap configuration.
+ * @param[in] dn	normalised DN of the object which changed.  May be NULL.
+ * @return The number of entries removed.
+ */
+int rlm_ldap_cache_invalidate(rlm_ldap_t const *inst, char const *dn)
+{
+	rlm_ldap_cache_t	*cache = inst->cache.mutable;
+	rlm_ldap_cache_entry_t	*c;
+	fr_rb_iter_inorder_t	iter;
+	int			count = 0;
+
+	if (!cache) return 0;
+
+	pthread_mutex_lock(&cache->mutex);
+	for (c = fr_rb_iter_init_inorder(&iter, cache->tree);
+	     c;
+	     c = fr_rb_iter_next_inorder(&iter)) {
+		if (dn) switch (c->type) {
+		case LDAP_CACHE_TYPE_USER:
+			if (c->value && (strcmp(c->value, dn) != 0)) continue;
+			break;
+
+		case LDAP_CACHE_TYPE_GROUP:
+			if (strcmp(c->key, dn) != 0) continue;
+			break;
+		}
+
+		fr_rb_iter_delete_inorder(&iter);
+		fr_heap_extract(&cache->heap, c);
+		talloc_free(c);
+		count++;
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	return count;
+}
+
+static int _cache_free(rlm_ldap_cache_t *cache)
+{
+	rlm_ldap_cache_entry_t	*c;
+
+	while ((c = fr_heap_pop(&cache->heap))) {
+		fr_rb_delete(cache->tree, c);
+		talloc_free(c);
+	}
+	pthread_mutex_destroy(&cache->mutex);
+
+	return 0;
+}
+
+/** Allocate the shared lookup cache
+ *
+ * @return
+ *	- The new cache.
+ *	- NULL on error.
+ */
+rlm_ldap_cache_t *rlm_ldap_cache_alloc(void)
+{
+	rlm_ldap_cache_t	*cache;
+
+	MEM(cache = talloc_zero(NULL, rlm_ldap_cache_t));
+
+	cache->tree = fr_rb_inline_talloc_alloc(cache, rlm_ldap_cache_entry_t, node, cache_entry_cmp, NULL);
+	if (!cache->tree) {
+	error:
+		ERROR("Failed creating lookup cache");
+		talloc_free(cache);
+		return NULL;
+	}
+
+	cache->heap = fr_heap_talloc_alloc(cache, cache_heap_cmp, rlm_ldap_cache_entry_t, heap_id, 0);
+	if (!cache->heap) goto error;
+
+	pthread_mutex_init(&cache->mutex, NULL);
+	talloc_set_destructor(cache, _cache_free);
+
+	return cache;
+}
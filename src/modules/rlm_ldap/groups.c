@@ -84,6 +84,44 @@ typedef struct {
 	bool				resolving_value;	//!< Is the current query resolving a DN from values.
 } ldap_group_userobj_dyn_ctx_t;
 
+/** Look up the name of a group DN in the lookup cache
+ *
+ * @param[in] ctx	to allocate the name in.
+ * @param[in] inst	Module instance.
+ * @param[in] dn	of the group.
+ * @return
+ *	- The group name.
+ *	- NULL if the DN has not been cached.
+ */
+static char *ldap_group_dn2name_cached(TALLOC_CTX *ctx, rlm_ldap_t const *inst, char const *dn)
+{
+	char	*norm, *name;
+
+	if (!inst->cache.mutable) return NULL;
+
+	MEM(norm = talloc_array(NULL, char, strlen(dn) + 1));
+	fr_ldap_util_normalise_dn(norm, dn);
+	rlm_ldap_cache_group_find(ctx, &name, inst, norm);
+	talloc_free(norm);
+
+	return name;
+}
+
+/** Add the name a group DN resolved to, to the lookup cache
+ *
+ */
+static void ldap_group_dn2name_cache_add(rlm_ldap_t const *inst, char const *dn, struct berval const *name)
+{
+	char	*norm;
+
+	if (!inst->cache.mutable) return;
+
+	MEM(norm = talloc_array(NULL, char, strlen(dn) + 1));
+	fr_ldap_util_normalise_dn(norm, dn);
+	rlm_ldap_cache_group_add(inst, norm, name->bv_val, name->bv_len);
+	talloc_free(norm);
+}
+
 /** Cancel a pending group lookup query
  *
  */
@@ -316,6 +354,7 @@ static unlang_action_t ldap_group_dn2name_resume(unlang_result_t *p_result, requ
 	fr_pair_value_bstrndup(vp, values[0]->bv_val, values[0]->bv_len, true);
 	fr_pair_append(&group_ctx->groups, vp);
 	RDEBUG2("Group DN \"%s\" resolves to name \"%pV\"", *group_ctx->dn, &vp->data);
+	ldap_group_dn2name_cache_add(inst, *group_ctx->dn, values[0]);
 
 finish:
 	/*
@@ -528,11 +567,24 @@ unlang_action_t rlm_ldap_cacheable_userobj(unlang_result_t *p_result, request_t
 			 *	this to a name.  Store group DNs which need resolving to names.
 			 */
 			} else {
+				char	*dn = fr_ldap_berval_to_string(group_ctx, values[i]);
+				char	*name = ldap_group_dn2name_cached(group_ctx, inst, dn);
+
+				if (name) {
+					RDEBUG2("Group DN \"%s\" resolves to name \"%s\" (cached)", dn, name);
+					MEM(vp = fr_pair_afrom_da(group_ctx->list_ctx, inst->group.cache_da));
+					fr_pair_value_bstrndup(vp, name, talloc_array_length(name) - 1, true);
+					fr_pair_append(&group_ctx->groups, vp);
+					talloc_free(name);
+					talloc_free(dn);
+					continue;
+				}
+
 				if (++dn2name > LDAP_MAX_CACHEABLE) {
 					REDEBUG("Too many groups require DN to name resolution");
 					goto invalid;
 				}
-				*dn_p++ = fr_ldap_berval_to_string(group_ctx, values[i]);
+				*dn_p++ = dn;
 			}
 		}
 	}
@@ -989,6 +1041,7 @@ static unlang_action_t ldap_check_userobj_resume(unlang_result_t *p_result, requ
 		MEM(buff = talloc_bstrndup(group_ctx, values[0]->bv_val, values[0]->bv_len));
 		RDEBUG2("Group DN \"%pV\" resolves to name \"%pV\"", fr_box_strvalue_buffer(group_ctx->lookup_dn),
 			fr_box_strvalue_len(values[0]->bv_val, values[0]->bv_len));
+		ldap_group_dn2name_cache_add(inst, group_ctx->lookup_dn, values[0]);
 		ldap_value_free_len(values);
 
 		if (group_ctx->resolving_value) {
@@ -1066,6 +1119,10 @@ static unlang_action_t ldap_check_userobj_resume(unlang_result_t *p_result, requ
 			 *	So we only do the DN -> name lookup once, regardless of how many
 			 *	group values we have to check, the resolved name is put in group_ctx->group_name
 			 */
+			if (!group_ctx->group_name) {
+				group_ctx->group_name = ldap_group_dn2name_cached(group_ctx, inst, group->vb_strvalue);
+			}
+
 			if (!group_ctx->group_name) {
 				group_ctx->lookup_dn = group->vb_strvalue;
 
@@ -1100,6 +1157,12 @@ static unlang_action_t ldap_check_userobj_resume(unlang_result_t *p_result, requ
 			group_ctx->lookup_dn = fr_ldap_berval_to_string(group_ctx, value);
 			group_ctx->resolving_value = true;
 
+			/*
+			 *	Compare against the cached name on the next pass of the loop
+			 */
+			value_name = ldap_group_dn2name_cached(group_ctx, inst, group_ctx->lookup_dn);
+			if (value_name) continue;
+
 			if (unlang_function_repeat_set(request, ldap_check_userobj_resume) < 0) RETURN_UNLANG_FAIL;
 
 			/* Need to push this for the custom cancellation function */
@@ -143,6 +143,17 @@ static conf_parser_t group_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+/*
+ *	Lookup cache configuration
+ */
+static conf_parser_t cache_config[] = {
+	{ FR_CONF_OFFSET("user_lifetime", rlm_ldap_t, cache.user_lifetime), .dflt = "0" },
+	{ FR_CONF_OFFSET("negative_lifetime", rlm_ldap_t, cache.negative_lifetime), .dflt = "0" },
+	{ FR_CONF_OFFSET("group_lifetime", rlm_ldap_t, cache.group_lifetime), .dflt = "0" },
+	{ FR_CONF_OFFSET("max_entries", rlm_ldap_t, cache.max_entries), .dflt = "16384" },
+	CONF_PARSER_TERMINATOR
+};
+
 static const conf_parser_t module_config[] = {
 	/*
 	 *	Pool config items
@@ -177,6 +188,8 @@ static const conf_parser_t module_config[] = {
 
 	{ FR_CONF_POINTER("profile", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) profile_config },
 
+	{ FR_CONF_POINTER("cache", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) cache_config },
+
 	{ FR_CONF_OFFSET_SUBSECTION("pool", 0, rlm_ldap_t, trunk_conf, trunk_config ) },
 
 	{ FR_CONF_OFFSET_SUBSECTION("bind_pool", 0, rlm_ldap_t, bind_trunk_conf, trunk_config ) },
@@ -953,7 +966,7 @@ static unlang_action_t ldap_group_xlat_user_find(UNUSED unlang_result_t *p_resul
 					/* discard, this function is only used by xlats */NULL,
 					xlat_ctx->inst, request,
 					xlat_ctx->basedn, xlat_ctx->filter,
-					xlat_ctx->ttrunk, xlat_ctx->attrs, &xlat_ctx->query);
+					xlat_ctx->ttrunk, xlat_ctx->attrs, false, &xlat_ctx->query);
 }
 
 /** Cancel an in-progress query for the LDAP group membership xlat
@@ -1043,6 +1056,58 @@ static xlat_action_t ldap_group_xlat_resume(TALLOC_CTX *ctx, fr_dcursor_t *out,
 	return XLAT_ACTION_DONE;
 }
 
+static xlat_arg_parser_t const ldap_cache_invalidate_xlat_arg[] = {
+	{ .concat = true, .type = FR_TYPE_STRING },
+	XLAT_ARG_PARSER_TERMINATOR
+};
+
+/** Remove entries from the lookup cache
+ *
+ * Removes cached user DNs which resolved to the given DN, the cached group
+ * name for the DN, and all negative user entries (as the change may have
+ * created a matching object).  With no argument the whole cache is flushed.
+ *
+ * Intended to be called from the `recv` sections of an `ldap_sync` virtual server.
+ *
+ * Example:
+@verbatim
+%ldap.cache.invalidate(%{LDAP-Sync.Entry-DN})
+@endverbatim
+ *
+ * @ingroup xlat_functions
+ */
+static xlat_action_t ldap_cache_invalidate_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out, xlat_ctx_t const *xctx,
+						request_t *request, fr_value_box_list_t *in)
+{
+	rlm_ldap_t const	*inst = talloc_get_type_abort_const(xctx->mctx->mi->data, rlm_ldap_t);
+	fr_value_box_t		*dn_vb = fr_value_box_list_head(in);
+	fr_value_box_t		*vb;
+	char			*dn = NULL;
+	int			count;
+
+	if (!inst->cache.mutable) {
+		RWDEBUG("Lookup cache is disabled");
+		count = 0;
+		goto done;
+	}
+
+	if (dn_vb && (dn_vb->vb_length > 0)) {
+		MEM(dn = talloc_bstrndup(NULL, dn_vb->vb_strvalue, dn_vb->vb_length));
+		fr_ldap_util_normalise_dn(dn, dn);
+	}
+
+	count = rlm_ldap_cache_invalidate(inst, dn);
+	RDEBUG2("Removed %i entries from the lookup cache", count);
+	talloc_free(dn);
+
+done:
+	MEM(vb = fr_value_box_alloc(ctx, FR_TYPE_UINT32, NULL));
+	vb->vb_uint32 = (uint32_t)count;
+	fr_dcursor_append(out, vb);
+
+	return XLAT_ACTION_DONE;
+}
+
 static xlat_arg_parser_t const ldap_group_xlat_arg[] = {
 	{ .required = true, .concat = true, .type = FR_TYPE_STRING, .safe_for = LDAP_URI_SAFE_FOR },
 	XLAT_ARG_PARSER_TERMINATOR
@@ -2003,7 +2068,7 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(unlang_result_t *p_result,
 	return rlm_ldap_find_user_async(autz_ctx, p_result,
 					autz_ctx->inst, request, &autz_ctx->call_env->user_base,
 					&autz_ctx->call_env->user_filter, autz_ctx->ttrunk, autz_ctx->expanded.attrs,
-					&autz_ctx->query);
+					true, &autz_ctx->query);
 }
 
 /** Cancel an in progress user modification.
@@ -2278,7 +2343,7 @@ static unlang_action_t CC_HINT(nonnull) mod_modify(unlang_result_t *p_result, mo
 					     usermod_ctx->inst, request,
 					     &usermod_ctx->call_env->user_base,
 					     &usermod_ctx->call_env->user_filter,
-					     usermod_ctx->ttrunk, NULL, NULL) == UNLANG_ACTION_FAIL) {
+					     usermod_ctx->ttrunk, NULL, false, NULL) == UNLANG_ACTION_FAIL) {
 			RETURN_UNLANG_FAIL;
 		}
 
@@ -2303,6 +2368,8 @@ static int mod_detach(module_detach_ctx_t const *mctx)
 	if (inst->user.obj_sort_ctrl) ldap_control_free(inst->user.obj_sort_ctrl);
 	if (inst->profile.obj_sort_ctrl) ldap_control_free(inst->profile.obj_sort_ctrl);
 
+	TALLOC_FREE(inst->cache.mutable);
+
 	return 0;
 }
 
@@ -2576,6 +2643,18 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	inst->group.da = boot->group_da;
 	inst->group.cache_da = boot->cache_da;
 
+	/*
+	 *	Lookup cache is shared between all threads
+	 */
+	if (fr_time_delta_ispos(inst->cache.user_lifetime) || fr_time_delta_ispos(inst->cache.negative_lifetime) ||
+	    fr_time_delta_ispos(inst->cache.group_lifetime)) {
+		inst->cache.mutable = rlm_ldap_cache_alloc();
+		if (!inst->cache.mutable) {
+			cf_log_err(conf, "Failed allocating lookup cache");
+			return -1;
+		}
+	}
+
 	inst->handle_config.name = talloc_typed_asprintf(inst, "rlm_ldap (%s)", mctx->mi->name);
 
 	/*
@@ -2863,6 +2942,10 @@ static int mod_bootstrap(module_inst_ctx_t const *mctx)
 	xlat_func_args_set(xlat, ldap_xlat_arg);
 	xlat_func_call_env_set(xlat, &xlat_profile_method_env);
 
+	if (unlikely(!(xlat = module_rlm_xlat_register(mctx->mi->boot, mctx, "cache.invalidate", ldap_cache_invalidate_xlat,
+							FR_TYPE_UINT32)))) return -1;
+	xlat_func_args_set(xlat, ldap_cache_invalidate_xlat_arg);
+
 	map_proc_register(mctx->mi->boot, inst, mctx->mi->name, mod_map_proc, ldap_map_verify, 0, LDAP_URI_SAFE_FOR);
 
 	return 0;
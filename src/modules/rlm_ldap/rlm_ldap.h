@@ -17,6 +17,10 @@
 #include <freeradius-devel/server/module_rlm.h>
 #include <freeradius-devel/ldap/base.h>
 
+/** Mutable lookup cache, shared between threads
+ */
+typedef struct rlm_ldap_cache_s rlm_ldap_cache_t;
+
 typedef struct {
 	/*
 	 *	Options
@@ -112,6 +116,18 @@ typedef struct {
 		bool		fallthrough_def;		//!< Should profile processing fall through by default.
 	} profile;
 
+	/*
+	 *	Lookup cache
+	 */
+	struct {
+		fr_time_delta_t	user_lifetime;			//!< How long to cache user DNs for.
+		fr_time_delta_t	negative_lifetime;		//!< How long to cache user searches which found nothing.
+		fr_time_delta_t	group_lifetime;			//!< How long to cache group DN to name resolutions.
+		uint32_t	max_entries;			//!< Maximum number of cached lookups.
+
+		rlm_ldap_cache_t *mutable;			//!< Cached lookups.  NULL if caching is disabled.
+	} cache;
+
 #ifdef WITH_EDIR
 	/*
 	 *	eDir support
@@ -264,12 +280,34 @@ unlang_action_t rlm_ldap_find_user_async(TALLOC_CTX *ctx,
 					 rlm_ldap_t const *inst, request_t *request,
 					 fr_value_box_t *base, fr_value_box_t *filter_box,
 					 fr_ldap_thread_trunk_t *ttrunk, char const *attrs[],
-					 fr_ldap_query_t **query_out);
+					 bool need_entry, fr_ldap_query_t **query_out);
 
 ldap_access_state_t rlm_ldap_check_access(rlm_ldap_t const *inst, request_t *request, LDAPMessage *entry);
 
 void rlm_ldap_check_reply(request_t *request, rlm_ldap_t const *inst, char const *inst_name, bool expect_password, fr_ldap_thread_trunk_t const *ttrunk);
 
+/*
+ *	cache.c - Lookup cache functions.
+ */
+typedef enum {
+	LDAP_CACHE_MISS = 0,				//!< Lookup is not cached.
+	LDAP_CACHE_FOUND,				//!< Lookup is cached with a result.
+	LDAP_CACHE_NOTFOUND				//!< Lookup is cached as finding nothing.
+} rlm_ldap_cache_status_t;
+
+rlm_ldap_cache_t *rlm_ldap_cache_alloc(void);
+
+rlm_ldap_cache_status_t rlm_ldap_cache_user_find(TALLOC_CTX *ctx, char **dn, rlm_ldap_t const *inst,
+						 char const *base_dn, char const *filter);
+
+void rlm_ldap_cache_user_add(rlm_ldap_t const *inst, char const *base_dn, char const *filter, char const *dn);
+
+rlm_ldap_cache_status_t rlm_ldap_cache_group_find(TALLOC_CTX *ctx, char **name, rlm_ldap_t const *inst, char const *dn);
+
+void rlm_ldap_cache_group_add(rlm_ldap_t const *inst, char const *dn, char const *name, size_t name_len);
+
+int rlm_ldap_cache_invalidate(rlm_ldap_t const *inst, char const *dn);
+
 /*
  *	groups.c - Group membership functions.
  */
@@ -45,6 +45,8 @@ typedef struct {
 	char const * const	*attrs;
 	fr_ldap_query_t		*query;
 	fr_ldap_query_t		**out;
+	rlm_ldap_cache_status_t	cached;		//!< Whether the result came from the lookup cache.
+	char			*cached_dn;	//!< User DN from the lookup cache.
 } ldap_user_find_ctx_t;
 
 /** Process the results of an async user lookup
@@ -59,6 +61,21 @@ static unlang_action_t ldap_find_user_async_result(unlang_result_t *p_result, re
 	char			*dn;
 	fr_pair_t		*vp;
 
+	switch (user_ctx->cached) {
+	case LDAP_CACHE_NOTFOUND:
+		RDEBUG2("User search is cached as finding no user object");
+		RETURN_UNLANG_NOTFOUND;
+
+	case LDAP_CACHE_FOUND:
+		RDEBUG2("User object found at DN \"%s\" (cached)", user_ctx->cached_dn);
+		MEM(pair_update_control(&vp, attr_ldap_userdn) >= 0);
+		fr_pair_value_strdup(vp, user_ctx->cached_dn, false);
+		RETURN_UNLANG_OK;
+
+	case LDAP_CACHE_MISS:
+		break;
+	}
+
 	if (!query) RETURN_UNLANG_FAIL;
 
 	/*
@@ -75,6 +92,7 @@ static unlang_action_t ldap_find_user_async_result(unlang_result_t *p_result, re
 	 *	DNs can now be dynamic, so a BAD DN often means the same thing as an empty result
 	 */
 	case LDAP_RESULT_BAD_DN:
+		rlm_ldap_cache_user_add(user_ctx->inst, user_ctx->base_dn, user_ctx->filter, NULL);
 		RETURN_UNLANG_NOTFOUND;
 
 	default:
@@ -118,6 +136,7 @@ static unlang_action_t ldap_find_user_async_result(unlang_result_t *p_result, re
 	fr_ldap_util_normalise_dn(dn, dn);
 
 	RDEBUG2("User object found at DN \"%s\"", dn);
+	rlm_ldap_cache_user_add(user_ctx->inst, user_ctx->base_dn, user_ctx->filter, dn);
 
 	MEM(pair_update_control(&vp, attr_ldap_userdn) >= 0);
 	fr_pair_value_strdup(vp, dn, false);
@@ -157,6 +176,8 @@ static void ldap_find_user_async_cancel(UNUSED request_t *request, UNUSED fr_sig
  * @param[in] filter	to use in LDAP search.
  * @param[in] ttrunk	LDAP thread trunk to use.
  * @param[in] attrs	Additional attributes to retrieve, may be NULL.
+ * @param[in] need_entry	The caller needs the user object, not just its DN,
+ *			so a cached DN can't be used.
  * @param[in] query_out	Where to put a pointer to the LDAP query structure -
  *			for extracting extra returned attributes, may be NULL.
  * @return
@@ -167,7 +188,8 @@ unlang_action_t rlm_ldap_find_user_async(TALLOC_CTX *ctx,
 					 unlang_result_t *p_result,
 					 rlm_ldap_t const *inst, request_t *request,
 					 fr_value_box_t *base, fr_value_box_t *filter,
-					 fr_ldap_thread_trunk_t *ttrunk, char const *attrs[], fr_ldap_query_t **query_out)
+					 fr_ldap_thread_trunk_t *ttrunk, char const *attrs[], bool need_entry,
+					 fr_ldap_query_t **query_out)
 {
 	static char const	*tmp_attrs[] = { NULL };
 	ldap_user_find_ctx_t	*user_ctx;
@@ -185,6 +207,15 @@ unlang_action_t rlm_ldap_find_user_async(TALLOC_CTX *ctx,
 	};
 
 	if (filter) user_ctx->filter = filter->vb_strvalue;
+
+	/*
+	 *	Negative entries can always be used.  Positive entries only
+	 *	when the caller just needs the DN.
+	 */
+	user_ctx->cached = rlm_ldap_cache_user_find(user_ctx, &user_ctx->cached_dn, inst,
+						    user_ctx->base_dn, user_ctx->filter);
+	if ((user_ctx->cached == LDAP_CACHE_FOUND) && need_entry) user_ctx->cached = LDAP_CACHE_MISS;
+
 	if (unlang_function_push_with_result(/* ldap_find_user_async_result sets an rcode based on the search result */ p_result,
 					     request,
 					     NULL,
@@ -195,6 +226,11 @@ unlang_action_t rlm_ldap_find_user_async(TALLOC_CTX *ctx,
 		return UNLANG_ACTION_FAIL;
 	}
 
+	/*
+	 *	ldap_find_user_async_result produces the result from the cache
+	 */
+	if (user_ctx->cached != LDAP_CACHE_MISS) return UNLANG_ACTION_PUSHED_CHILD;
+
 	return fr_ldap_trunk_search(user_ctx, &user_ctx->query, request, user_ctx->ttrunk,
 				    user_ctx->base_dn, user_ctx->inst->user.obj_scope, user_ctx->filter,
 				    user_ctx->attrs, serverctrls, NULL);
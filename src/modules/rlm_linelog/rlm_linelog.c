@@ -122,6 +122,7 @@ typedef struct {
 		exfile_t		*ef;			//!< Exclusive file access handle.
 		bool			escape;			//!< Do filename escaping, yes / no.
 		bool			fsync;			//!< fsync after each write.
+		exfile_buffer_conf_t	buffer;			//!< How much to buffer, and for how long.
 	} file;
 
 	struct {
@@ -137,6 +138,10 @@ typedef struct {
 	bool			triggers;		//!< Do we do triggers.
 } rlm_linelog_t;
 
+typedef struct {
+	exfile_buffer_t		*eb;			//!< Buffered file writes for this thread, if enabled.
+} rlm_linelog_thread_t;
+
 typedef struct {
 	int			sockfd;			//!< File descriptor associated with socket
 } linelog_conn_t;
@@ -147,6 +152,7 @@ static const conf_parser_t file_config[] = {
 	{ FR_CONF_OFFSET("group", rlm_linelog_t, file.group_str) },
 	{ FR_CONF_OFFSET("escape_filenames", rlm_linelog_t, file.escape), .dflt = "no" },
 	{ FR_CONF_OFFSET("fsync", rlm_linelog_t, file.fsync), .dflt = "no" },
+	{ FR_CONF_OFFSET_SUBSECTION("buffer", 0, rlm_linelog_t, file.buffer, exfile_buffer_config) },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -370,7 +376,24 @@ static void linelog_hexdump(request_t *request, struct iovec *vector_p, size_t v
 	RHEXDUMP3(fr_dbuff_start(agg), fr_dbuff_used(agg), "%s", msg);
 }
 
-static int linelog_write(rlm_linelog_t const *inst, linelog_call_env_t const *call_env, request_t *request, struct iovec *vector_p, size_t vector_len, bool with_delim)
+/** Write a log message
+ *
+ * @param[out] wait	If not NULL, and the message was buffered, a handle
+ *			to yield on until the message is written.
+ * @param[in] inst	Module instance.
+ * @param[in] t		Module thread instance.
+ * @param[in] call_env	Call environment.
+ * @param[in] request	The current request.
+ * @param[in] vector_p	Message to write.
+ * @param[in] vector_len	Number of elements in vector_p.
+ * @param[in] with_delim	Whether the message ends with a delimiter.
+ * @return
+ *	- Number of bytes written, or buffered.
+ *	- -1 on error.
+ */
+static int linelog_write(exfile_buffer_wait_t **wait, rlm_linelog_t const *inst, rlm_linelog_thread_t *t,
+			 linelog_call_env_t const *call_env, request_t *request,
+			 struct iovec *vector_p, size_t vector_len, bool with_delim)
 {
 	int 			ret = 0;
 	linelog_conn_t		*conn;
@@ -405,6 +428,41 @@ static int linelog_write(rlm_linelog_t const *inst, linelog_call_env_t const *ca
 			*p = '/';
 		}
 
+		/*
+		 *	Written along with other buffered messages, and any
+		 *	header is only written if the file is empty at that
+		 *	point.
+		 */
+		if (t->eb) {
+			struct iovec	head_vector_s[2];
+			size_t		head_vector_len = 0, i;
+
+			if (call_env->log_head) {
+				memcpy(&head_vector_s[0].iov_base, &call_env->log_head->vb_strvalue, sizeof(head_vector_s[0].iov_base));
+				head_vector_s[0].iov_len = call_env->log_head->vb_length;
+				head_vector_len = 1;
+
+				if (with_delim) {
+					memcpy(&head_vector_s[1].iov_base, &(inst->delimiter),
+					       sizeof(head_vector_s[1].iov_base));
+					head_vector_s[1].iov_len = inst->delimiter_len;
+					head_vector_len = 2;
+				}
+			}
+
+			if (RDEBUG_ENABLED3) linelog_hexdump(request, vector_p, vector_len, "linelog data");
+
+			if (exfile_buffer_write(unlang_interpret_frame_talloc_ctx(request), wait, t->eb, request, path,
+						head_vector_len ? head_vector_s : NULL, head_vector_len,
+						vector_p, vector_len) < 0) {
+				RPERROR("Failed writing to \"%pV\"", call_env->filename);
+				return -1;
+			}
+
+			for (i = 0; i < vector_len; i++) ret += vector_p[i].iov_len;
+			break;
+		}
+
 		fd = exfile_open(inst->file.ef, path, inst->file.permissions, &offset);
 		if (fd < 0) {
 			RERROR("Failed to open %pV: %s", call_env->filename, fr_syserror(errno));
@@ -462,6 +520,12 @@ static int linelog_write(rlm_linelog_t const *inst, linelog_call_env_t const *ca
 		ret = writev(fd, vector_p, vector_len);
 		if (ret < 0) goto write_fail;
 
+		if (inst->file.fsync && (fsync(fd) < 0)) {
+			RERROR("Failed syncing \"%pV\" to persistent storage: %s", call_env->filename, fr_syserror(errno));
+			exfile_close(inst->file.ef, fd);
+			return -1;
+		}
+
 		exfile_close(inst->file.ef, fd);
 	}
 		break;
@@ -590,6 +654,7 @@ static xlat_action_t linelog_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 				  fr_value_box_list_t *args)
 {
 	rlm_linelog_t const		*inst = talloc_get_type_abort_const(xctx->mctx->mi->data, rlm_linelog_t);
+	rlm_linelog_thread_t		*t = talloc_get_type_abort(xctx->mctx->thread, rlm_linelog_thread_t);
 	linelog_call_env_t const	*call_env = talloc_get_type_abort(xctx->env_data, linelog_call_env_t);
 
 	struct iovec			vector[2];
@@ -610,7 +675,7 @@ static xlat_action_t linelog_xlat(TALLOC_CTX *ctx, fr_dcursor_t *out,
 		vector[i].iov_len = inst->delimiter_len;
 		i++;
 	}
-	slen = linelog_write(inst, call_env, request, vector, i, with_delim);
+	slen = linelog_write(NULL, inst, t, call_env, request, vector, i, with_delim);
 	if (slen < 0) return XLAT_ACTION_FAIL;
 
 	MEM(wrote = fr_value_box_alloc(ctx, FR_TYPE_SIZE, NULL));
@@ -626,14 +691,29 @@ typedef struct {
 	bool			with_delim;	//!< Whether to add a delimiter
 } rlm_linelog_rctx_t;
 
+static unlang_action_t CC_HINT(nonnull) mod_do_linelog_buffered_resume(unlang_result_t *p_result, module_ctx_t const *mctx,
+								      request_t *request)
+{
+	exfile_buffer_wait_t	*wait = talloc_get_type_abort(mctx->rctx, exfile_buffer_wait_t);
+
+	if (exfile_buffer_wait_result(wait) < 0) {
+		RERROR("Failed writing buffered log message");
+		RETURN_UNLANG_FAIL;
+	}
+
+	RETURN_UNLANG_OK;
+}
+
 static unlang_action_t CC_HINT(nonnull) mod_do_linelog_resume(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_linelog_t const		*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_linelog_t);
 	linelog_call_env_t const	*call_env = talloc_get_type_abort(mctx->env_data, linelog_call_env_t);
+	rlm_linelog_thread_t		*t = talloc_get_type_abort(mctx->thread, rlm_linelog_thread_t);
 	rlm_linelog_rctx_t		*rctx = talloc_get_type_abort(mctx->rctx, rlm_linelog_rctx_t);
 	struct iovec			*vector;
 	struct iovec			*vector_p;
 	size_t				vector_len;
+	exfile_buffer_wait_t		*wait = NULL;
 
 	vector_len = fr_value_box_list_num_elements(&rctx->expanded);
 	if (vector_len == 0) {
@@ -679,7 +759,11 @@ static unlang_action_t CC_HINT(nonnull) mod_do_linelog_resume(unlang_result_t *p
 		}
 	}
 
-	RETURN_UNLANG_RCODE(linelog_write(inst, call_env, request, vector, vector_len, rctx->with_delim) < 0 ? RLM_MODULE_FAIL : RLM_MODULE_OK);
+	if (linelog_write(&wait, inst, t, call_env, request, vector, vector_len, rctx->with_delim) < 0) RETURN_UNLANG_FAIL;
+
+	if (wait) return unlang_module_yield(request, mod_do_linelog_buffered_resume, NULL, 0, wait);
+
+	RETURN_UNLANG_OK;
 }
 
 /** Write a linelog message
@@ -696,6 +780,7 @@ static unlang_action_t CC_HINT(nonnull) mod_do_linelog_resume(unlang_result_t *p
 static unlang_action_t CC_HINT(nonnull) mod_do_linelog(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	rlm_linelog_t const		*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_linelog_t);
+	rlm_linelog_thread_t		*t = talloc_get_type_abort(mctx->thread, rlm_linelog_thread_t);
 	linelog_call_env_t const	*call_env = talloc_get_type_abort(mctx->env_data, linelog_call_env_t);
 	CONF_SECTION			*conf = mctx->mi->conf;
 
@@ -824,6 +909,7 @@ build_vector:
 		struct iovec		*vector = NULL, *vector_p;
 		size_t			vector_len;
 		rlm_rcode_t		rcode = RLM_MODULE_OK;
+		exfile_buffer_wait_t	*wait = NULL;
 
 		MEM(vector = talloc_array(frame_ctx, struct iovec, alloced));
 		for (vp = tmpl_dcursor_init(NULL, NULL, &cc, &cursor, request, vpt_p), i = 0;
@@ -866,12 +952,14 @@ build_vector:
 			RDEBUG2("No data to write");
 			rcode = RLM_MODULE_NOOP;
 		} else {
-			rcode = linelog_write(inst, call_env, request, vector_p, vector_len, with_delim) < 0 ? RLM_MODULE_FAIL : RLM_MODULE_OK;
+			rcode = linelog_write(&wait, inst, t, call_env, request, vector_p, vector_len, with_delim) < 0 ? RLM_MODULE_FAIL : RLM_MODULE_OK;
 		}
 
 		talloc_free(vpt);
 		talloc_free(vector);
 
+		if (wait) return unlang_module_yield(request, mod_do_linelog_buffered_resume, NULL, 0, wait);
+
 		RETURN_UNLANG_RCODE(rcode);
 	}
 
@@ -1054,6 +1142,35 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	return 0;
 }
 
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_linelog_t const	*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_linelog_t);
+	rlm_linelog_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_linelog_thread_t);
+
+	if ((inst->log_dst != LINELOG_DST_FILE) || !inst->file.buffer.size) return 0;
+
+	t->eb = exfile_buffer_alloc(t, inst->file.ef, mctx->el, &inst->file.buffer, inst->file.permissions,
+				    inst->file.group_str ? inst->file.group : (gid_t) -1, inst->file.fsync);
+	if (!t->eb) {
+		ERROR("Failed allocating write buffer");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_linelog_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_linelog_thread_t);
+
+	/*
+	 *	Write anything still buffered.
+	 */
+	TALLOC_FREE(t->eb);
+
+	return 0;
+}
+
 static int mod_bootstrap(module_inst_ctx_t const *mctx)
 {
 	xlat_t *xlat;
@@ -1082,7 +1199,11 @@ module_rlm_t rlm_linelog = {
 		.config		= module_config,
 		.bootstrap	= mod_bootstrap,
 		.instantiate	= mod_instantiate,
-		.detach		= mod_detach
+		.detach		= mod_detach,
+
+		.thread_inst_size	= sizeof(rlm_linelog_thread_t),
+		.thread_instantiate	= mod_thread_instantiate,
+		.thread_detach		= mod_thread_detach
 	},
 	.method_group = {
 		.bindings = (module_method_binding_t[]){
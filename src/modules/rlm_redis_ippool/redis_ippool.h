@@ -51,6 +51,7 @@ typedef enum {
 	POOL_ACTION_UPDATE = 2,
 	POOL_ACTION_RELEASE = 3,
 	POOL_ACTION_BULK_RELEASE = 4,
+	POOL_ACTION_BULK_UPDATE = 5,
 } ippool_action_t;
 
 #define IPPOOL_MAX_KEY_PREFIX_SIZE	128
@@ -58,6 +59,7 @@ typedef enum {
 #define IPPOOL_ADDRESS_KEY		"ip"
 #define IPPOOL_OWNER_KEY		"device"
 #define IPPOOL_STATIC_BIT		0x10000000000000   /* A high bit which Redis ZSCORE will represent accurately*/
+#define IPPOOL_BULK_RELEASE_BATCH	1000		   /* Leases checked per bulk release script call */
 
 /** {prefix}:pool
  */
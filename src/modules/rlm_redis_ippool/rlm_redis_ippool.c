@@ -108,6 +108,9 @@ static conf_parser_t module_config[] = {
 typedef struct {
 	fr_value_box_t	pool_name;			//!< Name of the pool we're allocating IP addresses from.
 
+	fr_value_box_t	*fallback_pool_name;		//!< Pools to try, in order, if pool_name has no free
+							///< addresses.  One entry per conf pair.
+
 	fr_value_box_t	offer_time;			//!< How long we should reserve a lease for during
 							///< the pre-allocation stage (typically responding
 							///< to DHCP discover).
@@ -128,6 +131,9 @@ typedef struct {
 	tmpl_t		*range_attr;			//!< Attribute to write the range ID to.
 
 	tmpl_t		*expiry_attr;			//!< Time at which the lease will expire.
+
+	tmpl_t		*allocated_pool_attr;		//!< Attribute to write the name of the pool the
+							///< lease was allocated from.
 } redis_ippool_alloc_call_env_t;
 
 /** Call environment used when calling redis_ippool update method.
@@ -181,11 +187,25 @@ typedef struct {
 							///< Option 82 gateway.  Used for bulk lease cleanups.
 } redis_ippool_bulk_release_call_env_t;
 
+/** Call environment used when calling redis_ippool bulk update method.
+ *
+ */
+typedef struct {
+	fr_value_box_t	pool_name;			//!< Name of the pool we're allocating IP addresses from.
+
+	fr_value_box_t	lease_time;			//!< How long an IP address should be allocated for.
+
+	fr_value_box_t	gateway_id;			//!< Gateway identifier, usually NAS-Identifier or
+							///< Option 82 gateway.  Used for bulk lease cleanups.
+} redis_ippool_bulk_update_call_env_t;
+
 static const call_env_method_t redis_ippool_alloc_method_env = {
 	FR_CALL_ENV_METHOD_OUT(redis_ippool_alloc_call_env_t),
 	.env = (call_env_parser_t[]){
 		{ FR_CALL_ENV_OFFSET("pool_name", FR_TYPE_STRING, CALL_ENV_FLAG_REQUIRED | CALL_ENV_FLAG_CONCAT | CALL_ENV_FLAG_BARE_WORD_ATTRIBUTE,
 				     redis_ippool_alloc_call_env_t, pool_name) },
+		{ FR_CALL_ENV_OFFSET("fallback_pool_name", FR_TYPE_STRING, CALL_ENV_FLAG_CONCAT | CALL_ENV_FLAG_MULTI | CALL_ENV_FLAG_NULLABLE | CALL_ENV_FLAG_BARE_WORD_ATTRIBUTE,
+				     redis_ippool_alloc_call_env_t, fallback_pool_name) },
 		{ FR_CALL_ENV_OFFSET("owner", FR_TYPE_STRING, CALL_ENV_FLAG_REQUIRED | CALL_ENV_FLAG_CONCAT | CALL_ENV_FLAG_BARE_WORD_ATTRIBUTE,
 				     redis_ippool_alloc_call_env_t, owner) },
 		{ FR_CALL_ENV_OFFSET("gateway", FR_TYPE_STRING, CALL_ENV_FLAG_NULLABLE | CALL_ENV_FLAG_CONCAT | CALL_ENV_FLAG_BARE_WORD_ATTRIBUTE,
@@ -198,6 +218,7 @@ static const call_env_method_t redis_ippool_alloc_method_env = {
 		{ FR_CALL_ENV_PARSE_ONLY_OFFSET("range_attr", FR_TYPE_VOID, CALL_ENV_FLAG_ATTRIBUTE | CALL_ENV_FLAG_REQUIRED, redis_ippool_alloc_call_env_t, range_attr),
 					       .pair.dflt = "reply.IP-Pool.Range", .pair.dflt_quote = T_BARE_WORD },
 		{ FR_CALL_ENV_PARSE_ONLY_OFFSET("expiry_attr", FR_TYPE_VOID, CALL_ENV_FLAG_ATTRIBUTE, redis_ippool_alloc_call_env_t, expiry_attr) },
+		{ FR_CALL_ENV_PARSE_ONLY_OFFSET("allocated_pool_attr", FR_TYPE_VOID, CALL_ENV_FLAG_ATTRIBUTE, redis_ippool_alloc_call_env_t, allocated_pool_attr) },
 		CALL_ENV_TERMINATOR
 	}
 };
@@ -243,6 +264,17 @@ static const call_env_method_t redis_ippool_bulk_release_method_env = {
 	}
 };
 
+static const call_env_method_t redis_ippool_bulk_update_method_env = {
+	FR_CALL_ENV_METHOD_OUT(redis_ippool_bulk_update_call_env_t),
+	.env = (call_env_parser_t[]) {
+		{ FR_CALL_ENV_OFFSET("pool_name", FR_TYPE_STRING, CALL_ENV_FLAG_REQUIRED | CALL_ENV_FLAG_CONCAT | CALL_ENV_FLAG_BARE_WORD_ATTRIBUTE, redis_ippool_bulk_update_call_env_t, pool_name) },
+		{ FR_CALL_ENV_OFFSET("lease_time", FR_TYPE_UINT32, CALL_ENV_FLAG_REQUIRED, redis_ippool_bulk_update_call_env_t, lease_time) },
+		{ FR_CALL_ENV_OFFSET("gateway", FR_TYPE_STRING, CALL_ENV_FLAG_NULLABLE | CALL_ENV_FLAG_CONCAT | CALL_ENV_FLAG_BARE_WORD_ATTRIBUTE, redis_ippool_bulk_update_call_env_t, gateway_id),
+				     .pair.dflt = "", .pair.dflt_quote = T_SINGLE_QUOTED_STRING },
+		CALL_ENV_TERMINATOR
+	}
+};
+
 #define EOL "\n"
 
 /** Lua script for allocating new leases
@@ -252,21 +284,25 @@ static const call_env_method_t redis_ippool_bulk_release_method_env = {
  * - ARGV[2] Expires in (seconds).
  * - ARGV[3] Lease owner identifier (administratively configured).
  * - ARGV[4] (optional) Gateway identifier.
+ * - ARGV[5] (optional) NUL separated list of fallback pools, tried in order
+ *   if KEYS[1] has no free addresses.  They must hash to the same slot as KEYS[1].
+ *
+ * An existing lease for the owner in any of the pools is preferred over
+ * allocating a new one.
  *
- * Returns @verbatim { <rcode>[, <ip>][, <range>][, <lease time>][, <counter>] } @endverbatim
+ * Returns @verbatim { <rcode>[, <ip>][, <range>][, <lease time>][, <counter>][, <pool>] } @endverbatim
  * - IPPOOL_RCODE_SUCCESS lease updated..
- * - IPPOOL_RCODE_NOT_FOUND lease not found in pool.
+ * - IPPOOL_RCODE_POOL_EMPTY no free addresses in any of the pools.
+ *
+ * <pool> is the index of the pool the lease was found in, starting at 1 for KEYS[1].
  */
 static char lua_alloc_cmd[] =
-	"local ip" EOL											/* 1 */
-	"local exists" EOL										/* 2 */
-
-	"local pool_key" EOL										/* 3 */
-	"local address_key" EOL										/* 4 */
-	"local owner_key" EOL										/* 5 */
-
-	"pool_key = '{' .. KEYS[1] .. '}:"IPPOOL_POOL_KEY"'" EOL					/* 6 */
-	"owner_key = '{' .. KEYS[1] .. '}:"IPPOOL_OWNER_KEY":' .. ARGV[3]" EOL				/* 7 */
+	"local pools = { KEYS[1] }" EOL									/* 1 */
+	"if ARGV[5] then" EOL										/* 2 */
+	"  for pool in string.gmatch(ARGV[5], '[^%z]+') do" EOL						/* 3 */
+	"    pools[#pools + 1] = pool" EOL								/* 4 */
+	"  end" EOL											/* 5 */
+	"end" EOL											/* 6 */
 
 	/*
 	 *	Check to see if the client already has a lease,
@@ -275,59 +311,73 @@ static char lua_alloc_cmd[] =
 	 *	The additional sanity checks are to allow for the record
 	 *	of device/ip binding to persist for longer than the lease.
 	 */
-	"exists = redis.call('GET', owner_key);" EOL							/* 8 */
-	"if exists then" EOL										/* 9 */
-	"  local expires = tonumber(redis.call('ZSCORE', pool_key, exists))" EOL			/* 10 */
-	"  local static = expires >= " STRINGIFY(IPPOOL_STATIC_BIT) EOL					/* 11 */
-	"  local expires_in = expires - (static and " STRINGIFY(IPPOOL_STATIC_BIT) " or 0) - ARGV[1]" EOL	/* 12 */
-	"  if expires_in > 0 or static then" EOL							/* 13 */
-	"    ip = redis.call('HMGET', '{' .. KEYS[1] .. '}:"IPPOOL_ADDRESS_KEY":' .. exists, 'device', 'range', 'counter', 'gateway')" EOL	/* 14 */
-	"    if ip and (ip[1] == ARGV[3]) then" EOL							/* 15 */
-	"      if expires_in < tonumber(ARGV[2]) then" EOL						/* 16 */
-	"        redis.call('ZADD', pool_key, 'XX', ARGV[1] + ARGV[2] + (static and " STRINGIFY(IPPOOL_STATIC_BIT) " or 0), exists)" EOL	/* 17 */
-	"        expires_in = tonumber(ARGV[2])" EOL							/* 18 */
-	"        if not static then" EOL								/* 19 */
-	"          redis.call('EXPIRE', owner_key, ARGV[2])" EOL					/* 20 */
-	"        end" EOL										/* 21 */
-	"      end" EOL											/* 22 */
+	"local function existing(pool)" EOL								/* 7 */
+	"  local pool_key = '{' .. pool .. '}:"IPPOOL_POOL_KEY"'" EOL					/* 8 */
+	"  local owner_key = '{' .. pool .. '}:"IPPOOL_OWNER_KEY":' .. ARGV[3]" EOL			/* 9 */
+	"  local exists = redis.call('GET', owner_key)" EOL						/* 10 */
+	"  if not exists then return nil end" EOL							/* 11 */
+	"  local expires = tonumber(redis.call('ZSCORE', pool_key, exists))" EOL			/* 12 */
+	"  if not expires then return nil end" EOL							/* 13 */
+	"  local static = expires >= " STRINGIFY(IPPOOL_STATIC_BIT) EOL					/* 14 */
+	"  local expires_in = expires - (static and " STRINGIFY(IPPOOL_STATIC_BIT) " or 0) - ARGV[1]" EOL	/* 15 */
+	"  if expires_in <= 0 and not static then return nil end" EOL					/* 16 */
+	"  local address_key = '{' .. pool .. '}:"IPPOOL_ADDRESS_KEY":' .. exists" EOL			/* 17 */
+	"  local ip = redis.call('HMGET', address_key, 'device', 'range', 'counter', 'gateway')" EOL	/* 18 */
+	"  if not ip or (ip[1] ~= ARGV[3]) then return nil end" EOL					/* 19 */
+	"  if expires_in < tonumber(ARGV[2]) then" EOL							/* 20 */
+	"    redis.call('ZADD', pool_key, 'XX', ARGV[1] + ARGV[2] + (static and " STRINGIFY(IPPOOL_STATIC_BIT) " or 0), exists)" EOL	/* 21 */
+	"    expires_in = tonumber(ARGV[2])" EOL							/* 22 */
+	"    if not static then" EOL									/* 23 */
+	"      redis.call('EXPIRE', owner_key, ARGV[2])" EOL						/* 24 */
+	"    end" EOL											/* 25 */
+	"  end" EOL											/* 26 */
 
 	/*
 	 *	Ensure gateway is set correctly
 	 */
-	"      if ARGV[4] ~= ip[4] then" EOL								/* 23 */
-	"        redis.call('HSET', '{' .. KEYS[1] .. '}:"IPPOOL_ADDRESS_KEY":', 'gateway', ARGV[4])" EOL	/* 24 */
-	"      end" EOL											/* 25 */
-	"      return {" STRINGIFY(_IPPOOL_RCODE_SUCCESS) ", exists, ip[2], expires_in, ip[3] }" EOL	/* 26 */
-	"    end" EOL											/* 27 */
-	"  end" EOL											/* 28 */
-	"end" EOL											/* 29 */
+	"  if ARGV[4] ~= ip[4] then" EOL								/* 27 */
+	"    redis.call('HSET', address_key, 'gateway', ARGV[4])" EOL					/* 28 */
+	"  end" EOL											/* 29 */
+	"  return {" STRINGIFY(_IPPOOL_RCODE_SUCCESS) ", exists, ip[2], expires_in, ip[3] }" EOL	/* 30 */
+	"end" EOL											/* 31 */
 
 	/*
 	 *	Else, get the IP address which expired the longest time ago.
 	 */
-	"ip = redis.call('ZREVRANGE', pool_key, -1, -1, 'WITHSCORES')" EOL				/* 30 */
-	"if not ip or not ip[1] then" EOL								/* 31 */
-	"  return {" STRINGIFY(_IPPOOL_RCODE_POOL_EMPTY) "}" EOL					/* 32 */
-	"end" EOL											/* 33 */
-	"if ip[2] >= ARGV[1] then" EOL									/* 34 */
-	"  return {" STRINGIFY(_IPPOOL_RCODE_POOL_EMPTY) "}" EOL					/* 35 */
-	"end" EOL											/* 36 */
-	"redis.call('ZADD', pool_key, 'XX', ARGV[1] + ARGV[2], ip[1])" EOL				/* 37 */
+	"local function allocate(pool)" EOL								/* 32 */
+	"  local pool_key = '{' .. pool .. '}:"IPPOOL_POOL_KEY"'" EOL					/* 33 */
+	"  local ip = redis.call('ZREVRANGE', pool_key, -1, -1, 'WITHSCORES')" EOL			/* 34 */
+	"  if not ip or not ip[1] then return nil end" EOL						/* 35 */
+	"  if tonumber(ip[2]) >= tonumber(ARGV[1]) then return nil end" EOL				/* 36 */
+	"  redis.call('ZADD', pool_key, 'XX', ARGV[1] + ARGV[2], ip[1])" EOL				/* 37 */
 
 	/*
 	 *	Set the device/gateway keys
 	 */
-	"address_key = '{' .. KEYS[1] .. '}:"IPPOOL_ADDRESS_KEY":' .. ip[1]" EOL			/* 38 */
-	"redis.call('HMSET', address_key, 'device', ARGV[3], 'gateway', ARGV[4])" EOL			/* 39 */
-	"redis.call('SET', owner_key, ip[1])" EOL							/* 40 */
-	"redis.call('EXPIRE', owner_key, ARGV[2])" EOL							/* 41 */
-	"return { " EOL											/* 42 */
-	"  " STRINGIFY(_IPPOOL_RCODE_SUCCESS) "," EOL							/* 43 */
-	"  ip[1], " EOL											/* 44 */
-	"  redis.call('HGET', address_key, 'range'), " EOL						/* 45 */
-	"  tonumber(ARGV[2]), " EOL									/* 46 */
-	"  redis.call('HINCRBY', address_key, 'counter', 1)" EOL					/* 47 */
-	"}" EOL;											/* 48 */
+	"  local address_key = '{' .. pool .. '}:"IPPOOL_ADDRESS_KEY":' .. ip[1]" EOL			/* 38 */
+	"  local owner_key = '{' .. pool .. '}:"IPPOOL_OWNER_KEY":' .. ARGV[3]" EOL			/* 39 */
+	"  redis.call('HMSET', address_key, 'device', ARGV[3], 'gateway', ARGV[4])" EOL			/* 40 */
+	"  redis.call('SET', owner_key, ip[1])" EOL							/* 41 */
+	"  redis.call('EXPIRE', owner_key, ARGV[2])" EOL						/* 42 */
+	"  return { " EOL										/* 43 */
+	"    " STRINGIFY(_IPPOOL_RCODE_SUCCESS) "," EOL							/* 44 */
+	"    ip[1], " EOL										/* 45 */
+	"    redis.call('HGET', address_key, 'range'), " EOL						/* 46 */
+	"    tonumber(ARGV[2]), " EOL									/* 47 */
+	"    redis.call('HINCRBY', address_key, 'counter', 1)" EOL					/* 48 */
+	"  }" EOL											/* 49 */
+	"end" EOL											/* 50 */
+
+	"local ret" EOL											/* 51 */
+	"for i = 1, #pools do" EOL									/* 52 */
+	"  ret = existing(pools[i])" EOL								/* 53 */
+	"  if ret then ret[6] = i return ret end" EOL							/* 54 */
+	"end" EOL											/* 55 */
+	"for i = 1, #pools do" EOL									/* 56 */
+	"  ret = allocate(pools[i])" EOL								/* 57 */
+	"  if ret then ret[6] = i return ret end" EOL							/* 58 */
+	"end" EOL											/* 59 */
+	"return {" STRINGIFY(_IPPOOL_RCODE_POOL_EMPTY) "}" EOL;						/* 60 */
 static char lua_alloc_digest[(SHA1_DIGEST_LENGTH * 2) + 1];
 
 /** Lua script for updating leases
@@ -455,6 +505,110 @@ static char lua_release_cmd[] =
 	"}";										/* 25 */
 static char lua_release_digest[(SHA1_DIGEST_LENGTH * 2) + 1];
 
+/** Lua script for releasing all the leases held by devices behind a gateway
+ *
+ * - KEYS[1] The pool name.
+ * - ARGV[1] Wall time (seconds since epoch).
+ * - ARGV[2] Gateway identifier.
+ * - ARGV[3] Number of active leases already checked, and left alone.
+ * - ARGV[4] Maximum number of leases to check.
+ *
+ * Released leases drop out of the range of active leases, so the caller
+ * passes back the offset we return, until there are no more leases to check.
+ * Static leases are never released.
+ *
+ * Returns @verbatim array { <rcode>, <released>, <offset>, <more> } @endverbatim
+ * - IPPOOL_RCODE_SUCCESS leases checked.
+ */
+static char lua_bulk_release_cmd[] =
+	"local pool_key = '{' .. KEYS[1] .. '}:"IPPOOL_POOL_KEY"'" EOL				/* 1 */
+	"local released = 0" EOL								/* 2 */
+	"local offset = tonumber(ARGV[3])" EOL							/* 3 */
+	"local leases = redis.call('ZRANGEBYSCORE', pool_key, '(' .. ARGV[1], '+inf', 'WITHSCORES', 'LIMIT', offset, ARGV[4])" EOL	/* 4 */
+	"for i = 1, #leases, 2 do" EOL								/* 5 */
+	"  local ip = leases[i]" EOL								/* 6 */
+	"  local address_key = '{' .. KEYS[1] .. '}:"IPPOOL_ADDRESS_KEY":' .. ip" EOL		/* 7 */
+	"  local lease = redis.call('HMGET', address_key, 'device', 'gateway')" EOL		/* 8 */
+	"  if tonumber(leases[i + 1]) < " STRINGIFY(IPPOOL_STATIC_BIT) " and lease[2] == ARGV[2] then" EOL	/* 9 */
+	"    redis.call('ZADD', pool_key, 'XX', ARGV[1] - 1, ip)" EOL				/* 10 */
+
+	/*
+	 *	Only remove the device association if it still
+	 *	points to this lease.
+	 */
+	"    if lease[1] then" EOL								/* 11 */
+	"      local owner_key = '{' .. KEYS[1] .. '}:"IPPOOL_OWNER_KEY":' .. lease[1]" EOL	/* 12 */
+	"      if redis.call('GET', owner_key) == ip then" EOL					/* 13 */
+	"        redis.call('DEL', owner_key)" EOL						/* 14 */
+	"      end" EOL										/* 15 */
+	"    end" EOL										/* 16 */
+	"    redis.call('HINCRBY', address_key, 'counter', 1)" EOL				/* 17 */
+	"    released = released + 1" EOL							/* 18 */
+	"  else" EOL										/* 19 */
+	"    offset = offset + 1" EOL								/* 20 */
+	"  end" EOL										/* 21 */
+	"end" EOL										/* 22 */
+	"return {" EOL										/* 23 */
+	"  " STRINGIFY(_IPPOOL_RCODE_SUCCESS) "," EOL						/* 24 */
+	"  released," EOL									/* 25 */
+	"  offset," EOL										/* 26 */
+	"  ((#leases / 2) == tonumber(ARGV[4])) and 1 or 0" EOL				/* 27 */
+	"}";											/* 28 */
+static char lua_bulk_release_digest[(SHA1_DIGEST_LENGTH * 2) + 1];
+
+/** Lua script for extending all the leases held by devices behind a gateway
+ *
+ * - KEYS[1] The pool name.
+ * - ARGV[1] Wall time (seconds since epoch).
+ * - ARGV[2] Expires in (seconds).
+ * - ARGV[3] Gateway identifier.
+ * - ARGV[4] Number of leases already checked, and left alone.
+ * - ARGV[5] Maximum number of leases to check.
+ *
+ * Only active leases which would expire before the new expiry time are checked.
+ * Updated leases move out of that range, so as with bulk release, the caller
+ * passes back the offset we return, until there are no more leases to check.
+ * Static leases are never updated.
+ *
+ * Returns @verbatim array { <rcode>, <updated>, <offset>, <more> } @endverbatim
+ * - IPPOOL_RCODE_SUCCESS leases checked.
+ */
+static char lua_bulk_update_cmd[] =
+	"local pool_key = '{' .. KEYS[1] .. '}:"IPPOOL_POOL_KEY"'" EOL				/* 1 */
+	"local expires = ARGV[1] + ARGV[2]" EOL							/* 2 */
+	"local updated = 0" EOL									/* 3 */
+	"local offset = tonumber(ARGV[4])" EOL							/* 4 */
+	"local leases = redis.call('ZRANGEBYSCORE', pool_key, '(' .. ARGV[1], '(' .. expires, 'LIMIT', offset, ARGV[5])" EOL	/* 5 */
+	"for i = 1, #leases do" EOL								/* 6 */
+	"  local ip = leases[i]" EOL								/* 7 */
+	"  local address_key = '{' .. KEYS[1] .. '}:"IPPOOL_ADDRESS_KEY":' .. ip" EOL		/* 8 */
+	"  local lease = redis.call('HMGET', address_key, 'device', 'gateway')" EOL		/* 9 */
+	"  if lease[2] == ARGV[3] then" EOL							/* 10 */
+	"    redis.call('ZADD', pool_key, 'XX', expires, ip)" EOL				/* 11 */
+
+	/*
+	 *	Only extend the device association if it still
+	 *	points to this lease.
+	 */
+	"    if lease[1] then" EOL								/* 12 */
+	"      local owner_key = '{' .. KEYS[1] .. '}:"IPPOOL_OWNER_KEY":' .. lease[1]" EOL	/* 13 */
+	"      if redis.call('GET', owner_key) == ip then" EOL					/* 14 */
+	"        redis.call('EXPIRE', owner_key, ARGV[2])" EOL					/* 15 */
+	"      end" EOL										/* 16 */
+	"    end" EOL										/* 17 */
+	"    updated = updated + 1" EOL								/* 18 */
+	"  else" EOL										/* 19 */
+	"    offset = offset + 1" EOL								/* 20 */
+	"  end" EOL										/* 21 */
+	"end" EOL										/* 22 */
+	"return {" EOL										/* 23 */
+	"  " STRINGIFY(_IPPOOL_RCODE_SUCCESS) "," EOL						/* 24 */
+	"  updated," EOL									/* 25 */
+	"  offset," EOL										/* 26 */
+	"  (#leases == tonumber(ARGV[5])) and 1 or 0" EOL					/* 27 */
+	"}";											/* 28 */
+static char lua_bulk_update_digest[(SHA1_DIGEST_LENGTH * 2) + 1];
+
 /** Check the requisite number of slaves replicated the lease info
  *
  * @param request The current request.
@@ -524,6 +678,16 @@ static void ippool_action_print(request_t *request, ippool_action_t action,
 			key_prefix);
 		break;
 
+	case POOL_ACTION_BULK_RELEASE:
+		RDEBUGX(lvl, "Releasing all leases on gateway \"%s\" to pool \"%pV\"",
+			gateway_str ? gateway_str : "", key_prefix);
+		break;
+
+	case POOL_ACTION_BULK_UPDATE:
+		RDEBUGX(lvl, "Updating all leases on gateway \"%s\" in pool \"%pV\", expires in %us",
+			gateway_str ? gateway_str : "", key_prefix, expires);
+		break;
+
 	default:
 		break;
 	}
@@ -536,13 +700,68 @@ static void ippool_action_print(request_t *request, ippool_action_t action,
 	talloc_free(gateway_str);
 }
 
+/** Detach the error reply from the replies to a failed script call
+ *
+ * If the script was uploaded, the error will be one of the results of EXEC.
+ *
+ * @param[in,out] reply	to search.  The error reply is removed from it.
+ * @return
+ *	- The error reply.
+ *	- NULL if there was no error reply.
+ */
+static redisReply *ippool_script_error(redisReply **reply)
+{
+	redisReply	*error;
+	size_t		i;
+
+	if (!*reply) return NULL;
+
+	switch ((*reply)->type) {
+	case REDIS_REPLY_ERROR:
+		error = *reply;
+		*reply = NULL;
+		return error;
+
+	case REDIS_REPLY_ARRAY:
+		for (i = 0; i < (*reply)->elements; i++) {
+			if (!(*reply)->element[i] || ((*reply)->element[i]->type != REDIS_REPLY_ERROR)) continue;
+
+			error = (*reply)->element[i];
+			(*reply)->element[i] = NULL;	/* hiredis checks for NULL elements */
+			return error;
+		}
+		return NULL;
+
+	default:
+		return NULL;
+	}
+}
+
+/** Whether a script was refused because it used keys from more than one slot
+ *
+ * Depending on the version, Redis either refuses the whole command with
+ * CROSSSLOT, or fails the script when it touches a key it doesn't own.
+ */
+static bool ippool_script_cross_slot(redisReply const *reply)
+{
+	if (!reply || (reply->type != REDIS_REPLY_ERROR) || !reply->str) return false;
+
+	if (strncmp(reply->str, "CROSSSLOT", sizeof("CROSSSLOT") - 1) == 0) return true;
+
+	return (strstr(reply->str, "non local key") != NULL) ||
+	       (strstr(reply->str, "hash to the same slot") != NULL);
+}
+
 /** Execute a script against Redis cluster
  *
  * Handles uploading the script to the server if required.
  *
- * @note All replies will be freed on error.
+ * @note All replies will be freed on error, apart from any error reply
+ *	from the server, which is written to out.
  *
  * @param[out] out		Where to write Redis reply object resulting from the command.
+ *				On failure, the error reply from the server, if there was one.
+ *				Must be freed by the caller in either case.
  * @param[in] request		The current request.
  * @param[in] cluster		configuration.
  * @param[in] key		to use to determine the cluster node.
@@ -655,7 +874,10 @@ static fr_redis_rcode_t ippool_script(redisReply **out, request_t *request, fr_r
 			}
 		}
 	}
-	if (s_ret != REDIS_RCODE_SUCCESS) goto error;
+	if (s_ret != REDIS_RCODE_SUCCESS) {
+		if (reply_cnt > 0) *out = ippool_script_error(&replies[0]);
+		goto error;
+	}
 
 	switch (reply_cnt) {
 	case 2:	/* EVALSHA with wait */
@@ -690,38 +912,20 @@ finish:
 	return s_ret;
 }
 
-/** Allocate a new IP address from a pool
+/** Process the result of an allocation
  *
+ * @param[in] request		The current request.
+ * @param[in] env		call env for the allocation.
+ * @param[in] reply		from the allocation script.  Will be freed.
+ * @param[in] pools		which were passed to the script, in order.
+ * @param[in] num_pools		in the array above.
+ * @return the result of the allocation.
  */
-static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, request_t *request,
-					    redis_ippool_alloc_call_env_t *env, uint32_t lease_time)
+static ippool_rcode_t redis_ippool_alloc_result(request_t *request, redis_ippool_alloc_call_env_t *env,
+						redisReply *reply, fr_value_box_t const **pools, size_t num_pools)
 {
-	struct			timeval now;
-	redisReply		*reply = NULL;
-
-	fr_redis_rcode_t	status;
 	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
 
-	fr_assert(env->pool_name.vb_length > 0);
-	fr_assert(env->owner.vb_length > 0);
-
-	now = fr_time_to_timeval(fr_time());
-
-	status = ippool_script(&reply, request, inst->cluster,
-			       (uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
-			       inst->wait_num, inst->wait_timeout,
-			       lua_alloc_digest, lua_alloc_cmd,
-	 		       "EVALSHA %s 1 %b %u %u %b %b",
-	 		       lua_alloc_digest,
-			       (uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length,
-			       (unsigned int)now.tv_sec, lease_time,
-			       (uint8_t const *)env->owner.vb_strvalue, env->owner.vb_length,
-			       (uint8_t const *)env->gateway_id.vb_strvalue, env->gateway_id.vb_length);
-	if (status != REDIS_RCODE_SUCCESS) {
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
-	}
-
 	fr_assert(reply);
 	if (reply->type != REDIS_REPLY_ARRAY) {
 		REDEBUG("Expected result to be array got \"%s\"",
@@ -867,11 +1071,172 @@ static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, requ
 			goto finish;
 		}
 	}
+
+	/*
+	 *	Process the pool the lease came from
+	 */
+	if (env->allocated_pool_attr) {
+		fr_value_box_t const	*pool = pools[0];
+		tmpl_t			pool_rhs;
+		map_t			pool_map = {
+						.lhs = env->allocated_pool_attr,
+						.op = T_OP_SET,
+						.rhs = &pool_rhs
+					};
+
+		if ((reply->elements > 5) && (reply->element[5]->type == REDIS_REPLY_INTEGER) &&
+		    (reply->element[5]->integer >= 1) && ((size_t) reply->element[5]->integer <= num_pools)) {
+			pool = pools[reply->element[5]->integer - 1];
+		}
+
+		tmpl_init_shallow(&pool_rhs, TMPL_TYPE_DATA, T_DOUBLE_QUOTED_STRING, "", 0, NULL);
+		fr_value_box_bstrndup_shallow(&pool_map.rhs->data.literal, NULL,
+					      pool->vb_strvalue, pool->vb_length, true);
+		if (map_to_request(request, &pool_map, map_to_vp, NULL) < 0) {
+			ret = IPPOOL_RCODE_FAIL;
+			goto finish;
+		}
+	}
+
 finish:
 	fr_redis_reply_free(&reply);
 	return ret;
 }
 
+/** Call the allocation script for one or more pools
+ *
+ */
+static fr_redis_rcode_t redis_ippool_alloc_script(redisReply **out, rlm_redis_ippool_t const *inst, request_t *request,
+						  redis_ippool_alloc_call_env_t *env, uint32_t lease_time,
+						  fr_value_box_t const *pool, char const *fallback, size_t fallback_len)
+{
+	struct timeval now;
+
+	now = fr_time_to_timeval(fr_time());
+
+	return ippool_script(out, request, inst->cluster,
+			     (uint8_t const *)pool->vb_strvalue, pool->vb_length,
+			     inst->wait_num, inst->wait_timeout,
+			     lua_alloc_digest, lua_alloc_cmd,
+			     "EVALSHA %s 1 %b %u %u %b %b %b",
+			     lua_alloc_digest,
+			     (uint8_t const *)pool->vb_strvalue, pool->vb_length,
+			     (unsigned int)now.tv_sec, lease_time,
+			     (uint8_t const *)env->owner.vb_strvalue, env->owner.vb_length,
+			     (uint8_t const *)env->gateway_id.vb_strvalue, env->gateway_id.vb_length,
+			     (uint8_t const *)fallback, fallback_len);
+}
+
+/** Allocate a new IP address from a pool
+ *
+ * If there are fallback pools, and they're all in the same key slot as the
+ * main pool, they're passed to the allocation script, and the whole search
+ * is done in one round trip.  Otherwise each pool is tried in turn until
+ * one has a free address.
+ */
+static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, request_t *request,
+					    redis_ippool_alloc_call_env_t *env, uint32_t lease_time)
+{
+	redisReply				*reply = NULL;
+	fr_redis_rcode_t			status;
+	ippool_rcode_t				ret = IPPOOL_RCODE_FAIL;
+
+	fr_value_box_t const			**pools;
+	size_t					num_pools = 1, i;
+	fr_redis_cluster_key_slot_t const	*key_slot;
+	bool					same_slot = true;
+
+	fr_assert(env->pool_name.vb_length > 0);
+	fr_assert(env->owner.vb_length > 0);
+
+	/*
+	 *	Build the list of candidate pools, skipping empty ones.
+	 */
+	MEM(pools = talloc_array(request, fr_value_box_t const *, 1 + talloc_array_length(env->fallback_pool_name)));
+	pools[0] = &env->pool_name;
+
+	key_slot = fr_redis_cluster_slot_by_key(inst->cluster, request,
+						(uint8_t const *)env->pool_name.vb_strvalue, env->pool_name.vb_length);
+
+	for (i = 0; i < talloc_array_length(env->fallback_pool_name); i++) {
+		fr_value_box_t const *pool = &env->fallback_pool_name[i];
+
+		if ((pool->type != FR_TYPE_STRING) || (pool->vb_length == 0)) continue;
+
+		if (pool->vb_length > IPPOOL_MAX_KEY_PREFIX_SIZE) {
+			REDEBUG("Fallback pool name too long.  Expected %u bytes, got %zu bytes",
+				IPPOOL_MAX_KEY_PREFIX_SIZE, pool->vb_length);
+			ret = IPPOOL_RCODE_FAIL;
+			goto finish;
+		}
+
+		/*
+		 *	Scripts can only touch keys in one slot.
+		 */
+		if (same_slot &&
+		    (fr_redis_cluster_slot_by_key(inst->cluster, request,
+						  (uint8_t const *)pool->vb_strvalue, pool->vb_length) != key_slot)) {
+			same_slot = false;
+		}
+
+		pools[num_pools++] = pool;
+	}
+
+	if ((num_pools > 1) && same_slot) {
+		char	*fallback, *p;
+		size_t	len = 0;
+
+		for (i = 1; i < num_pools; i++) len += pools[i]->vb_length + 1;
+
+		MEM(p = fallback = talloc_array(pools, char, len));
+		for (i = 1; i < num_pools; i++) {
+			memcpy(p, pools[i]->vb_strvalue, pools[i]->vb_length);
+			p += pools[i]->vb_length;
+			*p++ = '\0';
+		}
+
+		status = redis_ippool_alloc_script(&reply, inst, request, env, lease_time,
+						   pools[0], fallback, len - 1);
+		if (status == REDIS_RCODE_SUCCESS) {
+			ret = redis_ippool_alloc_result(request, env, reply, pools, num_pools);
+			goto finish;
+		}
+
+		/*
+		 *	Only retry if the server couldn't run the script
+		 *	against keys from several slots, e.g. a proxy
+		 *	which doesn't hash the key names the same way.
+		 *	Any other error would just happen again.
+		 */
+		if (!ippool_script_cross_slot(reply)) {
+			fr_redis_reply_free(&reply);
+			ret = IPPOOL_RCODE_FAIL;
+			goto finish;
+		}
+		fr_redis_reply_free(&reply);
+
+		RWDEBUG("Server refused to allocate from all pools at once, trying each pool in turn");
+	}
+
+	for (i = 0; i < num_pools; i++) {
+		if (i > 0) RDEBUG2("Trying fallback pool \"%pV\"", pools[i]);
+
+		status = redis_ippool_alloc_script(&reply, inst, request, env, lease_time, pools[i], "", 0);
+		if (status != REDIS_RCODE_SUCCESS) {
+			fr_redis_reply_free(&reply);
+			ret = IPPOOL_RCODE_FAIL;
+			goto finish;
+		}
+
+		ret = redis_ippool_alloc_result(request, env, reply, &pools[i], 1);
+		if (ret != IPPOOL_RCODE_POOL_EMPTY) break;
+	}
+
+finish:
+	talloc_free(pools);
+	return ret;
+}
+
 /** Update an existing IP address in a pool
  *
  */
@@ -1087,6 +1452,143 @@ finish:
 	return ret;
 }
 
+/** Process one batch of results from a bulk release or update script
+ *
+ * @param[in] request		The current request.
+ * @param[in] reply		from the script.
+ * @param[in,out] count		Incremented by the number of leases changed.
+ * @param[out] offset		Where the next batch should start.
+ * @param[out] more		Whether there are more leases to check.
+ * @return the rcode from the script, or IPPOOL_RCODE_FAIL if the reply was malformed.
+ */
+static ippool_rcode_t redis_ippool_bulk_result(request_t *request, redisReply const *reply,
+					       uint64_t *count, uint64_t *offset, bool *more)
+{
+	ippool_rcode_t	ret;
+
+	if ((reply->type != REDIS_REPLY_ARRAY) || (reply->elements < 4)) {
+		REDEBUG("Expected result to be array of 4 elements got \"%s\"",
+			fr_table_str_by_value(redis_reply_types, reply->type, "<UNKNOWN>"));
+		return IPPOOL_RCODE_FAIL;
+	}
+
+	if ((reply->element[0]->type != REDIS_REPLY_INTEGER) ||
+	    (reply->element[1]->type != REDIS_REPLY_INTEGER) ||
+	    (reply->element[2]->type != REDIS_REPLY_INTEGER) ||
+	    (reply->element[3]->type != REDIS_REPLY_INTEGER)) {
+		REDEBUG("Server returned unexpected types in result");
+		return IPPOOL_RCODE_FAIL;
+	}
+
+	ret = reply->element[0]->integer;
+	if (ret < 0) return ret;
+
+	*count += reply->element[1]->integer;
+	*offset = reply->element[2]->integer;
+	*more = (reply->element[3]->integer != 0);
+
+	return ret;
+}
+
+/** Release all the leases associated with a gateway
+ *
+ * The pool is checked in batches of #IPPOOL_BULK_RELEASE_BATCH leases, so that
+ * large pools don't block the Redis server for the whole sweep.
+ */
+static ippool_rcode_t redis_ippool_bulk_release(rlm_redis_ippool_t const *inst, request_t *request,
+						fr_value_box_t const *key_prefix,
+						fr_value_box_t const *gateway_id,
+						uint64_t *released)
+{
+	struct			timeval now;
+	redisReply		*reply = NULL;
+
+	fr_redis_rcode_t	status;
+	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
+	uint64_t		offset = 0;
+	bool			more = true;
+
+	*released = 0;
+	now = fr_time_to_timeval(fr_time());
+
+	while (more) {
+		status = ippool_script(&reply, request, inst->cluster,
+				       (uint8_t const *)key_prefix->vb_strvalue, key_prefix->vb_length,
+				       inst->wait_num, inst->wait_timeout,
+				       lua_bulk_release_digest, lua_bulk_release_cmd,
+				       "EVALSHA %s 1 %b %u %b %" PRIu64 " %u",
+				       lua_bulk_release_digest,
+				       (uint8_t const *)key_prefix->vb_strvalue, key_prefix->vb_length,
+				       (unsigned int)now.tv_sec,
+				       (uint8_t const *)gateway_id->vb_strvalue, gateway_id->vb_length,
+				       offset, IPPOOL_BULK_RELEASE_BATCH);
+		if (status != REDIS_RCODE_SUCCESS) {
+			ret = IPPOOL_RCODE_FAIL;
+			goto finish;
+		}
+
+		ret = redis_ippool_bulk_result(request, reply, released, &offset, &more);
+		if (ret < 0) goto finish;
+
+		fr_redis_reply_free(&reply);
+	}
+
+finish:
+	fr_redis_reply_free(&reply);
+
+	return ret;
+}
+
+/** Extend all the leases associated with a gateway
+ *
+ * Used when a gateway reports that its sessions are still active, so each
+ * lease doesn't have to be updated individually.  As with bulk release, the
+ * pool is checked in batches of #IPPOOL_BULK_RELEASE_BATCH leases.
+ */
+static ippool_rcode_t redis_ippool_bulk_update(rlm_redis_ippool_t const *inst, request_t *request,
+					       fr_value_box_t const *key_prefix,
+					       fr_value_box_t const *gateway_id,
+					       uint32_t lease_time, uint64_t *updated)
+{
+	struct			timeval now;
+	redisReply		*reply = NULL;
+
+	fr_redis_rcode_t	status;
+	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
+	uint64_t		offset = 0;
+	bool			more = true;
+
+	*updated = 0;
+	now = fr_time_to_timeval(fr_time());
+
+	while (more) {
+		status = ippool_script(&reply, request, inst->cluster,
+				       (uint8_t const *)key_prefix->vb_strvalue, key_prefix->vb_length,
+				       inst->wait_num, inst->wait_timeout,
+				       lua_bulk_update_digest, lua_bulk_update_cmd,
+				       "EVALSHA %s 1 %b %u %u %b %" PRIu64 " %u",
+				       lua_bulk_update_digest,
+				       (uint8_t const *)key_prefix->vb_strvalue, key_prefix->vb_length,
+				       (unsigned int)now.tv_sec, lease_time,
+				       (uint8_t const *)gateway_id->vb_strvalue, gateway_id->vb_length,
+				       offset, IPPOOL_BULK_RELEASE_BATCH);
+		if (status != REDIS_RCODE_SUCCESS) {
+			ret = IPPOOL_RCODE_FAIL;
+			goto finish;
+		}
+
+		ret = redis_ippool_bulk_result(request, reply, updated, &offset, &more);
+		if (ret < 0) goto finish;
+
+		fr_redis_reply_free(&reply);
+	}
+
+finish:
+	fr_redis_reply_free(&reply);
+
+	return ret;
+}
+
 #define CHECK_POOL_NAME \
 	if (env->pool_name.vb_length > IPPOOL_MAX_KEY_PREFIX_SIZE) { \
 		REDEBUG("Pool name too long.  Expected %u bytes, got %ld bytes", \
@@ -1227,11 +1729,65 @@ static unlang_action_t CC_HINT(nonnull) mod_release(unlang_result_t *p_result, m
 	}
 }
 
-static unlang_action_t CC_HINT(nonnull) mod_bulk_release(unlang_result_t *p_result, UNUSED module_ctx_t const *mctx,
+static unlang_action_t CC_HINT(nonnull) mod_bulk_release(unlang_result_t *p_result, module_ctx_t const *mctx,
 							 request_t *request)
 {
-	RDEBUG2("Bulk release not yet implemented");
-	RETURN_UNLANG_NOOP;
+	rlm_redis_ippool_t const		*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_redis_ippool_t);
+	redis_ippool_bulk_release_call_env_t	*env = talloc_get_type_abort(mctx->env_data, redis_ippool_bulk_release_call_env_t);
+	uint64_t				released;
+
+	CHECK_POOL_NAME
+
+	if (env->gateway_id.vb_length == 0) {
+		RDEBUG2("Empty gateway.  Doing nothing");
+		RETURN_UNLANG_NOOP;
+	}
+
+	ippool_action_print(request, POOL_ACTION_BULK_RELEASE, L_DBG_LVL_2, &env->pool_name,
+			    NULL, NULL, &env->gateway_id, 0);
+	switch (redis_ippool_bulk_release(inst, request, &env->pool_name, &env->gateway_id, &released)) {
+	case IPPOOL_RCODE_SUCCESS:
+		if (!released) {
+			RDEBUG2("No leases found for gateway");
+			RETURN_UNLANG_NOTFOUND;
+		}
+		RDEBUG2("Released %" PRIu64 " lease(s)", released);
+		RETURN_UNLANG_UPDATED;
+
+	default:
+		RETURN_UNLANG_FAIL;
+	}
+}
+
+static unlang_action_t CC_HINT(nonnull) mod_bulk_update(unlang_result_t *p_result, module_ctx_t const *mctx,
+							request_t *request)
+{
+	rlm_redis_ippool_t const		*inst = talloc_get_type_abort_const(mctx->mi->data, rlm_redis_ippool_t);
+	redis_ippool_bulk_update_call_env_t	*env = talloc_get_type_abort(mctx->env_data, redis_ippool_bulk_update_call_env_t);
+	uint64_t				updated;
+
+	CHECK_POOL_NAME
+
+	if (env->gateway_id.vb_length == 0) {
+		RDEBUG2("Empty gateway.  Doing nothing");
+		RETURN_UNLANG_NOOP;
+	}
+
+	ippool_action_print(request, POOL_ACTION_BULK_UPDATE, L_DBG_LVL_2, &env->pool_name,
+			    NULL, NULL, &env->gateway_id, env->lease_time.vb_uint32);
+	switch (redis_ippool_bulk_update(inst, request, &env->pool_name, &env->gateway_id,
+					 env->lease_time.vb_uint32, &updated)) {
+	case IPPOOL_RCODE_SUCCESS:
+		if (!updated) {
+			RDEBUG2("No leases found for gateway");
+			RETURN_UNLANG_NOTFOUND;
+		}
+		RDEBUG2("Updated %" PRIu64 " lease(s)", updated);
+		RETURN_UNLANG_UPDATED;
+
+	default:
+		RETURN_UNLANG_FAIL;
+	}
 }
 
 static int mod_instantiate(module_inst_ctx_t const *mctx)
@@ -1272,6 +1828,16 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		fr_sha1_update(&sha1_ctx, (uint8_t const *)lua_release_cmd, sizeof(lua_release_cmd) - 1);
 		fr_sha1_final(digest, &sha1_ctx);
 		fr_base16_encode(&FR_SBUFF_OUT(lua_release_digest, sizeof(lua_release_digest)), &FR_DBUFF_TMP(digest, sizeof(digest)));
+
+		fr_sha1_init(&sha1_ctx);
+		fr_sha1_update(&sha1_ctx, (uint8_t const *)lua_bulk_release_cmd, sizeof(lua_bulk_release_cmd) - 1);
+		fr_sha1_final(digest, &sha1_ctx);
+		fr_base16_encode(&FR_SBUFF_OUT(lua_bulk_release_digest, sizeof(lua_bulk_release_digest)), &FR_DBUFF_TMP(digest, sizeof(digest)));
+
+		fr_sha1_init(&sha1_ctx);
+		fr_sha1_update(&sha1_ctx, (uint8_t const *)lua_bulk_update_cmd, sizeof(lua_bulk_update_cmd) - 1);
+		fr_sha1_final(digest, &sha1_ctx);
+		fr_base16_encode(&FR_SBUFF_OUT(lua_bulk_update_digest, sizeof(lua_bulk_update_digest)), &FR_DBUFF_TMP(digest, sizeof(digest)));
 	}
 
 	return 0;
@@ -1317,6 +1883,7 @@ module_rlm_t rlm_redis_ippool = {
 			{ .section = SECTION_NAME("renew", NULL), .method = mod_update, .method_env = &redis_ippool_update_method_env },				/* verb */
 			{ .section = SECTION_NAME("release", NULL), .method = mod_release, .method_env = &redis_ippool_release_method_env },				/* verb */
 			{ .section = SECTION_NAME("bulk-release", NULL), .method = mod_bulk_release, .method_env = &redis_ippool_bulk_release_method_env },		/* verb */
+			{ .section = SECTION_NAME("bulk-update", NULL), .method = mod_bulk_update, .method_env = &redis_ippool_bulk_update_method_env },		/* verb */
 			MODULE_BINDING_TERMINATOR
 		}
 	}
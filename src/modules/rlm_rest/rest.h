@@ -170,6 +170,10 @@ typedef struct {
 
 	fr_curl_conn_config_t	conn_config;	//!< Configuration of slab allocated connection handles.
 
+	fr_curl_share_config_t	share_config;	//!< Which caches to share between threads.
+	fr_curl_share_t		*share;		//!< Caches shared by the handles of all threads.
+						///< NULL if nothing is shared.
+
 	rlm_rest_section_t	xlat;		//!< Configuration specific to xlat.
 
  	fr_rb_tree_t		sections;	//!< Tree of sections with module call found by call_env parsing
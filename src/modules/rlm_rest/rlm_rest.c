@@ -160,6 +160,8 @@ static const conf_parser_t module_config[] = {
 
 	{ FR_CONF_OFFSET_SUBSECTION("connection", 0, rlm_rest_t, conn_config, fr_curl_conn_config) },
 
+	{ FR_CONF_OFFSET_SUBSECTION("share", 0, rlm_rest_t, share_config, fr_curl_share_config) },
+
 #ifdef CURLPIPE_MULTIPLEX
 	{ FR_CONF_OFFSET("multiplex", rlm_rest_t, multiplex), .dflt = "yes" },
 #endif
@@ -1132,6 +1134,8 @@ static int rest_conn_alloc(fr_curl_io_request_t *randle, void *uctx)
 	randle->uctx = curl_ctx;
 	talloc_set_destructor(randle, _mod_conn_free);
 
+	if (fr_curl_easy_share_init(randle, inst->share) < 0) return -1;
+
 	rest_slab_element_set_destructor(randle,  _rest_request_cleanup, NULL);
 
 	return 0;
@@ -1229,6 +1233,24 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	inst->conn_config.reuse.num_children = 1;
 	inst->conn_config.reuse.child_pool_size = sizeof(rlm_rest_curl_context_t);
 
+	if (inst->share_config.dns || inst->share_config.tls_session) {
+		inst->share = fr_curl_share_alloc(&inst->share_config);
+		if (!inst->share) return -1;
+	}
+
+	return 0;
+}
+
+/** Free the share handle
+ *
+ * Called after all threads have been detached, so no easy handles remain.
+ */
+static int mod_detach(module_detach_ctx_t const *mctx)
+{
+	rlm_rest_t *inst = talloc_get_type_abort(mctx->mi->data, rlm_rest_t);
+
+	TALLOC_FREE(inst->share);
+
 	return 0;
 }
 
@@ -1371,6 +1393,7 @@ module_rlm_t rlm_rest = {
 		.onload			= mod_load,
 		.bootstrap		= mod_bootstrap,
 		.instantiate		= mod_instantiate,
+		.detach			= mod_detach,
 		.thread_instantiate	= mod_thread_instantiate,
 		.thread_detach		= mod_thread_detach
 	},
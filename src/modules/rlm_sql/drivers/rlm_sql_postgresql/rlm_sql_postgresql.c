@@ -43,6 +43,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/skip.h>
 
 #include <sys/stat.h>
 
@@ -63,23 +64,51 @@ RCSID("$Id$")
 typedef struct {
 	char const	*db_string;		//!< Text based configuration string.
 	bool		send_application_name;	//!< Whether we send the application name to PostgreSQL.
+	bool		pipeline;		//!< Whether to send many queries on each connection.
 	fr_trie_t	*states;		//!< sql state trie.
 } rlm_sql_postgresql_t;
 
 typedef struct {
 	PGconn		*db;
-	PGresult	*result;
-	int		cur_row;
-	int		num_fields;
-	int		affected_rows;
-	char		**row;
 	connection_t	*conn;			//!< Generic connection structure for this connection.
 	int		fd;			//!< fd for this connection's I/O events.
-	fr_sql_query_t	*query_ctx;		//!< Current query running on this connection.
+	fr_dlist_head_t	queries;		//!< Queries which have been sent, in the order their
+						///< results will be returned.
+	bool		pipeline_allowed;	//!< Whether more than one query may be in flight.
+	bool		pipeline;		//!< Whether the connection is in pipeline mode.
+	bool		flush_pending;		//!< libpq has buffered data which couldn't be written yet.
+	fr_sql_query_t	*txn;			//!< Query which has an explicit transaction open on
+						///< this connection.
+
+	fr_event_list_t			*el;		//!< Event list I/O events are registered with.
+	trunk_connection_t		*tconn;		//!< Trunk connection for this connection.
+	trunk_connection_event_t	notify_on;	//!< Which events the trunk last asked for.
 } rlm_sql_postgres_conn_t;
 
+/** Per-query state
+ *
+ * In pipeline mode a connection may have many queries outstanding, so
+ * results are stored with the query rather than with the connection.
+ *
+ * Whilst the query is outstanding this is parented by the connection,
+ * once the result is returned it is parented by the query context.
+ */
+typedef struct {
+	fr_dlist_t		entry;			//!< Entry in the connection's list of outstanding queries.
+	fr_sql_query_t		*query_ctx;		//!< Query this relates to.  NULL if the query was
+							///< cancelled and the result should be discarded.
+	PGresult		*result;
+	bool			received;		//!< Received a result since the last NULL result.
+	int			stmt;			//!< Index of the next batch statement to return a result.
+	int			cur_row;
+	int			num_fields;
+	int			affected_rows;
+	char			**row;
+} rlm_sql_postgres_query_t;
+
 static conf_parser_t driver_config[] = {
 	{ FR_CONF_OFFSET("send_application_name", rlm_sql_postgresql_t, send_application_name), .dflt = "yes" },
+	{ FR_CONF_OFFSET("pipeline", rlm_sql_postgresql_t, pipeline), .dflt = "no" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -143,13 +172,19 @@ static int affected_rows(PGresult * result)
 	return atoi(PQcmdTuples(result));
 }
 
-/** Free the row of the current result that's stored in the conn struct
+/** Free the row of the current result that's stored in the query struct
  *
  */
-static void free_result_row(rlm_sql_postgres_conn_t *conn)
+static void free_result_row(rlm_sql_postgres_query_t *pq)
 {
-	TALLOC_FREE(conn->row);
-	conn->num_fields = 0;
+	TALLOC_FREE(pq->row);
+	pq->num_fields = 0;
+}
+
+static int _sql_query_free(rlm_sql_postgres_query_t *pq)
+{
+	if (pq->result) PQclear(pq->result);
+	return 0;
 }
 
 #if defined(PG_DIAG_SQLSTATE) && defined(PG_DIAG_MESSAGE_PRIMARY)
@@ -318,6 +353,16 @@ static connection_state_t _sql_connection_init(void **h, connection_t *conn, voi
 	MEM(c = talloc_zero(conn, rlm_sql_postgres_conn_t));
 	c->conn = conn;
 	c->fd = -1;
+	fr_dlist_init(&c->queries, rlm_sql_postgres_query_t, entry);
+
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+	/*
+	 *	Only use pipeline mode if it's enabled, and the trunk
+	 *	may send more than one query at a time on this
+	 *	connection.
+	 */
+	c->pipeline_allowed = inst->pipeline && (sql->config.trunk_conf.max_req_per_conn != 1);
+#endif
 
 	DEBUG2("Starting connection to PostgreSQL server using parameters: %s", inst->db_string);
 
@@ -368,193 +413,664 @@ static connection_state_t _sql_connection_init(void **h, connection_t *conn, voi
 
 static void _sql_connection_close(fr_event_list_t *el, void *h, UNUSED void *uctx)
 {
-	rlm_sql_postgres_conn_t	*c = talloc_get_type_abort(h, rlm_sql_postgres_conn_t);
+	rlm_sql_postgres_conn_t		*c = talloc_get_type_abort(h, rlm_sql_postgres_conn_t);
+	rlm_sql_postgres_query_t	*pq;
 
 	if (c->fd >= 0) {
 		fr_event_fd_delete(el, c->fd, FR_EVENT_FILTER_IO);
 		c->fd = -1;
 	}
 
-	if (c->result) {
-		PQclear(c->result);
-		c->result = NULL;
+	/*
+	 *	Any results still outstanding will never arrive.
+	 */
+	while ((pq = fr_dlist_pop_head(&c->queries))) {
+		if (pq->query_ctx) pq->query_ctx->uctx = NULL;
+		talloc_free(pq);
 	}
 
 	/* PQfinish also frees the memory used by the PGconn structure */
 	PQfinish(c->db);
-	c->query_ctx = NULL;
 	talloc_free(h);
 }
 
 SQL_TRUNK_CONNECTION_ALLOC
 
-TRUNK_NOTIFY_FUNC(sql_trunk_connection_notify, rlm_sql_postgres_conn_t)
+static void _conn_writeable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx);
+static void _conn_readable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx);
+static void _conn_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, int fd_errno, void *uctx);
+
+/** Register I/O events for the connection
+ *
+ * These are the events the trunk asked for, plus a write event if
+ * libpq has data it still needs to send.
+ */
+static int sql_conn_events_update(rlm_sql_postgres_conn_t *c)
+{
+	fr_event_fd_cb_t	read_fn = NULL, write_fn = NULL;
+
+	if (c->notify_on & TRUNK_CONN_EVENT_READ) read_fn = _conn_readable;
+	if ((c->notify_on & TRUNK_CONN_EVENT_WRITE) || c->flush_pending) write_fn = _conn_writeable;
+
+	if (!read_fn && !write_fn) {
+		fr_event_fd_delete(c->el, c->fd, FR_EVENT_FILTER_IO);
+		return 0;
+	}
+
+	if (fr_event_fd_insert(c, NULL, c->el, c->fd, read_fn, write_fn, _conn_error, c->tconn) < 0) {
+		PERROR("Failed inserting FD event");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Push any data libpq has buffered out to the server
+ *
+ * The connection is non-blocking, so a large pipeline may not be
+ * written in one go.  If data remains, a write event is registered
+ * so the rest is sent when the socket is writable.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if the connection has failed.
+ */
+static int sql_conn_flush(rlm_sql_postgres_conn_t *c)
+{
+	bool	was_pending = c->flush_pending;
+	int	ret;
+
+	ret = PQflush(c->db);
+	if (ret < 0) {
+		ERROR("Failed sending queries: %s", PQerrorMessage(c->db));
+		return -1;
+	}
+
+	c->flush_pending = (ret == 1);
+	if ((was_pending != c->flush_pending) && (sql_conn_events_update(c) < 0)) return -1;
+
+	return 0;
+}
+
+static void _conn_writeable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	trunk_connection_t	*tconn = talloc_get_type_abort(uctx, trunk_connection_t);
+	rlm_sql_postgres_conn_t	*c = talloc_get_type_abort(tconn->conn->h, rlm_sql_postgres_conn_t);
+
+	if (c->flush_pending && (sql_conn_flush(c) < 0)) {
+		trunk_connection_signal_reconnect(tconn, CONNECTION_FAILED);
+		return;
+	}
+
+	if (c->notify_on & TRUNK_CONN_EVENT_WRITE) trunk_connection_signal_writable(tconn);
+}
+
+static void _conn_readable(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	trunk_connection_t	*tconn = talloc_get_type_abort(uctx, trunk_connection_t);
+
+	trunk_connection_signal_readable(tconn);
+}
 
+static void _conn_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, int fd_errno, void *uctx)
+{
+	trunk_connection_t	*tconn = talloc_get_type_abort(uctx, trunk_connection_t);
+
+	if (fd_errno) ERROR("%s - Connection failed: %s", tconn->conn->name, fr_syserror(fd_errno));
+	connection_signal_reconnect(tconn->conn, CONNECTION_FAILED);
+}
+
+/** Trunk notification function
+ *
+ * As #TRUNK_NOTIFY_FUNC, but keeps a write event registered whilst
+ * libpq has unsent data.
+ */
 CC_NO_UBSAN(function) /* UBSAN: false positive - public vs private connection_t trips --fsanitize=function*/
-static void sql_trunk_request_mux(UNUSED fr_event_list_t *el, trunk_connection_t *tconn,
-				  connection_t *conn, UNUSED void *uctx)
+static void sql_trunk_connection_notify(trunk_connection_t *tconn, connection_t *conn,
+					fr_event_list_t *el, trunk_connection_event_t notify_on, UNUSED void *uctx)
 {
-	rlm_sql_postgres_conn_t	*sql_conn = talloc_get_type_abort(conn->h, rlm_sql_postgres_conn_t);
-	request_t		*request;
-	trunk_request_t		*treq;
-	fr_sql_query_t		*query_ctx;
-	int			err;
+	rlm_sql_postgres_conn_t	*c = talloc_get_type_abort(conn->h, rlm_sql_postgres_conn_t);
 
-	if (trunk_connection_pop_request(&treq, tconn) != 0) return;
-	if (!treq) return;
+	c->el = el;
+	c->tconn = tconn;
+	c->notify_on = notify_on;
 
-	query_ctx = talloc_get_type_abort(treq->preq, fr_sql_query_t);
-	request = query_ctx->request;
+	if (sql_conn_events_update(c) < 0) trunk_connection_signal_reconnect(tconn, CONNECTION_FAILED);
+}
 
-	switch (query_ctx->status) {
-	case SQL_QUERY_PREPARED:
-		ROPTIONAL(RDEBUG2, DEBUG2, "Executing query: %s", query_ctx->query_str);
-		err = PQsendQuery(sql_conn->db, query_ctx->query_str);
-		query_ctx->tconn = tconn;
-		if (!err) {
-			ROPTIONAL(RERROR, ERROR, "Failed to send query: %s", PQerrorMessage(sql_conn->db));
-			trunk_request_signal_fail(treq);
-			return;
-		}
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+/** Check whether a query starts with an SQL keyword
+ *
+ * @return
+ *	- A pointer to the text following the keyword.
+ *	- NULL if the query doesn't start with the keyword.
+ */
+static char const *sql_keyword(char const *query, char const *keyword)
+{
+	size_t	len = strlen(keyword);
 
-		query_ctx->status = SQL_QUERY_SUBMITTED;
-		sql_conn->query_ctx = query_ctx;
-		trunk_request_signal_sent(treq);
+	fr_skip_whitespace(query);
+	if (strncasecmp(query, keyword, len) != 0) return NULL;
+	if (isalnum((uint8_t)query[len]) || (query[len] == '_')) return NULL;
+
+	return query + len;
+}
+
+/** Whether a query opens an explicit transaction
+ */
+static bool sql_query_begins_txn(char const *query)
+{
+	char const *p;
+
+	if (sql_keyword(query, "BEGIN")) return true;
+
+	p = sql_keyword(query, "START");
+	return p && sql_keyword(p, "TRANSACTION");
+}
+
+/** Whether a query ends an explicit transaction
+ *
+ * "ROLLBACK TO SAVEPOINT" leaves the transaction open.
+ */
+static bool sql_query_ends_txn(char const *query)
+{
+	char const *p;
+
+	if (sql_keyword(query, "COMMIT") || sql_keyword(query, "END") || sql_keyword(query, "ABORT")) return true;
+
+	p = sql_keyword(query, "ROLLBACK");
+	return p && !sql_keyword(p, "TO");
+}
+
+/** Roll back a transaction which was abandoned before it was committed
+ *
+ * The result is discarded when it arrives.
+ */
+static void sql_txn_abandon(rlm_sql_postgres_conn_t *sql_conn)
+{
+	rlm_sql_postgres_query_t *pq;
+
+	WARN("Transaction abandoned, rolling back");
+
+	sql_conn->txn = NULL;
+
+	if (!PQsendQueryParams(sql_conn->db, "ROLLBACK", 0, NULL, NULL, NULL, NULL, 0) ||
+	    !PQpipelineSync(sql_conn->db)) {
+		ERROR("Failed to send rollback: %s", PQerrorMessage(sql_conn->db));
+		trunk_connection_signal_reconnect(sql_conn->tconn, CONNECTION_FAILED);
 		return;
+	}
 
-	default:
+	MEM(pq = talloc_zero(sql_conn, rlm_sql_postgres_query_t));
+	talloc_set_destructor(pq, _sql_query_free);
+	fr_dlist_insert_tail(&sql_conn->queries, pq);
+
+	if (sql_conn_flush(sql_conn) < 0) {
+		trunk_connection_signal_reconnect(sql_conn->tconn, CONNECTION_FAILED);
 		return;
 	}
+
+	trunk_connection_signal_active(sql_conn->tconn);
+}
+#endif
+
+/** Send a single query
+ *
+ * In pipeline mode each query is followed by a sync point, so that
+ * an error in one query doesn't abort the queries which follow it.
+ */
+static int sql_query_send(rlm_sql_postgres_conn_t *sql_conn, fr_sql_query_t *query_ctx)
+{
+	request_t			*request = query_ctx->request;
+	rlm_sql_postgres_query_t	*pq;
+
+	ROPTIONAL(RDEBUG2, DEBUG2, "Executing query: %s", query_ctx->query_str);
+
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+	/*
+	 *	Statements before a sync point run in a single
+	 *	implicit transaction, so a batch is sent as separate
+	 *	statements with one sync point at the end.  This
+	 *	gives us the rows affected by each.
+	 */
+	if (sql_conn->pipeline) {
+		size_t	i, num = query_ctx->batch ? talloc_array_length(query_ctx->batch) : 0;
+
+		if (num) {
+			for (i = 0; i < num; i++) {
+				if (!PQsendQueryParams(sql_conn->db, query_ctx->batch[i], 0, NULL, NULL, NULL, NULL, 0)) goto error;
+			}
+		} else if (!PQsendQueryParams(sql_conn->db, query_ctx->query_str, 0, NULL, NULL, NULL, NULL, 0)) {
+			goto error;
+		}
+
+		if (!PQpipelineSync(sql_conn->db)) {
+		error:
+			ROPTIONAL(RERROR, ERROR, "Failed to send query: %s", PQerrorMessage(sql_conn->db));
+			return -1;
+		}
+	} else
+#endif
+	/*
+	 *	Multiple statements sent in one simple query also run
+	 *	in a single implicit transaction, returning a result
+	 *	for each.
+	 */
+	if (!PQsendQuery(sql_conn->db, query_ctx->query_str)) goto error;
+
+	/*
+	 *	Free the state from any previous query run
+	 *	with this query context.
+	 */
+	if (query_ctx->uctx) TALLOC_FREE(query_ctx->uctx);
+
+	MEM(pq = talloc_zero(sql_conn, rlm_sql_postgres_query_t));
+	talloc_set_destructor(pq, _sql_query_free);
+	pq->query_ctx = query_ctx;
+	query_ctx->uctx = pq;
+
+	fr_dlist_insert_tail(&sql_conn->queries, pq);
+
+	return 0;
 }
 
 CC_NO_UBSAN(function) /* UBSAN: false positive - public vs private connection_t trips --fsanitize=function*/
-static void sql_trunk_request_demux(UNUSED fr_event_list_t *el, UNUSED trunk_connection_t *tconn,
-				    connection_t *conn, UNUSED void *uctx)
+static void sql_trunk_request_mux(fr_event_list_t *el, trunk_connection_t *tconn,
+				  connection_t *conn, UNUSED void *uctx)
 {
 	rlm_sql_postgres_conn_t	*sql_conn = talloc_get_type_abort(conn->h, rlm_sql_postgres_conn_t);
-	rlm_sql_postgresql_t	*inst;
+	trunk_request_t		*treq;
 	fr_sql_query_t		*query_ctx;
-	request_t		*request;
-	PGresult		*tmp_result;
-	ExecStatusType		status;
-	int			numfields;
 
-	query_ctx = sql_conn->query_ctx;
-	request = query_ctx->request;
-	inst = talloc_get_type_abort(query_ctx->inst->driver_submodule->data, rlm_sql_postgresql_t);
+	sql_conn->el = el;
+	sql_conn->tconn = tconn;
 
-	switch (query_ctx->status) {
-	case SQL_QUERY_SUBMITTED:
-		if (PQconsumeInput(sql_conn->db) == 0) {
-			ROPTIONAL(RERROR, ERROR, "SQL query failed: %s", PQerrorMessage(sql_conn->db));
-			query_ctx->rcode = RLM_SQL_ERROR;
-			break;
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+	/*
+	 *	Pipeline mode can only be entered when the connection
+	 *	is idle, so we wait until the first query is sent
+	 *	(after any "open_query" has run).
+	 */
+	if (sql_conn->pipeline_allowed && !sql_conn->pipeline && (fr_dlist_num_elements(&sql_conn->queries) == 0)) {
+		if (PQenterPipelineMode(sql_conn->db)) {
+			DEBUG2("Entered pipeline mode");
+			sql_conn->pipeline = true;
+		} else {
+			WARN("Failed entering pipeline mode: %s", PQerrorMessage(sql_conn->db));
+			sql_conn->pipeline_allowed = false;
 		}
-		if (PQisBusy(sql_conn->db)) return;
-
-		query_ctx->status = SQL_QUERY_RETURNED;
+	}
+#endif
 
-		sql_conn->result = PQgetResult(sql_conn->db);
+	while (trunk_connection_pop_request(&treq, tconn) == 0) {
+		if (!treq) break;
 
-		/* Discard results for appended queries */
-		while ((tmp_result = PQgetResult(sql_conn->db)) != NULL)
-			PQclear(tmp_result);
+		query_ctx = talloc_get_type_abort(treq->preq, fr_sql_query_t);
+		if (query_ctx->status != SQL_QUERY_PREPARED) break;
 
+#ifdef HAVE_PGRES_PIPELINE_SYNC
 		/*
-		 *  As this error COULD be a connection error OR an out-of-memory
-		 *  condition return value WILL be wrong SOME of the time
-		 *  regardless! Pick your poison...
+		 *	Only the query which opened the transaction
+		 *	may send statements until it's closed.
 		 */
-		if (!sql_conn->result) {
-			ROPTIONAL(RERROR, ERROR, "Failed getting query result: %s", PQerrorMessage(sql_conn->db));
-			query_ctx->rcode = RLM_SQL_RECONNECT;
+		if (sql_conn->txn && (sql_conn->txn != query_ctx)) break;
+#endif
+
+		query_ctx->tconn = tconn;
+		if (sql_query_send(sql_conn, query_ctx) < 0) {
+			trunk_request_signal_fail(treq);
 			break;
 		}
 
-		status = PQresultStatus(sql_conn->result);
-		switch (status){
+		query_ctx->status = SQL_QUERY_SUBMITTED;
+		trunk_request_signal_sent(treq);
+
+		if (!sql_conn->pipeline) break;
+
+#ifdef HAVE_PGRES_PIPELINE_SYNC
 		/*
-		 *  Successful completion of a command returning no data.
+		 *	Anything pipelined after a statement which
+		 *	opens a transaction would run inside it.
+		 *	Stop other requests being assigned to this
+		 *	connection, and move any which are waiting
+		 *	elsewhere, until the transaction is closed.
+		 *	Subsequent statements of the transaction are
+		 *	requeued on this connection by rlm_sql.
 		 */
-		case PGRES_COMMAND_OK:
-			/*
-			 *  Affected_rows function only returns the number of affected rows of a command
-			 *  returning no data...
-			 */
-			sql_conn->affected_rows = affected_rows(sql_conn->result);
-			ROPTIONAL(RDEBUG2, DEBUG2, "query affected rows = %i", sql_conn->affected_rows);
+		if (sql_conn->txn) {
+			if (!sql_query_ends_txn(query_ctx->query_str)) break;
+
+			DEBUG3("Transaction closed, accepting requests");
+			sql_conn->txn = NULL;
+			trunk_connection_signal_active(tconn);
+
+		} else if (sql_query_begins_txn(query_ctx->query_str)) {
+			DEBUG3("Transaction opened, no longer accepting requests");
+			sql_conn->txn = query_ctx;
+			trunk_connection_signal_inactive(tconn);
+			(void) trunk_connection_requests_requeue(tconn, TRUNK_REQUEST_STATE_PENDING, 0, false);
 			break;
+		}
+#endif
+	}
+
+	if (sql_conn_flush(sql_conn) < 0) trunk_connection_signal_reconnect(tconn, CONNECTION_FAILED);
+}
+
+/** Process the result of a query, and resume the request which sent it
+ *
+ * @param[in] sql_conn	the query was run on.
+ * @param[in] pq	which has returned, and has been removed from the
+ *			list of outstanding queries.
+ */
+static void sql_query_returned(rlm_sql_postgres_conn_t *sql_conn, rlm_sql_postgres_query_t *pq)
+{
+	rlm_sql_postgresql_t	*inst;
+	fr_sql_query_t		*query_ctx = pq->query_ctx;
+	request_t		*request;
+	ExecStatusType		status;
+	int			numfields;
+
+	/*
+	 *	The query was cancelled, nothing is waiting on the
+	 *	result.
+	 */
+	if (!query_ctx) {
+		talloc_free(pq);
+		return;
+	}
+
+	talloc_steal(query_ctx, pq);
+
+	request = query_ctx->request;
+	inst = talloc_get_type_abort(query_ctx->inst->driver_submodule->data, rlm_sql_postgresql_t);
+
+	query_ctx->status = SQL_QUERY_RETURNED;
+
+	/*
+	 *  As this error COULD be a connection error OR an out-of-memory
+	 *  condition return value WILL be wrong SOME of the time
+	 *  regardless! Pick your poison...
+	 */
+	if (!pq->result) {
+		ROPTIONAL(RERROR, ERROR, "Failed getting query result: %s", PQerrorMessage(sql_conn->db));
+		query_ctx->rcode = RLM_SQL_RECONNECT;
+		goto done;
+	}
+
+	status = PQresultStatus(pq->result);
+	switch (status){
+	/*
+	 *  Successful completion of a command returning no data.
+	 */
+	case PGRES_COMMAND_OK:
 		/*
-		 *  Successful completion of a command returning data (such as a SELECT or SHOW).
+		 *  Affected_rows function only returns the number of affected rows of a command
+		 *  returning no data...
 		 */
+		pq->affected_rows = affected_rows(pq->result);
+		ROPTIONAL(RDEBUG2, DEBUG2, "query affected rows = %i", pq->affected_rows);
+		break;
+	/*
+	 *  Successful completion of a command returning data (such as a SELECT or SHOW).
+	 */
 #ifdef HAVE_PGRES_SINGLE_TUPLE
-		case PGRES_SINGLE_TUPLE:
+	case PGRES_SINGLE_TUPLE:
 #endif
 #ifdef HAVE_PGRES_TUPLES_CHUNK
-		case PGRES_TUPLES_CHUNK:
+	case PGRES_TUPLES_CHUNK:
 #endif
-		case PGRES_TUPLES_OK:
-			sql_conn->cur_row = 0;
-			sql_conn->affected_rows = PQntuples(sql_conn->result);
-			numfields = PQnfields(sql_conn->result); /*Check row storing functions..*/
-			ROPTIONAL(RDEBUG2, DEBUG2, "query returned rows = %i, fields = %i", sql_conn->affected_rows, numfields);
-			break;
+	case PGRES_TUPLES_OK:
+		pq->cur_row = 0;
+		pq->affected_rows = PQntuples(pq->result);
+		numfields = PQnfields(pq->result); /*Check row storing functions..*/
+		ROPTIONAL(RDEBUG2, DEBUG2, "query returned rows = %i, fields = %i", pq->affected_rows, numfields);
+		break;
 
 #ifdef HAVE_PGRES_COPY_BOTH
-		case PGRES_COPY_BOTH:
+	case PGRES_COPY_BOTH:
 #endif
-		case PGRES_COPY_OUT:
-		case PGRES_COPY_IN:
-			DEBUG2("Data transfer started");
-			break;
+	case PGRES_COPY_OUT:
+	case PGRES_COPY_IN:
+		DEBUG2("Data transfer started");
+		break;
 
-		/*
-		 *  Weird.. this shouldn't happen.
-		 */
-		case PGRES_EMPTY_QUERY:
-		case PGRES_BAD_RESPONSE:	/* The server's response was not understood */
-		case PGRES_NONFATAL_ERROR:
-		case PGRES_FATAL_ERROR:
+	/*
+	 *  Weird.. this shouldn't happen.
+	 */
+	case PGRES_EMPTY_QUERY:
+	case PGRES_BAD_RESPONSE:	/* The server's response was not understood */
+	case PGRES_NONFATAL_ERROR:
+	case PGRES_FATAL_ERROR:
 #ifdef HAVE_PGRES_PIPELINE_SYNC
-		case PGRES_PIPELINE_SYNC:
-		case PGRES_PIPELINE_ABORTED:
+	case PGRES_PIPELINE_SYNC:
+	case PGRES_PIPELINE_ABORTED:
 #endif
+		break;
+	}
+
+	query_ctx->rcode = sql_classify_error(inst, status, pq->result);
+
+	/*
+	 *	A batch runs in a single implicit transaction.  In
+	 *	pipeline mode we only get here on its sync point, which
+	 *	commits it.  Otherwise the connection is idle once the
+	 *	transaction has been committed.
+	 */
+	if (query_ctx->batch && (query_ctx->rcode == RLM_SQL_OK)) {
+		query_ctx->batch_committed = sql_conn->pipeline ||
+					     (PQtransactionStatus(sql_conn->db) == PQTRANS_IDLE);
+	}
+
+done:
+	sql_query_resume_waiter(query_ctx);
+}
+
+/** Record a result for a query
+ *
+ * For a batch, the rows affected by each statement are recorded, and
+ * the first error is kept so the batch as a whole can be classified.
+ * Otherwise only the first result is kept, and results for any
+ * appended queries are discarded.
+ */
+static void sql_query_result(rlm_sql_postgres_query_t *pq, PGresult *result)
+{
+	fr_sql_query_t	*query_ctx = pq->query_ctx;
+	ExecStatusType	status = PQresultStatus(result);
+
+	pq->received = true;
+
+	if (!query_ctx || !query_ctx->batch) {
+		if (pq->result) {
+			PQclear(result);
+			return;
+		}
+		pq->result = result;
+		return;
+	}
+
+	if ((size_t)pq->stmt < talloc_array_length(query_ctx->batch)) {
+		switch (status) {
+		case PGRES_COMMAND_OK:
+			query_ctx->batch_affected[pq->stmt] = affected_rows(result);
+			break;
+
+		case PGRES_TUPLES_OK:
+			query_ctx->batch_affected[pq->stmt] = PQntuples(result);
+			break;
+
+		default:
 			break;
 		}
+		pq->stmt++;
+	}
 
-		query_ctx->rcode = sql_classify_error(inst, status, sql_conn->result);
+	if (!pq->result) {
+		pq->result = result;
+		return;
+	}
+
+	switch (PQresultStatus(pq->result)) {
+	case PGRES_COMMAND_OK:
+	case PGRES_TUPLES_OK:
+		if ((status != PGRES_COMMAND_OK) && (status != PGRES_TUPLES_OK)) {
+			PQclear(pq->result);
+			pq->result = result;
+			return;
+		}
 		break;
 
 	default:
-		fr_assert(0);
+		break;
+	}
+
+	PQclear(result);
+}
+
+CC_NO_UBSAN(function) /* UBSAN: false positive - public vs private connection_t trips --fsanitize=function*/
+static void sql_trunk_request_demux(UNUSED fr_event_list_t *el, UNUSED trunk_connection_t *tconn,
+				    connection_t *conn, UNUSED void *uctx)
+{
+	rlm_sql_postgres_conn_t		*sql_conn = talloc_get_type_abort(conn->h, rlm_sql_postgres_conn_t);
+	rlm_sql_postgres_query_t	*pq;
+	PGresult			*result;
+
+	if (PQconsumeInput(sql_conn->db) == 0) {
+		ERROR("SQL query failed: %s", PQerrorMessage(sql_conn->db));
+
+		/*
+		 *	Fail everything which is outstanding, none
+		 *	of it is coming back.
+		 */
+		while ((pq = fr_dlist_pop_head(&sql_conn->queries))) {
+			fr_sql_query_t	*query_ctx = pq->query_ctx;
+
+			if (!query_ctx) {
+				talloc_free(pq);
+				continue;
+			}
+			talloc_steal(query_ctx, pq);
+			query_ctx->rcode = RLM_SQL_ERROR;
+			sql_query_resume_waiter(query_ctx);
+		}
+		return;
 	}
 
-	if (request) unlang_interpret_mark_runnable(request);
+	/*
+	 *	Results are returned in the order the queries were
+	 *	sent.  Each statement produces one or more results
+	 *	followed by NULL.  Outside of pipeline mode that NULL
+	 *	ends the query.  In pipeline mode the query is ended
+	 *	by the result for the sync point which follows it,
+	 *	as a batch is sent as several statements with a single
+	 *	sync point at the end.
+	 *
+	 *	PQgetResult() blocks if no result is available, so
+	 *	we must check PQisBusy() before each call.
+	 */
+	while (!PQisBusy(sql_conn->db)) {
+		pq = fr_dlist_head(&sql_conn->queries);
+
+		result = PQgetResult(sql_conn->db);
+		if (!result) {
+			/*
+			 *	Nothing outstanding, or nothing
+			 *	returned for the current query yet.
+			 */
+			if (!pq || !pq->received) break;
+
+			pq->received = false;
+			if (sql_conn->pipeline) continue;
+
+			fr_dlist_remove(&sql_conn->queries, pq);
+			sql_query_returned(sql_conn, pq);
+			continue;
+		}
+
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+		if (PQresultStatus(result) == PGRES_PIPELINE_SYNC) {
+			PQclear(result);
+			if (!pq) continue;
+
+			fr_dlist_remove(&sql_conn->queries, pq);
+			sql_query_returned(sql_conn, pq);
+			continue;
+		}
+#endif
+
+		/*
+		 *	Discard anything we weren't expecting.
+		 */
+		if (!pq) {
+			PQclear(result);
+			continue;
+		}
+
+		sql_query_result(pq, result);
+	}
 }
 
 CC_NO_UBSAN(function) /* UBSAN: false positive - public vs private connection_t trips --fsanitize=function*/
-static void sql_request_cancel(connection_t *conn, void *preq, trunk_cancel_reason_t reason,
+static void sql_request_cancel(UNUSED connection_t *conn, void *preq, trunk_cancel_reason_t reason,
 			       UNUSED void *uctx)
 {
-	fr_sql_query_t		*query_ctx = talloc_get_type_abort(preq, fr_sql_query_t);
-	rlm_sql_postgres_conn_t	*sql_conn = talloc_get_type_abort(conn->h, rlm_sql_postgres_conn_t);
+	fr_sql_query_t			*query_ctx = talloc_get_type_abort(preq, fr_sql_query_t);
+	rlm_sql_postgres_query_t	*pq = query_ctx->uctx;
 
 	if (!query_ctx->treq) return;
 	if (reason != TRUNK_CANCEL_REASON_SIGNAL) return;
-	if (sql_conn->query_ctx == query_ctx) sql_conn->query_ctx = NULL;
+	if (!pq || !fr_dlist_entry_in_list(&pq->entry)) return;
+
+	/*
+	 *	The result will still arrive, and has to be read
+	 *	so the results for any later queries line up.
+	 *	Leave the entry in place, but discard the result.
+	 */
+	pq->query_ctx = NULL;
+	query_ctx->uctx = NULL;
+}
+
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+/** Roll back any transaction left open by a request which has finished with the connection
+ *
+ */
+CC_NO_UBSAN(function) /* UBSAN: false positive - public vs private connection_t trips --fsanitize=function*/
+static void sql_request_conn_release(connection_t *conn, void *preq, UNUSED void *uctx)
+{
+	rlm_sql_postgres_conn_t	*sql_conn;
+
+	/*
+	 *	The transaction is discarded with the connection.
+	 */
+	if (conn->state != CONNECTION_STATE_CONNECTED) return;
+
+	sql_conn = talloc_get_type_abort(conn->h, rlm_sql_postgres_conn_t);
+	if (sql_conn->txn == preq) sql_txn_abandon(sql_conn);
 }
+#endif
 
 CC_NO_UBSAN(function) /* UBSAN: false positive - public vs private connection_t trips --fsanitize=function*/
 static void sql_request_cancel_mux(UNUSED fr_event_list_t *el, trunk_connection_t *tconn,
 				   connection_t *conn, UNUSED void *uctx)
 {
-	trunk_request_t		*treq;
-	PGcancel		*cancel;
-	rlm_sql_postgres_conn_t	*sql_conn = talloc_get_type_abort(conn->h, rlm_sql_postgres_conn_t);
-	char			errbuf[256];
-	PGresult		*tmp_result;
+	trunk_request_t			*treq;
+	PGcancel			*cancel;
+	rlm_sql_postgres_conn_t		*sql_conn = talloc_get_type_abort(conn->h, rlm_sql_postgres_conn_t);
+	rlm_sql_postgres_query_t	*pq;
+	char				errbuf[256];
+	PGresult			*tmp_result;
+
+	while ((trunk_connection_pop_cancellation(&treq, tconn)) == 0) {
+		if (!treq) return;
+
+		/*
+		 *	Cancelling would abort whichever query the
+		 *	server is currently running, which in
+		 *	pipeline mode may belong to another request.
+		 *	The result is discarded when it arrives.
+		 */
+		if (sql_conn->pipeline) goto complete;
 
-	if ((trunk_connection_pop_cancellation(&treq, tconn)) == 0) {
 		cancel = PQgetCancel(sql_conn->db);
 		if (!cancel) goto complete;
 		if (PQcancel(cancel, errbuf, sizeof(errbuf)) == 0) {
@@ -569,6 +1085,18 @@ static void sql_request_cancel_mux(UNUSED fr_event_list_t *el, trunk_connection_
 		while ((tmp_result = PQgetResult(sql_conn->db)) != NULL)
 			PQclear(tmp_result);
 
+		/*
+		 *	All results have been consumed, so the
+		 *	cancelled query is no longer outstanding.
+		 */
+		while ((pq = fr_dlist_pop_head(&sql_conn->queries))) {
+			if (pq->query_ctx) {
+				talloc_steal(pq->query_ctx, pq);
+				continue;
+			}
+			talloc_free(pq);
+		}
+
 	complete:
 		trunk_request_signal_cancel_complete(treq);
 	}
@@ -579,17 +1107,19 @@ SQL_QUERY_RESUME
 
 static sql_rcode_t sql_fields(char const **out[], fr_sql_query_t *query_ctx, UNUSED rlm_sql_config_t const *config)
 {
-	rlm_sql_postgres_conn_t *conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_postgres_conn_t);
+	rlm_sql_postgres_query_t *pq = query_ctx->uctx;
 
 	int		fields, i;
 	char const	**names;
 
-	fields = PQnfields(conn->result);
+	if (!pq || !pq->result) return RLM_SQL_ERROR;
+
+	fields = PQnfields(pq->result);
 	if (fields <= 0) return RLM_SQL_ERROR;
 
 	MEM(names = talloc_array(query_ctx, char const *, fields));
 
-	for (i = 0; i < fields; i++) names[i] = PQfname(conn->result, i);
+	for (i = 0; i < fields; i++) names[i] = PQfname(pq->result, i);
 	*out = names;
 
 	return RLM_SQL_OK;
@@ -599,28 +1129,29 @@ static unlang_action_t sql_fetch_row(unlang_result_t *p_result, UNUSED request_t
 {
 	fr_sql_query_t		*query_ctx = talloc_get_type_abort(uctx, fr_sql_query_t);
 	int			records, i, len;
-	rlm_sql_postgres_conn_t *conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_postgres_conn_t);
+	rlm_sql_postgres_query_t *pq = query_ctx->uctx;
 
 	query_ctx->row = NULL;
 
 	query_ctx->rcode = RLM_SQL_NO_MORE_ROWS;
-	if (conn->cur_row >= PQntuples(conn->result)) RETURN_UNLANG_OK;
+	if (!pq || !pq->result) RETURN_UNLANG_OK;
+	if (pq->cur_row >= PQntuples(pq->result)) RETURN_UNLANG_OK;
 
-	free_result_row(conn);
+	free_result_row(pq);
 
-	records = PQnfields(conn->result);
-	conn->num_fields = records;
+	records = PQnfields(pq->result);
+	pq->num_fields = records;
 
-	if ((PQntuples(conn->result) > 0) && (records > 0)) {
-		conn->row = talloc_zero_array(conn, char *, records + 1);
+	if ((PQntuples(pq->result) > 0) && (records > 0)) {
+		pq->row = talloc_zero_array(pq, char *, records + 1);
 		for (i = 0; i < records; i++) {
-			if (PQgetisnull(conn->result, conn->cur_row, i)) continue;
-			len = PQgetlength(conn->result, conn->cur_row, i);
-			conn->row[i] = talloc_array(conn->row, char, len + 1);
-			strlcpy(conn->row[i], PQgetvalue(conn->result, conn->cur_row, i), len + 1);
+			if (PQgetisnull(pq->result, pq->cur_row, i)) continue;
+			len = PQgetlength(pq->result, pq->cur_row, i);
+			pq->row[i] = talloc_array(pq->row, char, len + 1);
+			strlcpy(pq->row[i], PQgetvalue(pq->result, pq->cur_row, i), len + 1);
 		}
-		conn->cur_row++;
-		query_ctx->row = conn->row;
+		pq->cur_row++;
+		query_ctx->row = pq->row;
 
 		query_ctx->rcode = RLM_SQL_OK;
 	}
@@ -630,23 +1161,27 @@ static unlang_action_t sql_fetch_row(unlang_result_t *p_result, UNUSED request_t
 
 static sql_rcode_t sql_free_result(fr_sql_query_t *query_ctx, UNUSED rlm_sql_config_t const *config)
 {
-	rlm_sql_postgres_conn_t *conn;
-
-	if (query_ctx->treq && !(query_ctx->treq->state &
-	    (TRUNK_REQUEST_STATE_SENT | TRUNK_REQUEST_STATE_REAPABLE | TRUNK_REQUEST_STATE_COMPLETE))) return RLM_SQL_OK;
-
-	if (!query_ctx->tconn || !query_ctx->tconn->conn || !query_ctx->tconn->conn->h) return RLM_SQL_ERROR;
+	rlm_sql_postgres_query_t *pq = query_ctx->uctx;
 
-	if (!(query_ctx->tconn->state & TRUNK_CONN_PROCESSING)) return RLM_SQL_ERROR;
+	if (!pq) return RLM_SQL_OK;
 
-	conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_postgres_conn_t);
+	/*
+	 *	Still waiting on the result.  The connection owns the
+	 *	query state, and will discard the result when it
+	 *	arrives.
+	 */
+	if (fr_dlist_entry_in_list(&pq->entry)) {
+		pq->query_ctx = NULL;
+		query_ctx->uctx = NULL;
+		return RLM_SQL_OK;
+	}
 
-	if (conn->result != NULL) {
-		PQclear(conn->result);
-		conn->result = NULL;
+	if (pq->result != NULL) {
+		PQclear(pq->result);
+		pq->result = NULL;
 	}
 
-	free_result_row(conn);
+	free_result_row(pq);
 
 	return 0;
 }
@@ -664,13 +1199,27 @@ static sql_rcode_t sql_free_result(fr_sql_query_t *query_ctx, UNUSED rlm_sql_con
 static size_t sql_error(TALLOC_CTX *ctx, sql_log_entry_t out[], size_t outlen,
 			fr_sql_query_t *query_ctx)
 {
-	rlm_sql_postgres_conn_t *conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_postgres_conn_t);
-	char const		*p, *q;
+	rlm_sql_postgres_query_t *pq = query_ctx->uctx;
+	char const		*p = NULL, *q;
 	size_t			i = 0;
 
 	fr_assert(outlen > 0);
 
-	p = PQerrorMessage(conn->db);
+	/*
+	 *	Prefer the error from the query's own result, in
+	 *	pipeline mode the connection's error message may
+	 *	relate to a different query.
+	 */
+	if (pq && pq->result) p = PQresultErrorMessage(pq->result);
+	if (!p || (*p == '\0')) {
+		rlm_sql_postgres_conn_t *conn;
+
+		if (!query_ctx->tconn || !query_ctx->tconn->conn || !query_ctx->tconn->conn->h) return 0;
+
+		conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_postgres_conn_t);
+		p = PQerrorMessage(conn->db);
+	}
+
 	while ((q = strchr(p, '\n'))) {
 		out[i].type = L_ERR;
 		out[i].msg = talloc_typed_asprintf(ctx, "%.*s", (int) (q - p), p);
@@ -688,9 +1237,11 @@ static size_t sql_error(TALLOC_CTX *ctx, sql_log_entry_t out[], size_t outlen,
 
 static int sql_affected_rows(fr_sql_query_t *query_ctx, UNUSED rlm_sql_config_t const *config)
 {
-	rlm_sql_postgres_conn_t *conn = talloc_get_type_abort(query_ctx->tconn->conn->h, rlm_sql_postgres_conn_t);
+	rlm_sql_postgres_query_t *pq = query_ctx->uctx;
 
-	return conn->affected_rows;
+	if (!pq) return -1;
+
+	return pq->affected_rows;
 }
 
 static ssize_t sql_escape_func(request_t *request, char *out, size_t outlen, char const *in, void *arg)
@@ -724,7 +1275,7 @@ static ssize_t sql_escape_func(request_t *request, char *out, size_t outlen, cha
 
 static int mod_instantiate(module_inst_ctx_t const *mctx)
 {
-	rlm_sql_t const		*parent = talloc_get_type_abort(mctx->mi->parent->data, rlm_sql_t);
+	rlm_sql_t		*parent = talloc_get_type_abort(mctx->mi->parent->data, rlm_sql_t);
 	rlm_sql_config_t const	*config = &parent->config;
 	rlm_sql_postgresql_t	*inst = talloc_get_type_abort(mctx->mi->data, rlm_sql_postgresql_t);
 	char 			application_name[NAMEDATALEN];
@@ -829,6 +1380,22 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		if (cs && (sql_state_entries_from_cs(inst->states, cs) < 0)) return -1;
 	}
 
+#ifndef HAVE_PGRES_PIPELINE_SYNC
+	if (inst->pipeline) {
+		cf_log_warn(mctx->mi->conf, "Ignoring \"pipeline = yes\", libpq does not support pipeline mode");
+		inst->pipeline = false;
+	}
+#endif
+
+	/*
+	 *	Outside of pipeline mode a connection can only run
+	 *	one query at a time.
+	 */
+	if (!inst->pipeline) {
+		parent->config.trunk_conf.target_req_per_conn = 1;
+		parent->config.trunk_conf.max_req_per_conn = 1;
+	}
+
 	return 0;
 }
 
@@ -883,7 +1450,11 @@ rlm_sql_driver_t rlm_sql_postgresql = {
 		.config				= driver_config,
 		.instantiate			= mod_instantiate
 	},
-	.flags				= RLM_SQL_RCODE_FLAGS_ALT_QUERY,
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+	.flags				= RLM_SQL_RCODE_FLAGS_ALT_QUERY | RLM_SQL_MULTI_QUERY_CONN | RLM_SQL_BATCH,
+#else
+	.flags				= RLM_SQL_RCODE_FLAGS_ALT_QUERY | RLM_SQL_BATCH,
+#endif
 	.sql_query_resume		= sql_query_resume,
 	.sql_select_query_resume	= sql_query_resume,
 	.sql_fields			= sql_fields,
@@ -902,6 +1473,9 @@ rlm_sql_driver_t rlm_sql_postgresql = {
 		.request_demux		= sql_trunk_request_demux,
 		.request_cancel		= sql_request_cancel,
 		.request_cancel_mux	= sql_request_cancel_mux,
+#ifdef HAVE_PGRES_PIPELINE_SYNC
+		.request_conn_release	= sql_request_conn_release,
+#endif
 		.request_fail		= sql_request_fail,
 	}
 };
@@ -61,6 +61,12 @@ typedef struct {
 	fr_dict_attr_t const *query_number_da;
 } rlm_sql_boot_t;
 
+static const conf_parser_t batch_config[] = {
+	{ FR_CONF_OFFSET("size", rlm_sql_config_t, batch_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("delay", rlm_sql_config_t, batch_delay), .dflt = "0.01" },
+	CONF_PARSER_TERMINATOR
+};
+
 static const conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET_TYPE_FLAGS("driver", FR_TYPE_VOID, 0, rlm_sql_t, driver_submodule), .dflt = "null",
 			 .func = submodule_parse },
@@ -88,6 +94,8 @@ static const conf_parser_t module_config[] = {
 	 */
 	{ FR_CONF_OFFSET_SUBSECTION("pool", 0, rlm_sql_config_t, trunk_conf, trunk_config) },
 
+	{ FR_CONF_POINTER("batch", 0, CONF_FLAG_SUBSECTION, NULL), .subcs = (void const *) batch_config },
+
 	{ FR_CONF_OFFSET_FLAGS("expand_rhs", CONF_FLAG_HIDDEN, rlm_sql_config_t, expand_rhs) },
 
 	CONF_PARSER_TERMINATOR
@@ -244,8 +252,35 @@ typedef struct {
 	fr_value_box_list_t		query;		//!< Where expanded query tmpl will be written.
 	fr_value_box_t			*query_vb;	//!< Current query string.
 	fr_sql_query_t			*query_ctx;	//!< Query context for current query.
+
+	rlm_sql_thread_t		*thread;	//!< Thread this request is running in.
+	struct sql_batch_entry_s	*batch_entry;	//!< Entry in the batch we're waiting on.
+	bool				no_batch;	//!< Run the query on its own, the batch failed.
+	sql_rcode_t			batch_rcode;	//!< Result of the batch.
+	int				batch_affected;	//!< Rows affected by our query in the batch.
 } sql_redundant_ctx_t;
 
+/** A batch of queries from multiple requests, run as a single transaction
+ *
+ */
+struct sql_batch_s {
+	rlm_sql_thread_t		*thread;	//!< Thread the batch belongs to.
+	fr_dlist_head_t			entries;	//!< Queries in the batch.
+	fr_timer_t			*ev;		//!< When to send the batch.
+	fr_sql_query_t			*query_ctx;	//!< Query context for the batch, once it's been sent.
+};
+
+/** A query in a batch
+ *
+ */
+typedef struct sql_batch_entry_s {
+	fr_dlist_t			entry;		//!< Entry in the batch.
+	sql_batch_t			*batch;		//!< Batch this query is part of.
+	sql_redundant_ctx_t		*redundant_ctx;	//!< Waiting on the result, or NULL if the request
+							///< went away after the batch was sent.
+	char const			*query;		//!< Copy of the query string.
+} sql_batch_entry_t;
+
 typedef struct {
 	fr_value_box_t	user;
 	tmpl_t		*membership_query;
@@ -1794,6 +1829,27 @@ static unlang_action_t CC_HINT(nonnull) mod_authorize(unlang_result_t *p_result,
  */
 static int sql_redundant_ctx_free(sql_redundant_ctx_t *to_free)
 {
+	sql_batch_entry_t	*entry = to_free->batch_entry;
+
+	/*
+	 *	The request went away whilst waiting on a batch.
+	 *	If the batch hasn't been sent yet, remove our query
+	 *	from it, otherwise just discard our result.
+	 */
+	if (entry) {
+		sql_batch_t	*batch = entry->batch;
+
+		if (batch->query_ctx) {
+			entry->redundant_ctx = NULL;
+		} else {
+			fr_dlist_talloc_free_item(&batch->entries, entry);
+			if (fr_dlist_num_elements(&batch->entries) == 0) {
+				if (batch->thread->batch == batch) batch->thread->batch = NULL;
+				talloc_free(batch);
+			}
+		}
+	}
+
 	if (!to_free->inst->sql_escape_arg) (void) request_data_get(to_free->request, (void *)sql_escape_uctx_alloc, 0);
 	sql_unset_user(to_free->inst, to_free->request);
 
@@ -1802,6 +1858,39 @@ static int sql_redundant_ctx_free(sql_redundant_ctx_t *to_free)
 
 static unlang_action_t mod_sql_redundant_resume(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request);
 
+/** Move on to the next query in a redundant list of queries
+ *
+ */
+static unlang_action_t sql_redundant_next(unlang_result_t *p_result, request_t *request, sql_redundant_ctx_t *redundant_ctx)
+{
+	sql_redundant_call_env_t	*call_env = redundant_ctx->call_env;
+
+	redundant_ctx->query_no++;
+	if (redundant_ctx->query_no >= talloc_array_length(call_env->query)) RETURN_UNLANG_NOOP;
+	if (unlang_module_yield(request, mod_sql_redundant_resume, NULL, 0, redundant_ctx) == UNLANG_ACTION_FAIL) RETURN_UNLANG_FAIL;
+	if (unlang_tmpl_push(redundant_ctx, NULL, &redundant_ctx->query, request, call_env->query[redundant_ctx->query_no], NULL, UNLANG_SUB_FRAME) < 0) RETURN_UNLANG_FAIL;
+
+	RDEBUG2("Trying next query...");
+
+	return UNLANG_ACTION_PUSHED_CHILD;
+}
+
+/** Record which query in a redundant list succeeded
+ *
+ */
+static unlang_action_t sql_redundant_success(unlang_result_t *p_result, request_t *request, sql_redundant_ctx_t *redundant_ctx)
+{
+	rlm_sql_t const		*inst = redundant_ctx->inst;
+
+	if (inst->query_number_da) {
+		fr_pair_t	*vp;
+		if (unlikely(pair_update_control(&vp, inst->query_number_da) < 0)) RETURN_UNLANG_FAIL;
+		vp->vp_uint32 = redundant_ctx->query_no + 1;
+		RDEBUG2("control.%pP", vp);
+	}
+	RETURN_UNLANG_OK;
+}
+
 /** Resume function called after executing an SQL query in a redundant list of queries.
  *
  * @param p_result	Result of current module call.
@@ -1812,7 +1901,6 @@ static unlang_action_t mod_sql_redundant_resume(unlang_result_t *p_result, modul
 static unlang_action_t mod_sql_redundant_query_resume(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
 	sql_redundant_ctx_t		*redundant_ctx = talloc_get_type_abort(mctx->rctx, sql_redundant_ctx_t);
-	sql_redundant_call_env_t	*call_env = redundant_ctx->call_env;
 	rlm_sql_t const			*inst = redundant_ctx->inst;
 	fr_sql_query_t			*query_ctx = redundant_ctx->query_ctx;
 	int				numaffected = 0;
@@ -1862,33 +1950,188 @@ static unlang_action_t mod_sql_redundant_query_resume(unlang_result_t *p_result,
 	 *	counted as successful.
 	 */
 	numaffected = (inst->driver->sql_affected_rows)(query_ctx, &inst->config);
-	TALLOC_FREE(query_ctx);
+	TALLOC_FREE(redundant_ctx->query_ctx);
 	RDEBUG2("%i record(s) updated", numaffected);
 
-	if (numaffected > 0) {
-		if (inst->query_number_da) {
-			fr_pair_t	*vp;
-			if (unlikely(pair_update_control(&vp, inst->query_number_da) < 0)) RETURN_UNLANG_FAIL;
-			vp->vp_uint32 = redundant_ctx->query_no + 1;
-			RDEBUG2("control.%pP", vp);
-		}
-		RETURN_UNLANG_OK;	/* A query succeeded, were done! */
-	}
+	if (numaffected > 0) return sql_redundant_success(p_result, request, redundant_ctx);	/* A query succeeded, were done! */
+
 next:
 	/*
 	 *	Look to see if there are any more queries to expand
 	 */
-	talloc_free(query_ctx);
-	redundant_ctx->query_no++;
-	if (redundant_ctx->query_no >= talloc_array_length(call_env->query)) RETURN_UNLANG_NOOP;
-	if (unlang_module_yield(request, mod_sql_redundant_resume, NULL, 0, redundant_ctx) == UNLANG_ACTION_FAIL) RETURN_UNLANG_FAIL;
-	if (unlang_tmpl_push(redundant_ctx, NULL, &redundant_ctx->query, request, call_env->query[redundant_ctx->query_no], NULL, UNLANG_SUB_FRAME) < 0) RETURN_UNLANG_FAIL;
+	TALLOC_FREE(redundant_ctx->query_ctx);
+	return sql_redundant_next(p_result, request, redundant_ctx);
+}
 
-	RDEBUG2("Trying next query...");
+/** Called when a batch of queries completes
+ *
+ * Copies the result for each query back to the request which
+ * submitted it, and resumes the request.
+ *
+ * The queries are only acknowledged once the driver has seen the
+ * batch's transaction commit.  Otherwise the batch is treated as
+ * having failed, and each query is run again on its own.
+ */
+static void sql_batch_done(fr_sql_query_t *query_ctx)
+{
+	sql_batch_t		*batch = talloc_get_type_abort(query_ctx->done_uctx, sql_batch_t);
+	module_ctx_t const	*mctx = MODULE_CTX(query_ctx->inst->mi, batch->thread, NULL, NULL);
+	sql_batch_entry_t	*entry = NULL;
+	size_t			i;
 
-	return UNLANG_ACTION_PUSHED_CHILD;
+	if (query_ctx->rcode != RLM_SQL_OK) {
+		rlm_sql_print_error(query_ctx->inst, NULL, query_ctx, false);
+	} else if (!query_ctx->batch_committed) {
+		ERROR("SQL batch completed without being committed");
+		query_ctx->rcode = RLM_SQL_ERROR;
+	}
+
+	for (i = 0; (entry = fr_dlist_next(&batch->entries, entry)); i++) {
+		sql_redundant_ctx_t	*redundant_ctx = entry->redundant_ctx;
+
+		if (!redundant_ctx) continue;
+
+		redundant_ctx->batch_entry = NULL;
+		redundant_ctx->batch_rcode = query_ctx->rcode;
+		redundant_ctx->batch_affected = query_ctx->batch_affected[i];
+		unlang_interpret_mark_runnable(redundant_ctx->request);
+	}
+
+	talloc_free(batch);
+}
+
+/** Send a batch of queries
+ *
+ * Called from a timer, either when the batch is full, or when the
+ * batch delay has expired.
+ */
+static void _sql_batch_send(UNUSED fr_timer_list_t *tl, UNUSED fr_time_t now, void *uctx)
+{
+	sql_batch_t		*batch = talloc_get_type_abort(uctx, sql_batch_t);
+	rlm_sql_thread_t	*thread = batch->thread;
+	rlm_sql_t const		*inst = thread->inst;
+	module_ctx_t const	*mctx = MODULE_CTX(inst->mi, thread, NULL, NULL);
+	sql_batch_entry_t	*entry = NULL;
+	fr_sql_query_t		*query_ctx;
+	size_t			i = 0, num = fr_dlist_num_elements(&batch->entries);
+	char const		**statements;
+	char			*query_str;
+
+	/*
+	 *	New queries go into a new batch.
+	 */
+	if (thread->batch == batch) thread->batch = NULL;
+
+	MEM(statements = talloc_array(batch, char const *, num));
+	MEM(query_str = talloc_strdup(batch, ""));
+	while ((entry = fr_dlist_next(&batch->entries, entry))) {
+		statements[i] = entry->query;
+		MEM(query_str = talloc_asprintf_append_buffer(query_str, "%s%s", i ? ";\n" : "", entry->query));
+		i++;
+	}
+
+	MEM(query_ctx = fr_sql_query_alloc(batch, inst, NULL, thread->trunk, query_str, SQL_QUERY_OTHER));
+	query_ctx->batch = statements;
+	MEM(query_ctx->batch_affected = talloc_array(query_ctx, int, num));
+	for (i = 0; i < num; i++) query_ctx->batch_affected[i] = -1;
+	query_ctx->done = sql_batch_done;
+	query_ctx->done_uctx = batch;
+	batch->query_ctx = query_ctx;
+
+	DEBUG2("Sending batch of %zu queries", num);
+
+	switch (trunk_request_enqueue(&query_ctx->treq, thread->trunk, NULL, query_ctx, NULL)) {
+	case TRUNK_ENQUEUE_OK:
+	case TRUNK_ENQUEUE_IN_BACKLOG:
+		return;
+
+	default:
+		ERROR("Unable to enqueue SQL batch");
+		query_ctx->treq = NULL;
+		query_ctx->status = SQL_QUERY_FAILED;
+		query_ctx->rcode = RLM_SQL_ERROR;
+		sql_batch_done(query_ctx);
+		return;
+	}
+}
+
+/** Add the current query to the thread's batch
+ *
+ * The batch is always sent from a timer, so that a request is never
+ * resumed before it has yielded.
+ */
+static int sql_batch_add(rlm_sql_thread_t *thread, sql_redundant_ctx_t *redundant_ctx)
+{
+	rlm_sql_t const		*inst = thread->inst;
+	sql_batch_t		*batch = thread->batch;
+	sql_batch_entry_t	*entry;
+
+	if (!batch) {
+		MEM(batch = talloc_zero(thread, sql_batch_t));
+		batch->thread = thread;
+		fr_dlist_talloc_init(&batch->entries, sql_batch_entry_t, entry);
+
+		if (fr_timer_in(batch, thread->el->tl, &batch->ev, inst->config.batch_delay,
+				false, _sql_batch_send, batch) < 0) {
+			talloc_free(batch);
+			return -1;
+		}
+		thread->batch = batch;
+	}
+
+	MEM(entry = talloc_zero(batch, sql_batch_entry_t));
+	entry->batch = batch;
+	entry->redundant_ctx = redundant_ctx;
+	MEM(entry->query = talloc_bstrndup(entry, redundant_ctx->query_vb->vb_strvalue, redundant_ctx->query_vb->vb_length));
+	fr_dlist_insert_tail(&batch->entries, entry);
+	redundant_ctx->batch_entry = entry;
+
+	/*
+	 *	Full, send it as soon as we return to the event loop.
+	 */
+	if (fr_dlist_num_elements(&batch->entries) >= inst->config.batch_size) {
+		thread->batch = NULL;
+		if (fr_timer_in(batch, thread->el->tl, &batch->ev, fr_time_delta_wrap(0),
+				false, _sql_batch_send, batch) < 0) return -1;
+	}
+
+	return 0;
 }
 
+/** Resume function called after a batch containing our query has completed
+ *
+ * If the batch succeeded, but our query didn't affect any rows, we move
+ * on to the next query as usual.  If the batch failed, we don't know
+ * which query caused the failure, so the query is run again on its own.
+ */
+static unlang_action_t mod_sql_redundant_batch_resume(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	sql_redundant_ctx_t		*redundant_ctx = talloc_get_type_abort(mctx->rctx, sql_redundant_ctx_t);
+	rlm_sql_t const			*inst = redundant_ctx->inst;
+
+	if (redundant_ctx->batch_rcode != RLM_SQL_OK) {
+		RDEBUG2("SQL batch failed, running query on its own");
+		redundant_ctx->no_batch = true;
+
+		MEM(redundant_ctx->query_ctx = fr_sql_query_alloc(redundant_ctx, inst, request, redundant_ctx->trunk,
+								  redundant_ctx->query_vb->vb_strvalue, SQL_QUERY_OTHER));
+
+		unlang_module_yield(request, mod_sql_redundant_query_resume, NULL, 0, redundant_ctx);
+		return unlang_function_push_with_result(/* discard, mod_sql_redundant_query_resume uses query_ctx->rcode*/ NULL,
+							request,
+							inst->query,
+							NULL,
+							NULL,
+							0, UNLANG_SUB_FRAME,
+							redundant_ctx->query_ctx);
+	}
+
+	RDEBUG2("%i record(s) updated", redundant_ctx->batch_affected);
+
+	if (redundant_ctx->batch_affected > 0) return sql_redundant_success(p_result, request, redundant_ctx);
+
+	return sql_redundant_next(p_result, request, redundant_ctx);
+}
 
 /** Resume function called after expansion of next query in a redundant list of queries
  *
@@ -1910,6 +2153,19 @@ static unlang_action_t mod_sql_redundant_resume(unlang_result_t *p_result, modul
 		rlm_sql_query_log(inst, call_env->filename.vb_strvalue, redundant_ctx->query_vb->vb_strvalue);
 	}
 
+	/*
+	 *	Batch the first query.  Any alternatives are only
+	 *	run if it fails to update anything, and are run on
+	 *	their own.
+	 */
+	if (inst->config.batch_size && (redundant_ctx->query_no == 0) && !redundant_ctx->no_batch &&
+	    (redundant_ctx->query_vb->vb_length > 0)) {
+		if (sql_batch_add(redundant_ctx->thread, redundant_ctx) < 0) RETURN_UNLANG_FAIL;
+
+		RDEBUG2("Added query to batch");
+		return unlang_module_yield(request, mod_sql_redundant_batch_resume, NULL, 0, redundant_ctx);
+	}
+
 	MEM(redundant_ctx->query_ctx = fr_sql_query_alloc(redundant_ctx, inst, request, redundant_ctx->trunk,
 							  redundant_ctx->query_vb->vb_strvalue, SQL_QUERY_OTHER));
 
@@ -1948,6 +2204,7 @@ static unlang_action_t CC_HINT(nonnull) mod_sql_redundant(unlang_result_t *p_res
 		.inst = inst,
 		.request = request,
 		.trunk = thread->trunk,
+		.thread = thread,
 		.call_env = call_env,
 		.query_no = 0
 	};
@@ -2229,6 +2486,12 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 		inst->config.trunk_conf.always_writable = true;
 	}
 
+	if (inst->config.batch_size && !(inst->driver->flags & RLM_SQL_BATCH)) {
+		cf_log_err(conf, "Driver %s does not support batching queries, batch.size must be 0",
+			   inst->driver_submodule->name);
+		return -1;
+	}
+
 	/*
 	 *	Instantiate the driver module
 	 */
@@ -2433,6 +2696,7 @@ static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
 	}
 
 	thread->inst = inst;
+	thread->el = mctx->el;
 
 	thread->trunk = trunk_alloc(thread, mctx->el, &inst->driver->trunk_io_funcs,
 			       &inst->config.trunk_conf, inst->name, thread, false, inst->trigger_args);
@@ -2446,6 +2710,12 @@ static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
 	rlm_sql_thread_t	*thread = talloc_get_type_abort(mctx->thread, rlm_sql_thread_t);
 	rlm_sql_t		*inst = talloc_get_type_abort(mctx->mi->data, rlm_sql_t);
 
+	/*
+	 *	Requests waiting on a batch which hasn't been
+	 *	sent have already been cancelled.
+	 */
+	TALLOC_FREE(thread->batch);
+
 	if (inst->driver->sql_escape_arg_free) inst->driver->sql_escape_arg_free(thread->sql_escape_arg);
 
 	return 0;
@@ -103,10 +103,16 @@ typedef struct {
 								///< series of redundant queries.
 
 	trunk_conf_t		trunk_conf;			//!< Configuration for trunk connections.
+
+	uint32_t		batch_size;			//!< Maximum number of queries to send in a batch.
+								///< 0 disables batching.
+	fr_time_delta_t		batch_delay;			//!< Maximum time to wait for a batch to fill.
 } rlm_sql_config_t;
 
 typedef struct sql_inst rlm_sql_t;
 
+typedef struct sql_batch_s sql_batch_t;
+
 /*
  *	Per-thread instance data structure
  */
@@ -114,6 +120,8 @@ typedef struct {
 	trunk_t			*trunk;				//!< Trunk connection for this thread.
 	rlm_sql_t const		*inst;				//!< Module instance data.
 	void			*sql_escape_arg;		//!< Thread specific argument to be passed to escape function.
+	fr_event_list_t		*el;				//!< Event list for this thread.
+	sql_batch_t		*batch;				//!< Batch of queries currently being filled.
 } rlm_sql_thread_t;
 
 typedef enum {
@@ -133,7 +141,14 @@ typedef enum {
 	SQL_QUERY_CANCELLED					//!< A cancellation has been sent to the server.
 } fr_sql_query_status_t;
 
-typedef struct {
+typedef struct fr_sql_query_s fr_sql_query_t;
+
+/** Called when a query submitted without a request completes
+ *
+ */
+typedef void (*fr_sql_query_done_t)(fr_sql_query_t *query_ctx);
+
+struct fr_sql_query_s {
 	rlm_sql_t const		*inst;				//!< Module instance for this query.
 	request_t		*request;			//!< Request this query relates to.
 	trunk_t			*trunk;				//!< Trunk this query is being run on.
@@ -145,7 +160,16 @@ typedef struct {
 	sql_rcode_t		rcode;				//!< Result code.
 	rlm_sql_row_t		row;				//!< Row data from the last query.
 	void			*uctx;				//!< Driver specific data.
-} fr_sql_query_t;
+
+	char const		**batch;			//!< Statements making up a batch.  query_str contains
+								///< the same statements joined together.
+	int			*batch_affected;		//!< Rows affected by each statement in the batch,
+								///< written by the driver.
+	bool			batch_committed;		//!< Set by the driver once it has seen the batch's
+								///< transaction commit.
+	fr_sql_query_done_t	done;				//!< Called on completion if there's no request.
+	void			*done_uctx;			//!< Passed to the done callback.
+};
 
 /** Context used when fetching attribute value pairs as a map list
  */
@@ -171,6 +195,22 @@ extern size_t sql_rcode_table_len;
 #define RLM_SQL_RCODE_FLAGS_ALT_QUERY	1			//!< Can distinguish between other errors and those
 								//!< resulting from a unique key violation.
 #define RLM_SQL_MULTI_QUERY_CONN	2			//!< Can support multiple queries on a single connection.
+#define RLM_SQL_BATCH			4			//!< Can run a batch of statements as a single transaction,
+								//!< and report the rows affected by each.
+
+/** Resume whatever is waiting on a query
+ *
+ * Either the request which submitted the query, or if the query was
+ * submitted without a request, its completion callback.
+ */
+static inline void sql_query_resume_waiter(fr_sql_query_t *query_ctx)
+{
+	if (query_ctx->request) {
+		unlang_interpret_mark_runnable(query_ctx->request);
+	} else if (query_ctx->done) {
+		query_ctx->done(query_ctx);
+	}
+}
 
 /** Retrieve errors from the last query operation
  *
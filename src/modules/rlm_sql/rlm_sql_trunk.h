@@ -62,11 +62,11 @@ static unlang_action_t sql_query_resume(unlang_result_t *p_result, UNUSED reques
 }
 
 #define SQL_QUERY_FAIL \
-static void sql_request_fail(request_t *request, void *preq, UNUSED void *rctx, \
+static void sql_request_fail(UNUSED request_t *request, void *preq, UNUSED void *rctx, \
 			     UNUSED trunk_request_state_t state, UNUSED void *uctx) \
 { \
 	fr_sql_query_t	*query_ctx = talloc_get_type_abort(preq, fr_sql_query_t); \
 	query_ctx->treq = NULL; \
 	if (query_ctx->rcode == RLM_SQL_OK) query_ctx->rcode = RLM_SQL_ERROR; \
-	if (request) unlang_interpret_mark_runnable(request); \
+	sql_query_resume_waiter(query_ctx); \
 }
@@ -43,9 +43,34 @@ typedef struct {
 	char const      *name;
 	char const	*sql_name;
 
+	fr_time_delta_t	reserve_lifetime;		//!< How long addresses claimed by "alloc_reserve"
+							///< may be handed out by this thread.
+
 	rlm_sql_t const	*sql;
 } rlm_sqlippool_t;
 
+/** An address reserved by "alloc_reserve", waiting to be handed out
+ */
+typedef struct {
+	fr_dlist_t	entry;				//!< Entry in the pool's list of reserved addresses.
+	fr_time_t	expires;			//!< After this time the address is no longer handed out.
+	char		*address;			//!< Address returned by the "alloc_reserve" query.
+} sqlippool_reserved_t;
+
+/** Addresses reserved by a thread from a single pool
+ */
+typedef struct {
+	fr_rb_node_t	node;				//!< Entry in the thread's tree of pools.
+	char		*pool_name;			//!< Pool the addresses were reserved from.
+	fr_dlist_head_t	reserved;			//!< Reserved addresses, oldest first.
+} sqlippool_reserved_pool_t;
+
+/** Per-thread instance data
+ */
+typedef struct {
+	fr_rb_tree_t	*pools;				//!< Addresses reserved by this thread, keyed by pool name.
+} rlm_sqlippool_thread_t;
+
 /**  Call environment used by module alloc method
  */
 typedef struct {
@@ -58,6 +83,8 @@ typedef struct {
 	tmpl_t		*existing;			//!< tmpl to expand as query for finding the existing IP.
 	tmpl_t		*requested;			//!< tmpl to expand as query for finding the requested IP.
 	tmpl_t		*find;				//!< tmpl to expand as query for finding an unused IP.
+	tmpl_t		*reserve;			//!< tmpl to expand as query for reserving a batch of unused IPs.
+	tmpl_t		*claim;				//!< tmpl to expand as query for claiming a reserved IP.
 	tmpl_t		*update;			//!< tmpl to expand as query for updating the found IP.
 	tmpl_t		*pool_check;			//!< tmpl to expand as query for checking for existence of the pool.
 	fr_value_box_t	commit;				//!< SQL query to commit transaction.
@@ -80,12 +107,16 @@ typedef enum {
 	IPPOOL_ALLOC_REQUESTED_RUN,		//!< Run the "requested" query
 	IPPOOL_ALLOC_FIND,			//!< Expanding the "find" query
 	IPPOOL_ALLOC_FIND_RUN,			//!< Run the "find" query
+	IPPOOL_ALLOC_RESERVE,			//!< Expanding the "reserve" query
+	IPPOOL_ALLOC_RESERVE_RUN,		//!< Run the "reserve" query
 	IPPOOL_ALLOC_NO_ADDRESS,		//!< No address was found
 	IPPOOL_ALLOC_POOL_CHECK,		//!< Expanding the "pool_check" query
 	IPPOOL_ALLOC_POOL_CHECK_RUN,		//!< Run the "pool_check" query
 	IPPOOL_ALLOC_MAKE_PAIR,			//!< Make the pair.
 	IPPOOL_ALLOC_UPDATE,			//!< Expanding the "update" query
 	IPPOOL_ALLOC_UPDATE_RUN,		//!< Run the "update" query
+	IPPOOL_ALLOC_CLAIM,			//!< Expanding the "claim" query
+	IPPOOL_ALLOC_CLAIM_RUN,			//!< Run the "claim" query
 	IPPOOL_ALLOC_COMMIT_RUN,		//!< RUn the "commit" query
 } ippool_alloc_status_t;
 
@@ -97,6 +128,10 @@ typedef struct {
 	ippool_alloc_call_env_t	*env;		//!< Call environment for the allocation.
 	trunk_t			*trunk;		//!< Trunk connection for queries.
 	rlm_sql_t const		*sql;		//!< SQL module instance.
+	rlm_sqlippool_t const	*inst;		//!< Module instance.
+	rlm_sqlippool_thread_t	*thread;	//!< Thread holding reserved addresses.
+	bool			reserved;	//!< The "reserve" query has already been run for this request.
+	bool			claiming;	//!< The current address came from the reserved list.
 	fr_value_box_list_t	values;		//!< Where to put the expanded queries ready for execution.
 	fr_value_box_t		*query;		//!< Current query being run.
 	fr_sql_query_t		*query_ctx;	//!< Query context for allocation queries.
@@ -114,6 +149,7 @@ typedef struct {
 
 static conf_parser_t module_config[] = {
 	{ FR_CONF_OFFSET("sql_module_instance", rlm_sqlippool_t, sql_name), .dflt = "sql" },
+	{ FR_CONF_OFFSET("reserve_lifetime", rlm_sqlippool_t, reserve_lifetime), .dflt = "30" },
 
 	CONF_PARSER_TERMINATOR
 };
@@ -181,6 +217,117 @@ finish:
 	return retval;
 }
 
+static int8_t sqlippool_reserved_pool_cmp(void const *one, void const *two)
+{
+	sqlippool_reserved_pool_t const *a = one, *b = two;
+
+	return CMP(strcmp(a->pool_name, b->pool_name), 0);
+}
+
+/** Find the list of addresses this thread has reserved from a pool
+ *
+ * @param[in] thread	holding the reserved addresses.
+ * @param[in] pool_name	to find.
+ * @param[in] create	the list if it doesn't already exist.
+ * @return
+ *	- The reserved pool.
+ *	- NULL if no addresses have been reserved from the pool and create is false.
+ */
+static sqlippool_reserved_pool_t *sqlippool_reserved_pool(rlm_sqlippool_thread_t *thread,
+							  fr_value_box_t const *pool_name, bool create)
+{
+	sqlippool_reserved_pool_t	*pool;
+
+	pool = fr_rb_find(thread->pools, &(sqlippool_reserved_pool_t){ .pool_name = UNCONST(char *, pool_name->vb_strvalue) });
+	if (pool || !create) return pool;
+
+	MEM(pool = talloc_zero(thread->pools, sqlippool_reserved_pool_t));
+	MEM(pool->pool_name = talloc_bstrndup(pool, pool_name->vb_strvalue, pool_name->vb_length));
+	fr_dlist_talloc_init(&pool->reserved, sqlippool_reserved_t, entry);
+	fr_rb_insert(thread->pools, pool);
+
+	return pool;
+}
+
+/** Take the oldest unexpired address this thread has reserved from a pool
+ *
+ * Reservations which are past their lifetime are discarded.  They are not
+ * released explicitly, the database returns them to the pool once the
+ * expiry time set by "alloc_reserve" passes.
+ *
+ * @param[out] out	Where to write the address.
+ * @param[in] outlen	Size of the output buffer.
+ * @param[in] thread	holding the reserved addresses.
+ * @param[in] pool_name	to take an address from.
+ * @return
+ *	- Length of the address written to out.
+ *	- 0 if there are no reserved addresses.
+ */
+static int sqlippool_reserved_pop(char *out, size_t outlen, rlm_sqlippool_thread_t *thread, fr_value_box_t const *pool_name)
+{
+	sqlippool_reserved_pool_t	*pool;
+	sqlippool_reserved_t		*reserved;
+	fr_time_t			now = fr_time();
+	size_t				len;
+
+	pool = sqlippool_reserved_pool(thread, pool_name, false);
+	if (!pool) return 0;
+
+	while ((reserved = fr_dlist_pop_head(&pool->reserved))) {
+		len = talloc_array_length(reserved->address) - 1;
+		if (fr_time_gt(now, reserved->expires) || (len >= outlen)) {
+			talloc_free(reserved);
+			continue;
+		}
+
+		strcpy(out, reserved->address);
+		talloc_free(reserved);
+		return len;
+	}
+
+	return 0;
+}
+
+/*
+ *	Add the results of the "reserve" query to the thread's reserved addresses
+ */
+static int sqlippool_reserve_process(rlm_sqlippool_thread_t *thread, fr_value_box_t const *pool_name,
+				     fr_time_delta_t lifetime, fr_sql_query_t *query_ctx)
+{
+	unlang_result_t			p_result;
+	sqlippool_reserved_pool_t	*pool = sqlippool_reserved_pool(thread, pool_name, true);
+	sqlippool_reserved_t		*reserved;
+	fr_time_t			expires = fr_time_add(fr_time(), lifetime);
+	request_t			*request = query_ctx->request;
+	int				count = 0;
+
+	for (;;) {
+		query_ctx->inst->fetch_row(&p_result, request, query_ctx);
+		if (query_ctx->rcode < 0) {
+			REDEBUG("Failed fetching query_result");
+			break;
+		}
+
+		if (!query_ctx->row) break;
+
+		if (!query_ctx->row[0]) {
+			RWDEBUG("Ignoring reserved address with NULL value");
+			continue;
+		}
+
+		MEM(reserved = talloc_zero(pool, sqlippool_reserved_t));
+		MEM(reserved->address = talloc_strdup(reserved, query_ctx->row[0]));
+		reserved->expires = expires;
+		fr_dlist_insert_tail(&pool->reserved, reserved);
+		count++;
+	}
+
+	query_ctx->inst->driver->sql_finish_select_query(query_ctx, &query_ctx->inst->config);
+
+	RDEBUG2("Reserved %d address(es) from pool \"%pV\"", count, pool_name);
+	return count;
+}
+
 /*
  *	Do any per-module initialization that is separate to each
  *	configured instance of the module.  e.g. set up connections
@@ -217,6 +364,16 @@ static int mod_instantiate(module_inst_ctx_t const *mctx)
 	return 0;
 }
 
+static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
+{
+	rlm_sqlippool_thread_t	*thread = talloc_get_type_abort(mctx->thread, rlm_sqlippool_thread_t);
+
+	MEM(thread->pools = fr_rb_inline_talloc_alloc(thread, sqlippool_reserved_pool_t, node,
+						      sqlippool_reserved_pool_cmp, NULL));
+
+	return 0;
+}
+
 /** Release SQL pool connections when alloc context is freed.
  */
 static int sqlippool_alloc_ctx_free(ippool_alloc_ctx_t *to_free)
@@ -329,13 +486,49 @@ static unlang_action_t mod_alloc_resume(unlang_result_t *p_result, module_ctx_t
 
 	expand_find:
 		/*
-		 *	Neither "existing" nor "requested" found an address, expand "find" query
+		 *	Neither "existing" nor "requested" found an address.
+		 *
+		 *	If reservations are enabled, hand out an address this thread
+		 *	has already reserved, or reserve a new batch of them.
+		 */
+		if (env->reserve && env->claim) {
+			allocation_len = sqlippool_reserved_pop(allocation, sizeof(allocation),
+								alloc_ctx->thread, &env->pool_name);
+			if (allocation_len > 0) {
+				alloc_ctx->claiming = true;
+				goto make_pair;
+			}
+
+			if (!alloc_ctx->reserved) {
+				alloc_ctx->reserved = true;
+				alloc_ctx->status = IPPOOL_ALLOC_RESERVE;
+				REPEAT_MOD_ALLOC_RESUME;
+				if (unlang_tmpl_push(alloc_ctx, NULL, &alloc_ctx->values, request, env->reserve, NULL, UNLANG_SUB_FRAME) < 0) goto error;
+				return UNLANG_ACTION_PUSHED_CHILD;
+			}
+		}
+
+	expand_find_query:
+		/*
+		 *	Fall back to the "find" query
 		 */
 		alloc_ctx->status = IPPOOL_ALLOC_FIND;
 		REPEAT_MOD_ALLOC_RESUME;
 		if (unlang_tmpl_push(alloc_ctx, NULL, &alloc_ctx->values, request, env->find, NULL, UNLANG_SUB_FRAME) < 0) goto error;
 		return UNLANG_ACTION_PUSHED_CHILD;
 
+	case IPPOOL_ALLOC_RESERVE:
+		if (query && query->vb_length) SUBMIT_QUERY(query->vb_strvalue, IPPOOL_ALLOC_RESERVE_RUN, SQL_QUERY_SELECT, select);
+		goto expand_find_query;
+
+	case IPPOOL_ALLOC_RESERVE_RUN:
+		TALLOC_FREE(alloc_ctx->query);
+		if (query_ctx->rcode != RLM_SQL_OK) goto error;
+
+		if (sqlippool_reserve_process(alloc_ctx->thread, &env->pool_name,
+					      alloc_ctx->inst->reserve_lifetime, query_ctx) > 0) goto expand_find;
+		goto expand_find_query;
+
 	case IPPOOL_ALLOC_FIND:
 		SUBMIT_QUERY(query->vb_strvalue, IPPOOL_ALLOC_FIND_RUN, SQL_QUERY_SELECT, select);
 
@@ -399,6 +592,17 @@ static unlang_action_t mod_alloc_resume(unlang_result_t *p_result, module_ctx_t
 		RDEBUG2("Allocated IP %s", allocation);
 		alloc_ctx->rcode = RLM_MODULE_UPDATED;
 
+		/*
+		 *	Reserved addresses are claimed with a single
+		 *	"claim" query in place of "update".
+		 */
+		if (alloc_ctx->claiming) {
+			alloc_ctx->status = IPPOOL_ALLOC_CLAIM;
+			REPEAT_MOD_ALLOC_RESUME;
+			if (unlang_tmpl_push(alloc_ctx, NULL, &alloc_ctx->values, request, env->claim, NULL, UNLANG_SUB_FRAME) < 0) goto error;
+			return UNLANG_ACTION_PUSHED_CHILD;
+		}
+
 		/*
 		 *	If we have an update query expand it
 		 */
@@ -455,6 +659,36 @@ static unlang_action_t mod_alloc_resume(unlang_result_t *p_result, module_ctx_t
 	case IPPOOL_ALLOC_UPDATE_RUN:
 		TALLOC_FREE(alloc_ctx->query);
 		if (env->update) sql->driver->sql_finish_query(query_ctx, &query_ctx->inst->config);
+		goto finish;
+
+	case IPPOOL_ALLOC_CLAIM:
+		if (query && query->vb_length) SUBMIT_QUERY(query->vb_strvalue, IPPOOL_ALLOC_CLAIM_RUN, SQL_QUERY_OTHER, query);
+		goto finish;
+
+	case IPPOOL_ALLOC_CLAIM_RUN:
+	{
+		int		affected;
+		fr_pair_t	*vp;
+
+		TALLOC_FREE(alloc_ctx->query);
+		if (query_ctx->rcode != RLM_SQL_OK) goto error;
+
+		affected = sql->driver->sql_affected_rows(query_ctx, &query_ctx->inst->config);
+		sql->driver->sql_finish_query(query_ctx, &query_ctx->inst->config);
+		if (affected > 0) goto finish;
+
+		/*
+		 *	The reservation was lost, e.g. it expired in the
+		 *	database or the address was released by another
+		 *	server.  Remove the attribute and try again.
+		 */
+		if (tmpl_find_vp(&vp, request, env->allocated_address_attr) == 0) {
+			RDEBUG2("Reservation for IP %pV is no longer valid", &vp->data);
+			fr_pair_delete(fr_pair_parent_list(vp), vp);
+		}
+		alloc_ctx->claiming = false;
+		goto expand_find;
+	}
 
 	finish:
 		if ((env->commit.type == FR_TYPE_STRING) &&
@@ -513,6 +747,8 @@ static unlang_action_t CC_HINT(nonnull) mod_alloc(unlang_result_t *p_result, mod
 		.env = env,
 		.trunk = thread->trunk,
 		.sql = inst->sql,
+		.inst = inst,
+		.thread = talloc_get_type_abort(mctx->thread, rlm_sqlippool_thread_t),
 		.request = request,
 	};
 	talloc_set_destructor(alloc_ctx, sqlippool_alloc_ctx_free);
@@ -747,6 +983,10 @@ static const call_env_method_t sqlippool_alloc_method_env = {
 						ippool_alloc_call_env_t, find), QUERY_ESCAPE },
 		{ FR_CALL_ENV_PARSE_ONLY_OFFSET("alloc_update", FR_TYPE_STRING, CALL_ENV_FLAG_PARSE_ONLY,
 						ippool_alloc_call_env_t, update), QUERY_ESCAPE },
+		{ FR_CALL_ENV_PARSE_ONLY_OFFSET("alloc_reserve", FR_TYPE_STRING, CALL_ENV_FLAG_PARSE_ONLY,
+						ippool_alloc_call_env_t, reserve), QUERY_ESCAPE },
+		{ FR_CALL_ENV_PARSE_ONLY_OFFSET("alloc_claim", FR_TYPE_STRING, CALL_ENV_FLAG_PARSE_ONLY,
+						ippool_alloc_call_env_t, claim), QUERY_ESCAPE },
 		{ FR_CALL_ENV_PARSE_ONLY_OFFSET("pool_check", FR_TYPE_STRING, CALL_ENV_FLAG_PARSE_ONLY,
 						ippool_alloc_call_env_t, pool_check), QUERY_ESCAPE },
 		{ FR_CALL_ENV_OFFSET("alloc_commit", FR_TYPE_STRING, CALL_ENV_FLAG_CONCAT | CALL_ENV_FLAG_NULLABLE,
@@ -810,7 +1050,10 @@ module_rlm_t rlm_sqlippool = {
 		.name		= "sqlippool",
 		.inst_size	= sizeof(rlm_sqlippool_t),
 		.config		= module_config,
-		.instantiate	= mod_instantiate
+		.instantiate	= mod_instantiate,
+
+		.thread_inst_size	= sizeof(rlm_sqlippool_thread_t),
+		.thread_instantiate	= mod_thread_instantiate
 	},
 	.method_group = {
 		.bindings = (module_method_binding_t[]){
@@ -41,10 +41,50 @@ RCSID("$Id$")
 
 #include <pthread.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+#define CACHE_LINE_SIZE		64
+
+/** Number of buckets in the response time histogram
+ *
+ * Bucket 0 counts responses sent within 10us of the request being
+ * received, each subsequent bucket is ten times wider, and the last
+ * bucket counts everything over 10s.
+ */
+#define RLM_STATS_ELAPSED_MAX	8
+
+/** Counters which are written by one thread, and read by many
+ *
+ * Only the thread which owns the counters ever writes to them, so
+ * increments are a relaxed load and store, and don't need a locked
+ * read-modify-write.  Readers use relaxed loads, and may see a
+ * snapshot which is slightly out of date.
+ */
+typedef struct {
+	_Atomic(uint64_t)	stats[FR_RADIUS_CODE_MAX];		//!< Packet counters, indexed by packet code.
+	_Atomic(uint64_t)	elapsed[RLM_STATS_ELAPSED_MAX];	//!< Response time histogram.
+} rlm_stats_counters_t;
+
+/** A point in time copy of one or more sets of counters
+ *
+ */
+typedef struct {
+	uint64_t		stats[FR_RADIUS_CODE_MAX];		//!< Packet counters, indexed by packet code.
+	uint64_t		elapsed[RLM_STATS_ELAPSED_MAX];	//!< Response time histogram.
+} rlm_stats_snapshot_t;
+
+#define COUNTER_INC(_var) atomic_store_explicit(&(_var), atomic_load_explicit(&(_var), memory_order_relaxed) + 1, \
+						memory_order_relaxed)
+#define COUNTER_LOAD(_var) atomic_load_explicit(&(_var), memory_order_relaxed)
+
 typedef struct {
 	pthread_mutex_t		mutex;
 	fr_dlist_head_t		list;				//!< for threads to know about each other
-	uint64_t		stats[FR_RADIUS_CODE_MAX];
+	rlm_stats_snapshot_t	retired;			//!< Counters from threads which have exited.
 } rlm_stats_mutable_t;
 
 /*
@@ -67,13 +107,12 @@ typedef struct {
 	fr_ipaddr_t		ipaddr;				//!< IP address of this thing
 	fr_time_t		created;			//!< when it was created
 	fr_time_t		last_packet;			//!< when we last saw a packet
-	uint64_t		stats[FR_RADIUS_CODE_MAX];	//!< actual statistic
+	rlm_stats_counters_t	counters;			//!< actual statistic
 } rlm_stats_data_t;
 
 typedef struct {
 	rlm_stats_t		*inst;
 
-	fr_time_t		last_global_update;
 	fr_dlist_t		entry;				//!< for threads to know about each other
 
 	fr_time_t		last_manage;			//!< when we deleted old things
@@ -81,9 +120,14 @@ typedef struct {
 	fr_rb_tree_t		*src;				//!< stats by source
 	fr_rb_tree_t		*dst;				//!< stats by destination
 
-	uint64_t		stats[FR_RADIUS_CODE_MAX];
+	rlm_stats_counters_t	*counters;			//!< Global counters for this thread.  These are
+								///< in their own cache lines, so that
+								///< incrementing them doesn't contend with
+								///< anything else.
 
-	pthread_mutex_t		mutex;
+	pthread_mutex_t		mutex;				//!< Held when inserting into the src and dst trees,
+								///< and by other threads when searching them.
+								///< The owning thread searches without it.
 } rlm_stats_thread_t;
 
 static const conf_parser_t module_config[] = {
@@ -102,6 +146,7 @@ static fr_dict_attr_t const *attr_freeradius_stats4_ipv4_address;
 static fr_dict_attr_t const *attr_freeradius_stats4_ipv6_address;
 static fr_dict_attr_t const *attr_freeradius_stats4_type;
 static fr_dict_attr_t const *attr_freeradius_stats4_packet_counters;
+static fr_dict_attr_t const *attr_freeradius_stats4_response_times;
 
 extern fr_dict_attr_autoload_t rlm_stats_dict_attr[];
 fr_dict_attr_autoload_t rlm_stats_dict_attr[] = {
@@ -109,69 +154,129 @@ fr_dict_attr_autoload_t rlm_stats_dict_attr[] = {
 	{ .out = &attr_freeradius_stats4_ipv6_address, .name = "Vendor-Specific.FreeRADIUS.Stats4.IPv6-Address", .type = FR_TYPE_IPV6_ADDR, .dict = &dict_radius },
 	{ .out = &attr_freeradius_stats4_type, .name = "Vendor-Specific.FreeRADIUS.Stats4.Type", .type = FR_TYPE_UINT32, .dict = &dict_radius },
 	{ .out = &attr_freeradius_stats4_packet_counters, .name = "Vendor-Specific.FreeRADIUS.Stats4.Packet-Counters", .type = FR_TYPE_TLV, .dict = &dict_radius },
+	{ .out = &attr_freeradius_stats4_response_times, .name = "Vendor-Specific.FreeRADIUS.Stats4.Response-Times", .type = FR_TYPE_TLV, .dict = &dict_radius },
 	DICT_AUTOLOAD_TERMINATOR
 };
 
-static void coalesce(uint64_t final_stats[FR_RADIUS_CODE_MAX], rlm_stats_thread_t *t,
+/** Add a set of live counters to a snapshot
+ *
+ */
+static void counters_add(rlm_stats_snapshot_t *out, rlm_stats_counters_t const *counters)
+{
+	int i;
+
+	for (i = 0; i < FR_RADIUS_CODE_MAX; i++) out->stats[i] += COUNTER_LOAD(counters->stats[i]);
+	for (i = 0; i < RLM_STATS_ELAPSED_MAX; i++) out->elapsed[i] += COUNTER_LOAD(counters->elapsed[i]);
+}
+
+/** Update counters for one request / response pair
+ *
+ * Must only be called by the thread which owns the counters.
+ */
+static inline CC_HINT(always_inline) void counters_inc(rlm_stats_counters_t *counters,
+						       int src_code, int dst_code, int elapsed)
+{
+	COUNTER_INC(counters->stats[src_code]);
+	COUNTER_INC(counters->stats[dst_code]);
+	COUNTER_INC(counters->elapsed[elapsed]);
+}
+
+/** Map a response time to a histogram bucket
+ *
+ */
+static int elapsed_bucket(fr_time_delta_t elapsed)
+{
+	int64_t	usec = fr_time_delta_to_usec(elapsed);
+	int	i;
+
+	for (i = 0; i < (RLM_STATS_ELAPSED_MAX - 1); i++) {
+		if (usec < 10) break;
+		usec /= 10;
+	}
+
+	return i;
+}
+
+static void coalesce(rlm_stats_snapshot_t *final, rlm_stats_thread_t *t,
 		     size_t tree_offset, rlm_stats_data_t *mydata)
 {
 	rlm_stats_data_t *stats;
 	rlm_stats_thread_t *other;
 	fr_rb_tree_t **tree;
-	uint64_t local_stats[FR_RADIUS_CODE_MAX];
 
-	tree = (fr_rb_tree_t **) (((uint8_t *) t) + tree_offset);
+	memset(final, 0, sizeof(*final));
 
 	/*
-	 *	Bootstrap with my statistics, where we don't need a
-	 *	lock.
+	 *	Bootstrap with my statistics.  We're the only
+	 *	writer of our own trees, so we don't need a lock.
 	 */
+	tree = (fr_rb_tree_t **) (((uint8_t *) t) + tree_offset);
 	stats = fr_rb_find(*tree, mydata);
-	if (!stats) {
-		memset(final_stats, 0, sizeof(uint64_t) * FR_RADIUS_CODE_MAX);
-	} else {
-		memcpy(final_stats, stats->stats, sizeof(stats->stats));
-	}
+	if (stats) counters_add(final, &stats->counters);
 
 	/*
-	 *	Loop over all of the other thread instances, locking
-	 *	them, and adding their statistics in.
+	 *	Loop over all of the other thread instances, adding
+	 *	their statistics in.
+	 *
+	 *	The other thread only takes its mutex when it inserts
+	 *	a new entry, so holding it here doesn't block the
+	 *	counter updates.
 	 */
 	pthread_mutex_lock(&t->inst->mutable->mutex);
 	for (other = fr_dlist_head(&t->inst->mutable->list);
 	     other != NULL;
 	     other = fr_dlist_next(&t->inst->mutable->list, other)) {
-		int i;
-
 		if (other == t) continue;
 
 		tree = (fr_rb_tree_t **) (((uint8_t *) other) + tree_offset);
 		pthread_mutex_lock(&other->mutex);
 		stats = fr_rb_find(*tree, mydata);
-
-		if (!stats) {
-			pthread_mutex_unlock(&other->mutex);
-			continue;
-		}
-		memcpy(&local_stats, stats->stats, sizeof(stats->stats));
-
-		for (i = 0; i < FR_RADIUS_CODE_MAX; i++) {
-			final_stats[i] += local_stats[i];
-		}
-
 		pthread_mutex_unlock(&other->mutex);
+
+		/*
+		 *	Entries are only freed when the thread
+		 *	exits, and it can't do that while we hold
+		 *	the instance mutex.
+		 */
+		if (stats) counters_add(final, &stats->counters);
 	}
 	pthread_mutex_unlock(&t->inst->mutable->mutex);
 }
 
+/** Find or create the stats entry for an IP address
+ *
+ */
+static rlm_stats_data_t *data_find_or_alloc(rlm_stats_thread_t *t, fr_rb_tree_t *tree,
+					    fr_ipaddr_t const *ipaddr, fr_time_t now)
+{
+	rlm_stats_data_t	*stats;
+	rlm_stats_data_t	mydata;
+
+	/*
+	 *	We're the only thread which modifies the tree,
+	 *	so lookups don't need the mutex.
+	 */
+	mydata.ipaddr = *ipaddr;
+	stats = fr_rb_find(tree, &mydata);
+	if (stats) return stats;
+
+	MEM(stats = talloc_zero(t, rlm_stats_data_t));
+
+	stats->ipaddr = *ipaddr;
+	stats->created = now;
+
+	pthread_mutex_lock(&t->mutex);
+	(void) fr_rb_insert(tree, stats);
+	pthread_mutex_unlock(&t->mutex);
+
+	return stats;
+}
 
 static unlang_action_t CC_HINT(nonnull) mod_stats_inc(unlang_result_t *p_result, module_ctx_t const *mctx, request_t *request)
 {
-	rlm_stats_t		*inst = talloc_get_type_abort(mctx->mi->data, rlm_stats_t);
 	rlm_stats_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_stats_thread_t);
-	int			i, src_code, dst_code;
+	int			src_code, dst_code, elapsed;
 	rlm_stats_data_t	*stats;
-	rlm_stats_data_t	mydata;
 
 	if (request->proto_dict != dict_radius) {
 		RWARN("%s can only be called in RADIUS virtual servers", mctx->mi->name);
@@ -184,64 +289,28 @@ static unlang_action_t CC_HINT(nonnull) mod_stats_inc(unlang_result_t *p_result,
 	dst_code = request->reply->code;
 	if (dst_code >= FR_RADIUS_CODE_MAX) dst_code = 0;
 
-	pthread_mutex_lock(&t->mutex);
-	t->stats[src_code]++;
-	t->stats[dst_code]++;
+	elapsed = elapsed_bucket(fr_time_sub(fr_time(), request->async->recv_time));
+
+	counters_inc(t->counters, src_code, dst_code, elapsed);
 
 	/*
 	 *	Update source statistics
 	 */
-	mydata.ipaddr = request->packet->socket.inet.src_ipaddr;
-	stats = fr_rb_find(t->src, &mydata);
-	if (!stats) {
-		MEM(stats = talloc_zero(t, rlm_stats_data_t));
-
-		stats->ipaddr = request->packet->socket.inet.src_ipaddr;
-		stats->created = request->async->recv_time;
-
-		(void) fr_rb_insert(t->src, stats);
-	}
-
+	stats = data_find_or_alloc(t, t->src, &request->packet->socket.inet.src_ipaddr, request->async->recv_time);
 	stats->last_packet = request->async->recv_time;
-	stats->stats[src_code]++;
-	stats->stats[dst_code]++;
+	counters_inc(&stats->counters, src_code, dst_code, elapsed);
 
 	/*
 	 *	Update destination statistics
 	 */
-	mydata.ipaddr = request->packet->socket.inet.dst_ipaddr;
-	stats = fr_rb_find(t->dst, &mydata);
-	if (!stats) {
-		MEM(stats = talloc_zero(t, rlm_stats_data_t));
-
-		stats->ipaddr = request->packet->socket.inet.dst_ipaddr;
-		stats->created = request->async->recv_time;
-
-		(void) fr_rb_insert(t->dst, stats);
-	}
-
+	stats = data_find_or_alloc(t, t->dst, &request->packet->socket.inet.dst_ipaddr, request->async->recv_time);
 	stats->last_packet = request->async->recv_time;
-	stats->stats[src_code]++;
-	stats->stats[dst_code]++;
-	pthread_mutex_unlock(&t->mutex);
+	counters_inc(&stats->counters, src_code, dst_code, elapsed);
 
 	/*
 	 *	@todo - periodically clean up old entries.
 	 */
 
-	if (fr_time_gt(fr_time_add(t->last_global_update, fr_time_delta_wrap(NSEC)), request->async->recv_time)) {
-		RETURN_UNLANG_UPDATED;
-	}
-
-	t->last_global_update = request->async->recv_time;
-
-	pthread_mutex_lock(&inst->mutable->mutex);
-	for (i = 0; i < FR_RADIUS_CODE_MAX; i++) {
-		inst->mutable->stats[i] += t->stats[i];
-		t->stats[i] = 0;
-	}
-	pthread_mutex_unlock(&inst->mutable->mutex);
-
 	RETURN_UNLANG_UPDATED;
 }
 
@@ -252,13 +321,14 @@ static unlang_action_t CC_HINT(nonnull) mod_stats_read(unlang_result_t *p_result
 {
 	rlm_stats_t		*inst = talloc_get_type_abort(mctx->mi->data, rlm_stats_t);
 	rlm_stats_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_stats_thread_t);
+	rlm_stats_thread_t	*other;
 	int			i;
 	uint32_t		stats_type;
 
 
 	fr_pair_t *vp;
 	rlm_stats_data_t mydata;
-	uint64_t local_stats[NUM_ELEMENTS(inst->mutable->stats)];
+	rlm_stats_snapshot_t local_stats;
 
 	if (request->proto_dict != dict_radius) {
 		RWARN("%s can only be called in RADIUS virtual servers", mctx->mi->name);
@@ -288,17 +358,19 @@ static unlang_action_t CC_HINT(nonnull) mod_stats_read(unlang_result_t *p_result
 	switch (stats_type) {
 	case FR_TYPE_VALUE_GLOBAL:			/* global */
 		/*
-		 *	Merge our stats with the global stats, and then copy
-		 *	the global stats to a thread-local variable.
-		 *
-		 *	The copy helps minimize mutex contention.
+		 *	Start with the counters from threads which
+		 *	have exited, and add in the live counters
+		 *	from every thread.  The mutex only protects
+		 *	the thread list, the workers never take it
+		 *	when updating their counters.
 		 */
 		pthread_mutex_lock(&inst->mutable->mutex);
-		for (i = 0; i < FR_RADIUS_CODE_MAX; i++) {
-			inst->mutable->stats[i] += t->stats[i];
-			t->stats[i] = 0;
+		local_stats = inst->mutable->retired;
+		for (other = fr_dlist_head(&inst->mutable->list);
+		     other != NULL;
+		     other = fr_dlist_next(&inst->mutable->list, other)) {
+			counters_add(&local_stats, other->counters);
 		}
-		memcpy(&local_stats, inst->mutable->stats, sizeof(inst->mutable->stats));
 		pthread_mutex_unlock(&inst->mutable->mutex);
 		vp = NULL;
 		break;
@@ -309,7 +381,7 @@ static unlang_action_t CC_HINT(nonnull) mod_stats_read(unlang_result_t *p_result
 		if (!vp) RETURN_UNLANG_NOOP;
 
 		mydata.ipaddr = vp->vp_ip;
-		coalesce(local_stats, t, offsetof(rlm_stats_thread_t, src), &mydata);
+		coalesce(&local_stats, t, offsetof(rlm_stats_thread_t, src), &mydata);
 		break;
 
 	case FR_TYPE_VALUE_LISTENER:			/* dst */
@@ -318,7 +390,7 @@ static unlang_action_t CC_HINT(nonnull) mod_stats_read(unlang_result_t *p_result
 		if (!vp) RETURN_UNLANG_NOOP;
 
 		mydata.ipaddr = vp->vp_ip;
-		coalesce(local_stats, t, offsetof(rlm_stats_thread_t, dst), &mydata);
+		coalesce(&local_stats, t, offsetof(rlm_stats_thread_t, dst), &mydata);
 		break;
 
 	default:
@@ -336,13 +408,25 @@ static unlang_action_t CC_HINT(nonnull) mod_stats_read(unlang_result_t *p_result
 	for (i = 0; i < FR_RADIUS_CODE_MAX; i++) {
 		fr_dict_attr_t const *da;
 
-		if (!local_stats[i]) continue;
+		if (!local_stats.stats[i]) continue;
 
 		da = fr_dict_attr_by_name(NULL, attr_freeradius_stats4_packet_counters, fr_radius_packet_name[i]);
 		if (!da) continue;
 
 		MEM(vp = fr_pair_afrom_da_nested(request->reply_ctx, &request->reply_pairs, da));
-		vp->vp_uint64 = local_stats[i];
+		vp->vp_uint64 = local_stats.stats[i];
+	}
+
+	for (i = 0; i < RLM_STATS_ELAPSED_MAX; i++) {
+		fr_dict_attr_t const *da;
+
+		if (!local_stats.elapsed[i]) continue;
+
+		da = fr_dict_attr_child_by_num(attr_freeradius_stats4_response_times, i + 1);
+		if (!da) continue;
+
+		MEM(vp = fr_pair_afrom_da_nested(request->reply_ctx, &request->reply_pairs, da));
+		vp->vp_uint64 = local_stats.elapsed[i];
 	}
 
 	RETURN_UNLANG_OK;
@@ -378,6 +462,20 @@ static int mod_thread_instantiate(module_thread_inst_ctx_t const *mctx)
 		return -1;
 	}
 
+	/*
+	 *	Give the global counters their own cache lines, so
+	 *	that updates don't cause false sharing with other
+	 *	threads' data.
+	 */
+	if (unlikely(!talloc_aligned_array(t, (void **)&t->counters, CACHE_LINE_SIZE, sizeof(*t->counters)))) {
+		TALLOC_FREE(t->src);
+		TALLOC_FREE(t->dst);
+		return -1;
+	}
+	memset(t->counters, 0, sizeof(*t->counters));
+
+	pthread_mutex_init(&t->mutex, NULL);
+
 	pthread_mutex_lock(&inst->mutable->mutex);
 	fr_dlist_insert_head(&inst->mutable->list, t);
 	pthread_mutex_unlock(&inst->mutable->mutex);
@@ -393,12 +491,9 @@ static int mod_thread_detach(module_thread_inst_ctx_t const *mctx)
 {
 	rlm_stats_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_stats_thread_t);
 	rlm_stats_t		*inst = t->inst;
-	int			i;
 
 	pthread_mutex_lock(&inst->mutable->mutex);
-	for (i = 0; i < FR_RADIUS_CODE_MAX; i++) {
-		inst->mutable->stats[i] += t->stats[i];
-	}
+	counters_add(&inst->mutable->retired, t->counters);
 	fr_dlist_remove(&inst->mutable->list, t);
 	pthread_mutex_unlock(&inst->mutable->mutex);
 	pthread_mutex_destroy(&t->mutex);